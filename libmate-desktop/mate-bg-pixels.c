@@ -0,0 +1,619 @@
+/* mate-bg-pixels.c: pixel loops used by MateBG
+
+   Copyright (C) 2022 MATE Developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this program; if not, write to the
+   Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "mate-bg-pixels.h"
+
+#include <string.h>
+
+/* The vector versions are compiled with per-function target attributes,
+ * so the library itself still runs on any x86 CPU */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef struct {
+  const char *name;
+  void (*sum_rgb)(const guchar *pixels, int width, int height, int rowstride,
+                  guint64 totals[4]);
+  void (*sum_rgba)(const guchar *pixels, int width, int height,
+                   int rowstride, guint64 totals[4]);
+  void (*fill_rgb)(guchar *dest, int n_pixels, const guchar rgb[3]);
+  /* @dest and @src have the same layout, @alpha is in 1..254 */
+  void (*blend)(guchar *dest, const guchar *src, int n_bytes, guint alpha);
+  /* RGBA @src over RGB @dest */
+  void (*over_rgba)(guchar *dest, const guchar *src, int n_pixels);
+} PixelKernels;
+
+/* x / 255 rounded to the nearest integer, exact for x <= 255 * 255. This
+ * is the rounding gdk-pixbuf uses when compositing. */
+static inline guint div_255(guint x) {
+  guint t = x + 0x80;
+
+  return (t + (t >> 8)) >> 8;
+}
+
+/*
+ *   Portable versions
+ */
+static void sum_rgb_row_c(const guchar *p, int n_pixels, guint64 totals[4]) {
+  guint64 r = 0, g = 0, b = 0;
+  int i;
+
+  for (i = 0; i < n_pixels; i++, p += 3) {
+    r += p[0];
+    g += p[1];
+    b += p[2];
+  }
+
+  totals[0] += r;
+  totals[1] += g;
+  totals[2] += b;
+}
+
+static void sum_rgba_row_c(const guchar *p, int n_pixels, guint64 totals[4]) {
+  guint64 r = 0, g = 0, b = 0, a = 0;
+  int i;
+
+  for (i = 0; i < n_pixels; i++, p += 4) {
+    guint alpha = p[3];
+
+    r += p[0] * alpha;
+    g += p[1] * alpha;
+    b += p[2] * alpha;
+    a += alpha;
+  }
+
+  totals[0] += r;
+  totals[1] += g;
+  totals[2] += b;
+  totals[3] += a;
+}
+
+static void sum_rgb_c(const guchar *pixels, int width, int height,
+                      int rowstride, guint64 totals[4]) {
+  int row;
+
+  for (row = 0; row < height; row++)
+    sum_rgb_row_c(pixels + (gsize)row * rowstride, width, totals);
+}
+
+static void sum_rgba_c(const guchar *pixels, int width, int height,
+                       int rowstride, guint64 totals[4]) {
+  int row;
+
+  for (row = 0; row < height; row++)
+    sum_rgba_row_c(pixels + (gsize)row * rowstride, width, totals);
+}
+
+static void fill_rgb_c(guchar *dest, int n_pixels, const guchar rgb[3]) {
+  int i;
+
+  for (i = 0; i < n_pixels; i++, dest += 3) {
+    dest[0] = rgb[0];
+    dest[1] = rgb[1];
+    dest[2] = rgb[2];
+  }
+}
+
+static void blend_c(guchar *dest, const guchar *src, int n_bytes,
+                    guint alpha) {
+  int i;
+
+  for (i = 0; i < n_bytes; i++)
+    dest[i] = (guchar)div_255(alpha * src[i] + (255 - alpha) * dest[i]);
+}
+
+static void composite_rgba_c(guchar *dest, const guchar *src, int n_pixels,
+                             guint overall_alpha) {
+  int i, c;
+
+  for (i = 0; i < n_pixels; i++, src += 4, dest += 3) {
+    guint a = (src[3] * overall_alpha) / 0xff;
+
+    switch (a) {
+      case 0:
+        break;
+      case 255:
+        dest[0] = src[0];
+        dest[1] = src[1];
+        dest[2] = src[2];
+        break;
+      default:
+        for (c = 0; c < 3; c++)
+          dest[c] = (guchar)div_255(a * src[c] + (255 - a) * dest[c]);
+        break;
+    }
+  }
+}
+
+static void over_rgba_c(guchar *dest, const guchar *src, int n_pixels) {
+  composite_rgba_c(dest, src, n_pixels, 255);
+}
+
+static const PixelKernels c_kernels = {
+    "c", sum_rgb_c, sum_rgba_c, fill_rgb_c, blend_c, over_rgba_c,
+};
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ *   SSE2
+ */
+
+/* RGB bytes are summed per channel with SAD against zero after masking out
+ * the other two channels. 16 pixels are three vectors, and byte j of
+ * vector k belongs to channel (16 * k + j) % 3. */
+TARGET_SSE2 static void sum_rgb_sse2(const guchar *pixels, int width,
+                                     int height, int rowstride,
+                                     guint64 totals[4]) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i masks[3][3];
+  __m128i sums[3];
+  guint64 lanes[2];
+  int row, i, j, k, c;
+
+  for (k = 0; k < 3; k++) {
+    for (c = 0; c < 3; c++) {
+      guchar m[16];
+
+      for (j = 0; j < 16; j++) m[j] = (16 * k + j) % 3 == c ? 0xff : 0;
+      masks[k][c] = _mm_loadu_si128((const __m128i *)m);
+    }
+  }
+
+  for (c = 0; c < 3; c++) sums[c] = zero;
+
+  for (row = 0; row < height; row++) {
+    const guchar *p = pixels + (gsize)row * rowstride;
+
+    for (i = 0; i + 16 <= width; i += 16, p += 48) {
+      for (k = 0; k < 3; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+
+        for (c = 0; c < 3; c++)
+          sums[c] = _mm_add_epi64(
+              sums[c], _mm_sad_epu8(_mm_and_si128(v, masks[k][c]), zero));
+      }
+    }
+
+    sum_rgb_row_c(p, width - i, totals);
+  }
+
+  for (c = 0; c < 3; c++) {
+    _mm_storeu_si128((__m128i *)lanes, sums[c]);
+    totals[c] += lanes[0] + lanes[1];
+  }
+}
+
+/* Rows are split so that the 32 bit lanes, each adding up to 255 * 255 per
+ * pixel, can't overflow */
+#define SUM_RGBA_CHUNK 32768
+
+TARGET_SSE2 static void sum_rgba_sse2(const guchar *pixels, int width,
+                                      int height, int rowstride,
+                                      guint64 totals[4]) {
+  const __m128i zero = _mm_setzero_si128();
+  /* multiply r, g and b by alpha, and alpha by 1 */
+  const __m128i keep_rgb = _mm_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+  const __m128i one_a = _mm_setr_epi16(0, 0, 0, 1, 0, 0, 0, 1);
+  guint32 lanes[4];
+  int row, start, i, c;
+
+  for (row = 0; row < height; row++) {
+    const guchar *p = pixels + (gsize)row * rowstride;
+
+    for (start = 0; start < width; start += SUM_RGBA_CHUNK) {
+      int end = MIN(width, start + SUM_RGBA_CHUNK);
+      __m128i acc = zero;
+
+      for (i = start; i + 4 <= end; i += 4, p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+        __m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+
+        a_lo = _mm_or_si128(_mm_and_si128(a_lo, keep_rgb), one_a);
+        a_hi = _mm_or_si128(_mm_and_si128(a_hi, keep_rgb), one_a);
+        lo = _mm_mullo_epi16(lo, a_lo);
+        hi = _mm_mullo_epi16(hi, a_hi);
+
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(lo, zero));
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(lo, zero));
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(hi, zero));
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(hi, zero));
+      }
+
+      _mm_storeu_si128((__m128i *)lanes, acc);
+      for (c = 0; c < 4; c++) totals[c] += lanes[c];
+
+      sum_rgba_row_c(p, end - i, totals);
+      p += 4 * (end - i);
+    }
+  }
+}
+
+TARGET_SSE2 static void fill_rgb_sse2(guchar *dest, int n_pixels,
+                                      const guchar rgb[3]) {
+  guchar pattern[48];
+  __m128i v0, v1, v2;
+  int i;
+
+  for (i = 0; i < 48; i++) pattern[i] = rgb[i % 3];
+
+  v0 = _mm_loadu_si128((const __m128i *)pattern);
+  v1 = _mm_loadu_si128((const __m128i *)(pattern + 16));
+  v2 = _mm_loadu_si128((const __m128i *)(pattern + 32));
+
+  for (i = 0; i + 16 <= n_pixels; i += 16, dest += 48) {
+    _mm_storeu_si128((__m128i *)dest, v0);
+    _mm_storeu_si128((__m128i *)(dest + 16), v1);
+    _mm_storeu_si128((__m128i *)(dest + 32), v2);
+  }
+
+  fill_rgb_c(dest, n_pixels - i, rgb);
+}
+
+/* div_255(a * s + (255 - a) * d) on eight 16 bit lanes; all intermediate
+ * values stay below 65536 */
+TARGET_SSE2 static inline __m128i blend_epi16_sse2(__m128i s, __m128i d,
+                                                   __m128i a, __m128i ia) {
+  __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a),
+                                          _mm_mullo_epi16(d, ia)),
+                            _mm_set1_epi16(0x80));
+
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+TARGET_SSE2 static void blend_sse2(guchar *dest, const guchar *src,
+                                   int n_bytes, guint alpha) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i a = _mm_set1_epi16((short)alpha);
+  const __m128i ia = _mm_set1_epi16((short)(255 - alpha));
+  int i;
+
+  for (i = 0; i + 16 <= n_bytes; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i d = _mm_loadu_si128((const __m128i *)(dest + i));
+    __m128i lo = blend_epi16_sse2(_mm_unpacklo_epi8(s, zero),
+                                  _mm_unpacklo_epi8(d, zero), a, ia);
+    __m128i hi = blend_epi16_sse2(_mm_unpackhi_epi8(s, zero),
+                                  _mm_unpackhi_epi8(d, zero), a, ia);
+
+    _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(lo, hi));
+  }
+
+  blend_c(dest + i, src + i, n_bytes - i, alpha);
+}
+
+/* Without pshufb, spreading packed RGB over vector lanes costs as much as
+ * the scalar loop, so RGBA over RGB stays portable here */
+static const PixelKernels sse2_kernels = {
+    "sse2", sum_rgb_sse2, sum_rgba_sse2, fill_rgb_sse2, blend_sse2,
+    over_rgba_c,
+};
+
+/*
+ *   AVX2
+ */
+
+/* Same as sum_rgb_sse2(), with 32 pixels in three vectors */
+TARGET_AVX2 static void sum_rgb_avx2(const guchar *pixels, int width,
+                                     int height, int rowstride,
+                                     guint64 totals[4]) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i masks[3][3];
+  __m256i sums[3];
+  guint64 lanes[4];
+  int row, i, j, k, c;
+
+  for (k = 0; k < 3; k++) {
+    for (c = 0; c < 3; c++) {
+      guchar m[32];
+
+      for (j = 0; j < 32; j++) m[j] = (32 * k + j) % 3 == c ? 0xff : 0;
+      masks[k][c] = _mm256_loadu_si256((const __m256i *)m);
+    }
+  }
+
+  for (c = 0; c < 3; c++) sums[c] = zero;
+
+  for (row = 0; row < height; row++) {
+    const guchar *p = pixels + (gsize)row * rowstride;
+
+    for (i = 0; i + 32 <= width; i += 32, p += 96) {
+      for (k = 0; k < 3; k++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * k));
+
+        for (c = 0; c < 3; c++)
+          sums[c] = _mm256_add_epi64(
+              sums[c],
+              _mm256_sad_epu8(_mm256_and_si256(v, masks[k][c]), zero));
+      }
+    }
+
+    sum_rgb_row_c(p, width - i, totals);
+  }
+
+  for (c = 0; c < 3; c++) {
+    _mm256_storeu_si256((__m256i *)lanes, sums[c]);
+    totals[c] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+}
+
+TARGET_AVX2 static void sum_rgba_avx2(const guchar *pixels, int width,
+                                      int height, int rowstride,
+                                      guint64 totals[4]) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i keep_rgb = _mm256_setr_epi16(-1, -1, -1, 0, -1, -1, -1, 0,
+                                             -1, -1, -1, 0, -1, -1, -1, 0);
+  const __m256i one_a =
+      _mm256_setr_epi16(0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1);
+  guint32 lanes[8];
+  int row, start, i, c;
+
+  for (row = 0; row < height; row++) {
+    const guchar *p = pixels + (gsize)row * rowstride;
+
+    for (start = 0; start < width; start += SUM_RGBA_CHUNK) {
+      int end = MIN(width, start + SUM_RGBA_CHUNK);
+      __m256i acc = zero;
+
+      for (i = start; i + 8 <= end; i += 8, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i lo = _mm256_unpacklo_epi8(v, zero);
+        __m256i hi = _mm256_unpackhi_epi8(v, zero);
+        __m256i a_lo =
+            _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, 0xff), 0xff);
+        __m256i a_hi =
+            _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, 0xff), 0xff);
+
+        a_lo = _mm256_or_si256(_mm256_and_si256(a_lo, keep_rgb), one_a);
+        a_hi = _mm256_or_si256(_mm256_and_si256(a_hi, keep_rgb), one_a);
+        lo = _mm256_mullo_epi16(lo, a_lo);
+        hi = _mm256_mullo_epi16(hi, a_hi);
+
+        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(lo, zero));
+        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(lo, zero));
+        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(hi, zero));
+        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(hi, zero));
+      }
+
+      _mm256_storeu_si256((__m256i *)lanes, acc);
+      for (c = 0; c < 4; c++) totals[c] += lanes[c] + lanes[c + 4];
+
+      sum_rgba_row_c(p, end - i, totals);
+      p += 4 * (end - i);
+    }
+  }
+}
+
+TARGET_AVX2 static void fill_rgb_avx2(guchar *dest, int n_pixels,
+                                      const guchar rgb[3]) {
+  guchar pattern[96];
+  __m256i v0, v1, v2;
+  int i;
+
+  for (i = 0; i < 96; i++) pattern[i] = rgb[i % 3];
+
+  v0 = _mm256_loadu_si256((const __m256i *)pattern);
+  v1 = _mm256_loadu_si256((const __m256i *)(pattern + 32));
+  v2 = _mm256_loadu_si256((const __m256i *)(pattern + 64));
+
+  for (i = 0; i + 32 <= n_pixels; i += 32, dest += 96) {
+    _mm256_storeu_si256((__m256i *)dest, v0);
+    _mm256_storeu_si256((__m256i *)(dest + 32), v1);
+    _mm256_storeu_si256((__m256i *)(dest + 64), v2);
+  }
+
+  fill_rgb_c(dest, n_pixels - i, rgb);
+}
+
+TARGET_AVX2 static inline __m256i blend_epi16_avx2(__m256i s, __m256i d,
+                                                   __m256i a, __m256i ia) {
+  __m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s, a),
+                                                _mm256_mullo_epi16(d, ia)),
+                               _mm256_set1_epi16(0x80));
+
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+TARGET_AVX2 static void blend_avx2(guchar *dest, const guchar *src,
+                                   int n_bytes, guint alpha) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i a = _mm256_set1_epi16((short)alpha);
+  const __m256i ia = _mm256_set1_epi16((short)(255 - alpha));
+  int i;
+
+  /* unpack and pack both work within 128 bit lanes, so bytes come back
+   * in their original order */
+  for (i = 0; i + 32 <= n_bytes; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dest + i));
+    __m256i lo = blend_epi16_avx2(_mm256_unpacklo_epi8(s, zero),
+                                  _mm256_unpacklo_epi8(d, zero), a, ia);
+    __m256i hi = blend_epi16_avx2(_mm256_unpackhi_epi8(s, zero),
+                                  _mm256_unpackhi_epi8(d, zero), a, ia);
+
+    _mm256_storeu_si256((__m256i *)(dest + i), _mm256_packus_epi16(lo, hi));
+  }
+
+  blend_c(dest + i, src + i, n_bytes - i, alpha);
+}
+
+/* Four pixels at a time: the RGB destination is spread to RGBx with pshufb,
+ * each source alpha is broadcast over its pixel's color lanes, and the
+ * result is packed back to RGB. With alpha 0 and 255 the arithmetic gives
+ * the destination and source unchanged, like the scalar branches. */
+TARGET_AVX2 static void over_rgba_avx2(guchar *dest, const guchar *src,
+                                       int n_pixels) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i c255 = _mm_set1_epi16(255);
+  const __m128i to_rgbx =
+      _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i to_rgb =
+      _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const __m128i alpha_lo =
+      _mm_setr_epi8(3, -1, 3, -1, 3, -1, -1, -1, 7, -1, 7, -1, 7, -1, -1, -1);
+  const __m128i alpha_hi = _mm_setr_epi8(11, -1, 11, -1, 11, -1, -1, -1, 15,
+                                         -1, 15, -1, 15, -1, -1, -1);
+  int i;
+
+  for (i = 0; i + 4 <= n_pixels; i += 4, src += 16, dest += 12) {
+    __m128i s = _mm_loadu_si128((const __m128i *)src);
+    __m128i d, a_lo, a_hi, lo, hi, r;
+    guint32 tail;
+
+    /* 12 bytes, without reading past the end of the row */
+    memcpy(&tail, dest + 8, 4);
+    d = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)dest),
+                           _mm_cvtsi32_si128((int)tail));
+    d = _mm_shuffle_epi8(d, to_rgbx);
+
+    a_lo = _mm_shuffle_epi8(s, alpha_lo);
+    a_hi = _mm_shuffle_epi8(s, alpha_hi);
+
+    lo = blend_epi16_sse2(_mm_unpacklo_epi8(s, zero),
+                          _mm_unpacklo_epi8(d, zero), a_lo,
+                          _mm_sub_epi16(c255, a_lo));
+    hi = blend_epi16_sse2(_mm_unpackhi_epi8(s, zero),
+                          _mm_unpackhi_epi8(d, zero), a_hi,
+                          _mm_sub_epi16(c255, a_hi));
+
+    r = _mm_shuffle_epi8(_mm_packus_epi16(lo, hi), to_rgb);
+    _mm_storel_epi64((__m128i *)dest, r);
+    tail = (guint32)_mm_cvtsi128_si32(_mm_srli_si128(r, 8));
+    memcpy(dest + 8, &tail, 4);
+  }
+
+  over_rgba_c(dest, src, n_pixels - i);
+}
+
+static const PixelKernels avx2_kernels = {
+    "avx2", sum_rgb_avx2, sum_rgba_avx2, fill_rgb_avx2, blend_avx2,
+    over_rgba_avx2,
+};
+
+#endif /* HAVE_X86_KERNELS */
+
+static gboolean kernels_supported(const PixelKernels *k) {
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (k == &avx2_kernels) return __builtin_cpu_supports("avx2");
+  if (k == &sse2_kernels) return __builtin_cpu_supports("sse2");
+#endif
+
+  return k == &c_kernels;
+}
+
+/* best first */
+static const PixelKernels *const all_kernels[] = {
+#ifdef HAVE_X86_KERNELS
+    &avx2_kernels,
+    &sse2_kernels,
+#endif
+    &c_kernels,
+};
+
+static gsize kernels = 0;
+
+static const PixelKernels *get_kernels(void) {
+  if (g_once_init_enter(&kernels)) {
+    const PixelKernels *k = &c_kernels;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(all_kernels); i++) {
+      if (kernels_supported(all_kernels[i])) {
+        k = all_kernels[i];
+        break;
+      }
+    }
+
+    g_once_init_leave(&kernels, (gsize)k);
+  }
+
+  return (const PixelKernels *)kernels;
+}
+
+const char *_mate_bg_pixels_get_implementation(void) {
+  return get_kernels()->name;
+}
+
+/* Meant for tests and benchmarks, not to be called while other threads
+ * are drawing */
+gboolean _mate_bg_pixels_set_implementation(const char *name) {
+  guint i;
+
+  get_kernels();
+
+  for (i = 0; i < G_N_ELEMENTS(all_kernels); i++) {
+    if (strcmp(all_kernels[i]->name, name) == 0 &&
+        kernels_supported(all_kernels[i])) {
+      kernels = (gsize)all_kernels[i];
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+void _mate_bg_pixels_sum(const guchar *pixels, int width, int height,
+                         int rowstride, gboolean has_alpha, guint64 totals[4]) {
+  const PixelKernels *k = get_kernels();
+
+  totals[0] = totals[1] = totals[2] = totals[3] = 0;
+
+  if (has_alpha)
+    k->sum_rgba(pixels, width, height, rowstride, totals);
+  else
+    k->sum_rgb(pixels, width, height, rowstride, totals);
+}
+
+void _mate_bg_pixels_fill_rgb(guchar *dest, int n_pixels,
+                              const guchar rgb[3]) {
+  get_kernels()->fill_rgb(dest, n_pixels, rgb);
+}
+
+void _mate_bg_pixels_composite_row(guchar *dest, const guchar *src,
+                                   int src_channels, int n_pixels,
+                                   guint overall_alpha) {
+  const PixelKernels *k = get_kernels();
+
+  if (n_pixels <= 0 || overall_alpha == 0) return;
+
+  if (src_channels == 3) {
+    if (overall_alpha >= 255)
+      memcpy(dest, src, 3 * (gsize)n_pixels);
+    else
+      k->blend(dest, src, 3 * n_pixels, overall_alpha);
+  } else if (overall_alpha >= 255) {
+    k->over_rgba(dest, src, n_pixels);
+  } else {
+    composite_rgba_c(dest, src, n_pixels, overall_alpha);
+  }
+}
@@ -0,0 +1,52 @@
+/* mate-bg-pixels.h: pixel loops used by MateBG
+
+   Copyright (C) 2022 MATE Developers
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this program; if not, write to the
+   Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#ifndef __MATE_BG_PIXELS_H__
+#define __MATE_BG_PIXELS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The implementation is picked on first use from what the CPU supports:
+ * "avx2", "sse2" or the portable "c" one. All of them give the same
+ * results. */
+const char *_mate_bg_pixels_get_implementation(void);
+gboolean _mate_bg_pixels_set_implementation(const char *name);
+
+/* Sums the channels of an 8 bit RGB or RGBA image. For RGBA, the color
+ * channels are weighted by alpha: totals are r*a, g*a, b*a and a. For RGB,
+ * totals[3] is 0. */
+void _mate_bg_pixels_sum(const guchar *pixels, int width, int height,
+                         int rowstride, gboolean has_alpha, guint64 totals[4]);
+
+/* Fills @n_pixels RGB pixels at @dest with the color @rgb */
+void _mate_bg_pixels_fill_rgb(guchar *dest, int n_pixels, const guchar rgb[3]);
+
+/* Composites @n_pixels of an RGB or RGBA row over an RGB row with the
+ * same rounding as gdk_pixbuf_composite() with GDK_INTERP_NEAREST and no
+ * scaling */
+void _mate_bg_pixels_composite_row(guchar *dest, const guchar *src,
+                                   int src_channels, int n_pixels,
+                                   guint overall_alpha);
+
+G_END_DECLS
+
+#endif
@@ -47,6 +47,8 @@ Authors: Soren Sandmann <sandmann@redhat.com>
 #include <mate-bg-crossfade.h>
 #include <mate-bg.h>
 
+#include "mate-bg-pixels.h"
+
 #define MATE_BG_CACHE_DIR "mate/background"
 
 /* We keep the large pixbufs around if the next update
@@ -74,8 +76,134 @@ struct _FileSize {
 
 #define THUMBNAIL_SIZE 256
 
+/* Decoded images, thumbnails and parsed slideshows, looked up by type and
+ * filename. Least recently used entries are dropped once the cache grows
+ * over its budget, see mate_bg_set_cache_budget(), and down to an eighth of
+ * it when the background won't change for a while. */
 typedef struct FileCacheEntry FileCacheEntry;
-#define CACHE_SIZE 4
+#define FILE_CACHE_BUDGET (256 * 1024 * 1024)
+#define FILE_CACHE_IDLE_SHARE 8
+
+/* Source and scaled pixbufs are kept per (filename, monitor, placement,
+ * size), so that monitors of different geometry don't throw away each
+ * other's pixbufs on every redraw. Least recently used entries are dropped
+ * once the cache grows over this many bytes, counting every pixbuf once
+ * however many entries share it. */
+typedef struct _PixbufCacheEntry PixbufCacheEntry;
+#define PIXBUF_CACHE_BUDGET (256 * 1024 * 1024)
+#define PIXBUF_CACHE_IDLE_BUDGET (64 * 1024 * 1024)
+
+struct _PixbufCacheEntry {
+  char *filename;
+  gint monitor;
+  MateBGPlacement placement;
+  gint width;
+  gint height;
+
+  GdkPixbuf *pixbuf; /* as returned by get_pixbuf_for_size() */
+  GdkPixbuf *scaled; /* pixbuf scaled for width x height, or NULL */
+};
+
+/* Monitors are drawn by one job per distinct (source, size) pair, see
+ * draw_each_monitor() */
+typedef struct _MonitorArea MonitorArea;
+typedef struct _ScaleJob ScaleJob;
+
+struct _MonitorArea {
+  gint monitor;
+  GdkRectangle rect;
+};
+
+struct _ScaleJob {
+  GdkPixbuf *pixbuf; /* source */
+  GdkPixbuf *scaled; /* NULL until the job has run, unless it was cached */
+  gint width;
+  gint height;
+  GArray *areas; /* MonitorArea drawn from this pixbuf */
+  gboolean refresh_cache;
+};
+
+/* Luminance statistics of a wallpaper image, so that mate_bg_is_dark() and
+ * friends don't have to look at its pixels on every call. They come from a
+ * downscaled decode or a strided walk over an already decoded image, and
+ * are kept in memory and next to the scaled wallpapers in the disk cache,
+ * keyed by file and mtime. */
+typedef struct _ImageStats ImageStats;
+typedef struct _ImageStatsEntry ImageStatsEntry;
+#define STATS_SAMPLE_SIZE 256
+#define STATS_GRID 8
+#define STATS_CACHE_SIZE 4
+/* stats files kept on disk, the most recently written ones */
+#define STATS_CACHE_FILES 64
+
+struct _ImageStats {
+  gint width; /* of the image, to place it like draw_scaled_area() does */
+  gint height;
+  GdkRGBA average; /* premultiplied average color, alpha is the coverage */
+  gdouble mean;    /* luminance of the opaque parts, 0..1 */
+  gdouble variance;
+  guchar grid[STATS_GRID * STATS_GRID * 4]; /* premultiplied RGBA per cell */
+};
+
+struct _ImageStatsEntry {
+  char *filename;
+  gint64 mtime;
+  ImageStats stats;
+};
+
+/* Frames of a slideshow transition, blended ahead of time on a worker
+ * thread so that the slideshow timeout only has to pick up the next one.
+ * The frames are scaled for one output size already; monitors of another
+ * size get a Transition of their own. Only the frames of one transition
+ * are kept, and for each size no more of them than fit in
+ * TRANSITION_BUDGET bytes. */
+typedef struct _Transition Transition;
+#define TRANSITION_BUDGET (128 * 1024 * 1024)
+#define TRANSITION_DEFAULT_FRAMES 16
+/* how long before a transition starts its frames are prepared */
+#define TRANSITION_LEAD_SECS 10
+
+struct _Transition {
+  MateBG *bg; /* owns this, unless it is a snapshot's copy */
+  char *file1;
+  char *file2;
+  MateBGPlacement placement;
+  gint width; /* size the files were picked and the frames scaled for */
+  gint height;
+  guint n_frames;
+
+  guint start_id;
+  GCancellable *cancellable; /* set while the frames are being prepared */
+  GPtrArray *frames; /* frame i is blended at i / (len - 1), NULL until ready */
+  gboolean failed;   /* don't try again, blend on demand instead */
+};
+
+/* An image of the next slide, decoded and scaled on a worker thread while
+ * the current one shows, so that switching slides doesn't stall the main
+ * loop. The image is decoded once and scaled for every monitor size it
+ * was picked for. Images that would take more than PREFETCH_BUDGET bytes,
+ * decoded and scaled, are left to be loaded when their slide comes. */
+typedef struct _Prefetch Prefetch;
+#define PREFETCH_BUDGET (256 * 1024 * 1024)
+/* how long before a slide starts its image is prefetched */
+#define PREFETCH_LEAD_SECS 10
+
+typedef struct {
+  gint width;
+  gint height;
+  GdkPixbuf *scaled; /* the image scaled for width x height, once ready */
+} PrefetchSize;
+
+struct _Prefetch {
+  MateBG *bg;
+  char *filename;
+  MateBGPlacement placement;
+  GArray *sizes; /* PrefetchSize, the monitor sizes the file was picked for */
+
+  guint start_id;
+  GCancellable *cancellable; /* set while the image is being loaded */
+  GdkPixbuf *pixbuf;         /* as get_as_pixbuf_for_size() loads it */
+};
 
 /*
  *   Implementation of the MateBG class
@@ -88,6 +216,8 @@ struct _MateBG {
   GdkRGBA primary;
   GdkRGBA secondary;
   gboolean is_enabled;
+  guint draw_threads; /* 0 means one per processor */
+  guint transition_frames;
 
   GFileMonitor *file_monitor;
 
@@ -98,10 +228,29 @@ struct _MateBG {
   /* Cached information, only access through cache accessor functions */
   SlideShow *slideshow;
   gint64 file_mtime;
-  GdkPixbuf *pixbuf_cache;
+  GQueue pixbuf_cache; /* PixbufCacheEntry, most recently used first */
+  gsize pixbuf_cache_size; /* bytes of the distinct pixbufs of the entries */
+  guint pixbuf_cache_serial; /* bumped whenever the cache is flushed */
   guint timeout_id;
 
-  GList *file_cache;
+  GQueue file_cache;            /* FileCacheEntry, most recently used first */
+  GHashTable *file_cache_index; /* FileCacheEntry set, by type and filename */
+  gsize file_cache_size;
+  gsize file_cache_budget;
+  guint file_cache_hits;
+  guint file_cache_misses;
+  GList *stats_cache; /* ImageStatsEntry, most recently used first */
+  GList *transitions; /* Transition, one per output size */
+  GList *prefetches; /* Prefetch, one per file of the next slide */
+  GList *prefetched; /* handed to the file cache, scaled copies not yet */
+
+  /* in-flight mate_bg_create_surface_async() request, if any */
+  GCancellable *surface_cancellable;
+
+  /* Set on the private copy a request draws on a worker thread; such a
+   * copy never adds sources to the main context. */
+  gboolean is_snapshot;
+  GCancellable *cancellable;
 };
 
 struct _MateBGClass {
@@ -118,7 +267,6 @@ static cairo_surface_t *make_root_pixmap(GdkWindow *window, gint width,
                                          gint height);
 
 /* Pixbuf utils */
-static void pixbuf_average_value(GdkPixbuf *pixbuf, GdkRGBA *result);
 static GdkPixbuf *pixbuf_scale_to_fit(GdkPixbuf *src, int max_width,
                                       int max_height);
 static GdkPixbuf *pixbuf_scale_to_min(GdkPixbuf *src, int min_width,
@@ -126,6 +274,8 @@ static GdkPixbuf *pixbuf_scale_to_min(GdkPixbuf *src, int min_width,
 
 static void pixbuf_draw_gradient(GdkPixbuf *pixbuf, gboolean horizontal,
                                  GdkRGBA *c1, GdkRGBA *c2, GdkRectangle *rect);
+static guchar *create_gradient(const GdkRGBA *primary, const GdkRGBA *secondary,
+                               int n_pixels);
 
 static void pixbuf_tile(GdkPixbuf *src, GdkPixbuf *dest);
 static void pixbuf_blend(GdkPixbuf *src, GdkPixbuf *dest, int src_x, int src_y,
@@ -141,7 +291,23 @@ static gboolean get_thumb_annotations(GdkPixbuf *thumb, int *orig_width,
 /* Cache */
 static GdkPixbuf *get_pixbuf_for_size(MateBG *bg, gint num_monitor, int width,
                                       int height);
+static GdkPixbuf *get_scaled_pixbuf_for_size(MateBG *bg, gint num_monitor,
+                                             int width, int height);
+static PixbufCacheEntry *get_pixbuf_cache_entry(MateBG *bg, gint num_monitor,
+                                                gint width, gint height);
+static PixbufCacheEntry *pixbuf_cache_lookup(MateBG *bg, gint num_monitor,
+                                             gint width, gint height);
+static GdkPixbuf *pixbuf_cache_find_scaled(MateBG *bg, PixbufCacheEntry *ent);
+static void pixbuf_cache_set_scaled(MateBG *bg, PixbufCacheEntry *ent,
+                                    GdkPixbuf *scaled);
+static void pixbuf_cache_clear(MateBG *bg);
+static void pixbuf_cache_shrink(MateBG *bg, gsize budget, guint keep);
+static void pixbuf_cache_copy(MateBG *bg, MateBG *from);
+static void pixbuf_cache_adopt(MateBG *bg, MateBG *from);
 static void clear_cache(MateBG *bg);
+static void image_stats_entry_free(ImageStatsEntry *ent);
+static gboolean get_stats_for_size(MateBG *bg, int width, int height,
+                                   ImageStats *stats);
 static gboolean is_different(MateBG *bg, const char *filename);
 static gint64 get_mtime(const char *filename);
 static GdkPixbuf *create_img_thumbnail(MateBG *bg,
@@ -150,6 +316,14 @@ static GdkPixbuf *create_img_thumbnail(MateBG *bg,
                                        int dest_height, int frame_num);
 static SlideShow *get_as_slideshow(MateBG *bg, const char *filename);
 static Slide *get_current_slide(SlideShow *show, double *alpha);
+static Slide *get_next_slide(SlideShow *show, double *time_until);
+static void clear_transition(MateBG *bg);
+static void clear_prefetch(MateBG *bg);
+static GdkPixbuf *get_prefetched_pixbuf(MateBG *bg, const char *filename);
+static GdkPixbuf *take_prefetched_scaled(MateBG *bg, GdkPixbuf *pixbuf,
+                                         gint width, gint height);
+static GList *transitions_copy(MateBG *bg, GList *transitions);
+static void ensure_timeout_from_snapshot(MateBG *bg, MateBG *snapshot);
 static gboolean slideshow_has_multiple_sizes(SlideShow *show);
 
 static SlideShow *read_slideshow_file(const char *filename, GError **err);
@@ -189,10 +363,10 @@ static void queue_changed(MateBG *bg) {
 static gboolean do_transitioned(MateBG *bg) {
   bg->transitioned_id = 0;
 
-  if (bg->pixbuf_cache) {
-    g_object_unref(bg->pixbuf_cache);
-    bg->pixbuf_cache = NULL;
-  }
+  /* Only drops the references to the frames shown; the prepared frames,
+   * scaled for each monitor size, stay with bg->transitions until the
+   * transition is over, see prepare_transition() */
+  pixbuf_cache_clear(bg);
 
   g_signal_emit(G_OBJECT(bg), signals[TRANSITIONED], 0);
 
@@ -370,7 +544,19 @@ void mate_bg_save_to_gsettings(MateBG *bg, GSettings *settings) {
   g_free(secondary);
 }
 
-static void mate_bg_init(MateBG *bg) {}
+static guint file_cache_entry_hash(gconstpointer key);
+static gboolean file_cache_entry_equal(gconstpointer a, gconstpointer b);
+static void file_cache_clear(MateBG *bg);
+static void file_cache_shrink(MateBG *bg, gsize budget, guint keep);
+
+static void mate_bg_init(MateBG *bg) {
+  g_queue_init(&bg->pixbuf_cache);
+  g_queue_init(&bg->file_cache);
+  bg->file_cache_index =
+      g_hash_table_new(file_cache_entry_hash, file_cache_entry_equal);
+  bg->file_cache_budget = FILE_CACHE_BUDGET;
+  bg->transition_frames = TRANSITION_DEFAULT_FRAMES;
+}
 
 static void mate_bg_dispose(GObject *object) {
   MateBG *bg = MATE_BG(object);
@@ -380,6 +566,9 @@ static void mate_bg_dispose(GObject *object) {
     bg->file_monitor = NULL;
   }
 
+  g_clear_object(&bg->surface_cancellable);
+  g_clear_object(&bg->cancellable);
+
   clear_cache(bg);
 
   G_OBJECT_CLASS(mate_bg_parent_class)->dispose(object);
@@ -406,6 +595,12 @@ static void mate_bg_finalize(GObject *object) {
   g_free(bg->filename);
   bg->filename = NULL;
 
+  g_list_free_full(bg->stats_cache, (GDestroyNotify)image_stats_entry_free);
+  bg->stats_cache = NULL;
+
+  file_cache_clear(bg);
+  g_hash_table_destroy(bg->file_cache_index);
+
   G_OBJECT_CLASS(mate_bg_parent_class)->finalize(object);
 }
 
@@ -492,6 +687,99 @@ const gchar *mate_bg_get_filename(MateBG *bg) {
   return bg->filename;
 }
 
+/**
+ * mate_bg_set_draw_threads:
+ * @bg: a #MateBG
+ * @n_threads: the maximum number of threads, or 0 for one per processor
+ *
+ * Sets how many threads mate_bg_draw() may use to scale and composite the
+ * background of each monitor. With @n_threads set to 1 the monitors are
+ * drawn one after the other on the calling thread. The result is the same,
+ * byte for byte, whatever the number of threads, so this can be used to
+ * check the threaded path against the serial one.
+ **/
+void mate_bg_set_draw_threads(MateBG *bg, guint n_threads) {
+  g_return_if_fail(bg != NULL);
+
+  bg->draw_threads = n_threads;
+}
+
+guint mate_bg_get_draw_threads(MateBG *bg) {
+  g_return_val_if_fail(bg != NULL, 0);
+
+  return bg->draw_threads;
+}
+
+/**
+ * mate_bg_set_transition_frames:
+ * @bg: a #MateBG
+ * @n_frames: the number of frames, or 0 to blend each frame when it is drawn
+ *
+ * Sets how many frames of a slideshow transition are blended ahead of time,
+ * on a worker thread, shortly before the transition starts. The slideshow
+ * then steps through these frames instead of blending the two slides on
+ * every redraw. The frames are scaled for each monitor size in use, and
+ * fewer of them are prepared for large monitors, so that they don't take
+ * more than a fixed amount of memory.
+ **/
+void mate_bg_set_transition_frames(MateBG *bg, guint n_frames) {
+  g_return_if_fail(bg != NULL);
+
+  if (bg->transition_frames == n_frames) return;
+
+  bg->transition_frames = n_frames;
+  clear_transition(bg);
+}
+
+guint mate_bg_get_transition_frames(MateBG *bg) {
+  g_return_val_if_fail(bg != NULL, 0);
+
+  return bg->transition_frames;
+}
+
+/**
+ * mate_bg_set_cache_budget:
+ * @bg: a #MateBG
+ * @n_bytes: the budget, in bytes
+ *
+ * Sets how much memory @bg may keep decoded images, thumbnails and parsed
+ * slideshows in. The least recently used ones are dropped to stay within
+ * @n_bytes, but the last one loaded is always kept.
+ **/
+void mate_bg_set_cache_budget(MateBG *bg, gsize n_bytes) {
+  g_return_if_fail(bg != NULL);
+
+  bg->file_cache_budget = n_bytes;
+  file_cache_shrink(bg, n_bytes, 1);
+}
+
+gsize mate_bg_get_cache_budget(MateBG *bg) {
+  g_return_val_if_fail(bg != NULL, 0);
+
+  return bg->file_cache_budget;
+}
+
+/**
+ * mate_bg_get_cache_stats:
+ * @bg: a #MateBG
+ * @hits: (out) (optional): return location for the number of lookups that
+ *   found a cached file
+ * @misses: (out) (optional): return location for the number of lookups that
+ *   had to load the file
+ * @n_bytes: (out) (optional): return location for the memory cached files
+ *   take now
+ *
+ * Gets statistics about the cache mate_bg_set_cache_budget() bounds.
+ **/
+void mate_bg_get_cache_stats(MateBG *bg, guint *hits, guint *misses,
+                             gsize *n_bytes) {
+  g_return_if_fail(bg != NULL);
+
+  if (hits) *hits = bg->file_cache_hits;
+  if (misses) *misses = bg->file_cache_misses;
+  if (n_bytes) *n_bytes = bg->file_cache_size;
+}
+
 static inline gchar *get_wallpaper_cache_dir(void) {
   return g_build_filename(g_get_user_cache_dir(), MATE_BG_CACHE_DIR, NULL);
 }
@@ -517,7 +805,8 @@ static char *get_wallpaper_cache_filename(const char *filename,
       G_CHECKSUM_MD5, (const guchar *)filename, strlen(filename));
   cache_prefix_name =
       get_wallpaper_cache_prefix_name(num_monitor, placement, width, height);
-  cache_basename = g_strdup_printf("%s_%s", cache_prefix_name, md5_filename);
+  cache_basename =
+      g_strdup_printf("%s_%s.raw", cache_prefix_name, md5_filename);
   cache_dir = get_wallpaper_cache_dir();
   cache_filename = g_build_filename(cache_dir, cache_basename, NULL);
 
@@ -555,17 +844,176 @@ static void cleanup_cache_for_monitor(gchar *cache_dir, gint num_monitor) {
   g_dir_close(g_cache_dir);
 }
 
-static gboolean cache_file_is_valid(const char *filename,
-                                    const char *cache_filename) {
-  if (!g_file_test(cache_filename, G_FILE_TEST_IS_REGULAR)) return FALSE;
+/* Scaled wallpapers are cached as the raw rows of the GdkPixbuf, after a
+ * header that says what they were scaled from and for. Loading one maps
+ * the file and wraps the mapping in a GdkPixbuf; nothing is decoded or
+ * copied. The cache is only read on the machine that wrote it, so the
+ * header is in native byte order. */
+#define CACHE_FILE_MAGIC "MATEBGC"
+#define CACHE_FILE_VERSION 1
+
+typedef struct {
+  gchar magic[8];
+  guint32 version;
+  guint32 header_size; /* offset of the first row */
+  guint8 source_md5[16];
+  gint64 source_mtime;
+  gint32 placement;
+  gint32 width;
+  gint32 height;
+  gint32 rowstride;
+  gint32 n_channels;
+  guint32 checksum; /* of the header up to here */
+} CacheFileHeader;
+
+G_STATIC_ASSERT(sizeof(CacheFileHeader) == 64);
+
+/* FNV-1a; the header is all it has to cover */
+static guint32 cache_file_header_checksum(const CacheFileHeader *header) {
+  const guint8 *p = (const guint8 *)header;
+  guint32 hash = 2166136261u;
+  gsize i;
+
+  for (i = 0; i < G_STRUCT_OFFSET(CacheFileHeader, checksum); i++)
+    hash = (hash ^ p[i]) * 16777619u;
+
+  return hash;
+}
+
+static void cache_file_header_init(CacheFileHeader *header,
+                                   const char *filename, gint64 mtime,
+                                   MateBGPlacement placement) {
+  GChecksum *checksum;
+  gsize len = sizeof(header->source_md5);
+
+  memset(header, 0, sizeof(CacheFileHeader));
+  memcpy(header->magic, CACHE_FILE_MAGIC, sizeof(header->magic));
+  header->version = CACHE_FILE_VERSION;
+  header->header_size = sizeof(CacheFileHeader);
+  header->source_mtime = mtime;
+  header->placement = placement;
+
+  checksum = g_checksum_new(G_CHECKSUM_MD5);
+  g_checksum_update(checksum, (const guchar *)filename, strlen(filename));
+  g_checksum_get_digest(checksum, header->source_md5, &len);
+  g_checksum_free(checksum);
+}
+
+static void unmap_cache_file(guchar *pixels, gpointer data) {
+  g_mapped_file_unref(data);
+}
+
+/* The file name says which monitor geometry the image was scaled for, the
+ * header which source, placement and pixbuf geometry it holds */
+static GdkPixbuf *map_cache_file(const char *cache_filename,
+                                 const char *filename,
+                                 MateBGPlacement placement) {
+  const CacheFileHeader *header;
+  CacheFileHeader expected;
+  GMappedFile *mapped;
+  const gchar *contents;
+  gsize length;
+
+  /* writable gives a private copy-on-write mapping, so nothing drawing
+   * into the pixbuf by mistake can reach the file or crash */
+  mapped = g_mapped_file_new(cache_filename, TRUE, NULL);
+  if (!mapped) return NULL;
+
+  contents = g_mapped_file_get_contents(mapped);
+  length = g_mapped_file_get_length(mapped);
+  header = (const CacheFileHeader *)contents;
+
+  cache_file_header_init(&expected, filename, get_mtime(filename), placement);
+
+  if (length < sizeof(CacheFileHeader) ||
+      memcmp(header, &expected, G_STRUCT_OFFSET(CacheFileHeader, width)) !=
+          0 ||
+      header->checksum != cache_file_header_checksum(header) ||
+      header->width <= 0 || header->height <= 0 ||
+      (header->n_channels != 3 && header->n_channels != 4) ||
+      header->rowstride < header->width * header->n_channels ||
+      length != header->header_size +
+                    (gsize)header->rowstride * (gsize)header->height) {
+    g_mapped_file_unref(mapped);
+    return NULL;
+  }
+
+  return gdk_pixbuf_new_from_data(
+      (const guchar *)contents + header->header_size, GDK_COLORSPACE_RGB,
+      header->n_channels == 4, 8, header->width, header->height,
+      header->rowstride, unmap_cache_file, mapped);
+}
+
+/* Writes through a temporary file, so that a reader never maps half of it */
+static gboolean write_cache_file(const char *cache_filename,
+                                 const char *filename,
+                                 MateBGPlacement placement, GdkPixbuf *pixbuf) {
+  CacheFileHeader header;
+  GFileOutputStream *stream;
+  GOutputStream *out;
+  GFile *file;
+  const guint8 *pixels;
+  gsize last_row;
+  gint height, rowstride;
+  gboolean ok;
+
+  height = gdk_pixbuf_get_height(pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  pixels = gdk_pixbuf_read_pixels(pixbuf);
+
+  cache_file_header_init(&header, filename, get_mtime(filename), placement);
+  header.width = gdk_pixbuf_get_width(pixbuf);
+  header.height = height;
+  header.rowstride = rowstride;
+  header.n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+  header.checksum = cache_file_header_checksum(&header);
+
+  file = g_file_new_for_path(cache_filename);
+  stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, NULL);
+  g_object_unref(file);
+  if (!stream) return FALSE;
+
+  out = G_OUTPUT_STREAM(stream);
+
+  /* the last row of a pixbuf isn't padded to the rowstride */
+  last_row =
+      gdk_pixbuf_get_byte_length(pixbuf) - (gsize)rowstride * (height - 1);
+
+  ok = g_output_stream_write_all(out, &header, sizeof(header), NULL, NULL,
+                                 NULL) &&
+       g_output_stream_write_all(out, pixels, (gsize)rowstride * (height - 1),
+                                 NULL, NULL, NULL) &&
+       g_output_stream_write_all(out, pixels + (gsize)rowstride * (height - 1),
+                                 last_row, NULL, NULL, NULL);
+  if (ok && last_row < (gsize)rowstride) {
+    guint8 *padding = g_malloc0(rowstride - last_row);
+
+    ok = g_output_stream_write_all(out, padding, rowstride - last_row, NULL,
+                                   NULL, NULL);
+    g_free(padding);
+  }
+
+  /* closing an unfinished replace leaves the old file alone */
+  if (!ok) {
+    GCancellable *cancellable = g_cancellable_new();
+
+    g_cancellable_cancel(cancellable);
+    g_output_stream_close(out, cancellable, NULL);
+    g_object_unref(cancellable);
+  } else {
+    ok = g_output_stream_close(out, NULL, NULL);
+  }
+
+  g_object_unref(stream);
 
-  return (get_mtime(filename) < get_mtime(cache_filename));
+  return ok;
 }
 
 static void refresh_cache_file(MateBG *bg, GdkPixbuf *new_pixbuf,
                                gint num_monitor, gint width, gint height) {
   gchar *cache_filename;
   gchar *cache_dir;
+  GdkPixbuf *cached;
 
   if ((num_monitor == -1) || (width <= 300) || (height <= 300)) return;
 
@@ -574,29 +1022,17 @@ static void refresh_cache_file(MateBG *bg, GdkPixbuf *new_pixbuf,
   cache_dir = get_wallpaper_cache_dir();
 
   /* Only refresh scaled file on disk if useful (and don't cache slideshow) */
-  if (!cache_file_is_valid(bg->filename, cache_filename)) {
-    GdkPixbufFormat *format;
-
-    format = gdk_pixbuf_get_file_info(bg->filename, NULL, NULL);
-    if (format != NULL) {
-      gchar *format_name;
-
-      if (!g_file_test(cache_dir, G_FILE_TEST_IS_DIR)) {
-        g_mkdir_with_parents(cache_dir, 0700);
-      } else {
-        cleanup_cache_for_monitor(cache_dir, num_monitor);
-      }
-
-      format_name = gdk_pixbuf_format_get_name(format);
-
-      if (strcmp(format_name, "jpeg") == 0)
-        gdk_pixbuf_save(new_pixbuf, cache_filename, format_name, NULL,
-                        "quality", "100", NULL);
-      else
-        gdk_pixbuf_save(new_pixbuf, cache_filename, format_name, NULL, NULL);
-
-      g_free(format_name);
+  cached = map_cache_file(cache_filename, bg->filename, bg->placement);
+  if (cached) {
+    g_object_unref(cached);
+  } else if (gdk_pixbuf_get_file_info(bg->filename, NULL, NULL) != NULL) {
+    if (!g_file_test(cache_dir, G_FILE_TEST_IS_DIR)) {
+      g_mkdir_with_parents(cache_dir, 0700);
+    } else {
+      cleanup_cache_for_monitor(cache_dir, num_monitor);
     }
+
+    write_cache_file(cache_filename, bg->filename, bg->placement, new_pixbuf);
   }
 
   g_free(cache_filename);
@@ -686,18 +1122,129 @@ static void draw_color(MateBG *bg, GdkPixbuf *dest) {
   draw_color_area(bg, dest, &rect);
 }
 
-static void draw_color_each_monitor(MateBG *bg, GdkPixbuf *dest,
-                                    GdkScreen *screen) {
+static GArray *get_monitor_areas(GdkScreen *screen) {
   GdkDisplay *display;
-  GdkRectangle rect;
+  GArray *areas;
   gint num_monitors;
-  int monitor;
+  gint monitor;
 
   display = gdk_screen_get_display(screen);
   num_monitors = gdk_display_get_n_monitors(display);
+  areas = g_array_sized_new(FALSE, FALSE, sizeof(MonitorArea),
+                            (guint)num_monitors);
+
   for (monitor = 0; monitor < num_monitors; monitor++) {
-    gdk_monitor_get_geometry(gdk_display_get_monitor(display, monitor), &rect);
-    draw_color_area(bg, dest, &rect);
+    MonitorArea area;
+
+    area.monitor = monitor;
+    gdk_monitor_get_geometry(gdk_display_get_monitor(display, monitor),
+                             &area.rect);
+    g_array_append_val(areas, area);
+  }
+
+  return areas;
+}
+
+/* Monitors can only be drawn in parallel if no two of them write to the
+ * same pixels of the destination, i.e. if none of them are cloned or
+ * overlapping */
+static gboolean monitor_areas_are_disjoint(GArray *areas, int width,
+                                           int height) {
+  GdkRectangle extent;
+  guint i, j;
+
+  extent.x = 0;
+  extent.y = 0;
+  extent.width = width;
+  extent.height = height;
+
+  for (i = 0; i < areas->len; i++) {
+    GdkRectangle a;
+
+    if (!gdk_rectangle_intersect(&g_array_index(areas, MonitorArea, i).rect,
+                                 &extent, &a))
+      continue;
+
+    for (j = i + 1; j < areas->len; j++) {
+      if (gdk_rectangle_intersect(&a, &g_array_index(areas, MonitorArea, j).rect,
+                                  NULL))
+        return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Only set on the private copies drawn by mate_bg_create_surface_async() */
+static gboolean draw_is_cancelled(MateBG *bg) {
+  return bg->cancellable && g_cancellable_is_cancelled(bg->cancellable);
+}
+
+static guint get_draw_threads(MateBG *bg, guint n_jobs) {
+  guint n_threads;
+
+  n_threads = bg->draw_threads ? bg->draw_threads : g_get_num_processors();
+
+  return MIN(n_threads, n_jobs);
+}
+
+typedef struct {
+  MateBG *bg;
+  GdkPixbuf *dest;
+} DrawContext;
+
+/* Runs @func on every element of @jobs, on a thread pool if more than one
+ * thread is allowed, and returns once all of them are done. The jobs must
+ * not write to overlapping parts of the destination pixbuf. */
+static void run_draw_jobs(MateBG *bg, GdkPixbuf *dest, GPtrArray *jobs,
+                          GFunc func) {
+  DrawContext ctx = {bg, dest};
+  GThreadPool *pool = NULL;
+  guint n_threads;
+  guint i;
+
+  n_threads = get_draw_threads(bg, jobs->len);
+  if (n_threads > 1)
+    pool = g_thread_pool_new(func, &ctx, (gint)n_threads, FALSE, NULL);
+
+  for (i = 0; i < jobs->len; i++) {
+    if (pool)
+      g_thread_pool_push(pool, g_ptr_array_index(jobs, i), NULL);
+    else
+      func(g_ptr_array_index(jobs, i), &ctx);
+  }
+
+  /* waits for the queued jobs to finish */
+  if (pool) g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+static void draw_color_area_job(gpointer data, gpointer user_data) {
+  MonitorArea *area = data;
+  DrawContext *ctx = user_data;
+
+  draw_color_area(ctx->bg, ctx->dest, &area->rect);
+}
+
+static void draw_color_each_monitor(MateBG *bg, GdkPixbuf *dest,
+                                    GArray *areas) {
+  guint i;
+
+  if (bg->color_type == MATE_BG_COLOR_SOLID) {
+    /* the solid fill covers the whole pixbuf anyway, so do it only once */
+    if (areas->len > 0) draw_color(bg, dest);
+  } else if (get_draw_threads(bg, areas->len) > 1 &&
+             monitor_areas_are_disjoint(areas, gdk_pixbuf_get_width(dest),
+                                        gdk_pixbuf_get_height(dest))) {
+    GPtrArray *jobs = g_ptr_array_sized_new(areas->len);
+
+    for (i = 0; i < areas->len; i++)
+      g_ptr_array_add(jobs, &g_array_index(areas, MonitorArea, i));
+
+    run_draw_jobs(bg, dest, jobs, draw_color_area_job);
+    g_ptr_array_free(jobs, TRUE);
+  } else {
+    for (i = 0; i < areas->len; i++)
+      draw_color_area(bg, dest, &g_array_index(areas, MonitorArea, i).rect);
   }
 }
 
@@ -727,8 +1274,7 @@ static GdkPixbuf *pixbuf_clip_to_fit(GdkPixbuf *src, int max_width,
 }
 
 static GdkPixbuf *get_scaled_pixbuf(MateBGPlacement placement,
-                                    GdkPixbuf *pixbuf, int width, int height,
-                                    int *x, int *y, int *w, int *h) {
+                                    GdkPixbuf *pixbuf, int width, int height) {
   GdkPixbuf *new;
 
   switch (placement) {
@@ -754,25 +1300,16 @@ static GdkPixbuf *get_scaled_pixbuf(MateBGPlacement placement,
       break;
   }
 
-  *w = gdk_pixbuf_get_width(new);
-  *h = gdk_pixbuf_get_height(new);
-  *x = (width - *w) / 2;
-  *y = (height - *h) / 2;
-
   return new;
 }
 
-static void draw_image_area(MateBG *bg, gint num_monitor, GdkPixbuf *pixbuf,
-                            GdkPixbuf *dest, GdkRectangle *area) {
-  int dest_width = area->width;
-  int dest_height = area->height;
-  int x, y, w, h;
-  GdkPixbuf *scaled;
-
-  if (!pixbuf) return;
-
-  scaled = get_scaled_pixbuf(bg->placement, pixbuf, dest_width, dest_height, &x,
-                             &y, &w, &h);
+/* Composites a pixbuf returned by get_scaled_pixbuf() into @area of @dest */
+static void draw_scaled_area(MateBG *bg, GdkPixbuf *scaled, GdkPixbuf *dest,
+                             GdkRectangle *area) {
+  int w = gdk_pixbuf_get_width(scaled);
+  int h = gdk_pixbuf_get_height(scaled);
+  int x = (area->width - w) / 2;
+  int y = (area->height - h) / 2;
 
   switch (bg->placement) {
     case MATE_BG_PLACEMENT_TILED:
@@ -791,8 +1328,18 @@ static void draw_image_area(MateBG *bg, gint num_monitor, GdkPixbuf *pixbuf,
       g_assert_not_reached();
       break;
   }
+}
+
+static void draw_image_area(MateBG *bg, gint num_monitor, GdkPixbuf *pixbuf,
+                            GdkPixbuf *dest, GdkRectangle *area) {
+  GdkPixbuf *scaled;
+
+  if (!pixbuf) return;
 
-  refresh_cache_file(bg, scaled, num_monitor, dest_width, dest_height);
+  scaled = get_scaled_pixbuf(bg->placement, pixbuf, area->width, area->height);
+  draw_scaled_area(bg, scaled, dest, area);
+
+  refresh_cache_file(bg, scaled, num_monitor, area->width, area->height);
 
   g_object_unref(scaled);
 }
@@ -811,7 +1358,7 @@ static void draw_image_for_thumb(MateBG *bg, GdkPixbuf *pixbuf,
 
 static void draw_once(MateBG *bg, GdkPixbuf *dest, gboolean is_root) {
   GdkRectangle rect;
-  GdkPixbuf *pixbuf;
+  GdkPixbuf *scaled;
   gint monitor;
 
   /* whether we're drawing on root window or normal (Caja) window */
@@ -822,44 +1369,182 @@ static void draw_once(MateBG *bg, GdkPixbuf *dest, gboolean is_root) {
   rect.width = gdk_pixbuf_get_width(dest);
   rect.height = gdk_pixbuf_get_height(dest);
 
-  pixbuf = get_pixbuf_for_size(bg, monitor, rect.width, rect.height);
-  if (pixbuf) {
-    draw_image_area(bg, monitor, pixbuf, dest, &rect);
+  scaled = get_scaled_pixbuf_for_size(bg, monitor, rect.width, rect.height);
+  if (scaled) {
+    draw_scaled_area(bg, scaled, dest, &rect);
 
-    g_object_unref(pixbuf);
+    g_object_unref(scaled);
   }
 }
 
-static void draw_each_monitor(MateBG *bg, GdkPixbuf *dest, GdkScreen *screen) {
-  GdkDisplay *display;
+static void draw_each_monitor_serial(MateBG *bg, GdkPixbuf *dest,
+                                     GArray *areas) {
+  guint i;
 
-  display = gdk_screen_get_display(screen);
-  gint num_monitors = gdk_display_get_n_monitors(display);
-  gint monitor = 0;
+  for (i = 0; i < areas->len && !draw_is_cancelled(bg); i++) {
+    MonitorArea *area = &g_array_index(areas, MonitorArea, i);
+    GdkPixbuf *scaled;
 
-  for (; monitor < num_monitors; monitor++) {
-    GdkRectangle rect;
-    GdkPixbuf *pixbuf;
+    scaled = get_scaled_pixbuf_for_size(bg, area->monitor, area->rect.width,
+                                        area->rect.height);
+    if (scaled) {
+      draw_scaled_area(bg, scaled, dest, &area->rect);
+
+      g_object_unref(scaled);
+    }
+  }
+}
+
+static void scale_job_free(ScaleJob *job) {
+  g_object_unref(job->pixbuf);
+  if (job->scaled) g_object_unref(job->scaled);
+  g_array_free(job->areas, TRUE);
+  g_free(job);
+}
+
+/* Runs on a worker thread; only reads @bg, which the main thread doesn't
+ * touch until all jobs are done. Without a destination pixbuf the job only
+ * scales, and the caller composites the result. */
+static void scale_job_run(gpointer data, gpointer user_data) {
+  ScaleJob *job = data;
+  DrawContext *ctx = user_data;
+  guint i;
+
+  if (draw_is_cancelled(ctx->bg)) return;
+
+  if (!job->scaled) {
+    job->scaled = get_scaled_pixbuf(ctx->bg->placement, job->pixbuf,
+                                    job->width, job->height);
+    job->refresh_cache = TRUE;
+  }
+
+  for (i = 0; i < job->areas->len; i++) {
+    MonitorArea *area = &g_array_index(job->areas, MonitorArea, i);
+
+    if (ctx->dest)
+      draw_scaled_area(ctx->bg, job->scaled, ctx->dest, &area->rect);
+
+    if (job->refresh_cache)
+      refresh_cache_file(ctx->bg, job->scaled, area->monitor, job->width,
+                         job->height);
+  }
+}
+
+/* Sources are decoded (or found in the cache) on the calling thread, since
+ * the caches aren't thread safe; scaling, compositing and writing the disk
+ * cache then happen on a thread pool, one job per distinct geometry. */
+static GPtrArray *get_scale_jobs(MateBG *bg, GArray *areas) {
+  GPtrArray *jobs;
+  guint i, j;
 
-    gdk_monitor_get_geometry(gdk_display_get_monitor(display, monitor), &rect);
+  jobs = g_ptr_array_new_with_free_func((GDestroyNotify)scale_job_free);
 
-    pixbuf = get_pixbuf_for_size(bg, monitor, rect.width, rect.height);
-    if (pixbuf) {
-      draw_image_area(bg, monitor, pixbuf, dest, &rect);
+  for (i = 0; i < areas->len && !draw_is_cancelled(bg); i++) {
+    MonitorArea *area = &g_array_index(areas, MonitorArea, i);
+    PixbufCacheEntry *ent;
+    ScaleJob *job = NULL;
 
-      g_object_unref(pixbuf);
+    ent = get_pixbuf_cache_entry(bg, area->monitor, area->rect.width,
+                                 area->rect.height);
+    if (!ent) continue;
+
+    for (j = 0; j < jobs->len; j++) {
+      ScaleJob *other = g_ptr_array_index(jobs, j);
+
+      if (other->pixbuf == ent->pixbuf && other->width == ent->width &&
+          other->height == ent->height) {
+        job = other;
+        break;
+      }
+    }
+
+    if (!job) {
+      GdkPixbuf *scaled = ent->scaled;
+
+      if (!scaled) scaled = pixbuf_cache_find_scaled(bg, ent);
+
+      job = g_new0(ScaleJob, 1);
+      job->pixbuf = g_object_ref(ent->pixbuf);
+      if (scaled) {
+        job->scaled = g_object_ref(scaled);
+      } else {
+        /* scaled ahead of time, but still to be written to the disk cache */
+        job->scaled = take_prefetched_scaled(bg, ent->pixbuf, ent->width,
+                                             ent->height);
+        job->refresh_cache = (job->scaled != NULL);
+      }
+      job->width = ent->width;
+      job->height = ent->height;
+      job->areas = g_array_new(FALSE, FALSE, sizeof(MonitorArea));
+      g_ptr_array_add(jobs, job);
     }
+
+    g_array_append_val(job->areas, *area);
   }
+
+  return jobs;
 }
 
-void mate_bg_draw(MateBG *bg, GdkPixbuf *dest, GdkScreen *screen,
-                  gboolean is_root) {
-  if (!bg) return;
+/* Hands the scaled pixbufs over to the cache, unless the entry was evicted
+ * or replaced meanwhile */
+static void scale_jobs_done(MateBG *bg, GPtrArray *jobs) {
+  guint i, j;
+
+  for (i = 0; i < jobs->len; i++) {
+    ScaleJob *job = g_ptr_array_index(jobs, i);
+
+    for (j = 0; j < job->areas->len; j++) {
+      MonitorArea *area = &g_array_index(job->areas, MonitorArea, j);
+      PixbufCacheEntry *ent;
+
+      ent = pixbuf_cache_lookup(bg, area->monitor, job->width, job->height);
+      if (ent && !ent->scaled && job->scaled && ent->pixbuf == job->pixbuf)
+        pixbuf_cache_set_scaled(bg, ent, job->scaled);
+    }
+  }
+}
+
+static void draw_each_monitor_parallel(MateBG *bg, GdkPixbuf *dest,
+                                       GArray *areas) {
+  GPtrArray *jobs;
+
+  jobs = get_scale_jobs(bg, areas);
+  run_draw_jobs(bg, dest, jobs, scale_job_run);
+  scale_jobs_done(bg, jobs);
+
+  g_ptr_array_free(jobs, TRUE);
+}
+
+/* Tiles cover the whole destination for every monitor, so they can't be
+ * drawn in parallel */
+static gboolean can_draw_in_parallel(MateBG *bg, GArray *areas, int width,
+                                     int height) {
+  return bg->placement != MATE_BG_PLACEMENT_TILED &&
+         get_draw_threads(bg, areas->len) > 1 &&
+         monitor_areas_are_disjoint(areas, width, height);
+}
+
+static void draw_each_monitor(MateBG *bg, GdkPixbuf *dest, GArray *areas) {
+  if (can_draw_in_parallel(bg, areas, gdk_pixbuf_get_width(dest),
+                           gdk_pixbuf_get_height(dest)))
+    draw_each_monitor_parallel(bg, dest, areas);
+  else
+    draw_each_monitor_serial(bg, dest, areas);
+}
+
+/* Monitor geometry is only needed when every monitor gets its own copy of
+ * the background */
+static gboolean draw_per_monitor(MateBG *bg, gboolean is_root) {
+  return is_root && (bg->placement != MATE_BG_PLACEMENT_SPANNED);
+}
 
-  if (is_root && (bg->placement != MATE_BG_PLACEMENT_SPANNED)) {
-    draw_color_each_monitor(bg, dest, screen);
+/* @areas is only used when every monitor gets its own copy */
+static void draw_areas(MateBG *bg, GdkPixbuf *dest, GArray *areas,
+                       gboolean is_root) {
+  if (draw_per_monitor(bg, is_root)) {
+    draw_color_each_monitor(bg, dest, areas);
     if (bg->filename) {
-      draw_each_monitor(bg, dest, screen);
+      draw_each_monitor(bg, dest, areas);
     }
   } else {
     draw_color(bg, dest);
@@ -869,39 +1554,279 @@ void mate_bg_draw(MateBG *bg, GdkPixbuf *dest, GdkScreen *screen,
   }
 }
 
-gboolean mate_bg_has_multiple_sizes(MateBG *bg) {
-  SlideShow *show;
-  gboolean ret;
+void mate_bg_draw(MateBG *bg, GdkPixbuf *dest, GdkScreen *screen,
+                  gboolean is_root) {
+  GArray *areas = NULL;
 
-  g_return_val_if_fail(bg != NULL, FALSE);
+  if (!bg) return;
 
-  ret = FALSE;
+  if (draw_per_monitor(bg, is_root)) areas = get_monitor_areas(screen);
 
-  show = get_as_slideshow(bg, bg->filename);
-  if (show) {
-    ret = slideshow_has_multiple_sizes(show);
-    slideshow_unref(show);
-  }
+  draw_areas(bg, dest, areas, is_root);
 
-  return ret;
+  if (areas) g_array_free(areas, TRUE);
 }
 
-static void mate_bg_get_pixmap_size(MateBG *bg, int width, int height,
-                                    int *pixmap_width, int *pixmap_height) {
-  int dummy;
+/*
+ * Cairo counterparts of the draw_*() functions above. They paint into the
+ * target surface directly instead of filling a pixbuf the size of the
+ * whole screen first, and produce the same pixels: colors are quantized
+ * the same way and images are composited from the same scaled pixbufs.
+ */
 
-  if (!pixmap_width) pixmap_width = &dummy;
-  if (!pixmap_height) pixmap_height = &dummy;
+/* Sources are painted at integer offsets, so without a device scale nearest
+ * sampling copies the exact pixels and lets pixman use its fast paths */
+static void set_source_filter(cairo_t *cr) {
+  double x = 1.0, y = 1.0;
 
-  *pixmap_width = width;
-  *pixmap_height = height;
+  cairo_user_to_device_distance(cr, &x, &y);
+  if (x == 1.0 && y == 1.0)
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+}
 
-  if (!bg->filename) {
-    switch (bg->color_type) {
-      case MATE_BG_COLOR_SOLID:
-        *pixmap_width = 1;
-        *pixmap_height = 1;
-        break;
+static void paint_gradient(cairo_t *cr, gboolean horizontal,
+                           GdkRGBA *primary, GdkRGBA *secondary,
+                           GdkRectangle *rect) {
+  cairo_surface_t *line;
+  guchar *gradient;
+  guchar *data;
+  int n_pixels;
+  int stride;
+  int i;
+
+  /* one row or column of the gradient, repeated over @rect */
+  n_pixels = horizontal ? rect->width : rect->height;
+  gradient = create_gradient(primary, secondary, n_pixels);
+
+  line = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                                    horizontal ? n_pixels : 1,
+                                    horizontal ? 1 : n_pixels);
+  cairo_surface_flush(line);
+  data = cairo_image_surface_get_data(line);
+  stride = cairo_image_surface_get_stride(line);
+
+  for (i = 0; i < n_pixels; i++) {
+    guchar *g = gradient + 3 * i;
+    guint32 *p = (guint32 *)(horizontal ? data + 4 * i : data + stride * i);
+
+    *p = ((guint32)g[0] << 16) | ((guint32)g[1] << 8) | g[2];
+  }
+
+  cairo_surface_mark_dirty(line);
+  g_free(gradient);
+
+  cairo_save(cr);
+  cairo_set_source_surface(cr, line, rect->x, rect->y);
+  cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_REPEAT);
+  set_source_filter(cr);
+  cairo_rectangle(cr, rect->x, rect->y, rect->width, rect->height);
+  cairo_fill(cr);
+  cairo_restore(cr);
+
+  cairo_surface_destroy(line);
+}
+
+static void paint_color_area(MateBG *bg, cairo_t *cr, int width, int height,
+                             GdkRectangle *rect) {
+  GdkRectangle extent;
+  GdkRectangle area;
+
+  extent.x = 0;
+  extent.y = 0;
+  extent.width = width;
+  extent.height = height;
+
+  if (!gdk_rectangle_intersect(rect, &extent, &area)) return;
+
+  switch (bg->color_type) {
+    case MATE_BG_COLOR_SOLID:
+      /* like draw_color_area(), fill everything with the truncated color */
+      cairo_set_source_rgb(cr, (guint)(bg->primary.red * 0xff) / 255.0,
+                           (guint)(bg->primary.green * 0xff) / 255.0,
+                           (guint)(bg->primary.blue * 0xff) / 255.0);
+      cairo_paint(cr);
+      break;
+
+    case MATE_BG_COLOR_H_GRADIENT:
+      paint_gradient(cr, TRUE, &(bg->primary), &(bg->secondary), &area);
+      break;
+
+    case MATE_BG_COLOR_V_GRADIENT:
+      paint_gradient(cr, FALSE, &(bg->primary), &(bg->secondary), &area);
+      break;
+
+    default:
+      break;
+  }
+}
+
+static void paint_color_each_monitor(MateBG *bg, cairo_t *cr, int width,
+                                     int height, GArray *areas) {
+  guint i;
+
+  if (bg->color_type == MATE_BG_COLOR_SOLID) {
+    GdkRectangle rect = {0, 0, width, height};
+
+    if (areas->len > 0) paint_color_area(bg, cr, width, height, &rect);
+    return;
+  }
+
+  for (i = 0; i < areas->len; i++)
+    paint_color_area(bg, cr, width, height,
+                     &g_array_index(areas, MonitorArea, i).rect);
+}
+
+/* Same as draw_scaled_area() */
+static void paint_scaled_area(MateBG *bg, cairo_t *cr, GdkPixbuf *scaled,
+                              GdkRectangle *area) {
+  int w = gdk_pixbuf_get_width(scaled);
+  int h = gdk_pixbuf_get_height(scaled);
+  int x = (area->width - w) / 2;
+  int y = (area->height - h) / 2;
+
+  cairo_save(cr);
+
+  switch (bg->placement) {
+    case MATE_BG_PLACEMENT_TILED:
+      gdk_cairo_set_source_pixbuf(cr, scaled, 0, 0);
+      cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_REPEAT);
+      set_source_filter(cr);
+      cairo_paint(cr);
+      break;
+    case MATE_BG_PLACEMENT_ZOOMED:
+    case MATE_BG_PLACEMENT_CENTERED:
+    case MATE_BG_PLACEMENT_FILL_SCREEN:
+    case MATE_BG_PLACEMENT_SCALED:
+      x += area->x;
+      y += area->y;
+      /* fall through */
+    case MATE_BG_PLACEMENT_SPANNED:
+      gdk_cairo_set_source_pixbuf(cr, scaled, x, y);
+      set_source_filter(cr);
+      cairo_rectangle(cr, x, y, w, h);
+      cairo_fill(cr);
+      break;
+    default:
+      g_assert_not_reached();
+      break;
+  }
+
+  cairo_restore(cr);
+}
+
+static void paint_once(MateBG *bg, cairo_t *cr, int width, int height,
+                       gboolean is_root) {
+  GdkRectangle rect;
+  GdkPixbuf *scaled;
+
+  rect.x = 0;
+  rect.y = 0;
+  rect.width = width;
+  rect.height = height;
+
+  scaled = get_scaled_pixbuf_for_size(bg, is_root ? 0 : -1, width, height);
+  if (scaled) {
+    paint_scaled_area(bg, cr, scaled, &rect);
+
+    g_object_unref(scaled);
+  }
+}
+
+static void paint_each_monitor(MateBG *bg, cairo_t *cr, int width, int height,
+                               GArray *areas) {
+  guint i, j;
+
+  if (can_draw_in_parallel(bg, areas, width, height)) {
+    GPtrArray *jobs;
+
+    /* scale on the thread pool, the painting itself is cheap */
+    jobs = get_scale_jobs(bg, areas);
+    run_draw_jobs(bg, NULL, jobs, scale_job_run);
+
+    for (i = 0; i < jobs->len; i++) {
+      ScaleJob *job = g_ptr_array_index(jobs, i);
+
+      if (!job->scaled) continue;
+
+      for (j = 0; j < job->areas->len; j++)
+        paint_scaled_area(bg, cr, job->scaled,
+                          &g_array_index(job->areas, MonitorArea, j).rect);
+    }
+
+    scale_jobs_done(bg, jobs);
+    g_ptr_array_free(jobs, TRUE);
+    return;
+  }
+
+  for (i = 0; i < areas->len && !draw_is_cancelled(bg); i++) {
+    MonitorArea *area = &g_array_index(areas, MonitorArea, i);
+    GdkPixbuf *scaled;
+
+    scaled = get_scaled_pixbuf_for_size(bg, area->monitor, area->rect.width,
+                                        area->rect.height);
+    if (scaled) {
+      paint_scaled_area(bg, cr, scaled, &area->rect);
+
+      g_object_unref(scaled);
+    }
+  }
+}
+
+/* Paints what mate_bg_draw() would draw into a @width x @height pixbuf,
+ * @areas is only used when every monitor gets its own copy. Uses no
+ * GdkScreen, GdkWindow or other display state, only GdkPixbuf and cairo,
+ * so it is safe off the main thread, but only if @cr targets an image
+ * surface. */
+static void paint_areas(MateBG *bg, cairo_t *cr, int width, int height,
+                        GArray *areas, gboolean is_root) {
+  if (draw_per_monitor(bg, is_root)) {
+    paint_color_each_monitor(bg, cr, width, height, areas);
+    if (bg->filename) {
+      paint_each_monitor(bg, cr, width, height, areas);
+    }
+  } else {
+    GdkRectangle rect = {0, 0, width, height};
+
+    paint_color_area(bg, cr, width, height, &rect);
+    if (bg->filename) {
+      paint_once(bg, cr, width, height, is_root);
+    }
+  }
+}
+
+gboolean mate_bg_has_multiple_sizes(MateBG *bg) {
+  SlideShow *show;
+  gboolean ret;
+
+  g_return_val_if_fail(bg != NULL, FALSE);
+
+  ret = FALSE;
+
+  show = get_as_slideshow(bg, bg->filename);
+  if (show) {
+    ret = slideshow_has_multiple_sizes(show);
+    slideshow_unref(show);
+  }
+
+  return ret;
+}
+
+static void mate_bg_get_pixmap_size(MateBG *bg, int width, int height,
+                                    int *pixmap_width, int *pixmap_height) {
+  int dummy;
+
+  if (!pixmap_width) pixmap_width = &dummy;
+  if (!pixmap_height) pixmap_height = &dummy;
+
+  *pixmap_width = width;
+  *pixmap_height = height;
+
+  if (!bg->filename) {
+    switch (bg->color_type) {
+      case MATE_BG_COLOR_SOLID:
+        *pixmap_width = 1;
+        *pixmap_height = 1;
+        break;
 
       case MATE_BG_COLOR_H_GRADIENT:
       case MATE_BG_COLOR_V_GRADIENT:
@@ -912,6 +1837,22 @@ static void mate_bg_get_pixmap_size(MateBG *bg, int width, int height,
   }
 }
 
+static cairo_surface_t *create_surface_for_window(MateBG *bg,
+                                                  GdkWindow *window, int width,
+                                                  int height, int scale,
+                                                  gboolean root) {
+  int pm_width, pm_height;
+
+  mate_bg_get_pixmap_size(bg, width, height, &pm_width, &pm_height);
+
+  if (root) {
+    return make_root_pixmap(window, pm_width * scale, pm_height * scale);
+  } else {
+    return gdk_window_create_similar_surface(window, CAIRO_CONTENT_COLOR,
+                                             pm_width, pm_height);
+  }
+}
+
 /**
  * mate_bg_create_surface:
  * @bg: MateBG
@@ -947,171 +1888,518 @@ cairo_surface_t *mate_bg_create_surface(MateBG *bg, GdkWindow *window,
 cairo_surface_t *mate_bg_create_surface_scale(MateBG *bg, GdkWindow *window,
                                               int width, int height, int scale,
                                               gboolean root) {
-  int pm_width, pm_height;
-
   cairo_surface_t *surface;
   cairo_t *cr;
 
   g_return_val_if_fail(bg != NULL, NULL);
   g_return_val_if_fail(window != NULL, NULL);
 
-  if (bg->pixbuf_cache && (gdk_pixbuf_get_width(bg->pixbuf_cache) != width ||
-                           gdk_pixbuf_get_height(bg->pixbuf_cache) != height)) {
-    g_object_unref(bg->pixbuf_cache);
-    bg->pixbuf_cache = NULL;
-  }
-
-  mate_bg_get_pixmap_size(bg, width, height, &pm_width, &pm_height);
-
-  if (root) {
-    surface = make_root_pixmap(window, pm_width * scale, pm_height * scale);
-  } else {
-    surface = gdk_window_create_similar_surface(window, CAIRO_CONTENT_COLOR,
-                                                pm_width, pm_height);
-  }
+  surface = create_surface_for_window(bg, window, width, height, scale, root);
 
   cr = cairo_create(surface);
   cairo_scale(cr, (double)scale, (double)scale);
 
   if (!bg->filename && bg->color_type == MATE_BG_COLOR_SOLID) {
     gdk_cairo_set_source_rgba(cr, &(bg->primary));
+    cairo_paint(cr);
   } else {
-    GdkPixbuf *pixbuf;
+    GArray *areas = NULL;
 
-    pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
-    mate_bg_draw(bg, pixbuf, gdk_window_get_screen(window), root);
-    gdk_cairo_set_source_pixbuf(cr, pixbuf, 0, 0);
-    g_object_unref(pixbuf);
-  }
+    if (draw_per_monitor(bg, root))
+      areas = get_monitor_areas(gdk_window_get_screen(window));
 
-  cairo_paint(cr);
+    paint_areas(bg, cr, width, height, areas, root);
+
+    if (areas) g_array_free(areas, TRUE);
+  }
 
   cairo_destroy(cr);
 
   return surface;
 }
 
-/* determine if a background is darker or lighter than average, to help
- * clients know what colors to draw on top with
- */
-gboolean mate_bg_is_dark(MateBG *bg, int width, int height) {
-  GdkRGBA color;
-  int intensity;
-  GdkPixbuf *pixbuf;
+typedef struct {
+  MateBG *snapshot;
+  GArray *areas; /* NULL unless every monitor is drawn separately */
+  GdkWindow *window;
+  int width;
+  int height;
+  int scale;
+  gboolean root;
+  guint cache_serial;
+
+  GCancellable *cancellable; /* cancelled by the caller or a newer request */
+  GCancellable *user_cancellable;
+  gulong cancelled_id;
+} SurfaceRequest;
+
+static void surface_request_free(SurfaceRequest *req) {
+  if (req->user_cancellable) {
+    g_cancellable_disconnect(req->user_cancellable, req->cancelled_id);
+    g_object_unref(req->user_cancellable);
+  }
+  g_clear_object(&req->cancellable);
+  g_clear_object(&req->snapshot);
+  if (req->areas) g_array_free(req->areas, TRUE);
+  g_object_unref(req->window);
+  g_free(req);
+}
 
-  g_return_val_if_fail(bg != NULL, FALSE);
+static void cancel_surface_request(GCancellable *user_cancellable,
+                                   gpointer data) {
+  g_cancellable_cancel(G_CANCELLABLE(data));
+}
 
-  if (bg->color_type == MATE_BG_COLOR_SOLID) {
-    color = bg->primary;
-  } else {
-    color.red = (bg->primary.red + bg->secondary.red) / 2;
-    color.green = (bg->primary.green + bg->secondary.green) / 2;
-    color.blue = (bg->primary.blue + bg->secondary.blue) / 2;
-  }
-  pixbuf = get_pixbuf_for_size(bg, -1, width, height);
-  if (pixbuf) {
-    GdkRGBA argb;
-    guchar a, r, g, b;
-
-    pixbuf_average_value(pixbuf, &argb);
-    a = (guchar)(argb.alpha * 255.0);
-    r = (guchar)(argb.red * 255.0);
-    g = (guchar)(argb.green * 255.0);
-    b = (guchar)(argb.blue * 255.0);
-
-    color.red = (color.red * (0xFF - a) + r * 0x101 * a) / 0xFF;
-    color.green = (color.green * (0xFF - a) + g * 0x101 * a) / 0xFF;
-    color.blue = (color.blue * (0xFF - a) + b * 0x101 * a) / 0xFF;
-    g_object_unref(pixbuf);
-  }
+/* A copy of the settings of @bg that can be drawn on another thread. It
+ * starts out with @bg's scaled pixbufs but has no file monitor, timeouts or
+ * idles of its own. */
+static MateBG *mate_bg_snapshot(MateBG *bg, GCancellable *cancellable) {
+  MateBG *copy = g_object_new(MATE_TYPE_BG, NULL);
+
+  copy->is_snapshot = TRUE;
+  copy->cancellable = g_object_ref(cancellable);
+  copy->filename = g_strdup(bg->filename);
+  copy->file_mtime = bg->file_mtime;
+  copy->placement = bg->placement;
+  copy->color_type = bg->color_type;
+  copy->primary = bg->primary;
+  copy->secondary = bg->secondary;
+  copy->is_enabled = bg->is_enabled;
+  copy->draw_threads = bg->draw_threads;
+  copy->transition_frames = bg->transition_frames;
+  copy->transitions = transitions_copy(copy, bg->transitions);
+
+  pixbuf_cache_copy(copy, bg);
+
+  return copy;
+}
+
+static void create_surface_thread(GTask *task, gpointer source_object,
+                                  gpointer task_data,
+                                  GCancellable *cancellable) {
+  SurfaceRequest *req = task_data;
+  cairo_surface_t *image;
+  cairo_t *cr;
 
-  intensity =
-      ((guint)(color.red * 65535.0) * 77 + (guint)(color.green * 65535.0) * 150 +
-       (guint)(color.blue * 65535.0) * 28) >>
-      16;
+  image = cairo_image_surface_create(CAIRO_FORMAT_RGB24, req->width,
+                                     req->height);
+  cr = cairo_create(image);
+  paint_areas(req->snapshot, cr, req->width, req->height, req->areas,
+              req->root);
+  cairo_destroy(cr);
 
-  return intensity < 160; /* biased slightly to be dark */
+  if (g_task_return_error_if_cancelled(task)) {
+    cairo_surface_destroy(image);
+    return;
+  }
+
+  g_task_return_pointer(task, image, (GDestroyNotify)cairo_surface_destroy);
 }
 
-/*
- * Create a persistent pixmap. We create a separate display
- * and set the closedown mode on it to RetainPermanent.
- */
-static cairo_surface_t *make_root_pixmap(GdkWindow *window, gint width,
-                                         gint height) {
-  GdkScreen *screen = gdk_window_get_screen(window);
-  char *disp_name = DisplayString(GDK_WINDOW_XDISPLAY(window));
-  Display *display;
-  Pixmap xpixmap;
+/* Back on the main thread: copy the image into a surface for the window and
+ * keep whatever the worker decoded and scaled */
+static void create_surface_done(GObject *source_object, GAsyncResult *result,
+                                gpointer user_data) {
+  MateBG *bg = MATE_BG(source_object);
+  GTask *task = user_data;
+  SurfaceRequest *req = g_task_get_task_data(G_TASK(result));
+  cairo_surface_t *image;
   cairo_surface_t *surface;
-  int depth;
+  GError *error = NULL;
+  cairo_t *cr;
 
-  /* Desktop background pixmap should be created from dummy X client since most
-   * applications will try to kill it with XKillClient later when changing
-   * pixmap
-   */
-  display = XOpenDisplay(disp_name);
+  if (bg->surface_cancellable == req->cancellable)
+    g_clear_object(&bg->surface_cancellable);
 
-  if (display == NULL) {
-    g_warning("Unable to open display '%s' when setting background pixmap\n",
-              (disp_name) ? disp_name : "NULL");
-    return NULL;
+  image = g_task_propagate_pointer(G_TASK(result), &error);
+
+  if (image && bg->pixbuf_cache_serial == req->cache_serial &&
+      g_strcmp0(bg->filename, req->snapshot->filename) == 0) {
+    pixbuf_cache_adopt(bg, req->snapshot);
+
+    /* the copy couldn't schedule the next slide itself */
+    ensure_timeout_from_snapshot(bg, req->snapshot);
   }
 
-  depth = DefaultDepth(display, gdk_x11_screen_get_screen_number(screen));
-  xpixmap =
-      XCreatePixmap(display, GDK_WINDOW_XID(window), (unsigned int)width,
-                    (unsigned int)height, (unsigned int)depth);
+  /* drop the copy here rather than on whichever thread releases the last
+   * reference to the inner task */
+  g_clear_object(&req->snapshot);
 
-  XFlush(display);
-  XSetCloseDownMode(display, RetainPermanent);
-  XCloseDisplay(display);
+  if (!image) {
+    g_task_return_error(task, error);
+    g_object_unref(task);
+    return;
+  }
 
-  surface = cairo_xlib_surface_create(
-      GDK_SCREEN_XDISPLAY(screen), xpixmap,
-      GDK_VISUAL_XVISUAL(gdk_screen_get_system_visual(screen)), width, height);
+  surface = create_surface_for_window(bg, req->window, req->width,
+                                      req->height, req->scale, req->root);
+  cr = cairo_create(surface);
+  cairo_scale(cr, (double)req->scale, (double)req->scale);
+  cairo_set_source_surface(cr, image, 0, 0);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+  cairo_surface_destroy(image);
 
-  return surface;
+  g_task_return_pointer(task, surface, (GDestroyNotify)cairo_surface_destroy);
+  g_object_unref(task);
 }
 
-static gboolean get_original_size(const char *filename, int *orig_width,
-                                  int *orig_height) {
-  gboolean result;
+/**
+ * mate_bg_create_surface_async:
+ * @bg: MateBG
+ * @window: the window the surface is for
+ * @width: width of the background
+ * @height: height of the background
+ * @scale: window scale factor
+ * @root: whether the surface is for the root window
+ * @cancellable: (nullable): optional #GCancellable object
+ * @callback: a #GAsyncReadyCallback to call when the surface is ready
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronous version of mate_bg_create_surface_scale(). The image is
+ * decoded, scaled and composited on a worker thread, only the final copy
+ * into the surface happens on the main thread. Starting a new request on
+ * @bg cancels the one still in flight, whose callback then gets
+ * %G_IO_ERROR_CANCELLED.
+ **/
+void mate_bg_create_surface_async(MateBG *bg, GdkWindow *window, int width,
+                                  int height, int scale, gboolean root,
+                                  GCancellable *cancellable,
+                                  GAsyncReadyCallback callback,
+                                  gpointer user_data) {
+  SurfaceRequest *req;
+  GTask *task;
+  GTask *thread_task;
 
-  if (gdk_pixbuf_get_file_info(filename, orig_width, orig_height))
-    result = TRUE;
-  else
-    result = FALSE;
+  g_return_if_fail(MATE_IS_BG(bg));
+  g_return_if_fail(window != NULL);
 
-  return result;
-}
+  if (bg->surface_cancellable) {
+    g_cancellable_cancel(bg->surface_cancellable);
+    g_clear_object(&bg->surface_cancellable);
+  }
 
-static const char *get_filename_for_size(MateBG *bg, gint best_width,
-                                         gint best_height) {
-  SlideShow *show;
-  Slide *slide;
-  FileSize *size;
+  task = g_task_new(bg, cancellable, callback, user_data);
+  g_task_set_source_tag(task, mate_bg_create_surface_async);
 
-  if (!bg->filename) return NULL;
+  /* nothing to decode, a plain fill is cheap enough for the main thread */
+  if (!bg->filename && bg->color_type == MATE_BG_COLOR_SOLID) {
+    g_task_return_pointer(
+        task, mate_bg_create_surface_scale(bg, window, width, height, scale,
+                                           root),
+        (GDestroyNotify)cairo_surface_destroy);
+    g_object_unref(task);
+    return;
+  }
 
-  show = get_as_slideshow(bg, bg->filename);
-  if (!show) {
-    return bg->filename;
+  req = g_new0(SurfaceRequest, 1);
+  req->window = g_object_ref(window);
+  req->width = width;
+  req->height = height;
+  req->scale = scale;
+  req->root = root;
+  req->cache_serial = bg->pixbuf_cache_serial;
+  req->cancellable = g_cancellable_new();
+  if (cancellable) {
+    req->user_cancellable = g_object_ref(cancellable);
+    req->cancelled_id = g_cancellable_connect(
+        cancellable, G_CALLBACK(cancel_surface_request),
+        g_object_ref(req->cancellable), g_object_unref);
   }
+  req->snapshot = mate_bg_snapshot(bg, req->cancellable);
+  if (draw_per_monitor(bg, root))
+    req->areas = get_monitor_areas(gdk_window_get_screen(window));
 
-  slide = get_current_slide(show, NULL);
-  slideshow_unref(show);
-  size = find_best_size(slide->file1, best_width, best_height);
-  return size->file;
+  bg->surface_cancellable = g_object_ref(req->cancellable);
+
+  thread_task = g_task_new(bg, req->cancellable, create_surface_done, task);
+  g_task_set_task_data(thread_task, req, (GDestroyNotify)surface_request_free);
+  g_task_run_in_thread(thread_task, create_surface_thread);
+  g_object_unref(thread_task);
 }
 
-gboolean mate_bg_get_image_size(MateBG *bg,
-                                MateDesktopThumbnailFactory *factory,
-                                int best_width, int best_height, int *width,
-                                int *height) {
-  GdkPixbuf *thumb;
-  gboolean result = FALSE;
-  const gchar *filename;
+/**
+ * mate_bg_create_surface_finish:
+ * @bg: MateBG
+ * @result: a #GAsyncResult
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an operation started with mate_bg_create_surface_async().
+ *
+ * Returns: (transfer full): the surface, or %NULL if @error is set
+ **/
+cairo_surface_t *mate_bg_create_surface_finish(MateBG *bg, GAsyncResult *result,
+                                               GError **error) {
+  g_return_val_if_fail(g_task_is_valid(result, bg), NULL);
+
+  return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+/* The color shown where there is no image, averaged for gradients */
+static void get_base_color(MateBG *bg, GdkRGBA *color) {
+  if (bg->color_type == MATE_BG_COLOR_SOLID) {
+    *color = bg->primary;
+  } else {
+    color->red = (bg->primary.red + bg->secondary.red) / 2;
+    color->green = (bg->primary.green + bg->secondary.green) / 2;
+    color->blue = (bg->primary.blue + bg->secondary.blue) / 2;
+  }
+  color->alpha = 1.0;
+}
+
+/* Composites a premultiplied color over @color */
+static void composite_color(GdkRGBA *color, double red, double green,
+                            double blue, double alpha) {
+  color->red = color->red * (1.0 - alpha) + red;
+  color->green = color->green * (1.0 - alpha) + green;
+  color->blue = color->blue * (1.0 - alpha) + blue;
+}
+
+static gboolean color_is_dark(const GdkRGBA *color) {
+  int intensity;
+
+  intensity = ((guint)(color->red * 65535.0) * 77 +
+               (guint)(color->green * 65535.0) * 150 +
+               (guint)(color->blue * 65535.0) * 28) >>
+              16;
+
+  return intensity < 160; /* biased slightly to be dark */
+}
+
+/* determine if a background is darker or lighter than average, to help
+ * clients know what colors to draw on top with
+ */
+gboolean mate_bg_is_dark(MateBG *bg, int width, int height) {
+  GdkRGBA color;
+  ImageStats stats;
+
+  g_return_val_if_fail(bg != NULL, FALSE);
+
+  get_base_color(bg, &color);
+
+  if (get_stats_for_size(bg, width, height, &stats))
+    composite_color(&color, stats.average.red, stats.average.green,
+                    stats.average.blue, stats.average.alpha);
+
+  return color_is_dark(&color);
+}
+
+/* Where the image lands in a @width x @height background, see
+ * get_scaled_pixbuf() and draw_scaled_area() */
+static void get_image_rect(MateBG *bg, const ImageStats *stats, int width,
+                           int height, double rect[4]) {
+  double factor = 1.0;
+
+  switch (bg->placement) {
+    case MATE_BG_PLACEMENT_FILL_SCREEN:
+      rect[0] = 0.0;
+      rect[1] = 0.0;
+      rect[2] = width;
+      rect[3] = height;
+      return;
+    case MATE_BG_PLACEMENT_TILED:
+      rect[0] = 0.0;
+      rect[1] = 0.0;
+      rect[2] = stats->width;
+      rect[3] = stats->height;
+      return;
+    case MATE_BG_PLACEMENT_SPANNED:
+    case MATE_BG_PLACEMENT_SCALED:
+      factor = MIN(width / (double)stats->width,
+                   height / (double)stats->height);
+      break;
+    case MATE_BG_PLACEMENT_ZOOMED:
+      factor = MAX(width / (double)stats->width,
+                   height / (double)stats->height);
+      break;
+    case MATE_BG_PLACEMENT_CENTERED:
+    default:
+      break;
+  }
+
+  rect[2] = stats->width * factor;
+  rect[3] = stats->height * factor;
+  rect[0] = (width - rect[2]) / 2;
+  rect[1] = (height - rect[3]) / 2;
+}
+
+#define AREA_SAMPLES 16
+
+/**
+ * mate_bg_is_dark_for_area:
+ * @bg: a #MateBG
+ * @width: width of the background
+ * @height: height of the background
+ * @area: the part of the background to look at
+ *
+ * Like mate_bg_is_dark(), but only considers @area of a @width x @height
+ * background, e.g. where a panel sits. For the root window, @width and
+ * @height are the size of the monitor and @area is relative to it, unless
+ * the placement is %MATE_BG_PLACEMENT_SPANNED.
+ *
+ * Returns: %TRUE if that part of the background is dark
+ **/
+gboolean mate_bg_is_dark_for_area(MateBG *bg, int width, int height,
+                                  const GdkRectangle *area) {
+  GdkRGBA base, color = {0.0, 0.0, 0.0, 1.0};
+  ImageStats stats;
+  double rect[4];
+  int i, j;
+
+  g_return_val_if_fail(MATE_IS_BG(bg), FALSE);
+  g_return_val_if_fail(area != NULL, FALSE);
+
+  get_base_color(bg, &base);
+
+  if (!get_stats_for_size(bg, width, height, &stats) || stats.width <= 0 ||
+      stats.height <= 0)
+    return color_is_dark(&base);
+
+  get_image_rect(bg, &stats, width, height, rect);
+
+  /* sample the area on a lattice, and look each point up in the grid */
+  for (j = 0; j < AREA_SAMPLES; j++) {
+    for (i = 0; i < AREA_SAMPLES; i++) {
+      double x = area->x + (i + 0.5) * area->width / AREA_SAMPLES;
+      double y = area->y + (j + 0.5) * area->height / AREA_SAMPLES;
+      double u = (x - rect[0]) / rect[2];
+      double v = (y - rect[1]) / rect[3];
+      GdkRGBA point = base;
+
+      if (bg->placement == MATE_BG_PLACEMENT_TILED) {
+        u -= floor(u);
+        v -= floor(v);
+      }
+
+      if (u >= 0.0 && u < 1.0 && v >= 0.0 && v < 1.0) {
+        const guchar *cell =
+            stats.grid + 4 * ((int)(v * STATS_GRID) * STATS_GRID +
+                              (int)(u * STATS_GRID));
+
+        composite_color(&point, cell[0] / 255.0, cell[1] / 255.0,
+                        cell[2] / 255.0, cell[3] / 255.0);
+      }
+
+      color.red += point.red;
+      color.green += point.green;
+      color.blue += point.blue;
+    }
+  }
+
+  color.red /= AREA_SAMPLES * AREA_SAMPLES;
+  color.green /= AREA_SAMPLES * AREA_SAMPLES;
+  color.blue /= AREA_SAMPLES * AREA_SAMPLES;
+
+  return color_is_dark(&color);
+}
+
+/**
+ * mate_bg_get_luminance:
+ * @bg: a #MateBG
+ * @width: width of the background
+ * @height: height of the background
+ * @mean: (out) (optional): return location for the mean luminance
+ * @variance: (out) (optional): return location for its variance
+ *
+ * Gets the luminance of the image of @bg, in the range 0 to 1, as an
+ * estimate from a downscaled copy. A low variance means text drawn on top
+ * will look the same everywhere.
+ *
+ * Returns: %FALSE if @bg has no image
+ **/
+gboolean mate_bg_get_luminance(MateBG *bg, int width, int height,
+                               gdouble *mean, gdouble *variance) {
+  ImageStats stats;
+
+  g_return_val_if_fail(MATE_IS_BG(bg), FALSE);
+
+  if (!get_stats_for_size(bg, width, height, &stats)) return FALSE;
+
+  if (mean) *mean = stats.mean;
+  if (variance) *variance = stats.variance;
+
+  return TRUE;
+}
+
+/*
+ * Create a persistent pixmap. We create a separate display
+ * and set the closedown mode on it to RetainPermanent.
+ */
+static cairo_surface_t *make_root_pixmap(GdkWindow *window, gint width,
+                                         gint height) {
+  GdkScreen *screen = gdk_window_get_screen(window);
+  char *disp_name = DisplayString(GDK_WINDOW_XDISPLAY(window));
+  Display *display;
+  Pixmap xpixmap;
+  cairo_surface_t *surface;
+  int depth;
+
+  /* Desktop background pixmap should be created from dummy X client since most
+   * applications will try to kill it with XKillClient later when changing
+   * pixmap
+   */
+  display = XOpenDisplay(disp_name);
+
+  if (display == NULL) {
+    g_warning("Unable to open display '%s' when setting background pixmap\n",
+              (disp_name) ? disp_name : "NULL");
+    return NULL;
+  }
+
+  depth = DefaultDepth(display, gdk_x11_screen_get_screen_number(screen));
+  xpixmap =
+      XCreatePixmap(display, GDK_WINDOW_XID(window), (unsigned int)width,
+                    (unsigned int)height, (unsigned int)depth);
+
+  XFlush(display);
+  XSetCloseDownMode(display, RetainPermanent);
+  XCloseDisplay(display);
+
+  surface = cairo_xlib_surface_create(
+      GDK_SCREEN_XDISPLAY(screen), xpixmap,
+      GDK_VISUAL_XVISUAL(gdk_screen_get_system_visual(screen)), width, height);
+
+  return surface;
+}
+
+static gboolean get_original_size(const char *filename, int *orig_width,
+                                  int *orig_height) {
+  gboolean result;
+
+  if (gdk_pixbuf_get_file_info(filename, orig_width, orig_height))
+    result = TRUE;
+  else
+    result = FALSE;
+
+  return result;
+}
+
+static const char *get_filename_for_size(MateBG *bg, gint best_width,
+                                         gint best_height) {
+  SlideShow *show;
+  Slide *slide;
+  FileSize *size;
+
+  if (!bg->filename) return NULL;
+
+  show = get_as_slideshow(bg, bg->filename);
+  if (!show) {
+    return bg->filename;
+  }
+
+  slide = get_current_slide(show, NULL);
+  slideshow_unref(show);
+  size = find_best_size(slide->file1, best_width, best_height);
+  return size->file;
+}
+
+gboolean mate_bg_get_image_size(MateBG *bg,
+                                MateDesktopThumbnailFactory *factory,
+                                int best_width, int best_height, int *width,
+                                int *height) {
+  GdkPixbuf *thumb;
+  gboolean result = FALSE;
+  const gchar *filename;
 
   g_return_val_if_fail(bg != NULL, FALSE);
   g_return_val_if_fail(factory != NULL, FALSE);
@@ -1432,6 +2720,10 @@ struct _SlideShow {
 
   gboolean has_multiple_sizes;
 
+  /* the slide found last time, where lookups start */
+  GList *current;
+  double current_start;
+
   /* used during parsing */
   struct tm start_tm;
   GQueue *stack;
@@ -1443,20 +2735,32 @@ static double now(void) {
   return ((double)tv) / microseconds_per_second;
 }
 
-static Slide *get_current_slide(SlideShow *show, double *alpha) {
+/* The link of the slide shown now, and how many seconds into it we are */
+static GList *get_current_slide_link(SlideShow *show, double *offset) {
   double delta = fmod(now() - show->start_time, show->total_duration);
   GList *list;
   double elapsed;
 
   if (delta < 0) delta += show->total_duration;
 
-  elapsed = 0;
-  for (list = show->slides->head; list != NULL; list = list->next) {
+  /* time only moves on, so this is usually the slide found last time or
+   * the one after it */
+  if (show->current && delta >= show->current_start) {
+    list = show->current;
+    elapsed = show->current_start;
+  } else {
+    list = show->slides->head;
+    elapsed = 0;
+  }
+
+  for (; list != NULL; list = list->next) {
     Slide *slide = list->data;
 
     if (elapsed + slide->duration > delta) {
-      if (alpha) *alpha = (delta - elapsed) / (double)slide->duration;
-      return slide;
+      show->current = list;
+      show->current_start = elapsed;
+      *offset = delta - elapsed;
+      return list;
     }
 
     elapsed += slide->duration;
@@ -1470,6 +2774,27 @@ static Slide *get_current_slide(SlideShow *show, double *alpha) {
   return NULL;
 }
 
+static Slide *get_current_slide(SlideShow *show, double *alpha) {
+  double offset;
+  Slide *slide;
+
+  slide = get_current_slide_link(show, &offset)->data;
+  if (alpha) *alpha = offset / (double)slide->duration;
+
+  return slide;
+}
+
+/* The slide after the current one, and in how many seconds it starts */
+static Slide *get_next_slide(SlideShow *show, double *time_until) {
+  double offset;
+  GList *list;
+
+  list = get_current_slide_link(show, &offset);
+  *time_until = ((Slide *)list->data)->duration - offset;
+
+  return list->next ? list->next->data : show->slides->head->data;
+}
+
 static GdkPixbuf *blend(GdkPixbuf *p1, GdkPixbuf *p2, double alpha) {
   GdkPixbuf *result = gdk_pixbuf_copy(p1);
   GdkPixbuf *tmp;
@@ -1500,6 +2825,9 @@ struct FileCacheEntry {
     SlideShow *slideshow;
     GdkPixbuf *thumbnail;
   } u;
+
+  GList *link; /* in bg->file_cache */
+  gsize size;  /* bytes accounted against the budget */
 };
 
 static void file_cache_entry_delete(FileCacheEntry *ent) {
@@ -1520,183 +2848,1291 @@ static void file_cache_entry_delete(FileCacheEntry *ent) {
   g_free(ent);
 }
 
-static void bound_cache(MateBG *bg) {
-  while (g_list_length(bg->file_cache) >= CACHE_SIZE) {
-    GList *last_link = g_list_last(bg->file_cache);
-    FileCacheEntry *ent = last_link->data;
+static guint file_cache_entry_hash(gconstpointer key) {
+  const FileCacheEntry *ent = key;
 
-    file_cache_entry_delete(ent);
+  return g_str_hash(ent->filename) ^ (guint)ent->type;
+}
 
-    bg->file_cache = g_list_delete_link(bg->file_cache, last_link);
-  }
+static gboolean file_cache_entry_equal(gconstpointer a, gconstpointer b) {
+  const FileCacheEntry *ent_a = a;
+  const FileCacheEntry *ent_b = b;
+
+  return ent_a->type == ent_b->type &&
+         strcmp(ent_a->filename, ent_b->filename) == 0;
 }
 
-static const FileCacheEntry *file_cache_lookup(MateBG *bg, FileType type,
-                                               const char *filename) {
+static gsize slideshow_size(SlideShow *show) {
+  gsize size = sizeof(SlideShow);
   GList *list;
+  GSList *l;
+
+  for (list = show->slides->head; list != NULL; list = list->next) {
+    Slide *slide = list->data;
+
+    size += sizeof(GList) + sizeof(Slide);
+    for (l = slide->file1; l != NULL; l = l->next)
+      size += sizeof(GSList) + sizeof(FileSize) +
+              strlen(((FileSize *)l->data)->file) + 1;
+    for (l = slide->file2; l != NULL; l = l->next)
+      size += sizeof(GSList) + sizeof(FileSize) +
+              strlen(((FileSize *)l->data)->file) + 1;
+  }
+
+  return size;
+}
+
+static gsize file_cache_entry_size(FileCacheEntry *ent) {
+  gsize size = sizeof(FileCacheEntry) + strlen(ent->filename) + 1;
+
+  switch (ent->type) {
+    case PIXBUF:
+      size += gdk_pixbuf_get_byte_length(ent->u.pixbuf);
+      break;
+    case SLIDESHOW:
+      size += slideshow_size(ent->u.slideshow);
+      break;
+    case THUMBNAIL:
+      size += gdk_pixbuf_get_byte_length(ent->u.thumbnail);
+      break;
+  }
+
+  return size;
+}
+
+static void file_cache_remove(MateBG *bg, FileCacheEntry *ent) {
+  g_hash_table_remove(bg->file_cache_index, ent);
+  g_queue_delete_link(&bg->file_cache, ent->link);
+  bg->file_cache_size -= ent->size;
+
+  file_cache_entry_delete(ent);
+}
+
+/* Drops least recently used entries until the cache takes at most @budget
+ * bytes or only @keep entries are left */
+static void file_cache_shrink(MateBG *bg, gsize budget, guint keep) {
+  while (bg->file_cache.length > keep && bg->file_cache_size > budget)
+    file_cache_remove(bg, bg->file_cache.tail->data);
+}
+
+/* Like file_cache_shrink(), but only drops decoded images, which are what
+ * takes memory */
+static void file_cache_shrink_pixbufs(MateBG *bg, gsize budget) {
+  GList *list = bg->file_cache.tail;
 
-  for (list = bg->file_cache; list != NULL; list = list->next) {
+  while (list != NULL && bg->file_cache_size > budget) {
     FileCacheEntry *ent = list->data;
 
-    if (ent && ent->type == type && strcmp(ent->filename, filename) == 0) {
-      return ent;
-    }
+    list = list->prev;
+    if (ent->type == PIXBUF) file_cache_remove(bg, ent);
   }
+}
 
-  return NULL;
+static void file_cache_clear(MateBG *bg) {
+  file_cache_shrink(bg, 0, 0);
+}
+
+/* Only tells whether the file is cached: neither the hit and miss counts
+ * nor the order entries are dropped in change */
+static FileCacheEntry *file_cache_peek(MateBG *bg, FileType type,
+                                       const char *filename) {
+  FileCacheEntry key = {.type = type, .filename = (char *)filename};
+
+  return g_hash_table_lookup(bg->file_cache_index, &key);
+}
+
+/* For callers that load the file themselves if it isn't cached */
+static const FileCacheEntry *file_cache_lookup(MateBG *bg, FileType type,
+                                               const char *filename) {
+  FileCacheEntry *ent;
+
+  ent = file_cache_peek(bg, type, filename);
+  if (!ent) {
+    bg->file_cache_misses++;
+    return NULL;
+  }
+
+  bg->file_cache_hits++;
+
+  g_queue_unlink(&bg->file_cache, ent->link);
+  g_queue_push_head_link(&bg->file_cache, ent->link);
+
+  return ent;
 }
 
-static FileCacheEntry *file_cache_entry_new(MateBG *bg, FileType type,
+static FileCacheEntry *file_cache_entry_new(FileType type,
                                             const char *filename) {
   FileCacheEntry *ent = g_new0(FileCacheEntry, 1);
 
-  g_assert(!file_cache_lookup(bg, type, filename));
-
   ent->type = type;
   ent->filename = g_strdup(filename);
 
-  bg->file_cache = g_list_prepend(bg->file_cache, ent);
+  return ent;
+}
 
-  bound_cache(bg);
+/* Takes over @ent, which must be filled in already */
+static void file_cache_insert(MateBG *bg, FileCacheEntry *ent) {
+  g_assert(!g_hash_table_contains(bg->file_cache_index, ent));
 
-  return ent;
+  ent->size = file_cache_entry_size(ent);
+
+  g_queue_push_head(&bg->file_cache, ent);
+  ent->link = bg->file_cache.head;
+  g_hash_table_add(bg->file_cache_index, ent);
+  bg->file_cache_size += ent->size;
+
+  /* the new entry is about to be used */
+  file_cache_shrink(bg, bg->file_cache_budget, 1);
+}
+
+static void file_cache_add_pixbuf(MateBG *bg, const char *filename,
+                                  GdkPixbuf *pixbuf) {
+  FileCacheEntry *ent = file_cache_entry_new(PIXBUF, filename);
+  ent->u.pixbuf = g_object_ref(pixbuf);
+  file_cache_insert(bg, ent);
+}
+
+static void file_cache_add_thumbnail(MateBG *bg, const char *filename,
+                                     GdkPixbuf *pixbuf) {
+  FileCacheEntry *ent = file_cache_entry_new(THUMBNAIL, filename);
+  ent->u.thumbnail = g_object_ref(pixbuf);
+  file_cache_insert(bg, ent);
+}
+
+static void file_cache_add_slide_show(MateBG *bg, const char *filename,
+                                      SlideShow *show) {
+  FileCacheEntry *ent = file_cache_entry_new(SLIDESHOW, filename);
+  ent->u.slideshow = slideshow_ref(show);
+  file_cache_insert(bg, ent);
+}
+
+static GdkPixbuf *load_from_cache_file(MateBG *bg, const char *filename,
+                                       gint num_monitor, gint best_width,
+                                       gint best_height) {
+  GdkPixbuf *pixbuf = NULL;
+  gchar *cache_filename;
+
+  cache_filename = get_wallpaper_cache_filename(
+      filename, num_monitor, bg->placement, best_width, best_height);
+
+  pixbuf = map_cache_file(cache_filename, filename, bg->placement);
+
+  g_free(cache_filename);
+
+  return pixbuf;
 }
 
-static void file_cache_add_pixbuf(MateBG *bg, const char *filename,
-                                  GdkPixbuf *pixbuf) {
-  FileCacheEntry *ent = file_cache_entry_new(bg, PIXBUF, filename);
-  ent->u.pixbuf = g_object_ref(pixbuf);
+/* Doesn't touch any MateBG, so it can run on any thread */
+static GdkPixbuf *decode_pixbuf(MateBGPlacement placement,
+                                const char *filename, gint best_width,
+                                gint best_height) {
+  GdkPixbuf *pixbuf = NULL;
+  GdkPixbufFormat *format;
+  gchar *tmp = NULL;
+  GdkPixbuf *tmp_pixbuf;
+
+  /* If scalable choose maximum size */
+  format = gdk_pixbuf_get_file_info(filename, NULL, NULL);
+  if (format != NULL) tmp = gdk_pixbuf_format_get_name(format);
+
+  if (g_strcmp0(tmp, "svg") == 0 && (best_width > 0 && best_height > 0) &&
+      (placement == MATE_BG_PLACEMENT_FILL_SCREEN ||
+       placement == MATE_BG_PLACEMENT_SCALED ||
+       placement == MATE_BG_PLACEMENT_ZOOMED)) {
+    pixbuf = gdk_pixbuf_new_from_file_at_size(filename, best_width,
+                                              best_height, NULL);
+  } else {
+    pixbuf = gdk_pixbuf_new_from_file(filename, NULL);
+  }
+
+  if (tmp != NULL) g_free(tmp);
+
+  if (pixbuf) {
+    tmp_pixbuf = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+    g_object_unref(pixbuf);
+    pixbuf = tmp_pixbuf;
+  }
+
+  return pixbuf;
+}
+
+/* Sets @scaled, if not %NULL, when the pixbuf came from the disk cache and
+ * so is scaled for the monitor already */
+static GdkPixbuf *get_as_pixbuf_for_size(MateBG *bg, const char *filename,
+                                         gint monitor, gint best_width,
+                                         gint best_height, gboolean *scaled) {
+  const FileCacheEntry *ent;
+  if ((ent = file_cache_lookup(bg, PIXBUF, filename))) {
+    return g_object_ref(ent->u.pixbuf);
+  } else {
+    GdkPixbuf *pixbuf = NULL;
+
+    /* Loaded ahead of time, see prefetch_next_slide() */
+    if ((pixbuf = get_prefetched_pixbuf(bg, filename))) {
+      file_cache_add_pixbuf(bg, filename, pixbuf);
+      return pixbuf;
+    }
+
+    /* Try to hit local cache first if relevant. The cached file is already
+     * scaled for this monitor, so it must not end up in the file cache
+     * where other monitors would pick it up as the source image. */
+    if (monitor != -1) {
+      pixbuf =
+          load_from_cache_file(bg, filename, monitor, best_width, best_height);
+      if (pixbuf) {
+        if (scaled) *scaled = TRUE;
+        return pixbuf;
+      }
+    }
+
+    pixbuf = decode_pixbuf(bg->placement, filename, best_width, best_height);
+    if (pixbuf) file_cache_add_pixbuf(bg, filename, pixbuf);
+
+    return pixbuf;
+  }
+}
+
+static SlideShow *get_as_slideshow(MateBG *bg, const char *filename) {
+  const FileCacheEntry *ent;
+  if ((ent = file_cache_lookup(bg, SLIDESHOW, filename))) {
+    return slideshow_ref(ent->u.slideshow);
+  } else {
+    SlideShow *show = read_slideshow_file(filename, NULL);
+
+    if (show) file_cache_add_slide_show(bg, filename, show);
+
+    return show;
+  }
+}
+
+static GdkPixbuf *get_as_thumbnail(MateBG *bg,
+                                   MateDesktopThumbnailFactory *factory,
+                                   const char *filename) {
+  const FileCacheEntry *ent;
+  if ((ent = file_cache_lookup(bg, THUMBNAIL, filename))) {
+    return g_object_ref(ent->u.thumbnail);
+  } else {
+    GdkPixbuf *thumb = create_thumbnail_for_filename(factory, filename);
+
+    if (thumb) file_cache_add_thumbnail(bg, filename, thumb);
+
+    return thumb;
+  }
+}
+
+/* Statistics */
+static void image_stats_entry_free(ImageStatsEntry *ent) {
+  g_free(ent->filename);
+  g_free(ent);
+}
+
+static void image_stats_compute(ImageStats *stats, GdkPixbuf *pixbuf) {
+  gdouble cells[STATS_GRID * STATS_GRID][5] = {{0.0}};
+  gdouble sum_r = 0.0, sum_g = 0.0, sum_b = 0.0, sum_a = 0.0;
+  gdouble sum_l = 0.0, sum_l2 = 0.0;
+  const guchar *pixels;
+  gboolean has_alpha;
+  int width, height, rowstride, n_channels;
+  int step_x, step_y;
+  int x, y, i;
+  guint64 n = 0;
+
+  width = gdk_pixbuf_get_width(pixbuf);
+  height = gdk_pixbuf_get_height(pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+  has_alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+  pixels = gdk_pixbuf_read_pixels(pixbuf);
+
+  /* an already decoded full size image is only looked at on a lattice */
+  step_x = MAX(1, width / STATS_SAMPLE_SIZE);
+  step_y = MAX(1, height / STATS_SAMPLE_SIZE);
+
+  for (y = 0; y < height; y += step_y) {
+    const guchar *row = pixels + (gsize)y * rowstride;
+    int cell_y = y * STATS_GRID / height;
+
+    for (x = 0; x < width; x += step_x) {
+      const guchar *p = row + x * n_channels;
+      gdouble *cell = cells[cell_y * STATS_GRID + x * STATS_GRID / width];
+      gdouble a = has_alpha ? p[3] / 255.0 : 1.0;
+      gdouble l = (77 * p[0] + 150 * p[1] + 28 * p[2]) / (255.0 * 255.0);
+
+      cell[0] += p[0] * a;
+      cell[1] += p[1] * a;
+      cell[2] += p[2] * a;
+      cell[3] += a;
+      cell[4] += 1.0;
+
+      sum_r += p[0] * a;
+      sum_g += p[1] * a;
+      sum_b += p[2] * a;
+      sum_a += a;
+      sum_l += l * a;
+      sum_l2 += l * l * a;
+      n++;
+    }
+  }
+
+  if (n == 0) return;
+
+  stats->average.red = sum_r / (255.0 * n);
+  stats->average.green = sum_g / (255.0 * n);
+  stats->average.blue = sum_b / (255.0 * n);
+  stats->average.alpha = sum_a / n;
+
+  if (sum_a > 0.0) {
+    stats->mean = sum_l / sum_a;
+    stats->variance = MAX(0.0, sum_l2 / sum_a - stats->mean * stats->mean);
+  }
+
+  for (i = 0; i < STATS_GRID * STATS_GRID; i++) {
+    gdouble count = MAX(cells[i][4], 1.0);
+
+    stats->grid[4 * i] = (guchar)(cells[i][0] / count + 0.5);
+    stats->grid[4 * i + 1] = (guchar)(cells[i][1] / count + 0.5);
+    stats->grid[4 * i + 2] = (guchar)(cells[i][2] / count + 0.5);
+    stats->grid[4 * i + 3] = (guchar)(255.0 * cells[i][3] / count + 0.5);
+  }
+}
+
+#define STATS_FILE_PREFIX "stats_"
+
+static char *get_stats_cache_filename(const char *filename) {
+  gchar *md5_filename;
+  gchar *cache_basename;
+  gchar *cache_dir;
+  gchar *cache_filename;
+
+  md5_filename = g_compute_checksum_for_data(
+      G_CHECKSUM_MD5, (const guchar *)filename, strlen(filename));
+  cache_basename = g_strconcat(STATS_FILE_PREFIX, md5_filename, NULL);
+  cache_dir = get_wallpaper_cache_dir();
+  cache_filename = g_build_filename(cache_dir, cache_basename, NULL);
+
+  g_free(md5_filename);
+  g_free(cache_basename);
+  g_free(cache_dir);
+
+  return cache_filename;
+}
+
+#define STATS_GROUP "Luminance"
+
+static gboolean image_stats_load(const char *filename, gint64 mtime,
+                                 ImageStats *stats) {
+  GKeyFile *key_file;
+  gchar *cache_filename;
+  gdouble *average = NULL;
+  gint *grid = NULL;
+  gsize n_average = 0, n_grid = 0;
+  gboolean result = FALSE;
+  gsize i;
+
+  cache_filename = get_stats_cache_filename(filename);
+  key_file = g_key_file_new();
+
+  if (!g_key_file_load_from_file(key_file, cache_filename, G_KEY_FILE_NONE,
+                                 NULL) ||
+      g_key_file_get_int64(key_file, STATS_GROUP, "Mtime", NULL) != mtime)
+    goto out;
+
+  average = g_key_file_get_double_list(key_file, STATS_GROUP, "Average",
+                                       &n_average, NULL);
+  grid = g_key_file_get_integer_list(key_file, STATS_GROUP, "Grid", &n_grid,
+                                     NULL);
+  if (n_average != 4 || n_grid != G_N_ELEMENTS(stats->grid)) goto out;
+
+  stats->width = g_key_file_get_integer(key_file, STATS_GROUP, "Width", NULL);
+  stats->height = g_key_file_get_integer(key_file, STATS_GROUP, "Height", NULL);
+  stats->average.red = average[0];
+  stats->average.green = average[1];
+  stats->average.blue = average[2];
+  stats->average.alpha = average[3];
+  stats->mean = g_key_file_get_double(key_file, STATS_GROUP, "Mean", NULL);
+  stats->variance =
+      g_key_file_get_double(key_file, STATS_GROUP, "Variance", NULL);
+  for (i = 0; i < n_grid; i++) stats->grid[i] = (guchar)CLAMP(grid[i], 0, 255);
+
+  result = TRUE;
+
+out:
+  g_free(average);
+  g_free(grid);
+  g_key_file_free(key_file);
+  g_free(cache_filename);
+
+  return result;
+}
+
+typedef struct {
+  gchar *path;
+  gint64 mtime;
+} StatsFile;
+
+static gint stats_file_compare_newest_first(gconstpointer a, gconstpointer b) {
+  const StatsFile *fa = a;
+  const StatsFile *fb = b;
+
+  return fa->mtime < fb->mtime ? 1 : fa->mtime > fb->mtime ? -1 : 0;
+}
+
+/* Stats files aren't tied to a monitor, so cleanup_cache_for_monitor()
+ * leaves them alone; only the STATS_CACHE_FILES newest are kept instead */
+static void prune_stats_files(const char *cache_dir) {
+  GDir *dir;
+  GArray *files;
+  const gchar *name;
+  guint i;
+
+  dir = g_dir_open(cache_dir, 0, NULL);
+  if (!dir) return;
+
+  files = g_array_new(FALSE, FALSE, sizeof(StatsFile));
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    StatsFile file;
+    GStatBuf buf;
+
+    if (!g_str_has_prefix(name, STATS_FILE_PREFIX)) continue;
+
+    file.path = g_build_filename(cache_dir, name, NULL);
+    if (g_stat(file.path, &buf) != 0 || !S_ISREG(buf.st_mode)) {
+      g_free(file.path);
+      continue;
+    }
+    file.mtime = buf.st_mtime;
+    g_array_append_val(files, file);
+  }
+  g_dir_close(dir);
+
+  if (files->len > STATS_CACHE_FILES)
+    g_array_sort(files, stats_file_compare_newest_first);
+
+  for (i = 0; i < files->len; i++) {
+    StatsFile *file = &g_array_index(files, StatsFile, i);
+
+    if (i >= STATS_CACHE_FILES) g_unlink(file->path);
+    g_free(file->path);
+  }
+  g_array_free(files, TRUE);
+}
+
+static void image_stats_save(const char *filename, gint64 mtime,
+                             const ImageStats *stats) {
+  GKeyFile *key_file;
+  gchar *cache_filename;
+  gchar *cache_dir;
+  gdouble average[4];
+  gint grid[G_N_ELEMENTS(stats->grid)];
+  gsize i;
+
+  cache_dir = get_wallpaper_cache_dir();
+  if (!g_file_test(cache_dir, G_FILE_TEST_IS_DIR))
+    g_mkdir_with_parents(cache_dir, 0700);
+
+  average[0] = stats->average.red;
+  average[1] = stats->average.green;
+  average[2] = stats->average.blue;
+  average[3] = stats->average.alpha;
+  for (i = 0; i < G_N_ELEMENTS(grid); i++) grid[i] = stats->grid[i];
+
+  key_file = g_key_file_new();
+  g_key_file_set_int64(key_file, STATS_GROUP, "Mtime", mtime);
+  g_key_file_set_integer(key_file, STATS_GROUP, "Width", stats->width);
+  g_key_file_set_integer(key_file, STATS_GROUP, "Height", stats->height);
+  g_key_file_set_double_list(key_file, STATS_GROUP, "Average", average, 4);
+  g_key_file_set_double(key_file, STATS_GROUP, "Mean", stats->mean);
+  g_key_file_set_double(key_file, STATS_GROUP, "Variance", stats->variance);
+  g_key_file_set_integer_list(key_file, STATS_GROUP, "Grid", grid,
+                              G_N_ELEMENTS(grid));
+
+  cache_filename = get_stats_cache_filename(filename);
+  if (g_key_file_save_to_file(key_file, cache_filename, NULL))
+    prune_stats_files(cache_dir);
+
+  g_free(cache_filename);
+  g_free(cache_dir);
+  g_key_file_free(key_file);
+}
+
+/* A small decode is enough for statistics; an image that is already in
+ * memory is used as it is */
+static GdkPixbuf *get_stats_sample(MateBG *bg, const char *filename,
+                                   int *width, int *height) {
+  const FileCacheEntry *ent;
+  GdkPixbuf *pixbuf, *tmp;
+
+  if ((ent = file_cache_peek(bg, PIXBUF, filename))) {
+    *width = gdk_pixbuf_get_width(ent->u.pixbuf);
+    *height = gdk_pixbuf_get_height(ent->u.pixbuf);
+    return g_object_ref(ent->u.pixbuf);
+  }
+
+  pixbuf = gdk_pixbuf_new_from_file_at_size(filename, STATS_SAMPLE_SIZE,
+                                            STATS_SAMPLE_SIZE, NULL);
+  if (!pixbuf) return NULL;
+
+  tmp = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+  g_object_unref(pixbuf);
+  pixbuf = tmp;
+
+  if (!get_original_size(filename, width, height)) {
+    *width = gdk_pixbuf_get_width(pixbuf);
+    *height = gdk_pixbuf_get_height(pixbuf);
+  } else if ((*width > *height) !=
+             (gdk_pixbuf_get_width(pixbuf) > gdk_pixbuf_get_height(pixbuf))) {
+    /* the orientation turned the image */
+    int w = *width;
+
+    *width = *height;
+    *height = w;
+  }
+
+  return pixbuf;
+}
+
+static const ImageStats *get_image_stats(MateBG *bg, const char *filename) {
+  ImageStatsEntry *ent = NULL;
+  GdkPixbuf *pixbuf;
+  gint64 mtime;
+  GList *l;
+
+  mtime = get_mtime(filename);
+
+  for (l = bg->stats_cache; l != NULL; l = l->next) {
+    ImageStatsEntry *e = l->data;
+
+    if (e->mtime == mtime && strcmp(e->filename, filename) == 0) {
+      bg->stats_cache = g_list_remove_link(bg->stats_cache, l);
+      bg->stats_cache = g_list_concat(l, bg->stats_cache);
+      return &e->stats;
+    }
+  }
+
+  ent = g_new0(ImageStatsEntry, 1);
+  ent->filename = g_strdup(filename);
+  ent->mtime = mtime;
+
+  if (!image_stats_load(filename, mtime, &ent->stats)) {
+    pixbuf = get_stats_sample(bg, filename, &ent->stats.width,
+                              &ent->stats.height);
+    if (!pixbuf) {
+      image_stats_entry_free(ent);
+      return NULL;
+    }
+
+    image_stats_compute(&ent->stats, pixbuf);
+    g_object_unref(pixbuf);
+
+    image_stats_save(filename, mtime, &ent->stats);
+  }
+
+  bg->stats_cache = g_list_prepend(bg->stats_cache, ent);
+
+  if (g_list_length(bg->stats_cache) > STATS_CACHE_SIZE) {
+    l = g_list_last(bg->stats_cache);
+    image_stats_entry_free(l->data);
+    bg->stats_cache = g_list_delete_link(bg->stats_cache, l);
+  }
+
+  return &ent->stats;
+}
+
+/* Mixes the statistics of two slides the way blend() mixes their pixels.
+ * The variance is only approximated. */
+static void image_stats_mix(ImageStats *stats, const ImageStats *other,
+                            double alpha) {
+  gsize i;
+
+  stats->average.red = stats->average.red * (1.0 - alpha) +
+                       other->average.red * alpha;
+  stats->average.green = stats->average.green * (1.0 - alpha) +
+                         other->average.green * alpha;
+  stats->average.blue = stats->average.blue * (1.0 - alpha) +
+                        other->average.blue * alpha;
+  stats->average.alpha = stats->average.alpha * (1.0 - alpha) +
+                         other->average.alpha * alpha;
+  stats->mean = stats->mean * (1.0 - alpha) + other->mean * alpha;
+  stats->variance = stats->variance * (1.0 - alpha) + other->variance * alpha;
+
+  for (i = 0; i < G_N_ELEMENTS(stats->grid); i++)
+    stats->grid[i] =
+        (guchar)(stats->grid[i] * (1.0 - alpha) + other->grid[i] * alpha + 0.5);
+}
+
+/* Statistics of the image mate_bg_draw() would show at @width x @height */
+static gboolean get_stats_for_size(MateBG *bg, int width, int height,
+                                   ImageStats *stats) {
+  const ImageStats *s1, *s2 = NULL;
+  SlideShow *show;
+  Slide *slide;
+  double alpha;
+
+  if (!bg->filename) return FALSE;
+
+  /* telling a plain image from a slideshow sniffs the start of the file,
+   * and its stats are checked against its mtime, but an image that has
+   * been looked at before isn't decoded again */
+  if (gdk_pixbuf_get_file_info(bg->filename, NULL, NULL) != NULL ||
+      !(show = get_as_slideshow(bg, bg->filename))) {
+    s1 = get_image_stats(bg, bg->filename);
+    if (!s1) return FALSE;
+
+    *stats = *s1;
+    return TRUE;
+  }
+
+  slide = get_current_slide(show, &alpha);
+
+  s1 = get_image_stats(bg, find_best_size(slide->file1, width, height)->file);
+  if (s1) *stats = *s1;
+  if (!slide->fixed)
+    s2 = get_image_stats(bg, find_best_size(slide->file2, width, height)->file);
+
+  slideshow_unref(show);
+
+  if (!s1) return FALSE;
+  if (s2) image_stats_mix(stats, s2, alpha);
+
+  return TRUE;
+}
+
+/* Transitions */
+typedef struct {
+  char *file1;
+  char *file2;
+  MateBGPlacement placement;
+  gint width;
+  gint height;
+  guint n_frames;
+} TransitionJob;
+
+static void transition_job_free(TransitionJob *job) {
+  g_free(job->file1);
+  g_free(job->file2);
+  g_free(job);
+}
+
+static void transition_free(Transition *t) {
+  if (t->start_id != 0) g_source_remove(t->start_id);
+  if (t->cancellable) {
+    g_cancellable_cancel(t->cancellable);
+    g_object_unref(t->cancellable);
+  }
+  if (t->frames) g_ptr_array_unref(t->frames);
+  g_free(t->file1);
+  g_free(t->file2);
+  g_free(t);
+}
+
+static void clear_transition(MateBG *bg) {
+  g_list_free_full(bg->transitions, (GDestroyNotify)transition_free);
+  bg->transitions = NULL;
+}
+
+/* The frames are never changed once they are ready, so a snapshot can
+ * share them with the MateBG it was taken from */
+static Transition *transition_copy(MateBG *bg, const Transition *t) {
+  Transition *copy;
+
+  copy = g_new0(Transition, 1);
+  copy->bg = bg;
+  copy->file1 = g_strdup(t->file1);
+  copy->file2 = g_strdup(t->file2);
+  copy->placement = t->placement;
+  copy->width = t->width;
+  copy->height = t->height;
+  copy->n_frames = t->n_frames;
+  copy->frames = g_ptr_array_ref(t->frames);
+
+  return copy;
+}
+
+/* Copies the transitions whose frames are ready over to @bg */
+static GList *transitions_copy(MateBG *bg, GList *transitions) {
+  GList *copy = NULL;
+  GList *l;
+
+  for (l = transitions; l != NULL; l = l->next) {
+    Transition *t = l->data;
+
+    if (t->frames) copy = g_list_prepend(copy, transition_copy(bg, t));
+  }
+
+  return g_list_reverse(copy);
+}
+
+static gboolean transition_is_for(const Transition *t,
+                                  MateBGPlacement placement, const char *file1,
+                                  const char *file2, gint width, gint height) {
+  return t->placement == placement && t->width == width &&
+         t->height == height && strcmp(t->file1, file1) == 0 &&
+         strcmp(t->file2, file2) == 0;
+}
+
+static gboolean slide_has_file(GSList *sizes, const char *file) {
+  for (; sizes != NULL; sizes = sizes->next) {
+    FileSize *size = sizes->data;
+
+    if (strcmp(size->file, file) == 0) return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Whether @t is for @slide, at whatever size */
+static gboolean transition_is_for_slide(const Transition *t, Slide *slide) {
+  return slide_has_file(slide->file1, t->file1) &&
+         slide_has_file(slide->file2, t->file2);
+}
+
+/* The transition of @slide prepared for @width x @height, if any */
+static Transition *find_transition(MateBG *bg, Slide *slide, gint width,
+                                   gint height) {
+  const char *file1 = find_best_size(slide->file1, width, height)->file;
+  const char *file2 = find_best_size(slide->file2, width, height)->file;
+  GList *l;
+
+  for (l = bg->transitions; l != NULL; l = l->next) {
+    Transition *t = l->data;
+
+    if (transition_is_for(t, bg->placement, file1, file2, width, height))
+      return t;
+  }
+
+  return NULL;
+}
+
+static void prepare_transition_thread(GTask *task, gpointer source_object,
+                                      gpointer task_data,
+                                      GCancellable *cancellable) {
+  TransitionJob *job = task_data;
+  GPtrArray *frames = NULL;
+  GdkPixbuf *p1 = NULL, *p2 = NULL;
+  gsize frame_size;
+  guint n_frames, i;
+
+  /* Blended as the monitor shows them, so that neither the budget nor the
+   * blending depends on how large the images are */
+  if (!g_cancellable_is_cancelled(cancellable)) {
+    GdkPixbuf *s1, *s2;
+
+    s1 = decode_pixbuf(job->placement, job->file1, job->width, job->height);
+    s2 = decode_pixbuf(job->placement, job->file2, job->width, job->height);
+
+    if (s1 && s2) {
+      p1 = get_scaled_pixbuf(job->placement, s1, job->width, job->height);
+      p2 = get_scaled_pixbuf(job->placement, s2, job->width, job->height);
+    }
+
+    if (s1) g_object_unref(s1);
+    if (s2) g_object_unref(s2);
+  }
+
+  if (p1 && p2) {
+    frame_size = (gsize)gdk_pixbuf_get_rowstride(p1) *
+                 (gsize)gdk_pixbuf_get_height(p1);
+    n_frames = (guint)MIN(job->n_frames, TRANSITION_BUDGET / frame_size);
+
+    if (n_frames >= 2) {
+      /* blend() would scale the second slide again for every frame */
+      if (gdk_pixbuf_get_width(p2) != gdk_pixbuf_get_width(p1) ||
+          gdk_pixbuf_get_height(p2) != gdk_pixbuf_get_height(p1)) {
+        GdkPixbuf *tmp = gdk_pixbuf_scale_simple(
+            p2, gdk_pixbuf_get_width(p1), gdk_pixbuf_get_height(p1),
+            GDK_INTERP_BILINEAR);
+
+        g_object_unref(p2);
+        p2 = tmp;
+      }
+
+      frames = g_ptr_array_new_full(n_frames, g_object_unref);
+      for (i = 0; i < n_frames && !g_cancellable_is_cancelled(cancellable);
+           i++)
+        g_ptr_array_add(frames, blend(p1, p2, i / (double)(n_frames - 1)));
+    }
+  }
+
+  if (p1) g_object_unref(p1);
+  if (p2) g_object_unref(p2);
+
+  if (g_task_return_error_if_cancelled(task)) {
+    if (frames) g_ptr_array_unref(frames);
+    return;
+  }
+
+  g_task_return_pointer(task, frames, (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void transition_ready(GObject *source_object, GAsyncResult *result,
+                             gpointer user_data) {
+  MateBG *bg = MATE_BG(source_object);
+  GCancellable *cancellable = g_task_get_cancellable(G_TASK(result));
+  GPtrArray *frames;
+  GList *l;
+
+  frames = g_task_propagate_pointer(G_TASK(result), NULL);
+
+  for (l = bg->transitions; l != NULL; l = l->next) {
+    Transition *t = l->data;
+
+    if (t->cancellable == cancellable) {
+      g_clear_object(&t->cancellable);
+      t->frames = frames;
+      t->failed = (frames == NULL);
+      return;
+    }
+  }
+
+  /* the transition was dropped meanwhile */
+  if (frames) g_ptr_array_unref(frames);
+}
+
+static gboolean start_transition(gpointer data) {
+  Transition *t = data;
+  TransitionJob *job;
+  GTask *task;
+
+  t->start_id = 0;
+  t->cancellable = g_cancellable_new();
+
+  job = g_new0(TransitionJob, 1);
+  job->file1 = g_strdup(t->file1);
+  job->file2 = g_strdup(t->file2);
+  job->placement = t->placement;
+  job->width = t->width;
+  job->height = t->height;
+  job->n_frames = t->n_frames;
+
+  task = g_task_new(t->bg, t->cancellable, transition_ready, NULL);
+  g_task_set_source_tag(task, start_transition);
+  g_task_set_task_data(task, job, (GDestroyNotify)transition_job_free);
+  g_task_run_in_thread(task, prepare_transition_thread);
+  g_object_unref(task);
+
+  return FALSE;
+}
+
+/* Makes sure the frames of the transition @slide are prepared for a
+ * @width x @height output, starting on them in @delay seconds. Frames of
+ * any other transition are dropped, those of this one for other sizes
+ * are kept. */
+static void prepare_transition(MateBG *bg, Slide *slide, gint width,
+                               gint height, double delay) {
+  Transition *t;
+  GList *l;
+
+  if (bg->is_snapshot || bg->transition_frames < 2) return;
+
+  if (find_transition(bg, slide, width, height)) return;
+
+  for (l = bg->transitions; l != NULL;) {
+    GList *next = l->next;
+
+    t = l->data;
+    if (t->placement != bg->placement || !transition_is_for_slide(t, slide)) {
+      transition_free(t);
+      bg->transitions = g_list_delete_link(bg->transitions, l);
+    }
+    l = next;
+  }
+
+  t = g_new0(Transition, 1);
+  t->bg = bg;
+  t->file1 = g_strdup(find_best_size(slide->file1, width, height)->file);
+  t->file2 = g_strdup(find_best_size(slide->file2, width, height)->file);
+  t->placement = bg->placement;
+  t->width = width;
+  t->height = height;
+  t->n_frames = bg->transition_frames;
+  bg->transitions = g_list_prepend(bg->transitions, t);
+
+  if (delay >= 1.0)
+    t->start_id = g_timeout_add_seconds_full(G_PRIORITY_LOW, (guint)delay,
+                                             start_transition, t, NULL);
+  else
+    start_transition(t);
+}
+
+/* The prepared frame closest to @alpha, already scaled for @width x
+ * @height, or NULL if there is none */
+static GdkPixbuf *get_transition_frame(MateBG *bg, Slide *slide, gint width,
+                                       gint height, double alpha) {
+  Transition *t = find_transition(bg, slide, width, height);
+  guint i;
+
+  if (!t || !t->frames) return NULL;
+
+  i = (guint)(CLAMP(alpha, 0.0, 1.0) * (t->frames->len - 1) + 0.5);
+
+  return g_object_ref(g_ptr_array_index(t->frames, i));
+}
+
+/* How many steps the transition @slide is shown in */
+static guint get_transition_steps(MateBG *bg, Slide *slide) {
+  guint steps = 0;
+  GList *l;
+
+  /* with prepared frames, there is nothing to show in between; monitors
+   * that got fewer of them just show each one for longer */
+  for (l = bg->transitions; l != NULL; l = l->next) {
+    Transition *t = l->data;
+
+    if (t->frames && transition_is_for_slide(t, slide))
+      steps = MAX(steps, t->frames->len - 1);
+  }
+
+  if (steps > 0) return steps;
+
+  /* In the worst case we will do a fade from 0 to 256, which mean
+   * we will never use more than 255 steps, however in most cases
+   * the first and last value are similar and users can't percieve
+   * changes in pixel values as small as 1/255th. So, lets not waste
+   * CPU cycles on transitioning to often.
+   *
+   * 64 steps is enough for each step to be just detectable in a 16bit
+   * color mode in the worst case, so we'll use this as an approximation
+   * of whats detectable.
+   */
+  return 64;
+}
+
+/* Prefetching */
+typedef struct {
+  char *filename;
+  MateBGPlacement placement;
+  GArray *sizes; /* PrefetchSize, with no scaled copies */
+} PrefetchJob;
+
+typedef struct {
+  GdkPixbuf *pixbuf;
+  GPtrArray *scaled; /* one per size of the job, in the same order */
+} PrefetchResult;
+
+static void prefetch_size_clear(PrefetchSize *size) {
+  g_clear_object(&size->scaled);
+}
+
+static void prefetch_job_free(PrefetchJob *job) {
+  g_free(job->filename);
+  g_array_unref(job->sizes);
+  g_free(job);
+}
+
+static void prefetch_result_free(PrefetchResult *result) {
+  g_object_unref(result->pixbuf);
+  g_ptr_array_unref(result->scaled);
+  g_free(result);
+}
+
+static void prefetch_free(Prefetch *prefetch) {
+  if (prefetch->start_id != 0) g_source_remove(prefetch->start_id);
+  if (prefetch->cancellable) {
+    g_cancellable_cancel(prefetch->cancellable);
+    g_object_unref(prefetch->cancellable);
+  }
+  g_clear_object(&prefetch->pixbuf);
+  g_array_unref(prefetch->sizes);
+  g_free(prefetch->filename);
+  g_free(prefetch);
+}
+
+static void clear_prefetch(MateBG *bg) {
+  g_list_free_full(bg->prefetches, (GDestroyNotify)prefetch_free);
+  bg->prefetches = NULL;
+
+  g_list_free_full(bg->prefetched, (GDestroyNotify)prefetch_free);
+  bg->prefetched = NULL;
+}
+
+static void prefetch_thread(GTask *task, gpointer source_object,
+                            gpointer task_data, GCancellable *cancellable) {
+  PrefetchJob *job = task_data;
+  PrefetchResult *result;
+  GdkPixbuf *pixbuf;
+  GPtrArray *scaled;
+  gint width, height;
+  gsize needed;
+  guint i;
+
+  /* the next slide may have come and gone while this waited for a thread */
+  if (g_task_return_error_if_cancelled(task)) return;
+
+  /* the header is enough to tell whether the image fits */
+  if (!gdk_pixbuf_get_file_info(job->filename, &width, &height)) {
+    g_task_return_pointer(task, NULL, NULL);
+    return;
+  }
+
+  needed = (gsize)width * (gsize)height * 4;
+  for (i = 0; i < job->sizes->len; i++) {
+    PrefetchSize *size = &g_array_index(job->sizes, PrefetchSize, i);
+
+    needed += (gsize)size->width * (gsize)size->height * 4;
+  }
+
+  if (needed > PREFETCH_BUDGET) {
+    g_task_return_pointer(task, NULL, NULL);
+    return;
+  }
+
+  /* the best size picked the file, so any of them will do for svgs */
+  pixbuf = decode_pixbuf(job->placement, job->filename,
+                         g_array_index(job->sizes, PrefetchSize, 0).width,
+                         g_array_index(job->sizes, PrefetchSize, 0).height);
+  if (!pixbuf) {
+    g_task_return_pointer(task, NULL, NULL);
+    return;
+  }
+
+  scaled = g_ptr_array_new_full(job->sizes->len, g_object_unref);
+  for (i = 0; i < job->sizes->len; i++) {
+    PrefetchSize *size = &g_array_index(job->sizes, PrefetchSize, i);
+
+    if (g_cancellable_is_cancelled(cancellable)) break;
+
+    g_ptr_array_add(scaled, get_scaled_pixbuf(job->placement, pixbuf,
+                                              size->width, size->height));
+  }
+
+  if (g_task_return_error_if_cancelled(task)) {
+    g_ptr_array_unref(scaled);
+    g_object_unref(pixbuf);
+    return;
+  }
+
+  result = g_new0(PrefetchResult, 1);
+  result->pixbuf = pixbuf;
+  result->scaled = scaled;
+
+  g_task_return_pointer(task, result, (GDestroyNotify)prefetch_result_free);
+}
+
+static void prefetch_ready(GObject *source_object, GAsyncResult *result,
+                           gpointer user_data) {
+  MateBG *bg = MATE_BG(source_object);
+  GCancellable *cancellable = g_task_get_cancellable(G_TASK(result));
+  PrefetchResult *images;
+  GList *l;
+  guint i;
+
+  images = g_task_propagate_pointer(G_TASK(result), NULL);
+
+  for (l = bg->prefetches; l != NULL; l = l->next) {
+    Prefetch *prefetch = l->data;
+
+    if (prefetch->cancellable != cancellable) continue;
+
+    g_clear_object(&prefetch->cancellable);
+
+    if (images) {
+      prefetch->pixbuf = g_object_ref(images->pixbuf);
+      for (i = 0; i < images->scaled->len; i++)
+        g_array_index(prefetch->sizes, PrefetchSize, i).scaled =
+            g_object_ref(g_ptr_array_index(images->scaled, i));
+      prefetch_result_free(images);
+    }
+    return;
+  }
+
+  /* the prefetch was dropped meanwhile */
+  if (images) prefetch_result_free(images);
 }
 
-static void file_cache_add_thumbnail(MateBG *bg, const char *filename,
-                                     GdkPixbuf *pixbuf) {
-  FileCacheEntry *ent = file_cache_entry_new(bg, THUMBNAIL, filename);
-  ent->u.thumbnail = g_object_ref(pixbuf);
-}
+static gboolean start_prefetch(gpointer data) {
+  Prefetch *prefetch = data;
+  PrefetchJob *job;
+  GTask *task;
+  guint i;
+
+  prefetch->start_id = 0;
+  prefetch->cancellable = g_cancellable_new();
+
+  job = g_new0(PrefetchJob, 1);
+  job->filename = g_strdup(prefetch->filename);
+  job->placement = prefetch->placement;
+  job->sizes = g_array_sized_new(FALSE, TRUE, sizeof(PrefetchSize),
+                                 prefetch->sizes->len);
+  for (i = 0; i < prefetch->sizes->len; i++) {
+    PrefetchSize size = g_array_index(prefetch->sizes, PrefetchSize, i);
+
+    size.scaled = NULL;
+    g_array_append_val(job->sizes, size);
+  }
 
-static void file_cache_add_slide_show(MateBG *bg, const char *filename,
-                                      SlideShow *show) {
-  FileCacheEntry *ent = file_cache_entry_new(bg, SLIDESHOW, filename);
-  ent->u.slideshow = slideshow_ref(show);
-}
+  task = g_task_new(prefetch->bg, prefetch->cancellable, prefetch_ready, NULL);
+  g_task_set_source_tag(task, start_prefetch);
+  g_task_set_task_data(task, job, (GDestroyNotify)prefetch_job_free);
+  g_task_run_in_thread(task, prefetch_thread);
+  g_object_unref(task);
 
-static GdkPixbuf *load_from_cache_file(MateBG *bg, const char *filename,
-                                       gint num_monitor, gint best_width,
-                                       gint best_height) {
-  GdkPixbuf *pixbuf = NULL;
-  gchar *cache_filename;
+  return FALSE;
+}
 
-  cache_filename = get_wallpaper_cache_filename(
-      filename, num_monitor, bg->placement, best_width, best_height);
+static gboolean prefetch_has_size(Prefetch *prefetch, gint width,
+                                  gint height) {
+  guint i;
 
-  if (cache_file_is_valid(filename, cache_filename))
-    pixbuf = gdk_pixbuf_new_from_file(cache_filename, NULL);
+  for (i = 0; i < prefetch->sizes->len; i++) {
+    PrefetchSize *size = &g_array_index(prefetch->sizes, PrefetchSize, i);
 
-  g_free(cache_filename);
+    if (size->width == width && size->height == height) return TRUE;
+  }
 
-  return pixbuf;
+  return FALSE;
 }
 
-static GdkPixbuf *get_as_pixbuf_for_size(MateBG *bg, const char *filename,
-                                         gint monitor, gint best_width,
-                                         gint best_height) {
-  const FileCacheEntry *ent;
-  if ((ent = file_cache_lookup(bg, PIXBUF, filename))) {
-    return g_object_ref(ent->u.pixbuf);
-  } else {
-    GdkPixbuf *pixbuf = NULL;
-    gchar *tmp = NULL;
-    GdkPixbuf *tmp_pixbuf;
+/* Starts loading @filename for a @width x @height monitor in @delay seconds,
+ * unless it is loaded already. @filename is one of @files, the sizes of the
+ * slide coming up; prefetches of any other slide are dropped. Monitors that
+ * ask for the same file share one prefetch, which scales it for each of
+ * their sizes as long as it hasn't started yet. */
+static void prefetch_file(MateBG *bg, GSList *files, const char *filename,
+                          gint width, gint height, double delay) {
+  Prefetch *prefetch = NULL;
+  PrefetchSize size = {width, height, NULL};
+  GList *l;
 
-    /* Try to hit local cache first if relevant */
-    if (monitor != -1)
-      pixbuf =
-          load_from_cache_file(bg, filename, monitor, best_width, best_height);
+  if (bg->is_snapshot || file_cache_peek(bg, PIXBUF, filename)) return;
 
-    if (!pixbuf) {
-      /* If scalable choose maximum size */
-      GdkPixbufFormat *format = gdk_pixbuf_get_file_info(filename, NULL, NULL);
-      if (format != NULL) tmp = gdk_pixbuf_format_get_name(format);
-
-      if (g_strcmp0(tmp, "svg") == 0 && (best_width > 0 && best_height > 0) &&
-          (bg->placement == MATE_BG_PLACEMENT_FILL_SCREEN ||
-           bg->placement == MATE_BG_PLACEMENT_SCALED ||
-           bg->placement == MATE_BG_PLACEMENT_ZOOMED)) {
-        pixbuf = gdk_pixbuf_new_from_file_at_size(filename, best_width,
-                                                  best_height, NULL);
-      } else {
-        pixbuf = gdk_pixbuf_new_from_file(filename, NULL);
-      }
+  for (l = bg->prefetches; l != NULL;) {
+    GList *next = l->next;
+    Prefetch *p = l->data;
 
-      if (tmp != NULL) g_free(tmp);
+    if (p->placement != bg->placement || !slide_has_file(files, p->filename)) {
+      prefetch_free(p);
+      bg->prefetches = g_list_delete_link(bg->prefetches, l);
+    } else if (strcmp(p->filename, filename) == 0) {
+      prefetch = p;
     }
+    l = next;
+  }
 
-    if (pixbuf) {
-      tmp_pixbuf = gdk_pixbuf_apply_embedded_orientation(pixbuf);
-      g_object_unref(pixbuf);
-      pixbuf = tmp_pixbuf;
-      file_cache_add_pixbuf(bg, filename, pixbuf);
-    }
+  if (prefetch) {
+    /* once started, other sizes are scaled when their slide comes */
+    if (prefetch->start_id != 0 && !prefetch_has_size(prefetch, width, height))
+      g_array_append_val(prefetch->sizes, size);
+    return;
+  }
 
-    return pixbuf;
+  prefetch = g_new0(Prefetch, 1);
+  prefetch->bg = bg;
+  prefetch->filename = g_strdup(filename);
+  prefetch->placement = bg->placement;
+  prefetch->sizes = g_array_new(FALSE, TRUE, sizeof(PrefetchSize));
+  g_array_set_clear_func(prefetch->sizes, (GDestroyNotify)prefetch_size_clear);
+  g_array_append_val(prefetch->sizes, size);
+  bg->prefetches = g_list_prepend(bg->prefetches, prefetch);
+
+  /* even right away, leave the other monitors of this redraw the time to
+   * add their sizes */
+  if (delay >= 1.0)
+    prefetch->start_id = g_timeout_add_seconds_full(
+        G_PRIORITY_LOW, (guint)delay, start_prefetch, prefetch, NULL);
+  else
+    prefetch->start_id =
+        g_idle_add_full(G_PRIORITY_LOW, start_prefetch, prefetch, NULL);
+}
+
+/* Prefetches whatever image @show needs next, now that @slide shows */
+static void prefetch_next_slide(MateBG *bg, SlideShow *show, Slide *slide,
+                                gint width, gint height) {
+  double time_until;
+  Slide *next;
+
+  if (!slide->fixed) {
+    /* the slide the transition ends on; its frames don't go through the
+     * file cache */
+    prefetch_file(bg, slide->file2,
+                  find_best_size(slide->file2, width, height)->file, width,
+                  height, 0.0);
+    return;
   }
+
+  /* a transition brings its own images, see prepare_transition() */
+  next = get_next_slide(show, &time_until);
+  if (next->fixed && next != slide)
+    prefetch_file(bg, next->file1,
+                  find_best_size(next->file1, width, height)->file, width,
+                  height, time_until - PREFETCH_LEAD_SECS);
 }
 
-static SlideShow *get_as_slideshow(MateBG *bg, const char *filename) {
-  const FileCacheEntry *ent;
-  if ((ent = file_cache_lookup(bg, SLIDESHOW, filename))) {
-    return slideshow_ref(ent->u.slideshow);
-  } else {
-    SlideShow *show = read_slideshow_file(filename, NULL);
+/* The prefetched image of @filename, if it is ready. The prefetch moves
+ * aside, so that the next slide can be prefetched while its scaled copies
+ * wait for take_prefetched_scaled(). */
+static GdkPixbuf *get_prefetched_pixbuf(MateBG *bg, const char *filename) {
+  GList *l;
 
-    if (show) file_cache_add_slide_show(bg, filename, show);
+  for (l = bg->prefetches; l != NULL; l = l->next) {
+    Prefetch *prefetch = l->data;
 
-    return show;
+    if (!prefetch->pixbuf || prefetch->placement != bg->placement ||
+        strcmp(prefetch->filename, filename) != 0)
+      continue;
+
+    bg->prefetches = g_list_remove_link(bg->prefetches, l);
+    bg->prefetched = g_list_concat(l, bg->prefetched);
+
+    return g_object_ref(prefetch->pixbuf);
   }
+
+  return NULL;
 }
 
-static GdkPixbuf *get_as_thumbnail(MateBG *bg,
-                                   MateDesktopThumbnailFactory *factory,
-                                   const char *filename) {
-  const FileCacheEntry *ent;
-  if ((ent = file_cache_lookup(bg, THUMBNAIL, filename))) {
-    return g_object_ref(ent->u.thumbnail);
-  } else {
-    GdkPixbuf *thumb = create_thumbnail_for_filename(factory, filename);
+/* The prefetched scaled copy of @pixbuf, if there is one */
+static GdkPixbuf *take_prefetched_scaled(MateBG *bg, GdkPixbuf *pixbuf,
+                                         gint width, gint height) {
+  GList *l;
+  guint i;
 
-    if (thumb) file_cache_add_thumbnail(bg, filename, thumb);
+  for (l = bg->prefetched; l != NULL; l = l->next) {
+    Prefetch *prefetched = l->data;
 
-    return thumb;
+    if (prefetched->pixbuf != pixbuf ||
+        prefetched->placement != bg->placement)
+      continue;
+
+    for (i = 0; i < prefetched->sizes->len; i++) {
+      PrefetchSize *size = &g_array_index(prefetched->sizes, PrefetchSize, i);
+      GdkPixbuf *scaled = size->scaled;
+
+      if (!scaled || size->width != width || size->height != height)
+        continue;
+
+      size->scaled = NULL;
+      g_array_remove_index_fast(prefetched->sizes, i);
+
+      /* done once every monitor took its copy */
+      if (prefetched->sizes->len == 0) {
+        prefetch_free(prefetched);
+        bg->prefetched = g_list_delete_link(bg->prefetched, l);
+      }
+
+      return scaled;
+    }
   }
+
+  return NULL;
 }
 
 static gboolean blow_expensive_caches(gpointer data) {
   MateBG *bg = data;
-  GList *list;
 
   bg->blow_caches_id = 0;
 
-  if (bg->file_cache) {
-    for (list = bg->file_cache; list != NULL; list = list->next) {
-      FileCacheEntry *ent = list->data;
-
-      if (ent->type == PIXBUF) {
-        file_cache_entry_delete(ent);
-        bg->file_cache = g_list_delete_link(bg->file_cache, list);
-      }
-    }
-  }
+  /* keep what was used last, as long as it is not too big */
+  file_cache_shrink_pixbufs(bg, bg->file_cache_budget / FILE_CACHE_IDLE_SHARE);
+  pixbuf_cache_shrink(bg, PIXBUF_CACHE_IDLE_BUDGET, 0);
 
-  if (bg->pixbuf_cache) {
-    g_object_unref(bg->pixbuf_cache);
-    bg->pixbuf_cache = NULL;
-  }
+  /* but not what is being prefetched for the next slide */
+  g_list_free_full(bg->prefetched, (GDestroyNotify)prefetch_free);
+  bg->prefetched = NULL;
 
   return FALSE;
 }
 
 static void blow_expensive_caches_in_idle(MateBG *bg) {
-  if (bg->blow_caches_id == 0) {
+  if (bg->blow_caches_id == 0 && !bg->is_snapshot) {
     bg->blow_caches_id = g_idle_add(blow_expensive_caches, bg);
   }
 }
@@ -1711,40 +4147,38 @@ static gboolean on_timeout(gpointer data) {
   return FALSE;
 }
 
-static double get_slide_timeout(Slide *slide) {
+static double get_slide_timeout(MateBG *bg, Slide *slide) {
   double timeout;
   if (slide->fixed) {
     timeout = slide->duration;
   } else {
-    /* Maybe the number of steps should be configurable? */
-
-    /* In the worst case we will do a fade from 0 to 256, which mean
-     * we will never use more than 255 steps, however in most cases
-     * the first and last value are similar and users can't percieve
-     * changes in pixel values as small as 1/255th. So, lets not waste
-     * CPU cycles on transitioning to often.
-     *
-     * 64 steps is enough for each step to be just detectable in a 16bit
-     * color mode in the worst case, so we'll use this as an approximation
-     * of whats detectable.
-     */
-    timeout = slide->duration / 64.0;
+    timeout = slide->duration / get_transition_steps(bg, slide);
   }
   return timeout;
 }
 
 static void ensure_timeout(MateBG *bg, Slide *slide) {
-  if (bg->timeout_id == 0) {
-    double timeout = get_slide_timeout(slide);
-    guint interval = (guint) timeout;
+  if (bg->timeout_id == 0 && !bg->is_snapshot) {
+    double timeout = get_slide_timeout(bg, slide);
     /* G_MAXUINT means "only one slide" */
-    if (interval < G_MAXUINT) {
-      bg->timeout_id = g_timeout_add_full(G_PRIORITY_LOW, interval * 1000,
+    if (timeout < G_MAXUINT) {
+      /* a transition step is usually shorter than a second */
+      guint interval = (guint)MIN(timeout * 1000.0, (double)G_MAXUINT);
+
+      bg->timeout_id = g_timeout_add_full(G_PRIORITY_LOW, interval,
                                           on_timeout, bg, NULL);
     }
   }
 }
 
+/* Uses the slideshow @snapshot has parsed instead of reading it again */
+static void ensure_timeout_from_snapshot(MateBG *bg, MateBG *snapshot) {
+  const FileCacheEntry *ent;
+
+  ent = file_cache_peek(snapshot, SLIDESHOW, snapshot->filename);
+  if (ent) ensure_timeout(bg, get_current_slide(ent->u.slideshow, NULL));
+}
+
 static gint64 get_mtime(const char *filename) {
   gint64 ret = -1;
 
@@ -1938,81 +4372,309 @@ static FileSize *find_best_size(GSList *sizes, gint width, gint height) {
   return best;
 }
 
-static GdkPixbuf *get_pixbuf_for_size(MateBG *bg, gint monitor, gint best_width,
-                                      gint best_height) {
-  guint time_until_next_change;
-  gboolean hit_cache = FALSE;
-
-  /* only hit the cache if the aspect ratio matches */
-  if (bg->pixbuf_cache) {
-    int width, height;
-    width = gdk_pixbuf_get_width(bg->pixbuf_cache);
-    height = gdk_pixbuf_get_height(bg->pixbuf_cache);
-    hit_cache = 0.2 > fabs((best_width / (double)best_height) -
-                           (width / (double)height));
-    if (!hit_cache) {
-      g_object_unref(bg->pixbuf_cache);
-      bg->pixbuf_cache = NULL;
+static void pixbuf_cache_entry_free(PixbufCacheEntry *ent) {
+  g_free(ent->filename);
+  g_object_unref(ent->pixbuf);
+  if (ent->scaled) g_object_unref(ent->scaled);
+  g_free(ent);
+}
+
+static gsize count_pixbuf_once(GHashTable *counted, GdkPixbuf *pixbuf) {
+  if (!pixbuf || !g_hash_table_add(counted, pixbuf)) return 0;
+
+  return gdk_pixbuf_get_byte_length(pixbuf);
+}
+
+/* Monitors showing the same file share its source pixbuf, and monitors of
+ * the same geometry the scaled one too, so each is only counted once */
+static void pixbuf_cache_update_size(MateBG *bg) {
+  GHashTable *counted;
+  GList *list;
+  gsize size = 0;
+
+  counted = g_hash_table_new(NULL, NULL);
+  for (list = bg->pixbuf_cache.head; list != NULL; list = list->next) {
+    PixbufCacheEntry *ent = list->data;
+
+    size += count_pixbuf_once(counted, ent->pixbuf);
+    size += count_pixbuf_once(counted, ent->scaled);
+  }
+  g_hash_table_destroy(counted);
+
+  bg->pixbuf_cache_size = size;
+}
+
+/* Drops least recently used entries until the cache takes at most @budget
+ * bytes or only @keep entries are left */
+static void pixbuf_cache_shrink(MateBG *bg, gsize budget, guint keep) {
+  while (bg->pixbuf_cache.length > keep && bg->pixbuf_cache_size > budget) {
+    pixbuf_cache_entry_free(g_queue_pop_tail(&bg->pixbuf_cache));
+    pixbuf_cache_update_size(bg);
+  }
+}
+
+/* The most recently used entry is always kept, even if it is over budget by
+ * itself, since the caller is about to use it. */
+static void pixbuf_cache_bound(MateBG *bg) {
+  pixbuf_cache_shrink(bg, PIXBUF_CACHE_BUDGET, 1);
+}
+
+static void pixbuf_cache_clear(MateBG *bg) {
+  PixbufCacheEntry *ent;
+
+  while ((ent = g_queue_pop_head(&bg->pixbuf_cache)) != NULL)
+    pixbuf_cache_entry_free(ent);
+
+  bg->pixbuf_cache_size = 0;
+  bg->pixbuf_cache_serial++;
+}
+
+/* Gives @bg its own entries sharing @from's pixbufs, which are never
+ * modified once cached and so can be read from any thread */
+static void pixbuf_cache_copy(MateBG *bg, MateBG *from) {
+  GList *l;
+
+  for (l = from->pixbuf_cache.tail; l != NULL; l = l->prev) {
+    PixbufCacheEntry *src = l->data;
+    PixbufCacheEntry *ent = g_new0(PixbufCacheEntry, 1);
+
+    ent->filename = g_strdup(src->filename);
+    ent->monitor = src->monitor;
+    ent->placement = src->placement;
+    ent->width = src->width;
+    ent->height = src->height;
+    ent->pixbuf = g_object_ref(src->pixbuf);
+    ent->scaled = src->scaled ? g_object_ref(src->scaled) : NULL;
+
+    g_queue_push_head(&bg->pixbuf_cache, ent);
+  }
+
+  bg->pixbuf_cache_size = from->pixbuf_cache_size;
+}
+
+/* Moves the entries of @from that @bg doesn't have yet over to @bg */
+static void pixbuf_cache_adopt(MateBG *bg, MateBG *from) {
+  PixbufCacheEntry *ent;
+
+  while ((ent = g_queue_pop_tail(&from->pixbuf_cache)) != NULL) {
+    if (g_strcmp0(ent->filename, bg->filename) != 0 ||
+        ent->placement != bg->placement ||
+        pixbuf_cache_lookup(bg, ent->monitor, ent->width, ent->height)) {
+      pixbuf_cache_entry_free(ent);
+      continue;
     }
+
+    g_queue_push_head(&bg->pixbuf_cache, ent);
   }
 
-  if (!hit_cache && bg->filename) {
-    bg->file_mtime = get_mtime(bg->filename);
+  from->pixbuf_cache_size = 0;
+  pixbuf_cache_update_size(bg);
+  pixbuf_cache_bound(bg);
+}
 
-    bg->pixbuf_cache = get_as_pixbuf_for_size(bg, bg->filename, monitor,
-                                              best_width, best_height);
-    time_until_next_change = G_MAXUINT;
-    if (!bg->pixbuf_cache) {
-      SlideShow *show = get_as_slideshow(bg, bg->filename);
+static PixbufCacheEntry *pixbuf_cache_lookup(MateBG *bg, gint monitor,
+                                             gint width, gint height) {
+  GList *list;
 
-      if (show) {
-        double alpha;
-        double timeout;
-        Slide *slide;
+  for (list = bg->pixbuf_cache.head; list != NULL; list = list->next) {
+    PixbufCacheEntry *ent = list->data;
+
+    if (ent->monitor == monitor && ent->width == width &&
+        ent->height == height && ent->placement == bg->placement &&
+        g_strcmp0(ent->filename, bg->filename) == 0) {
+      g_queue_unlink(&bg->pixbuf_cache, list);
+      g_queue_push_head_link(&bg->pixbuf_cache, list);
+      return ent;
+    }
+  }
 
-        slideshow_ref(show);
+  return NULL;
+}
 
-        slide = get_current_slide(show, &alpha);
-        timeout = get_slide_timeout(slide);
-        time_until_next_change = (guint)timeout;
-        if (slide->fixed) {
-          FileSize *size =
-              find_best_size(slide->file1, best_width, best_height);
-          bg->pixbuf_cache = get_as_pixbuf_for_size(bg, size->file, monitor,
-                                                    best_width, best_height);
-        } else {
-          FileSize *size;
-          GdkPixbuf *p1, *p2;
+static PixbufCacheEntry *pixbuf_cache_add(MateBG *bg, gint monitor,
+                                          gint width, gint height,
+                                          GdkPixbuf *pixbuf) {
+  PixbufCacheEntry *ent = g_new0(PixbufCacheEntry, 1);
 
-          size = find_best_size(slide->file1, best_width, best_height);
-          p1 = get_as_pixbuf_for_size(bg, size->file, monitor, best_width,
-                                      best_height);
+  ent->filename = g_strdup(bg->filename);
+  ent->monitor = monitor;
+  ent->placement = bg->placement;
+  ent->width = width;
+  ent->height = height;
+  ent->pixbuf = g_object_ref(pixbuf);
 
-          size = find_best_size(slide->file2, best_width, best_height);
-          p2 = get_as_pixbuf_for_size(bg, size->file, monitor, best_width,
-                                      best_height);
+  g_queue_push_head(&bg->pixbuf_cache, ent);
+  pixbuf_cache_update_size(bg);
 
-          if (p1 && p2) bg->pixbuf_cache = blend(p1, p2, alpha);
-          if (p1) g_object_unref(p1);
-          if (p2) g_object_unref(p2);
-        }
+  pixbuf_cache_bound(bg);
 
-        ensure_timeout(bg, slide);
+  return ent;
+}
 
-        slideshow_unref(show);
+static void pixbuf_cache_set_scaled(MateBG *bg, PixbufCacheEntry *ent,
+                                    GdkPixbuf *scaled) {
+  ent->scaled = g_object_ref(scaled);
+  pixbuf_cache_update_size(bg);
+
+  pixbuf_cache_bound(bg);
+}
+
+/* Monitors that share a geometry also share the scaled pixbuf, as long as
+ * they were drawn from the same source pixbuf */
+static GdkPixbuf *pixbuf_cache_find_scaled(MateBG *bg,
+                                           PixbufCacheEntry *wanted) {
+  GList *list;
+
+  for (list = bg->pixbuf_cache.head; list != NULL; list = list->next) {
+    PixbufCacheEntry *ent = list->data;
+
+    if (ent != wanted && ent->scaled && ent->pixbuf == wanted->pixbuf &&
+        ent->width == wanted->width && ent->height == wanted->height &&
+        ent->placement == wanted->placement)
+      return ent->scaled;
+  }
+
+  return NULL;
+}
+
+/* Sets @scaled if the pixbuf is scaled for the size already */
+static GdkPixbuf *load_pixbuf_for_size(MateBG *bg, gint monitor,
+                                       gint best_width, gint best_height,
+                                       gboolean *scaled) {
+  GdkPixbuf *pixbuf;
+  guint time_until_next_change;
+
+  bg->file_mtime = get_mtime(bg->filename);
+
+  pixbuf = get_as_pixbuf_for_size(bg, bg->filename, monitor, best_width,
+                                  best_height, scaled);
+  time_until_next_change = G_MAXUINT;
+  if (!pixbuf) {
+    SlideShow *show = get_as_slideshow(bg, bg->filename);
+
+    if (show) {
+      double alpha;
+      double timeout;
+      Slide *slide;
+
+      slideshow_ref(show);
+
+      slide = get_current_slide(show, &alpha);
+      if (slide->fixed) {
+        FileSize *size = find_best_size(slide->file1, best_width, best_height);
+        double time_until;
+        Slide *next;
+
+        pixbuf = get_as_pixbuf_for_size(bg, size->file, monitor, best_width,
+                                        best_height, scaled);
+
+        /* get the frames of the next transition ready in time, and drop
+         * those of the last one */
+        next = get_next_slide(show, &time_until);
+        if (!next->fixed)
+          prepare_transition(bg, next, best_width, best_height,
+                             time_until - TRANSITION_LEAD_SECS);
+        else
+          clear_transition(bg);
+      } else if ((pixbuf = get_transition_frame(bg, slide, best_width,
+                                                best_height, alpha))) {
+        /* prepared ahead of time */
+        *scaled = TRUE;
+      } else {
+        FileSize *size;
+        GdkPixbuf *p1, *p2;
+
+        /* too late to prepare this frame, but not the rest of them */
+        prepare_transition(bg, slide, best_width, best_height, 0.0);
+
+        size = find_best_size(slide->file1, best_width, best_height);
+        p1 = get_as_pixbuf_for_size(bg, size->file, monitor, best_width,
+                                    best_height, NULL);
+
+        size = find_best_size(slide->file2, best_width, best_height);
+        p2 = get_as_pixbuf_for_size(bg, size->file, monitor, best_width,
+                                    best_height, NULL);
+
+        if (p1 && p2) pixbuf = blend(p1, p2, alpha);
+        if (p1) g_object_unref(p1);
+        if (p2) g_object_unref(p2);
       }
-    }
 
-    /* If the next slideshow step is a long time away then
-       we blow away the expensive stuff (large pixbufs) from
-       the cache */
-    if (time_until_next_change > KEEP_EXPENSIVE_CACHE_SECS)
-      blow_expensive_caches_in_idle(bg);
+      prefetch_next_slide(bg, show, slide, best_width, best_height);
+
+      timeout = get_slide_timeout(bg, slide);
+      time_until_next_change = (guint)timeout;
+
+      ensure_timeout(bg, slide);
+
+      slideshow_unref(show);
+    }
   }
 
-  if (bg->pixbuf_cache) g_object_ref(bg->pixbuf_cache);
+  /* If the next slideshow step is a long time away then
+     we blow away the expensive stuff (large pixbufs) from
+     the cache */
+  if (time_until_next_change > KEEP_EXPENSIVE_CACHE_SECS)
+    blow_expensive_caches_in_idle(bg);
+
+  return pixbuf;
+}
+
+static PixbufCacheEntry *get_pixbuf_cache_entry(MateBG *bg, gint monitor,
+                                                gint best_width,
+                                                gint best_height) {
+  PixbufCacheEntry *ent;
+  GdkPixbuf *pixbuf;
+  gboolean scaled = FALSE;
+
+  if (!bg->filename) return NULL;
+
+  ent = pixbuf_cache_lookup(bg, monitor, best_width, best_height);
+  if (ent) return ent;
+
+  pixbuf =
+      load_pixbuf_for_size(bg, monitor, best_width, best_height, &scaled);
+  if (!pixbuf) return NULL;
+
+  ent = pixbuf_cache_add(bg, monitor, best_width, best_height, pixbuf);
+  if (scaled) pixbuf_cache_set_scaled(bg, ent, pixbuf);
+  g_object_unref(pixbuf);
+
+  return ent;
+}
+
+static GdkPixbuf *get_pixbuf_for_size(MateBG *bg, gint monitor, gint best_width,
+                                      gint best_height) {
+  PixbufCacheEntry *ent;
+
+  ent = get_pixbuf_cache_entry(bg, monitor, best_width, best_height);
+
+  return ent ? g_object_ref(ent->pixbuf) : NULL;
+}
+
+static GdkPixbuf *get_scaled_pixbuf_for_size(MateBG *bg, gint monitor,
+                                             gint width, gint height) {
+  PixbufCacheEntry *ent;
+
+  ent = get_pixbuf_cache_entry(bg, monitor, width, height);
+  if (!ent) return NULL;
+
+  if (!ent->scaled) {
+    GdkPixbuf *scaled = pixbuf_cache_find_scaled(bg, ent);
+
+    if (scaled) {
+      pixbuf_cache_set_scaled(bg, ent, scaled);
+    } else {
+      scaled = take_prefetched_scaled(bg, ent->pixbuf, width, height);
+      if (!scaled)
+        scaled = get_scaled_pixbuf(bg->placement, ent->pixbuf, width, height);
+      pixbuf_cache_set_scaled(bg, ent, scaled);
+      refresh_cache_file(bg, scaled, monitor, width, height);
+      g_object_unref(scaled);
+    }
+  }
 
-  return bg->pixbuf_cache;
+  return g_object_ref(ent->scaled);
 }
 
 static gboolean is_different(MateBG *bg, const char *filename) {
@@ -2032,22 +4694,10 @@ static gboolean is_different(MateBG *bg, const char *filename) {
 }
 
 static void clear_cache(MateBG *bg) {
-  GList *list;
-
-  if (bg->file_cache) {
-    for (list = bg->file_cache; list != NULL; list = list->next) {
-      FileCacheEntry *ent = list->data;
-
-      file_cache_entry_delete(ent);
-    }
-    g_list_free(bg->file_cache);
-    bg->file_cache = NULL;
-  }
-
-  if (bg->pixbuf_cache) {
-    g_object_unref(bg->pixbuf_cache);
-    bg->pixbuf_cache = NULL;
-  }
+  file_cache_clear(bg);
+  pixbuf_cache_clear(bg);
+  clear_transition(bg);
+  clear_prefetch(bg);
 
   if (bg->timeout_id != 0) {
     g_source_remove(bg->timeout_id);
@@ -2056,70 +4706,6 @@ static void clear_cache(MateBG *bg) {
 }
 
 /* Pixbuf utilities */
-static void pixbuf_average_value(GdkPixbuf *pixbuf, GdkRGBA *result) {
-  int width;
-  int height;
-  int row;
-  int column;
-  int row_stride;
-  const guchar *pixels, *p;
-  guchar r, g, b, a;
-  guint64 dividend;
-  guint64 a_total, r_total, g_total, b_total;
-  gdouble dd;
-
-  width = gdk_pixbuf_get_width(pixbuf);
-  height = gdk_pixbuf_get_height(pixbuf);
-  row_stride = gdk_pixbuf_get_rowstride(pixbuf);
-  pixels = gdk_pixbuf_get_pixels(pixbuf);
-
-  /* iterate through the pixbuf, counting up each component */
-  a_total = 0;
-  r_total = 0;
-  g_total = 0;
-  b_total = 0;
-
-  if (gdk_pixbuf_get_has_alpha(pixbuf)) {
-    for (row = 0; row < height; row++) {
-      p = pixels + (row * row_stride);
-      for (column = 0; column < width; column++) {
-        r = *p++;
-        g = *p++;
-        b = *p++;
-        a = *p++;
-
-        a_total += a;
-        r_total += r * a;
-        g_total += g * a;
-        b_total += b * a;
-      }
-    }
-    dividend = ((guint64)(height * width)) * UCHAR_MAX;
-    a_total *= UCHAR_MAX;
-  } else {
-    for (row = 0; row < height; row++) {
-      p = pixels + (row * row_stride);
-      for (column = 0; column < width; column++) {
-        r = *p++;
-        g = *p++;
-        b = *p++;
-
-        r_total += r;
-        g_total += g;
-        b_total += b;
-      }
-    }
-    dividend = (guint64)(height * width);
-    a_total = dividend * UCHAR_MAX;
-  }
-
-  dd = ((gdouble)dividend) * 255.0;
-  result->alpha = ((gdouble)a_total) / dd;
-  result->red = ((gdouble)r_total) / dd;
-  result->green = ((gdouble)g_total) / dd;
-  result->blue = ((gdouble)b_total) / dd;
-}
-
 static GdkPixbuf *pixbuf_scale_to_fit(GdkPixbuf *src, int max_width,
                                       int max_height) {
   double factor;
@@ -2209,29 +4795,51 @@ static void pixbuf_draw_gradient(GdkPixbuf *pixbuf, gboolean horizontal,
     }
     g_free(gradient);
   } else {
-    guchar *gb, *gradient;
+    guchar *gradient;
     int i;
 
     gradient = create_gradient(primary, secondary, height);
-    for (i = 0; i < height; i++) {
-      int j;
-      guchar *d;
-
-      d = dst + rowstride * i;
-      gb = gradient + n_channels * i;
-      for (j = width; j > 0; j--) {
-        int k;
-
-        for (k = 0; k < n_channels; k++) {
-          *(d++) = gb[k];
-        }
-      }
-    }
+    for (i = 0; i < height; i++)
+      _mate_bg_pixels_fill_rgb(dst + rowstride * i, width,
+                               gradient + n_channels * i);
 
     g_free(gradient);
   }
 }
 
+/* gdk_pixbuf_composite() without scaling is a row by row blend, as long as
+ * the destination has no alpha and the source rectangle lies within @src
+ * (gdk-pixbuf would repeat the edge pixels otherwise) */
+static gboolean can_composite_rows(GdkPixbuf *src, GdkPixbuf *dest, int src_x,
+                                   int src_y, int width, int height) {
+  return gdk_pixbuf_get_n_channels(dest) == 3 &&
+         !gdk_pixbuf_get_has_alpha(dest) &&
+         gdk_pixbuf_get_bits_per_sample(src) == 8 &&
+         gdk_pixbuf_get_bits_per_sample(dest) == 8 && src_x >= 0 &&
+         src_y >= 0 && src_x + width <= gdk_pixbuf_get_width(src) &&
+         src_y + height <= gdk_pixbuf_get_height(src);
+}
+
+static void composite_rows(GdkPixbuf *src, GdkPixbuf *dest, int src_x,
+                           int src_y, int width, int height, int dest_x,
+                           int dest_y, guint alpha) {
+  int src_channels = gdk_pixbuf_get_n_channels(src);
+  int src_stride = gdk_pixbuf_get_rowstride(src);
+  int dest_stride = gdk_pixbuf_get_rowstride(dest);
+  const guchar *s;
+  guchar *d;
+  int y;
+
+  s = gdk_pixbuf_read_pixels(src) + (gsize)src_y * src_stride +
+      src_x * src_channels;
+  d = gdk_pixbuf_get_pixels(dest) + (gsize)dest_y * dest_stride + dest_x * 3;
+
+  for (y = 0; y < height; y++)
+    _mate_bg_pixels_composite_row(d + (gsize)y * dest_stride,
+                                  s + (gsize)y * src_stride, src_channels,
+                                  width, alpha);
+}
+
 static void pixbuf_blend(GdkPixbuf *src, GdkPixbuf *dest, int src_x, int src_y,
                          int src_width, int src_height, int dest_x, int dest_y,
                          double alpha) {
@@ -2254,6 +4862,14 @@ static void pixbuf_blend(GdkPixbuf *src, GdkPixbuf *dest, int src_x, int src_y,
     src_height = dest_height - dest_y;
   }
 
+  if (can_composite_rows(src, dest, dest_x - offset_x, dest_y - offset_y,
+                         src_width, src_height)) {
+    composite_rows(src, dest, dest_x - offset_x, dest_y - offset_y,
+                   src_width, src_height, dest_x, dest_y,
+                   (guint)(alpha * 255.0));
+    return;
+  }
+
   gdk_pixbuf_composite(src, dest, dest_x, dest_y, src_width, src_height,
                        (double)offset_x, (double)offset_y, 1.0, 1.0,
                        GDK_INTERP_NEAREST, (int)(alpha * 255.0));
@@ -2268,6 +4884,18 @@ static void pixbuf_tile(GdkPixbuf *src, GdkPixbuf *dest) {
   tile_width = gdk_pixbuf_get_width(src);
   tile_height = gdk_pixbuf_get_height(src);
 
+  /* one composite call per row instead of one per tile */
+  if (can_composite_rows(src, dest, 0, 0, tile_width, tile_height)) {
+    for (y = 0; y < dest_height; y++) {
+      int src_y = y % tile_height;
+
+      for (x = 0; x < dest_width; x += tile_width)
+        composite_rows(src, dest, 0, src_y, MIN(tile_width, dest_width - x),
+                       1, x, y, 255);
+    }
+    return;
+  }
+
   for (y = 0; y < dest_height; y += tile_height) {
     for (x = 0; x < dest_width; x += tile_width) {
       pixbuf_blend(src, dest, 0, 0, tile_width, tile_height, x, y, 1.0);
@@ -103,12 +103,20 @@ void mate_bg_set_placement(MateBG *bg, MateBGPlacement placement);
 void mate_bg_set_color(MateBG *bg, MateBGColorType type, GdkRGBA *primary,
                        GdkRGBA *secondary);
 void mate_bg_set_draw_background(MateBG *bg, gboolean draw_background);
+void mate_bg_set_draw_threads(MateBG *bg, guint n_threads);
+void mate_bg_set_transition_frames(MateBG *bg, guint n_frames);
+void mate_bg_set_cache_budget(MateBG *bg, gsize n_bytes);
 /* Getters */
 gboolean mate_bg_get_draw_background(MateBG *bg);
 MateBGPlacement mate_bg_get_placement(MateBG *bg);
 void mate_bg_get_color(MateBG *bg, MateBGColorType *type, GdkRGBA *primary,
                        GdkRGBA *secondary);
 const gchar *mate_bg_get_filename(MateBG *bg);
+guint mate_bg_get_draw_threads(MateBG *bg);
+guint mate_bg_get_transition_frames(MateBG *bg);
+gsize mate_bg_get_cache_budget(MateBG *bg);
+void mate_bg_get_cache_stats(MateBG *bg, guint *hits, guint *misses,
+                             gsize *n_bytes);
 
 /* Drawing and thumbnailing */
 void mate_bg_draw(MateBG *bg, GdkPixbuf *dest, GdkScreen *screen,
@@ -121,6 +129,14 @@ cairo_surface_t *mate_bg_create_surface_scale(MateBG *bg, GdkWindow *window,
                                               int width, int height, int scale,
                                               gboolean root);
 
+void mate_bg_create_surface_async(MateBG *bg, GdkWindow *window, int width,
+                                  int height, int scale, gboolean root,
+                                  GCancellable *cancellable,
+                                  GAsyncReadyCallback callback,
+                                  gpointer user_data);
+cairo_surface_t *mate_bg_create_surface_finish(MateBG *bg, GAsyncResult *result,
+                                               GError **error);
+
 gboolean mate_bg_get_image_size(MateBG *bg,
                                 MateDesktopThumbnailFactory *factory,
                                 int best_width, int best_height, int *width,
@@ -130,6 +146,10 @@ GdkPixbuf *mate_bg_create_thumbnail(MateBG *bg,
                                     GdkScreen *screen, int dest_width,
                                     int dest_height);
 gboolean mate_bg_is_dark(MateBG *bg, int dest_width, int dest_height);
+gboolean mate_bg_is_dark_for_area(MateBG *bg, int dest_width, int dest_height,
+                                  const GdkRectangle *area);
+gboolean mate_bg_get_luminance(MateBG *bg, int dest_width, int dest_height,
+                               gdouble *mean, gdouble *variance);
 gboolean mate_bg_has_multiple_sizes(MateBG *bg);
 gboolean mate_bg_changes_with_time(MateBG *bg);
 GdkPixbuf *mate_bg_create_frame_thumbnail(MateBG *bg,
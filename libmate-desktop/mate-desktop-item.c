@@ -61,6 +61,115 @@
 
 #include "private.h"
 
+/*
+ * A key table is one array with open addressing and linear probing.  The
+ * keys and values it points to belong to the item: see replace_value().
+ */
+
+typedef struct {
+  const char *key; /* NULL for a free slot */
+  const char *value;
+} KeyValue;
+
+typedef struct {
+  KeyValue *slots;
+  guint n_slots; /* 0 or a power of two */
+  guint n_keys;
+} KeyTable;
+
+#define KEY_TABLE_MIN_SLOTS 16
+
+static guint key_table_slot(const KeyTable *table, const char *key) {
+  guint64 hash = (guint64)g_str_hash(key) *
+                 G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+
+  return (guint)(hash >> 32) & (table->n_slots - 1);
+}
+
+static KeyValue *key_table_find(const KeyTable *table, const char *key) {
+  guint i;
+
+  if (table->n_slots == 0 || key == NULL) return NULL;
+
+  for (i = key_table_slot(table, key); table->slots[i].key != NULL;
+       i = (i + 1) & (table->n_slots - 1)) {
+    if (strcmp(table->slots[i].key, key) == 0) return &table->slots[i];
+  }
+
+  return NULL;
+}
+
+static const char *key_table_lookup(const KeyTable *table, const char *key) {
+  KeyValue *slot = key_table_find(table, key);
+
+  return slot != NULL ? slot->value : NULL;
+}
+
+static void key_table_insert(KeyTable *table, const char *key,
+                             const char *value) {
+  guint i;
+
+  /* keep at least a quarter of the slots free */
+  if ((table->n_keys + 1) * 4 > table->n_slots * 3) {
+    KeyValue *old_slots = table->slots;
+    guint old_n_slots = table->n_slots;
+
+    table->n_slots = MAX(old_n_slots * 2, KEY_TABLE_MIN_SLOTS);
+    table->slots = g_new0(KeyValue, table->n_slots);
+    table->n_keys = 0;
+
+    for (i = 0; i < old_n_slots; i++) {
+      if (old_slots[i].key != NULL)
+        key_table_insert(table, old_slots[i].key, old_slots[i].value);
+    }
+    g_free(old_slots);
+  }
+
+  for (i = key_table_slot(table, key); table->slots[i].key != NULL;
+       i = (i + 1) & (table->n_slots - 1)) {
+    if (strcmp(table->slots[i].key, key) == 0) {
+      table->slots[i].value = value;
+      return;
+    }
+  }
+
+  table->slots[i].key = key;
+  table->slots[i].value = value;
+  table->n_keys++;
+}
+
+static void key_table_remove(KeyTable *table, const char *key) {
+  KeyValue *slot = key_table_find(table, key);
+  guint mask = table->n_slots - 1;
+  guint hole, i;
+
+  if (slot == NULL) return;
+
+  /* move later keys of the run back, so that no probe stops early */
+  hole = (guint)(slot - table->slots);
+  for (i = (hole + 1) & mask; table->slots[i].key != NULL;
+       i = (i + 1) & mask) {
+    guint home = key_table_slot(table, table->slots[i].key);
+
+    /* unless its probe starts between the hole and here */
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      table->slots[hole] = table->slots[i];
+      hole = i;
+    }
+  }
+
+  table->slots[hole].key = NULL;
+  table->slots[hole].value = NULL;
+  table->n_keys--;
+}
+
+static void key_table_clear(KeyTable *table) {
+  g_free(table->slots);
+  table->slots = NULL;
+  table->n_slots = 0;
+  table->n_keys = 0;
+}
+
 struct _MateDesktopItem {
   int refcount;
 
@@ -80,7 +189,14 @@ struct _MateDesktopItem {
 
   /* This includes ALL keys, including
    * other sections, separated by '/' */
-  GHashTable *main_hash;
+  KeyTable main_table;
+
+  /* The keys, and the values of the file, which stay until the item is
+   * freed */
+  GStringChunk *strings;
+
+  /* The values set since, freed when replaced */
+  GHashTable *set_values;
 
   char *location;
 
@@ -93,6 +209,62 @@ struct _MateDesktopItem {
  * this is to be used internally only. */
 #define DONT_UPDATE_MTIME ((gint64)-2)
 
+/* The first block of the strings arena of an item */
+#define ITEM_STRINGS_SIZE 2048
+
+/* Returns the copy of @key owned by the item, which is the same for equal
+ * keys, so that the key lists and the table share it */
+static const char *item_key(MateDesktopItem *item, const char *key) {
+  return g_string_chunk_insert_const(item->strings, key);
+}
+
+static void release_value(MateDesktopItem *item, const char *value) {
+  if (item->set_values != NULL && value != NULL)
+    g_hash_table_remove(item->set_values, value);
+}
+
+static void store_value(MateDesktopItem *item, const char *key,
+                        const char *value) {
+  KeyValue *slot = key_table_find(&item->main_table, key);
+
+  if (slot != NULL) {
+    release_value(item, slot->value);
+    slot->value = value;
+  } else {
+    key_table_insert(&item->main_table, item_key(item, key), value);
+  }
+}
+
+/* Values read from a file go to the strings arena, which is cheap to fill
+ * and free at once.  Values set afterwards get their own allocation and are
+ * freed once replaced, so that setting a key over and over doesn't grow the
+ * item: see set_value(). */
+static void replace_value(MateDesktopItem *item, const char *key,
+                          const char *value) {
+  store_value(item, key, g_string_chunk_insert(item->strings, value));
+}
+
+static void set_value(MateDesktopItem *item, const char *key,
+                      const char *value) {
+  /* copied first, as @value may be the one it replaces */
+  char *copy = g_strdup(value);
+
+  if (item->set_values == NULL)
+    item->set_values = g_hash_table_new_full(NULL, NULL, g_free, NULL);
+  g_hash_table_add(item->set_values, copy);
+
+  store_value(item, key, copy);
+}
+
+static void remove_value(MateDesktopItem *item, const char *key) {
+  KeyValue *slot = key_table_find(&item->main_table, key);
+
+  if (slot == NULL) return;
+
+  release_value(item, slot->value);
+  key_table_remove(&item->main_table, key);
+}
+
 typedef struct {
   char *name;
   GList *keys;
@@ -105,19 +277,16 @@ typedef enum {
 } Encoding;
 
 /*
- * IO reading utils, that look like the libc buffered io stuff
+ * IO reading utils.  The whole file is mapped (or, for non-local files,
+ * read in one go) so that it can be parsed in a single pass over
+ * contiguous memory.
  */
 
-#define READ_BUF_SIZE (32 * 1024)
-
 typedef struct {
-  GFile *file;
-  GFileInputStream *stream;
   char *uri;
-  char *buf;
-  gboolean buf_needs_free;
-  gboolean past_first_read;
-  gboolean eof;
+  GMappedFile *mapped;
+  char *contents;
+  const char *data;
   gsize size;
   gsize pos;
 } ReadBuf;
@@ -133,88 +302,58 @@ static void mate_desktop_item_set_location_gfile(MateDesktopItem *item,
 static MateDesktopItem *mate_desktop_item_new_from_gfile(
     GFile *file, MateDesktopItemLoadFlags flags, GError **error);
 
-static int readbuf_getc(ReadBuf *rb) {
-  if (rb->eof) return EOF;
-
-  if (rb->size == 0 || rb->size == rb->pos) {
-    gssize bytes_read;
-
-    if (rb->stream == NULL)
-      bytes_read = 0;
-    else
-      bytes_read = g_input_stream_read(G_INPUT_STREAM(rb->stream), rb->buf,
-                                       READ_BUF_SIZE, NULL, NULL);
-
-    /* FIXME: handle errors other than EOF */
-    if (bytes_read <= 0) {
-      rb->eof = TRUE;
-      return EOF;
-    }
-
-    if (rb->size != 0) rb->past_first_read = TRUE;
-    rb->size = (gsize)bytes_read;
-    rb->pos = 0;
-  }
-
-  return (guchar)rb->buf[rb->pos++];
-}
-
 /* Note, does not include the trailing \n */
-static char *readbuf_gets(char *buf, gsize bufsize, ReadBuf *rb) {
-  int c;
-  gsize pos;
-
-  g_return_val_if_fail(buf != NULL, NULL);
-  g_return_val_if_fail(rb != NULL, NULL);
+static gboolean readbuf_next_line(ReadBuf *rb, const char **line,
+                                  gsize *length) {
+  const char *eol;
 
-  pos = 0;
-  buf[0] = '\0';
+  if (rb->pos >= rb->size) return FALSE;
 
-  do {
-    c = readbuf_getc(rb);
-    if (c == EOF || c == '\n') break;
-    buf[pos++] = c;
-  } while (pos < bufsize - 1);
-
-  if (c == EOF && pos == 0) return NULL;
-
-  buf[pos++] = '\0';
+  *line = rb->data + rb->pos;
+  eol = memchr(*line, '\n', rb->size - rb->pos);
+  *length = eol != NULL ? (gsize)(eol - *line) : rb->size - rb->pos;
+  rb->pos += *length + 1;
 
-  return buf;
+  return TRUE;
 }
 
 static ReadBuf *readbuf_open(GFile *file, GError **error) {
   GError *local_error;
-  GFileInputStream *stream;
-  char *uri;
+  char *path;
   ReadBuf *rb;
 
   g_return_val_if_fail(file != NULL, NULL);
 
-  uri = g_file_get_uri(file);
-  local_error = NULL;
-  stream = g_file_read(file, NULL, &local_error);
+  rb = g_new0(ReadBuf, 1);
+  rb->uri = g_file_get_uri(file);
 
-  if (stream == NULL) {
+  path = g_file_get_path(file);
+  if (path != NULL) {
+    rb->mapped = g_mapped_file_new(path, FALSE, NULL);
+    g_free(path);
+  }
+
+  if (rb->mapped != NULL) {
+    rb->data = g_mapped_file_get_contents(rb->mapped);
+    rb->size = g_mapped_file_get_length(rb->mapped);
+    return rb;
+  }
+
+  /* not a local file, or one that can't be mapped */
+  local_error = NULL;
+  if (!g_file_load_contents(file, NULL, &rb->contents, &rb->size, NULL,
+                            &local_error)) {
     g_set_error(error,
                 /* FIXME: better errors */
                 MATE_DESKTOP_ITEM_ERROR, MATE_DESKTOP_ITEM_ERROR_CANNOT_OPEN,
-                _("Error reading file '%s': %s"), uri, local_error->message);
+                _("Error reading file '%s': %s"), rb->uri,
+                local_error->message);
     g_error_free(local_error);
-    g_free(uri);
+    g_free(rb->uri);
+    g_free(rb);
     return NULL;
   }
-
-  rb = g_new0(ReadBuf, 1);
-  rb->stream = stream;
-  rb->file = g_file_dup(file);
-  rb->uri = uri;
-  rb->buf = g_malloc(READ_BUF_SIZE);
-  rb->buf_needs_free = TRUE;
-  /* rb->past_first_read = FALSE; */
-  /* rb->eof = FALSE; */
-  /* rb->size = 0; */
-  /* rb->pos = 0; */
+  rb->data = rb->contents;
 
   return rb;
 }
@@ -224,56 +363,19 @@ static ReadBuf *readbuf_new_from_string(const char *uri, const char *string,
   ReadBuf *rb;
 
   g_return_val_if_fail(string != NULL, NULL);
-  g_return_val_if_fail(length >= 0, NULL);
 
   rb = g_new0(ReadBuf, 1);
-  /* rb->file = NULL; */
-  /* rb->stream = NULL; */
   rb->uri = g_strdup(uri);
-  rb->buf = (char *)string;
-  /* rb->buf_needs_free = FALSE; */
-  /* rb->past_first_read = FALSE; */
-  /* rb->eof = FALSE; */
+  rb->data = string;
   rb->size = length;
-  /* rb->pos = 0; */
 
   return rb;
 }
 
-static gboolean readbuf_rewind(ReadBuf *rb, GError **error) {
-  GError *local_error;
-
-  rb->eof = FALSE;
-  rb->pos = 0;
-
-  if (!rb->past_first_read) return TRUE;
-
-  rb->size = 0;
-
-  if (g_seekable_seek(G_SEEKABLE(rb->stream), 0, G_SEEK_SET, NULL, NULL))
-    return TRUE;
-
-  g_object_unref(rb->stream);
-  local_error = NULL;
-  rb->stream = g_file_read(rb->file, NULL, &local_error);
-
-  if (rb->stream == NULL) {
-    g_set_error(
-        error, MATE_DESKTOP_ITEM_ERROR, MATE_DESKTOP_ITEM_ERROR_CANNOT_OPEN,
-        _("Error rewinding file '%s': %s"), rb->uri, local_error->message);
-    g_error_free(local_error);
-
-    return FALSE;
-  }
-
-  return TRUE;
-}
-
 static void readbuf_close(ReadBuf *rb) {
-  if (rb->stream != NULL) g_object_unref(rb->stream);
-  if (rb->file != NULL) g_object_unref(rb->file);
+  if (rb->mapped != NULL) g_mapped_file_unref(rb->mapped);
+  g_free(rb->contents);
   g_free(rb->uri);
-  if (rb->buf_needs_free) g_free(rb->buf);
   g_free(rb);
 }
 
@@ -328,8 +430,7 @@ MateDesktopItem *mate_desktop_item_new(void) {
 
   retval->refcount++;
 
-  retval->main_hash = g_hash_table_new_full(
-      g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
+  retval->strings = g_string_chunk_new(ITEM_STRINGS_SIZE);
 
   /* These are guaranteed to be set */
   mate_desktop_item_set_string(retval, MATE_DESKTOP_ITEM_NAME,
@@ -345,22 +446,23 @@ MateDesktopItem *mate_desktop_item_new(void) {
   return retval;
 }
 
-static Section *dup_section(Section *sec) {
-  GList *li;
-  Section *retval = g_new0(Section, 1);
-
-  retval->name = g_strdup(sec->name);
+/* Copies the key list, the keys going to the strings of @item */
+static GList *copy_keys(MateDesktopItem *item, GList *keys) {
+  GList *retval = g_list_copy(keys), *li;
 
-  retval->keys = g_list_copy(sec->keys);
-  for (li = retval->keys; li != NULL; li = li->next)
-    li->data = g_strdup(li->data);
+  for (li = retval; li != NULL; li = li->next)
+    li->data = (char *)item_key(item, li->data);
 
   return retval;
 }
 
-static void copy_string_hash(gpointer key, gpointer value, gpointer user_data) {
-  GHashTable *copy = user_data;
-  g_hash_table_replace(copy, g_strdup(key), g_strdup(value));
+static Section *dup_section(MateDesktopItem *item, Section *sec) {
+  Section *retval = g_new0(Section, 1);
+
+  retval->name = g_strdup(sec->name);
+  retval->keys = copy_keys(item, sec->keys);
+
+  return retval;
 }
 
 /**
@@ -375,6 +477,7 @@ static void copy_string_hash(gpointer key, gpointer value, gpointer user_data) {
 MateDesktopItem *mate_desktop_item_copy(const MateDesktopItem *item) {
   GList *li;
   MateDesktopItem *retval;
+  guint i;
 
   g_return_val_if_fail(item != NULL, NULL);
   g_return_val_if_fail(item->refcount > 0, NULL);
@@ -393,26 +496,30 @@ MateDesktopItem *mate_desktop_item_copy(const MateDesktopItem *item) {
     li->data = g_strdup(li->data);
 
   /* Keys */
-  retval->keys = g_list_copy(item->keys);
-  for (li = retval->keys; li != NULL; li = li->next)
-    li->data = g_strdup(li->data);
+  g_list_free(retval->keys);
+  retval->keys = copy_keys(retval, item->keys);
 
   /* Sections */
   retval->sections = g_list_copy(item->sections);
   for (li = retval->sections; li != NULL; li = li->next)
-    li->data = dup_section(li->data);
+    li->data = dup_section(retval, li->data);
 
-  retval->main_hash = g_hash_table_new_full(
-      g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
+  key_table_clear(&retval->main_table);
+  g_clear_pointer(&retval->set_values, g_hash_table_destroy);
+  for (i = 0; i < item->main_table.n_slots; i++) {
+    const KeyValue *slot = &item->main_table.slots[i];
 
-  g_hash_table_foreach(item->main_hash, copy_string_hash, retval->main_hash);
+    if (slot->key != NULL)
+      replace_value(retval, slot->key, slot->value);
+  }
 
   return retval;
 }
 
 static void read_sort_order(MateDesktopItem *item, GFile *dir) {
   GFile *child;
-  char buf[BUFSIZ];
+  const char *line;
+  gsize length;
   GString *str;
   ReadBuf *rb;
 
@@ -424,11 +531,9 @@ static void read_sort_order(MateDesktopItem *item, GFile *dir) {
   if (rb == NULL) return;
 
   str = NULL;
-  while (readbuf_gets(buf, sizeof(buf), rb) != NULL) {
-    if (str == NULL)
-      str = g_string_new(buf);
-    else
-      g_string_append(str, buf);
+  while (readbuf_next_line(rb, &line, &length)) {
+    if (str == NULL) str = g_string_new(NULL);
+    g_string_append_len(str, line, length);
     g_string_append_c(str, ';');
   }
   readbuf_close(rb);
@@ -501,7 +606,492 @@ MateDesktopItem *mate_desktop_item_new_from_uri(const char *uri,
   retval = mate_desktop_item_new_from_gfile(file, flags, error);
   g_object_unref(file);
 
-  return retval;
+  return retval;
+}
+
+/*
+ * Parsed items of the desktop files in the data dirs, cached across
+ * processes.  There is a file per directory, named after the checksum of
+ * its path: a GVariant of ITEM_CACHE_TYPE with the version, the directory,
+ * its modification time and an entry per file, sorted by name, with the
+ * file's modification time and size and the parsed item.  The files are
+ * mapped, so processes share the pages and a hit doesn't parse anything.
+ * When a file changes, only that file is parsed again and the entries of
+ * the others are copied over.
+ */
+#define ITEM_CACHE_DIR "mate/desktop-entries"
+#define ITEM_CACHE_VERSION 1
+#define ITEM_CACHE_ENTRY_TYPE "(sxtuasasa(sas)a(ss))"
+#define ITEM_CACHE_TYPE "(usxa" ITEM_CACHE_ENTRY_TYPE ")"
+
+G_LOCK_DEFINE_STATIC(item_caches);
+static GHashTable *item_caches = NULL;
+static GHashTable *item_caches_updating = NULL; /* directories */
+
+/* The modification time in microseconds, or 0 if it can't be read */
+static gint64 query_mtime_and_size(GFile *file, guint64 *size) {
+  GFileInfo *info;
+  gint64 mtime;
+
+  info = g_file_query_info(file,
+                           G_FILE_ATTRIBUTE_TIME_MODIFIED
+                           "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+                           "," G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                           G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (info == NULL) return 0;
+
+  mtime = (gint64)g_file_info_get_attribute_uint64(
+              info, G_FILE_ATTRIBUTE_TIME_MODIFIED) *
+              G_USEC_PER_SEC +
+          g_file_info_get_attribute_uint32(info,
+                                           G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  if (size != NULL) *size = (guint64)g_file_info_get_size(info);
+  g_object_unref(info);
+
+  return mtime;
+}
+
+static gboolean is_in_dir(const char *dir_name, const char *parent) {
+  gsize length = strlen(parent);
+
+  return length > 0 && strncmp(dir_name, parent, length) == 0 &&
+         (dir_name[length] == G_DIR_SEPARATOR ||
+          parent[length - 1] == G_DIR_SEPARATOR);
+}
+
+static gboolean is_in_data_dir(const char *dir_name) {
+  const char *const *system_data_dirs;
+  int i;
+
+  if (is_in_dir(dir_name, g_get_user_data_dir())) return TRUE;
+
+  system_data_dirs = g_get_system_data_dirs();
+  for (i = 0; system_data_dirs[i]; i++) {
+    if (is_in_dir(dir_name, system_data_dirs[i])) return TRUE;
+  }
+
+  return FALSE;
+}
+
+static char *item_cache_path(const char *dir_name) {
+  char *checksum, *name, *path;
+
+  checksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, dir_name, -1);
+  name = g_strconcat(checksum, ".cache", NULL);
+  path = g_build_filename(g_get_user_cache_dir(), ITEM_CACHE_DIR, name, NULL);
+  g_free(name);
+  g_free(checksum);
+
+  return path;
+}
+
+static GVariant *load_item_cache(const char *dir_name) {
+  GMappedFile *mapped;
+  GVariant *cache;
+  GBytes *bytes;
+  guint32 version;
+  const char *cached_dir;
+  char *path;
+
+  path = item_cache_path(dir_name);
+  mapped = g_mapped_file_new(path, FALSE, NULL);
+  g_free(path);
+
+  if (!mapped) return NULL;
+
+  /* untrusted, so GVariant checks every access against the file size */
+  bytes = g_mapped_file_get_bytes(mapped);
+  g_mapped_file_unref(mapped);
+  cache = g_variant_ref_sink(g_variant_new_from_bytes(
+      G_VARIANT_TYPE(ITEM_CACHE_TYPE), bytes, FALSE));
+  g_bytes_unref(bytes);
+
+  g_variant_get_child(cache, 0, "u", &version);
+  g_variant_get_child(cache, 1, "&s", &cached_dir);
+
+  if (version != ITEM_CACHE_VERSION || strcmp(cached_dir, dir_name) != 0) {
+    g_variant_unref(cache);
+    return NULL;
+  }
+
+  return cache;
+}
+
+static GVariant *list_to_variant(GList *list) {
+  GVariantBuilder builder;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE_STRING_ARRAY);
+  for (; list != NULL; list = list->next)
+    g_variant_builder_add(&builder, "s", list->data);
+
+  return g_variant_builder_end(&builder);
+}
+
+static GVariant *item_cache_entry_new(const char *name, gint64 mtime,
+                                      guint64 size, MateDesktopItem *item) {
+  GVariantBuilder sections, values;
+  GList *li;
+  guint i;
+
+  g_variant_builder_init(&sections, G_VARIANT_TYPE("a(sas)"));
+  for (li = item->sections; li != NULL; li = li->next) {
+    Section *section = li->data;
+
+    g_variant_builder_add(&sections, "(s@as)", section->name,
+                          list_to_variant(section->keys));
+  }
+
+  g_variant_builder_init(&values, G_VARIANT_TYPE("a(ss)"));
+  for (i = 0; i < item->main_table.n_slots; i++) {
+    const KeyValue *slot = &item->main_table.slots[i];
+
+    if (slot->key != NULL)
+      g_variant_builder_add(&values, "(ss)", slot->key, slot->value);
+  }
+
+  return g_variant_new("(sxtu@as@asa(sas)a(ss))", name, mtime, size,
+                       (guint32)item->type, list_to_variant(item->languages),
+                       list_to_variant(item->keys), &sections, &values);
+}
+
+/* Returns the strings as a list, in the strings of @item if given, or else
+ * as copies */
+static GList *list_from_variant(GVariant *strings, MateDesktopItem *item) {
+  GVariantIter iter;
+  const char *string;
+  GList *list = NULL;
+
+  g_variant_iter_init(&iter, strings);
+  while (g_variant_iter_next(&iter, "&s", &string))
+    list = g_list_prepend(list, item != NULL ? (char *)item_key(item, string)
+                                             : g_strdup(string));
+
+  return g_list_reverse(list);
+}
+
+static MateDesktopItem *item_from_cache_entry(GVariant *entry) {
+  MateDesktopItem *item;
+  GVariantIter *sections, *values;
+  GVariant *languages, *keys, *section_keys;
+  const char *name, *key, *value;
+  guint32 type;
+
+  g_variant_get(entry, "(&sxtu@as@asa(sas)a(ss))", NULL, NULL, NULL, &type,
+                &languages, &keys, &sections, &values);
+
+  _mate_desktop_init_i18n();
+
+  item = g_new0(MateDesktopItem, 1);
+  item->refcount = 1;
+  item->type = type;
+  item->strings = g_string_chunk_new(ITEM_STRINGS_SIZE);
+  item->languages = list_from_variant(languages, NULL);
+  item->keys = list_from_variant(keys, item);
+
+  while (g_variant_iter_next(sections, "(&s@as)", &name, &section_keys)) {
+    Section *section = g_new0(Section, 1);
+
+    section->name = g_strdup(name);
+    section->keys = list_from_variant(section_keys, item);
+    item->sections = g_list_prepend(item->sections, section);
+    g_variant_unref(section_keys);
+  }
+  item->sections = g_list_reverse(item->sections);
+
+  while (g_variant_iter_next(values, "(&s&s)", &key, &value))
+    replace_value(item, key, value);
+
+  g_variant_iter_free(sections);
+  g_variant_iter_free(values);
+  g_variant_unref(keys);
+  g_variant_unref(languages);
+
+  return item;
+}
+
+static int compare_names(gconstpointer a, gconstpointer b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* Looks the file up by binary search, and checks that it is current */
+static GVariant *find_item_cache_entry(GVariant *cache, const char *name,
+                                       gint64 mtime, guint64 size,
+                                       gboolean *stale) {
+  GVariant *entries;
+  GVariant *found = NULL;
+  gsize low, high;
+
+  entries = g_variant_get_child_value(cache, 3);
+  low = 0;
+  high = g_variant_n_children(entries);
+
+  while (low < high && found == NULL) {
+    gsize middle = low + (high - low) / 2;
+    GVariant *entry = g_variant_get_child_value(entries, middle);
+    const char *entry_name;
+    guint64 entry_size;
+    gint64 entry_mtime;
+    int cmp;
+
+    g_variant_get_child(entry, 0, "&s", &entry_name);
+    cmp = strcmp(name, entry_name);
+
+    if (cmp == 0) {
+      g_variant_get_child(entry, 1, "x", &entry_mtime);
+      g_variant_get_child(entry, 2, "t", &entry_size);
+
+      if (entry_mtime == mtime && entry_size == size)
+        found = g_variant_ref(entry);
+      else
+        *stale = TRUE;
+      g_variant_unref(entry);
+      break;
+    }
+
+    g_variant_unref(entry);
+    if (cmp < 0)
+      high = middle;
+    else
+      low = middle + 1;
+  }
+
+  g_variant_unref(entries);
+
+  return found;
+}
+
+/* Parses the desktop files in the directory, except those @old, if not
+ * NULL, still has current entries for */
+static GVariant *build_item_cache(const char *dir_name, GVariant *old) {
+  GVariantBuilder builder;
+  GPtrArray *names;
+  const char *name;
+  GFile *dir_file;
+  gint64 dir_mtime;
+  GDir *dir;
+  guint i;
+
+  /* anything that changes from here on makes the cache stale */
+  dir_file = g_file_new_for_path(dir_name);
+  dir_mtime = query_mtime_and_size(dir_file, NULL);
+  g_object_unref(dir_file);
+
+  dir = g_dir_open(dir_name, 0, NULL);
+  if (dir == NULL) return NULL;
+
+  names = g_ptr_array_new_with_free_func(g_free);
+  while ((name = g_dir_read_name(dir))) {
+    if (g_str_has_suffix(name, ".desktop") || strcmp(name, ".directory") == 0)
+      g_ptr_array_add(names, g_strdup(name));
+  }
+  g_dir_close(dir);
+
+  /* sorted, so that entries can be found without an index */
+  g_ptr_array_sort(names, compare_names);
+
+  g_variant_builder_init(&builder,
+                         G_VARIANT_TYPE("a" ITEM_CACHE_ENTRY_TYPE));
+  for (i = 0; i < names->len; i++) {
+    const char *name = g_ptr_array_index(names, i);
+    MateDesktopItem *item;
+    GVariant *entry;
+    GFile *file;
+    ReadBuf *rb;
+    guint64 size = 0;
+    gboolean stale = FALSE;
+    gint64 mtime;
+    char *path;
+
+    path = g_build_filename(dir_name, name, NULL);
+    file = g_file_new_for_path(path);
+    g_free(path);
+
+    mtime = query_mtime_and_size(file, &size);
+    if (mtime == 0) {
+      g_object_unref(file);
+      continue;
+    }
+
+    if (old != NULL &&
+        (entry = find_item_cache_entry(old, name, mtime, size, &stale))) {
+      g_variant_builder_add_value(&builder, entry);
+      g_variant_unref(entry);
+      g_object_unref(file);
+      continue;
+    }
+
+    rb = readbuf_open(file, NULL);
+    g_object_unref(file);
+    if (rb == NULL) continue;
+
+    if ((item = ditem_load(rb, FALSE, NULL)) == NULL) continue;
+
+    g_variant_builder_add_value(&builder,
+                                item_cache_entry_new(name, mtime, size, item));
+    mate_desktop_item_unref(item);
+  }
+  g_ptr_array_unref(names);
+
+  return g_variant_ref_sink(g_variant_new(ITEM_CACHE_TYPE, ITEM_CACHE_VERSION,
+                                          dir_name, dir_mtime, &builder));
+}
+
+/* Returns the mapped copy of the cache if it could be saved */
+static GVariant *save_item_cache(const char *dir_name, GVariant *cache) {
+  GVariant *saved = NULL;
+  char *path, *dir;
+
+  path = item_cache_path(dir_name);
+  dir = g_path_get_dirname(path);
+
+  /* written to a new file and renamed, so mappings stay valid */
+  if (g_mkdir_with_parents(dir, 0700) == 0 &&
+      g_file_set_contents(path, g_variant_get_data(cache),
+                          g_variant_get_size(cache), NULL))
+    saved = load_item_cache(dir_name);
+
+  g_free(dir);
+  g_free(path);
+
+  return saved;
+}
+
+/* Whether files may have come or gone since the cache was built */
+static gboolean item_cache_is_outdated(GVariant *cache, const char *dir_name) {
+  GFile *dir_file;
+  gint64 cached_mtime, mtime;
+
+  g_variant_get_child(cache, 2, "x", &cached_mtime);
+
+  dir_file = g_file_new_for_path(dir_name);
+  mtime = query_mtime_and_size(dir_file, NULL);
+  g_object_unref(dir_file);
+
+  return mtime != cached_mtime;
+}
+
+static void share_item_cache(const char *dir_name, GVariant *cache) {
+  G_LOCK(item_caches);
+  g_hash_table_replace(item_caches, g_strdup(dir_name), g_variant_ref(cache));
+  G_UNLOCK(item_caches);
+}
+
+/* Brings the cache of the directory up to date, parsing only the files
+ * that changed since @old, and shares it with the other threads.  Only one
+ * thread does so at a time: the others get NULL and parse their own file
+ * meanwhile, instead of all parsing the whole directory at once. */
+static GVariant *update_item_cache(const char *dir_name, GVariant *old) {
+  GVariant *built, *cache = NULL;
+
+  G_LOCK(item_caches);
+  if (g_hash_table_contains(item_caches_updating, dir_name)) {
+    G_UNLOCK(item_caches);
+    return NULL;
+  }
+  g_hash_table_add(item_caches_updating, g_strdup(dir_name));
+  G_UNLOCK(item_caches);
+
+  /* the lock only guards the tables, so other directories aren't held up
+   * while this one is parsed and written */
+  if ((built = build_item_cache(dir_name, old)) != NULL) {
+    cache = save_item_cache(dir_name, built);
+    if (cache == NULL)
+      cache = built;
+    else
+      g_variant_unref(built);
+  }
+
+  G_LOCK(item_caches);
+  if (cache != NULL)
+    g_hash_table_replace(item_caches, g_strdup(dir_name),
+                         g_variant_ref(cache));
+  g_hash_table_remove(item_caches_updating, dir_name);
+  G_UNLOCK(item_caches);
+
+  return cache;
+}
+
+/* Returns the item of a desktop file in a data dir from the cache,
+ * bringing the cache up to date if needed, or NULL if it isn't cached */
+static MateDesktopItem *item_cache_lookup(GFile *file, gint64 mtime,
+                                          guint64 size) {
+  MateDesktopItem *item = NULL;
+  GVariant *cache, *entry = NULL;
+  gboolean stale = FALSE;
+  char *path, *dir_name, *name;
+
+  path = g_file_get_path(file);
+  if (path == NULL) return NULL;
+
+  dir_name = g_path_get_dirname(path);
+  name = g_path_get_basename(path);
+  g_free(path);
+
+  if (!is_in_data_dir(dir_name)) {
+    g_free(dir_name);
+    g_free(name);
+    return NULL;
+  }
+
+  G_LOCK(item_caches);
+
+  if (item_caches == NULL) {
+    item_caches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify)g_variant_unref);
+    item_caches_updating =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  }
+
+  cache = g_hash_table_lookup(item_caches, dir_name);
+  if (cache != NULL) g_variant_ref(cache);
+
+  G_UNLOCK(item_caches);
+
+  if (cache != NULL)
+    entry = find_item_cache_entry(cache, name, mtime, size, &stale);
+
+  /* a file that is missing from an up to date cache couldn't be parsed,
+   * so only look further if the cache may be out of date */
+  if (entry == NULL &&
+      (cache == NULL || stale || item_cache_is_outdated(cache, dir_name))) {
+    GVariant *loaded;
+    gboolean current = FALSE;
+
+    /* another process may have updated it already */
+    stale = FALSE;
+    if ((loaded = load_item_cache(dir_name)) != NULL) {
+      entry = find_item_cache_entry(loaded, name, mtime, size, &stale);
+      current = entry != NULL ||
+                (!stale && !item_cache_is_outdated(loaded, dir_name));
+      if (current) share_item_cache(dir_name, loaded);
+
+      if (cache != NULL) g_variant_unref(cache);
+      cache = loaded;
+    }
+
+    if (!current) {
+      GVariant *updated = update_item_cache(dir_name, cache);
+
+      if (cache != NULL) g_variant_unref(cache);
+      cache = updated;
+
+      stale = FALSE;
+      if (cache != NULL)
+        entry = find_item_cache_entry(cache, name, mtime, size, &stale);
+    }
+  }
+
+  if (cache != NULL) g_variant_unref(cache);
+
+  if (entry != NULL) {
+    item = item_from_cache_entry(entry);
+    g_variant_unref(entry);
+  }
+
+  g_free(dir_name);
+  g_free(name);
+
+  return item;
 }
 
 static MateDesktopItem *mate_desktop_item_new_from_gfile(
@@ -512,13 +1102,18 @@ static MateDesktopItem *mate_desktop_item_new_from_gfile(
   GFileType type;
   GFile *parent;
   guint64 mtime = 0;
+  guint64 size;
+  gint64 mtime_usec;
   ReadBuf *rb;
 
   g_return_val_if_fail(file != NULL, NULL);
 
-  info = g_file_query_info(
-      file, G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_TIME_MODIFIED,
-      G_FILE_QUERY_INFO_NONE, NULL, error);
+  info = g_file_query_info(file,
+                           G_FILE_ATTRIBUTE_STANDARD_TYPE
+                           "," G_FILE_ATTRIBUTE_STANDARD_SIZE
+                           "," G_FILE_ATTRIBUTE_TIME_MODIFIED
+                           "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                           G_FILE_QUERY_INFO_NONE, NULL, error);
   if (info == NULL) return NULL;
 
   type = g_file_info_get_file_type(info);
@@ -540,6 +1135,10 @@ static MateDesktopItem *mate_desktop_item_new_from_gfile(
 
   mtime =
       g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+  mtime_usec = (gint64)mtime * G_USEC_PER_SEC +
+               g_file_info_get_attribute_uint32(
+                   info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  size = (guint64)g_file_info_get_size(info);
 
   g_object_unref(info);
 
@@ -548,7 +1147,10 @@ static MateDesktopItem *mate_desktop_item_new_from_gfile(
     GFileInfo *child_info;
 
     child = g_file_get_child(file, ".directory");
-    child_info = g_file_query_info(child, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+    child_info = g_file_query_info(child,
+                                   G_FILE_ATTRIBUTE_STANDARD_SIZE
+                                   "," G_FILE_ATTRIBUTE_TIME_MODIFIED
+                                   "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
                                    G_FILE_QUERY_INFO_NONE, NULL, NULL);
 
     if (child_info == NULL) {
@@ -563,6 +1165,10 @@ static MateDesktopItem *mate_desktop_item_new_from_gfile(
 
     mtime = g_file_info_get_attribute_uint64(child_info,
                                              G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    mtime_usec = (gint64)mtime * G_USEC_PER_SEC +
+                 g_file_info_get_attribute_uint32(
+                     child_info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+    size = (guint64)g_file_info_get_size(child_info);
     g_object_unref(child_info);
 
     subfn = child;
@@ -570,19 +1176,27 @@ static MateDesktopItem *mate_desktop_item_new_from_gfile(
     subfn = g_file_dup(file);
   }
 
-  rb = readbuf_open(subfn, error);
+  /* the cache only has items with all their translations */
+  if (flags & MATE_DESKTOP_ITEM_LOAD_NO_TRANSLATIONS)
+    retval = NULL;
+  else
+    retval = item_cache_lookup(subfn, mtime_usec, size);
 
-  if (rb == NULL) {
-    g_object_unref(subfn);
-    return NULL;
-  }
+  if (retval == NULL) {
+    rb = readbuf_open(subfn, error);
 
-  retval = ditem_load(rb, (flags & MATE_DESKTOP_ITEM_LOAD_NO_TRANSLATIONS) != 0,
-                      error);
+    if (rb == NULL) {
+      g_object_unref(subfn);
+      return NULL;
+    }
 
-  if (retval == NULL) {
-    g_object_unref(subfn);
-    return NULL;
+    retval = ditem_load(
+        rb, (flags & MATE_DESKTOP_ITEM_LOAD_NO_TRANSLATIONS) != 0, error);
+
+    if (retval == NULL) {
+      g_object_unref(subfn);
+      return NULL;
+    }
   }
 
   if (flags & MATE_DESKTOP_ITEM_LOAD_ONLY_IF_EXISTS &&
@@ -654,7 +1268,7 @@ static char *lookup_desktop_file_in_data_dir(const char *desktop_file,
   return path;
 }
 
-static char *file_from_basename(const char *basename) {
+static char *lookup_desktop_file_in_data_dirs(const char *basename) {
   const char *const *system_data_dirs;
   const char *user_data_dir;
   char *retval;
@@ -675,6 +1289,139 @@ static char *file_from_basename(const char *basename) {
   return NULL;
 }
 
+/*
+ * Index of the applications directories of all the data dirs, from
+ * basename to path, so that finding a desktop file doesn't cost a stat
+ * per data dir.  It is read with one readdir per directory and thrown
+ * away when the monitors see a file come or go.  If a directory can't be
+ * monitored, nothing would tell the index that e.g. a user override came
+ * up in a directory that takes precedence, so it isn't used at all.
+ */
+G_LOCK_DEFINE_STATIC(applications_index);
+static GHashTable *applications_index = NULL;
+static GPtrArray *applications_monitors = NULL;
+static gboolean applications_unmonitored = FALSE;
+
+static void invalidate_applications_index(void) {
+  G_LOCK(applications_index);
+  g_clear_pointer(&applications_index, g_hash_table_unref);
+  G_UNLOCK(applications_index);
+}
+
+static void applications_dir_changed(GFileMonitor *monitor, GFile *file,
+                                     GFile *other_file,
+                                     GFileMonitorEvent event_type,
+                                     gpointer user_data) {
+  switch (event_type) {
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+      /* same files, same paths */
+      break;
+    default:
+      invalidate_applications_index();
+      break;
+  }
+}
+
+static void monitor_applications_dir(const char *dir_name) {
+  GFileMonitor *monitor;
+  GFile *dir;
+
+  dir = g_file_new_for_path(dir_name);
+  monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_NONE, NULL, NULL);
+  g_object_unref(dir);
+
+  if (monitor == NULL) {
+    applications_unmonitored = TRUE;
+    return;
+  }
+
+  g_signal_connect(monitor, "changed", G_CALLBACK(applications_dir_changed),
+                   NULL);
+  g_ptr_array_add(applications_monitors, monitor);
+}
+
+static void index_applications_dir(GHashTable *index, const char *data_dir,
+                                   gboolean monitor) {
+  const char *name;
+  char *dir_name;
+  GDir *dir;
+
+  dir_name = g_build_filename(data_dir, "applications", NULL);
+
+  /* also watch directories that don't exist yet */
+  if (monitor) monitor_applications_dir(dir_name);
+
+  if ((dir = g_dir_open(dir_name, 0, NULL))) {
+    while ((name = g_dir_read_name(dir))) {
+      /* earlier data dirs take precedence */
+      if (!g_hash_table_contains(index, name))
+        g_hash_table_insert(index, g_strdup(name),
+                            g_build_filename(dir_name, name, NULL));
+    }
+    g_dir_close(dir);
+  }
+
+  g_free(dir_name);
+}
+
+/* Must be called with the applications_index lock held.  Returns NULL if
+ * the index can't be kept up to date. */
+static GHashTable *build_applications_index(void) {
+  const char *const *system_data_dirs;
+  GHashTable *index;
+  gboolean monitor;
+  int i;
+
+  index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  /* the monitors are set up once and outlive the indexes */
+  monitor = (applications_monitors == NULL);
+  if (monitor)
+    applications_monitors = g_ptr_array_new_with_free_func(g_object_unref);
+
+  index_applications_dir(index, g_get_user_data_dir(), monitor);
+
+  system_data_dirs = g_get_system_data_dirs();
+  for (i = 0; system_data_dirs[i]; i++)
+    index_applications_dir(index, system_data_dirs[i], monitor);
+
+  if (applications_unmonitored) {
+    g_hash_table_unref(index);
+    return NULL;
+  }
+
+  return index;
+}
+
+static char *file_from_basename(const char *basename) {
+  char *retval = NULL;
+  gboolean indexed;
+
+  /* the index only knows what is directly in the applications dirs */
+  if (strchr(basename, G_DIR_SEPARATOR) != NULL)
+    return lookup_desktop_file_in_data_dirs(basename);
+
+  G_LOCK(applications_index);
+  if (applications_index == NULL && !applications_unmonitored)
+    applications_index = build_applications_index();
+  indexed = (applications_index != NULL);
+  if (indexed)
+    retval = g_strdup(g_hash_table_lookup(applications_index, basename));
+  G_UNLOCK(applications_index);
+
+  if (!indexed) return lookup_desktop_file_in_data_dirs(basename);
+  if (retval != NULL) return retval;
+
+  /* Misses are rare, so check them the slow way in case the monitors
+   * haven't told us about a new file yet, e.g. without a main loop */
+  retval = lookup_desktop_file_in_data_dirs(basename);
+  if (retval != NULL) invalidate_applications_index();
+
+  return retval;
+}
+
 /**
  * mate_desktop_item_new_from_basename:
  * @basename: The basename of the MateDesktopItem to load.
@@ -688,6 +1435,7 @@ static char *file_from_basename(const char *basename) {
 MateDesktopItem *mate_desktop_item_new_from_basename(
     const char *basename, MateDesktopItemLoadFlags flags, GError **error) {
   MateDesktopItem *retval;
+  GError *local_error = NULL;
   char *file;
 
   g_return_val_if_fail(basename != NULL, NULL);
@@ -699,12 +1447,378 @@ MateDesktopItem *mate_desktop_item_new_from_basename(
     return NULL;
   }
 
-  retval = mate_desktop_item_new_from_file(file, flags, error);
+  retval = mate_desktop_item_new_from_file(file, flags, &local_error);
   g_free(file);
 
+  if (g_error_matches(local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+    /* the index went stale before its monitors noticed */
+    g_clear_error(&local_error);
+    invalidate_applications_index();
+
+    if (!(file = file_from_basename(basename))) {
+      g_set_error(error, MATE_DESKTOP_ITEM_ERROR,
+                  MATE_DESKTOP_ITEM_ERROR_CANNOT_OPEN,
+                  _("Cannot find file '%s'"), basename);
+      return NULL;
+    }
+
+    retval = mate_desktop_item_new_from_file(file, flags, &local_error);
+    g_free(file);
+  }
+
+  if (local_error != NULL) g_propagate_error(error, local_error);
+
   return retval;
 }
 
+/*
+ * Bulk loading.  The files are parsed on a shared pool with a thread per
+ * processor, and handed back on the caller's main context in the order
+ * they were asked for, as soon as every file before them is done.
+ */
+
+typedef struct {
+  char *directory; /* NULL when loading a list of files */
+  GPtrArray *files;
+  MateDesktopItemLoadFlags flags;
+  MateDesktopItemLoadedFunc loaded_func;
+  gpointer loaded_data;
+
+  GMutex lock;
+  MateDesktopItem **items;
+  GError **errors;
+  gboolean *done;
+  gboolean listed;
+  GError *list_error;
+  guint n_ready; /* all files before this one are done */
+  guint n_delivered;
+  gboolean delivery_pending;
+} LoadContext;
+
+typedef struct {
+  GTask *task;
+  guint index; /* LOAD_JOB_LIST to list the directory */
+} LoadJob;
+
+#define LOAD_JOB_LIST G_MAXUINT
+
+static void load_context_free(LoadContext *ctx) {
+  guint i;
+
+  for (i = 0; ctx->items && i < ctx->files->len; i++) {
+    if (ctx->items[i]) mate_desktop_item_unref(ctx->items[i]);
+    g_clear_error(&ctx->errors[i]);
+  }
+  g_free(ctx->items);
+  g_free(ctx->errors);
+  g_free(ctx->done);
+  g_clear_error(&ctx->list_error);
+  g_ptr_array_unref(ctx->files);
+  g_free(ctx->directory);
+  g_mutex_clear(&ctx->lock);
+  g_free(ctx);
+}
+
+static GPtrArray *load_context_take_items(LoadContext *ctx) {
+  GPtrArray *items;
+  guint i;
+
+  items = g_ptr_array_new_full(ctx->files->len,
+                               (GDestroyNotify)mate_desktop_item_unref);
+  for (i = 0; i < ctx->files->len; i++) {
+    /* a directory has no list of files to line the items up with */
+    if (ctx->items[i] || ctx->directory == NULL)
+      g_ptr_array_add(items, ctx->items[i]);
+    ctx->items[i] = NULL;
+  }
+
+  return items;
+}
+
+static gboolean deliver_items(gpointer data) {
+  GTask *task = data;
+  LoadContext *ctx = g_task_get_task_data(task);
+  gboolean finished;
+  guint from, to, i;
+
+  g_mutex_lock(&ctx->lock);
+  from = ctx->n_delivered;
+  to = ctx->n_ready;
+  ctx->n_delivered = to;
+  ctx->delivery_pending = FALSE;
+  finished = ctx->listed && to == ctx->files->len;
+  g_mutex_unlock(&ctx->lock);
+
+  /* the items are written before n_ready moves past them */
+  if (ctx->loaded_func &&
+      !g_cancellable_is_cancelled(g_task_get_cancellable(task))) {
+    for (i = from; i < to; i++)
+      ctx->loaded_func(g_ptr_array_index(ctx->files, i), ctx->items[i],
+                       ctx->errors[i], ctx->loaded_data);
+  }
+
+  if (!finished || g_task_return_error_if_cancelled(task))
+    return G_SOURCE_REMOVE;
+
+  if (ctx->list_error)
+    g_task_return_error(task, g_steal_pointer(&ctx->list_error));
+  else
+    g_task_return_pointer(task, load_context_take_items(ctx),
+                          (GDestroyNotify)g_ptr_array_unref);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Must be called with the lock held */
+static void schedule_delivery(GTask *task) {
+  LoadContext *ctx = g_task_get_task_data(task);
+  GSource *source;
+
+  if (ctx->delivery_pending) return;
+  ctx->delivery_pending = TRUE;
+
+  source = g_idle_source_new();
+  g_source_set_priority(source, g_task_get_priority(task));
+  g_source_set_callback(source, deliver_items, g_object_ref(task),
+                        g_object_unref);
+  g_source_attach(source, g_task_get_context(task));
+  g_source_unref(source);
+}
+
+static void load_job(gpointer data, gpointer user_data);
+
+static GThreadPool *get_load_pool(void) {
+  static GThreadPool *pool = NULL;
+
+  if (g_once_init_enter(&pool)) {
+    GThreadPool *new_pool;
+
+    new_pool = g_thread_pool_new(load_job, NULL, g_get_num_processors(),
+                                 FALSE, NULL);
+    g_once_init_leave(&pool, new_pool);
+  }
+
+  return pool;
+}
+
+/* Must be called with the lock held, once the files are known */
+static void start_loading(GTask *task) {
+  LoadContext *ctx = g_task_get_task_data(task);
+  guint i;
+
+  ctx->items = g_new0(MateDesktopItem *, ctx->files->len);
+  ctx->errors = g_new0(GError *, ctx->files->len);
+  ctx->done = g_new0(gboolean, ctx->files->len);
+  ctx->listed = TRUE;
+
+  if (ctx->files->len == 0) schedule_delivery(task);
+
+  for (i = 0; i < ctx->files->len; i++) {
+    LoadJob *job = g_new(LoadJob, 1);
+
+    job->task = g_object_ref(task);
+    job->index = i;
+    g_thread_pool_push(get_load_pool(), job, NULL);
+  }
+}
+
+static int compare_files(gconstpointer a, gconstpointer b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void list_directory(GTask *task) {
+  LoadContext *ctx = g_task_get_task_data(task);
+  const char *name;
+  GError *error = NULL;
+  GDir *dir;
+
+  dir = g_dir_open(ctx->directory, 0, &error);
+  if (dir != NULL) {
+    while ((name = g_dir_read_name(dir))) {
+      if (g_str_has_suffix(name, ".desktop"))
+        g_ptr_array_add(ctx->files,
+                        g_build_filename(ctx->directory, name, NULL));
+    }
+    g_dir_close(dir);
+    g_ptr_array_sort(ctx->files, compare_files);
+  }
+
+  g_mutex_lock(&ctx->lock);
+  ctx->list_error = error;
+  start_loading(task);
+  g_mutex_unlock(&ctx->lock);
+}
+
+static void load_job(gpointer data, gpointer user_data) {
+  LoadJob *job = data;
+  LoadContext *ctx = g_task_get_task_data(job->task);
+  MateDesktopItem *item = NULL;
+  GError *error = NULL;
+  guint i = job->index;
+
+  if (i == LOAD_JOB_LIST) {
+    list_directory(job->task);
+    g_object_unref(job->task);
+    g_free(job);
+    return;
+  }
+
+  if (!g_cancellable_is_cancelled(g_task_get_cancellable(job->task)))
+    item = mate_desktop_item_new_from_file(g_ptr_array_index(ctx->files, i),
+                                           ctx->flags, &error);
+
+  g_mutex_lock(&ctx->lock);
+  ctx->items[i] = item;
+  ctx->errors[i] = error;
+  ctx->done[i] = TRUE;
+  if (i == ctx->n_ready) {
+    while (ctx->n_ready < ctx->files->len && ctx->done[ctx->n_ready])
+      ctx->n_ready++;
+    schedule_delivery(job->task);
+  }
+  g_mutex_unlock(&ctx->lock);
+
+  g_object_unref(job->task);
+  g_free(job);
+}
+
+static GTask *load_task_new(gpointer source_tag, const char *directory,
+                            MateDesktopItemLoadFlags flags,
+                            MateDesktopItemLoadedFunc loaded_func,
+                            gpointer loaded_data, GCancellable *cancellable,
+                            GAsyncReadyCallback callback, gpointer user_data) {
+  LoadContext *ctx;
+  GTask *task;
+
+  ctx = g_new0(LoadContext, 1);
+  ctx->directory = g_strdup(directory);
+  ctx->files = g_ptr_array_new_with_free_func(g_free);
+  ctx->flags = flags;
+  ctx->loaded_func = loaded_func;
+  ctx->loaded_data = loaded_data;
+  g_mutex_init(&ctx->lock);
+
+  task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_source_tag(task, source_tag);
+  g_task_set_task_data(task, ctx, (GDestroyNotify)load_context_free);
+
+  return task;
+}
+
+/**
+ * mate_desktop_item_load_directory_async:
+ * @directory: the directory to load the desktop files of
+ * @flags: Flags to influence the loading process
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @loaded_func: (nullable): called for each file, in the
+ * order of their names, as soon as it and every file before it are loaded
+ * @loaded_data: data for @loaded_func
+ * @callback: called when all the files have been loaded
+ * @user_data: data for @callback
+ *
+ * Loads every .desktop file in @directory, like
+ * mate_desktop_item_new_from_file() would, on as many threads as there are
+ * processors. @loaded_func and @callback are called from the thread-default
+ * main context of the caller. Call mate_desktop_item_load_directory_finish()
+ * from @callback to get the items.
+ */
+void mate_desktop_item_load_directory_async(
+    const char *directory, MateDesktopItemLoadFlags flags,
+    GCancellable *cancellable, MateDesktopItemLoadedFunc loaded_func,
+    gpointer loaded_data, GAsyncReadyCallback callback, gpointer user_data) {
+  LoadJob *job;
+
+  g_return_if_fail(directory != NULL);
+
+  job = g_new(LoadJob, 1);
+  job->task = load_task_new(mate_desktop_item_load_directory_async, directory,
+                            flags, loaded_func, loaded_data, cancellable,
+                            callback, user_data);
+  job->index = LOAD_JOB_LIST;
+
+  /* listing the directory is I/O too */
+  g_thread_pool_push(get_load_pool(), job, NULL);
+}
+
+/**
+ * mate_desktop_item_load_directory_finish:
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an operation started with
+ * mate_desktop_item_load_directory_async().
+ *
+ * Returns: (transfer full) (element-type MateDesktopItem): the items that
+ * could be loaded, in the order of their file names, or %NULL if the
+ * directory couldn't be read or the operation was cancelled
+ */
+GPtrArray *mate_desktop_item_load_directory_finish(GAsyncResult *result,
+                                                   GError **error) {
+  g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+  return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+/**
+ * mate_desktop_item_load_files_async:
+ * @files: (array zero-terminated=1): the files to load
+ * @flags: Flags to influence the loading process
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @loaded_func: (nullable): called for each file, in the
+ * order of @files, as soon as it and every file before it are loaded
+ * @loaded_data: data for @loaded_func
+ * @callback: called when all the files have been loaded
+ * @user_data: data for @callback
+ *
+ * Like mate_desktop_item_load_directory_async(), for a list of files.
+ * @files is copied, so it can be freed right away. Call
+ * mate_desktop_item_load_files_finish() from @callback to get the items.
+ */
+void mate_desktop_item_load_files_async(const char *const *files,
+                                        MateDesktopItemLoadFlags flags,
+                                        GCancellable *cancellable,
+                                        MateDesktopItemLoadedFunc loaded_func,
+                                        gpointer loaded_data,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data) {
+  LoadContext *ctx;
+  GTask *task;
+  int i;
+
+  g_return_if_fail(files != NULL);
+
+  task = load_task_new(mate_desktop_item_load_files_async, NULL, flags,
+                       loaded_func, loaded_data, cancellable, callback,
+                       user_data);
+  ctx = g_task_get_task_data(task);
+  for (i = 0; files[i] != NULL; i++)
+    g_ptr_array_add(ctx->files, g_strdup(files[i]));
+
+  g_mutex_lock(&ctx->lock);
+  start_loading(task);
+  g_mutex_unlock(&ctx->lock);
+
+  g_object_unref(task);
+}
+
+/**
+ * mate_desktop_item_load_files_finish:
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes an operation started with mate_desktop_item_load_files_async().
+ *
+ * Returns: (transfer full) (element-type MateDesktopItem): an array with
+ * the item of each file, or %NULL where it couldn't be loaded, or %NULL if
+ * the operation was cancelled
+ */
+GPtrArray *mate_desktop_item_load_files_finish(GAsyncResult *result,
+                                               GError **error) {
+  g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+  return g_task_propagate_pointer(G_TASK(result), error);
+}
+
 /**
  * mate_desktop_item_save:
  * @item: A desktop item
@@ -766,7 +1880,7 @@ static void free_section(gpointer data) {
   g_free(section->name);
   section->name = NULL;
 
-  g_list_free_full(section->keys, g_free);
+  g_list_free(section->keys);
   section->keys = NULL;
 
   g_free(section);
@@ -790,14 +1904,16 @@ void mate_desktop_item_unref(MateDesktopItem *item) {
   g_list_free_full(item->languages, g_free);
   item->languages = NULL;
 
-  g_list_free_full(item->keys, g_free);
+  g_list_free(item->keys);
   item->keys = NULL;
 
   g_list_free_full(item->sections, (GDestroyNotify)free_section);
   item->sections = NULL;
 
-  g_hash_table_destroy(item->main_hash);
-  item->main_hash = NULL;
+  key_table_clear(&item->main_table);
+  g_clear_pointer(&item->set_values, g_hash_table_destroy);
+  g_string_chunk_free(item->strings);
+  item->strings = NULL;
 
   g_free(item->location);
   item->location = NULL;
@@ -857,7 +1973,7 @@ static const char *key_basename(const char *key) {
 }
 
 static const char *lookup(const MateDesktopItem *item, const char *key) {
-  return g_hash_table_lookup(item->main_hash, key);
+  return key_table_lookup(&item->main_table, key);
 }
 
 static const char *lookup_locale(const MateDesktopItem *item, const char *key,
@@ -894,32 +2010,27 @@ static void set(MateDesktopItem *item, const char *key, const char *value) {
 
   if (sec != NULL) {
     if (value != NULL) {
-      if (g_hash_table_lookup(item->main_hash, key) == NULL)
-        sec->keys = g_list_append(sec->keys, g_strdup(key_basename(key)));
+      if (lookup(item, key) == NULL)
+        sec->keys = g_list_append(sec->keys,
+                                  (char *)item_key(item, key_basename(key)));
 
-      g_hash_table_replace(item->main_hash, g_strdup(key), g_strdup(value));
+      set_value(item, key, value);
     } else {
       GList *list = g_list_find_custom(sec->keys, key_basename(key),
                                        (GCompareFunc)strcmp);
-      if (list != NULL) {
-        g_free(list->data);
-        sec->keys = g_list_delete_link(sec->keys, list);
-      }
-      g_hash_table_remove(item->main_hash, key);
+      if (list != NULL) sec->keys = g_list_delete_link(sec->keys, list);
+      remove_value(item, key);
     }
   } else {
     if (value != NULL) {
-      if (g_hash_table_lookup(item->main_hash, key) == NULL)
-        item->keys = g_list_append(item->keys, g_strdup(key));
+      if (lookup(item, key) == NULL)
+        item->keys = g_list_append(item->keys, (char *)item_key(item, key));
 
-      g_hash_table_replace(item->main_hash, g_strdup(key), g_strdup(value));
+      set_value(item, key, value);
     } else {
       GList *list = g_list_find_custom(item->keys, key, (GCompareFunc)strcmp);
-      if (list != NULL) {
-        g_free(list->data);
-        item->keys = g_list_delete_link(item->keys, list);
-      }
-      g_hash_table_remove(item->main_hash, key);
+      if (list != NULL) item->keys = g_list_delete_link(item->keys, list);
+      remove_value(item, key);
     }
   }
   item->modified = TRUE;
@@ -2547,21 +3658,15 @@ void mate_desktop_item_clear_section(MateDesktopItem *item,
   sec = find_section(item, section);
 
   if (sec == NULL) {
-    for (li = item->keys; li != NULL; li = li->next) {
-      g_hash_table_remove(item->main_hash, li->data);
-      g_free(li->data);
-      li->data = NULL;
-    }
+    for (li = item->keys; li != NULL; li = li->next)
+      remove_value(item, li->data);
     g_list_free(item->keys);
     item->keys = NULL;
   } else {
     for (li = sec->keys; li != NULL; li = li->next) {
-      char *key = li->data;
-      char *full = g_strdup_printf("%s/%s", sec->name, key);
-      g_hash_table_remove(item->main_hash, full);
+      char *full = g_strdup_printf("%s/%s", sec->name, (char *)li->data);
+      remove_value(item, full);
       g_free(full);
-      g_free(key);
-      li->data = NULL;
     }
     g_list_free(sec->keys);
     sec->keys = NULL;
@@ -2576,16 +3681,19 @@ void mate_desktop_item_clear_section(MateDesktopItem *item,
 static gboolean G_GNUC_CONST standard_is_boolean(const char *key) {
   static GHashTable *bools = NULL;
 
-  if (bools == NULL) {
-    bools = g_hash_table_new(g_str_hash, g_str_equal);
-    g_hash_table_insert(bools, MATE_DESKTOP_ITEM_NO_DISPLAY,
+  /* items can be loaded on several threads at once */
+  if (g_once_init_enter(&bools)) {
+    GHashTable *table = g_hash_table_new(g_str_hash, g_str_equal);
+
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_NO_DISPLAY,
                         MATE_DESKTOP_ITEM_NO_DISPLAY);
-    g_hash_table_insert(bools, MATE_DESKTOP_ITEM_HIDDEN,
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_HIDDEN,
                         MATE_DESKTOP_ITEM_HIDDEN);
-    g_hash_table_insert(bools, MATE_DESKTOP_ITEM_TERMINAL,
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_TERMINAL,
                         MATE_DESKTOP_ITEM_TERMINAL);
-    g_hash_table_insert(bools, MATE_DESKTOP_ITEM_READ_ONLY,
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_READ_ONLY,
                         MATE_DESKTOP_ITEM_READ_ONLY);
+    g_once_init_leave(&bools, table);
   }
 
   return g_hash_table_lookup(bools, key) != NULL;
@@ -2594,18 +3702,21 @@ static gboolean G_GNUC_CONST standard_is_boolean(const char *key) {
 static gboolean G_GNUC_CONST standard_is_strings(const char *key) {
   static GHashTable *strings = NULL;
 
-  if (strings == NULL) {
-    strings = g_hash_table_new(g_str_hash, g_str_equal);
-    g_hash_table_insert(strings, MATE_DESKTOP_ITEM_FILE_PATTERN,
+  /* items can be loaded on several threads at once */
+  if (g_once_init_enter(&strings)) {
+    GHashTable *table = g_hash_table_new(g_str_hash, g_str_equal);
+
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_FILE_PATTERN,
                         MATE_DESKTOP_ITEM_FILE_PATTERN);
-    g_hash_table_insert(strings, MATE_DESKTOP_ITEM_ACTIONS,
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_ACTIONS,
                         MATE_DESKTOP_ITEM_ACTIONS);
-    g_hash_table_insert(strings, MATE_DESKTOP_ITEM_MIME_TYPE,
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_MIME_TYPE,
                         MATE_DESKTOP_ITEM_MIME_TYPE);
-    g_hash_table_insert(strings, MATE_DESKTOP_ITEM_PATTERNS,
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_PATTERNS,
                         MATE_DESKTOP_ITEM_PATTERNS);
-    g_hash_table_insert(strings, MATE_DESKTOP_ITEM_SORT_ORDER,
+    g_hash_table_insert(table, MATE_DESKTOP_ITEM_SORT_ORDER,
                         MATE_DESKTOP_ITEM_SORT_ORDER);
+    g_once_init_leave(&strings, table);
   }
 
   return g_hash_table_lookup(strings, key) != NULL;
@@ -2782,7 +3893,8 @@ static const char *get_encoding_from_locale(const char *locale) {
     return encoding + 1;
   }
 
-  if (encodings == NULL) encodings = init_encodings();
+  if (g_once_init_enter(&encodings))
+    g_once_init_leave(&encodings, init_encodings());
 
   /* first try the entire locale (at this point ll_CC) */
   encoding = g_hash_table_lookup(encodings, locale);
@@ -2794,37 +3906,43 @@ static const char *get_encoding_from_locale(const char *locale) {
   return g_hash_table_lookup(encodings, lang);
 }
 
-static Encoding get_encoding(ReadBuf *rb) {
-  gboolean old_kde = FALSE;
-  char buf[BUFSIZ];
-  gboolean all_valid_utf8 = TRUE;
+static gboolean span_equal(const char *span, gsize length, const char *str) {
+  return strlen(str) == length && memcmp(span, str, length) == 0;
+}
 
-  while (readbuf_gets(buf, sizeof(buf), rb) != NULL) {
-    if (strncmp(MATE_DESKTOP_ITEM_ENCODING, buf,
-                strlen(MATE_DESKTOP_ITEM_ENCODING)) == 0) {
-      char *p = &buf[strlen(MATE_DESKTOP_ITEM_ENCODING)];
-      if (*p == ' ') p++;
-      if (*p != '=') continue;
-      p++;
-      if (*p == ' ') p++;
-      if (strcmp(p, "UTF-8") == 0) {
-        return ENCODING_UTF8;
-      } else if (strcmp(p, "Legacy-Mixed") == 0) {
-        return ENCODING_LEGACY_MIXED;
-      } else {
-        /* According to the spec we're not supposed
-         * to read a file like this */
-        return ENCODING_UNKNOWN;
-      }
-    } else if (strcmp("[KDE Desktop Entry]", buf) == 0) {
-      old_kde = TRUE;
-      /* don't break yet, we still want to support
-       * Encoding even here */
-    }
-    if (all_valid_utf8 && !g_utf8_validate(buf, -1, NULL))
-      all_valid_utf8 = FALSE;
+/* Whether the line sets the encoding, and if so to what */
+static gboolean line_sets_encoding(const char *line, gsize length,
+                                   Encoding *encoding) {
+  gsize key_length = strlen(MATE_DESKTOP_ITEM_ENCODING);
+  const char *end = line + length;
+  const char *p;
+
+  if (length < key_length ||
+      strncmp(MATE_DESKTOP_ITEM_ENCODING, line, key_length) != 0)
+    return FALSE;
+
+  p = line + key_length;
+  if (p < end && *p == ' ') p++;
+  if (p == end || *p != '=') return FALSE;
+  p++;
+  if (p < end && *p == ' ') p++;
+
+  if (span_equal(p, end - p, "UTF-8")) {
+    *encoding = ENCODING_UTF8;
+  } else if (span_equal(p, end - p, "Legacy-Mixed")) {
+    *encoding = ENCODING_LEGACY_MIXED;
+  } else {
+    /* According to the spec we're not supposed
+     * to read a file like this */
+    *encoding = ENCODING_UNKNOWN;
   }
 
+  return TRUE;
+}
+
+/* For files that don't say what their encoding is */
+static Encoding guess_encoding(ReadBuf *rb, gboolean old_kde,
+                               gboolean all_valid_utf8) {
   if (old_kde) return ENCODING_LEGACY_MIXED;
 
   /* try to guess by location */
@@ -2976,32 +4094,36 @@ static void insert_key(MateDesktopItem *item, Section *cur_section,
 
   if (cur_section == NULL) {
     /* only add to list if we haven't seen it before */
-    if (g_hash_table_lookup(item->main_hash, k) == NULL) {
-      item->keys = g_list_prepend(item->keys, g_strdup(k));
+    if (lookup(item, k) == NULL) {
+      item->keys = g_list_prepend(item->keys, (char *)item_key(item, k));
     }
     /* later duplicates override earlier ones */
-    g_hash_table_replace(item->main_hash, k, val);
+    replace_value(item, k, val);
   } else {
     char *full = g_strdup_printf("%s/%s", cur_section->name, k);
     /* only add to list if we haven't seen it before */
-    if (g_hash_table_lookup(item->main_hash, full) == NULL) {
-      cur_section->keys = g_list_prepend(cur_section->keys, k);
+    if (lookup(item, full) == NULL) {
+      cur_section->keys =
+          g_list_prepend(cur_section->keys, (char *)item_key(item, k));
     }
     /* later duplicates override earlier ones */
-    g_hash_table_replace(item->main_hash, full, val);
+    replace_value(item, full, val);
+    g_free(full);
   }
+
+  g_free(k);
+  g_free(val);
 }
 
 static void setup_type(MateDesktopItem *item, const char *uri) {
-  const char *type =
-      g_hash_table_lookup(item->main_hash, MATE_DESKTOP_ITEM_TYPE);
+  const char *type = lookup(item, MATE_DESKTOP_ITEM_TYPE);
   if (type == NULL && uri != NULL) {
     char *base = g_path_get_basename(uri);
     if (base != NULL && strcmp(base, ".directory") == 0) {
       /* This gotta be a directory */
-      g_hash_table_replace(item->main_hash, g_strdup(MATE_DESKTOP_ITEM_TYPE),
-                           g_strdup("Directory"));
-      item->keys = g_list_prepend(item->keys, g_strdup(MATE_DESKTOP_ITEM_TYPE));
+      replace_value(item, MATE_DESKTOP_ITEM_TYPE, "Directory");
+      item->keys = g_list_prepend(
+          item->keys, (char *)item_key(item, MATE_DESKTOP_ITEM_TYPE));
       item->type = MATE_DESKTOP_ITEM_TYPE_DIRECTORY;
     } else {
       item->type = MATE_DESKTOP_ITEM_TYPE_NULL;
@@ -3060,193 +4182,197 @@ static void sanitize(MateDesktopItem *item, const char *uri) {
        * an application or a document */
       name = g_strdup(_("No name"));
     }
-    g_hash_table_replace(item->main_hash, g_strdup(MATE_DESKTOP_ITEM_NAME),
-                         name);
-    item->keys = g_list_prepend(item->keys, g_strdup(MATE_DESKTOP_ITEM_NAME));
+    replace_value(item, MATE_DESKTOP_ITEM_NAME, name);
+    g_free(name);
+    item->keys = g_list_prepend(
+        item->keys, (char *)item_key(item, MATE_DESKTOP_ITEM_NAME));
   }
   if (lookup(item, MATE_DESKTOP_ITEM_ENCODING) == NULL) {
     /* We store everything in UTF-8 so write that down */
-    g_hash_table_replace(item->main_hash, g_strdup(MATE_DESKTOP_ITEM_ENCODING),
-                         g_strdup("UTF-8"));
-    item->keys =
-        g_list_prepend(item->keys, g_strdup(MATE_DESKTOP_ITEM_ENCODING));
+    replace_value(item, MATE_DESKTOP_ITEM_ENCODING, "UTF-8");
+    item->keys = g_list_prepend(
+        item->keys, (char *)item_key(item, MATE_DESKTOP_ITEM_ENCODING));
   }
   if (lookup(item, MATE_DESKTOP_ITEM_VERSION) == NULL) {
     /* this is the version that we follow, so write it down */
-    g_hash_table_replace(item->main_hash, g_strdup(MATE_DESKTOP_ITEM_VERSION),
-                         g_strdup("1.0"));
-    item->keys =
-        g_list_prepend(item->keys, g_strdup(MATE_DESKTOP_ITEM_VERSION));
+    replace_value(item, MATE_DESKTOP_ITEM_VERSION, "1.0");
+    item->keys = g_list_prepend(
+        item->keys, (char *)item_key(item, MATE_DESKTOP_ITEM_VERSION));
   }
 }
 
-enum {
-  FirstBrace,
-  OnSecHeader,
-  IgnoreToEOL,
-  IgnoreToEOLFirst,
-  KeyDef,
-  KeyDefOnKey,
-  KeyValue
-};
+/* A section header or a key, pointing into the file contents */
+typedef struct {
+  const char *key; /* NULL for a section header */
+  gsize key_length;
+  const char *value; /* or the section name */
+  gsize value_length;
+} Token;
+
+static void tokenize_line(const char *line, gsize length,
+                          gboolean *seen_section, GArray *tokens) {
+  const char *end = line + length;
+  const char *p = line;
+  Token token;
+
+  if (!*seen_section) {
+    /* On first pass, don't allow dangling keys */
+    while (p < end && *p != '#' && *p != '[') p++;
+  } else {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+  }
+
+  if (p == end || *p == '#') return;
+
+  if (*p == '[') {
+    const char *close;
+
+    p++;
+    close = memchr(p, ']', end - p);
+    token.key = NULL;
+    token.key_length = 0;
+    token.value = p;
+    token.value_length = (close != NULL ? close : end) - p;
+    g_array_append_val(tokens, token);
+    *seen_section = TRUE;
+    return;
+  }
+
+  token.key = p;
+  while (p < end && *p != '=') {
+    if (*p == '#') return;
+    p++;
+  }
+  /* Abort Definition */
+  if (p == end) return;
+
+  token.key_length = p - token.key;
+  token.value = p + 1;
+  token.value_length = end - token.value;
+  g_array_append_val(tokens, token);
+}
+
+/* Splits the file into tokens and works out its encoding, in one pass */
+static Encoding tokenize(ReadBuf *rb, GArray *tokens) {
+  Encoding encoding = ENCODING_UNKNOWN;
+  gboolean encoding_known = FALSE;
+  gboolean seen_section = FALSE;
+  gboolean old_kde = FALSE;
+  gboolean all_valid_utf8 = TRUE;
+  const char *line;
+  gsize length;
+
+  while (readbuf_next_line(rb, &line, &length)) {
+    if (!encoding_known) {
+      gsize l = length;
+
+      if (l > 0 && line[l - 1] == '\r') l--;
+
+      if (line_sets_encoding(line, l, &encoding)) {
+        encoding_known = TRUE;
+      } else {
+        /* don't stop at this, we still want to support
+         * Encoding even here */
+        if (span_equal(line, l, "[KDE Desktop Entry]")) old_kde = TRUE;
+        if (all_valid_utf8 && !g_utf8_validate(line, length, NULL))
+          all_valid_utf8 = FALSE;
+      }
+    }
+
+    tokenize_line(line, length, &seen_section, tokens);
+  }
+
+  if (encoding_known) return encoding;
+
+  return guess_encoding(rb, old_kde, all_valid_utf8);
+}
+
+/* Copies a span into str, ignoring carriage returns and drop */
+static const char *copy_span(GString *str, const char *span, gsize length,
+                             char drop) {
+  gsize i;
+
+  g_string_truncate(str, 0);
+  for (i = 0; i < length; i++) {
+    char c = span[i];
+
+    if (c != '\r' && c != drop) g_string_append_c(str, c);
+  }
+
+  return str->str;
+}
 
 static MateDesktopItem *ditem_load(ReadBuf *rb, gboolean no_translations,
                                    GError **error) {
-  int state;
-  char CharBuffer[1024];
-  char *next = CharBuffer;
-  int c;
   Encoding encoding;
   MateDesktopItem *item;
   Section *cur_section = NULL;
-  char *key = NULL;
+  GArray *tokens;
+  GString *key, *value;
   gboolean old_kde = FALSE;
+  guint i;
+
+  tokens = g_array_sized_new(FALSE, FALSE, sizeof(Token), 32);
 
-  encoding = get_encoding(rb);
+  encoding = tokenize(rb, tokens);
   if (encoding == ENCODING_UNKNOWN) {
     /* spec says, don't read this file */
     g_set_error(error, MATE_DESKTOP_ITEM_ERROR,
                 MATE_DESKTOP_ITEM_ERROR_UNKNOWN_ENCODING,
                 _("Unknown encoding of: %s"), rb->uri);
+    g_array_free(tokens, TRUE);
     readbuf_close(rb);
     return NULL;
   }
 
-  /* Rewind since get_encoding goes through the file */
-  if (!readbuf_rewind(rb, error)) {
-    readbuf_close(rb);
-    /* spec says, don't read this file */
-    return NULL;
-  }
-
   item = mate_desktop_item_new();
   item->modified = FALSE;
 
   /* Note: location and mtime are filled in by the new_from_file
    * function since it has those values */
 
-#define OVERFLOW (next == &CharBuffer[sizeof(CharBuffer) - 1])
-
-  state = FirstBrace;
-  while ((c = readbuf_getc(rb)) != EOF) {
-    if (c == '\r') /* Ignore Carriage Return */
-      continue;
-
-    switch (state) {
-      case OnSecHeader:
-        if (c == ']' || OVERFLOW) {
-          *next = '\0';
-          next = CharBuffer;
-
-          /* keys were inserted in reverse */
-          if (cur_section != NULL && cur_section->keys != NULL) {
-            cur_section->keys = g_list_reverse(cur_section->keys);
-          }
-          if (strcmp(CharBuffer, "KDE Desktop Entry") == 0) {
-            /* Main section */
-            cur_section = NULL;
-            old_kde = TRUE;
-          } else if (strcmp(CharBuffer, "Desktop Entry") == 0) {
-            /* Main section */
-            cur_section = NULL;
-          } else {
-            cur_section = g_new0(Section, 1);
-            cur_section->name = g_strdup(CharBuffer);
-            cur_section->keys = NULL;
-            item->sections = g_list_prepend(item->sections, cur_section);
-          }
-          state = IgnoreToEOL;
-        } else if (c == '[') {
-          /* FIXME: probably error out instead of ignoring this */
-        } else {
-          *next++ = c;
-        }
-        break;
-
-      case IgnoreToEOL:
-      case IgnoreToEOLFirst:
-        if (c == '\n') {
-          if (state == IgnoreToEOLFirst)
-            state = FirstBrace;
-          else
-            state = KeyDef;
-          next = CharBuffer;
-        }
-        break;
-
-      case FirstBrace:
-      case KeyDef:
-      case KeyDefOnKey:
-        if (c == '#') {
-          if (state == FirstBrace)
-            state = IgnoreToEOLFirst;
-          else
-            state = IgnoreToEOL;
-          break;
-        }
-
-        if (c == '[' && state != KeyDefOnKey) {
-          state = OnSecHeader;
-          next = CharBuffer;
-          g_free(key);
-          key = NULL;
-          break;
-        }
-        /* On first pass, don't allow dangling keys */
-        if (state == FirstBrace) break;
-
-        if ((c == ' ' && state != KeyDefOnKey) || c == '\t') break;
+  key = g_string_new(NULL);
+  value = g_string_new(NULL);
 
-        if (c == '\n' || OVERFLOW) { /* Abort Definition */
-          next = CharBuffer;
-          state = KeyDef;
-          break;
-        }
-
-        if (c == '=' || OVERFLOW) {
-          *next = '\0';
-
-          g_free(key);
-          key = g_strdup(CharBuffer);
-          state = KeyValue;
-          next = CharBuffer;
-        } else {
-          *next++ = c;
-          state = KeyDefOnKey;
-        }
-        break;
-
-      case KeyValue:
-        if (OVERFLOW || c == '\n') {
-          *next = '\0';
-
-          insert_key(item, cur_section, encoding, key, CharBuffer, old_kde,
-                     no_translations);
+  for (i = 0; i < tokens->len; i++) {
+    Token *token = &g_array_index(tokens, Token, i);
 
-          g_free(key);
-          key = NULL;
+    if (token->key == NULL) {
+      const char *name;
 
-          state = (c == '\n') ? KeyDef : IgnoreToEOL;
-          next = CharBuffer;
-        } else {
-          *next++ = c;
-        }
-        break;
+      /* FIXME: probably error out instead of ignoring '[' */
+      name = copy_span(value, token->value, token->value_length, '[');
 
-    } /* switch */
+      /* keys were inserted in reverse */
+      if (cur_section != NULL && cur_section->keys != NULL) {
+        cur_section->keys = g_list_reverse(cur_section->keys);
+      }
+      if (strcmp(name, "KDE Desktop Entry") == 0) {
+        /* Main section */
+        cur_section = NULL;
+        old_kde = TRUE;
+      } else if (strcmp(name, "Desktop Entry") == 0) {
+        /* Main section */
+        cur_section = NULL;
+      } else {
+        cur_section = g_new0(Section, 1);
+        cur_section->name = g_strdup(name);
+        cur_section->keys = NULL;
+        item->sections = g_list_prepend(item->sections, cur_section);
+      }
+      continue;
+    }
 
-  } /* while ((c = getc_unlocked (f)) != EOF) */
-  if (c == EOF && state == KeyValue) {
-    *next = '\0';
+    copy_span(key, token->key, token->key_length, '\t');
+    copy_span(value, token->value, token->value_length, '\r');
 
-    insert_key(item, cur_section, encoding, key, CharBuffer, old_kde,
+    insert_key(item, cur_section, encoding, key->str, value->str, old_kde,
                no_translations);
-
-    g_free(key);
-    key = NULL;
   }
 
-#undef OVERFLOW
+  g_string_free(key, TRUE);
+  g_string_free(value, TRUE);
+  g_array_free(tokens, TRUE);
 
   /* keys were inserted in reverse */
   if (cur_section != NULL && cur_section->keys != NULL) {
@@ -3292,7 +4418,7 @@ static void dump_section(MateDesktopItem *item, GFileOutputStream *stream,
   for (li = section->keys; li != NULL; li = li->next) {
     const char *key = li->data;
     char *full = g_strdup_printf("%s/%s", section->name, key);
-    const char *value = g_hash_table_lookup(item->main_hash, full);
+    const char *value = lookup(item, full);
     if (value != NULL) {
       char *val = escape_string_and_dup(value);
       stream_printf(stream, "%s=%s\n", key, val);
@@ -3315,7 +4441,7 @@ static gboolean ditem_save(MateDesktopItem *item, const char *uri,
   stream_printf(stream, "[Desktop Entry]\n");
   for (li = item->keys; li != NULL; li = li->next) {
     const char *key = li->data;
-    const char *value = g_hash_table_lookup(item->main_hash, key);
+    const char *value = key_table_lookup(&item->main_table, key);
     if (value != NULL) {
       char *val = escape_string_and_dup(value);
       stream_printf(stream, "%s=%s\n", key, val);
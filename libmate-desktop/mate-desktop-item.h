@@ -165,6 +165,29 @@ MateDesktopItem *mate_desktop_item_new_from_basename(
     const char *basename, MateDesktopItemLoadFlags flags, GError **error);
 MateDesktopItem *mate_desktop_item_copy(const MateDesktopItem *item);
 
+/* Bulk loading, on a pool of threads.  item is NULL where error tells
+ * why the file couldn't be loaded */
+typedef void (*MateDesktopItemLoadedFunc)(const char *file,
+                                          MateDesktopItem *item,
+                                          const GError *error,
+                                          gpointer user_data);
+
+void mate_desktop_item_load_directory_async(
+    const char *directory, MateDesktopItemLoadFlags flags,
+    GCancellable *cancellable, MateDesktopItemLoadedFunc loaded_func,
+    gpointer loaded_data, GAsyncReadyCallback callback, gpointer user_data);
+GPtrArray *mate_desktop_item_load_directory_finish(GAsyncResult *result,
+                                                   GError **error);
+void mate_desktop_item_load_files_async(const char *const *files,
+                                        MateDesktopItemLoadFlags flags,
+                                        GCancellable *cancellable,
+                                        MateDesktopItemLoadedFunc loaded_func,
+                                        gpointer loaded_data,
+                                        GAsyncReadyCallback callback,
+                                        gpointer user_data);
+GPtrArray *mate_desktop_item_load_files_finish(GAsyncResult *result,
+                                               GError **error);
+
 /* if under is NULL save in original location */
 gboolean mate_desktop_item_save(MateDesktopItem *item, const char *under,
                                 gboolean force, GError **error);
@@ -28,11 +28,24 @@
 #include <config.h>
 #endif
 
+#ifdef HAVE_MEMFD_CREATE
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define MATE_DESKTOP_USE_UNSTABLE_API
 #include "mate-desktop-thumbnail.h"
@@ -50,9 +63,31 @@ struct _MateDesktopThumbnailFactoryPrivate {
   GHashTable *mime_types_map;
   GList *monitors;
 
+  /* Thumbnails queued with mate_desktop_thumbnail_factory_queue_thumbnail() */
+  GMutex queue_lock;
+  GThreadPool *pool;
+  GQueue queue;
+  GHashTable *requests;
+  guint max_jobs;
+
+  /* Batches of mate_desktop_thumbnail_factory_lookup_many(), made on first
+   * use under queue_lock */
+  GThreadPool *lookup_pool;
+
+  /* zlib level of saved thumbnails, or -1 for the default */
+  gint compression;
+
+  /* Failed thumbnails in the fail directory, see failed_index_lookup() */
+  GMutex failed_lock;
+  GHashTable *failed;
+  gint64 failed_dir_mtime; /* in nanoseconds, see failed_dir_stat() */
+  goffset failed_dir_size;
+  gint64 failed_checked;
+
   GSettings *settings;
   gboolean loaded : 1;
   gboolean disabled : 1;
+  gboolean in_memory_output : 1;
   gchar **disabled_types;
 };
 
@@ -345,18 +380,12 @@ static void remove_thumbnailers_for_dir(MateDesktopThumbnailFactory *factory,
   g_mutex_unlock(&priv->lock);
 }
 
-static void mate_desktop_thumbnail_factory_load_thumbnailers_for_dir(
+static void mate_desktop_thumbnail_factory_monitor_thumbnailers_dir(
     MateDesktopThumbnailFactory *factory, const gchar *path) {
   MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
-  GDir *dir;
   GFile *dir_file;
   GFileMonitor *monitor;
-  const gchar *dirent;
-
-  dir = g_dir_open(path, 0, NULL);
-  if (!dir) return;
 
-  /* Monitor dir */
   dir_file = g_file_new_for_path(path);
   monitor = g_file_monitor_directory(dir_file, G_FILE_MONITOR_NONE, NULL, NULL);
   if (monitor) {
@@ -365,6 +394,17 @@ static void mate_desktop_thumbnail_factory_load_thumbnailers_for_dir(
     priv->monitors = g_list_prepend(priv->monitors, monitor);
   }
   g_object_unref(dir_file);
+}
+
+static void mate_desktop_thumbnail_factory_load_thumbnailers_for_dir(
+    MateDesktopThumbnailFactory *factory, const gchar *path) {
+  GDir *dir;
+  const gchar *dirent;
+
+  dir = g_dir_open(path, 0, NULL);
+  if (!dir) return;
+
+  mate_desktop_thumbnail_factory_monitor_thumbnailers_dir(factory, path);
 
   while ((dirent = g_dir_read_name(dir))) {
     Thumbnailer *thumb;
@@ -382,6 +422,156 @@ static void mate_desktop_thumbnail_factory_load_thumbnailers_for_dir(
   g_dir_close(dir);
 }
 
+/* The thumbnailers found in the thumbnailer directories, so that factories
+ * don't have to read them all again while none of the directories changed.
+ * It's a GVariant of SNAPSHOT_TYPE: the version, the modification time of
+ * each directory, or 0 if it doesn't exist, and the thumbnailers in the
+ * order they were registered. */
+#define THUMBNAILERS_SNAPSHOT "mate/thumbnailers.snapshot"
+#define THUMBNAILERS_SNAPSHOT_VERSION 1
+#define THUMBNAILERS_SNAPSHOT_TYPE "(ua(sx)a(sssas))"
+
+static char *thumbnailers_snapshot_path(void) {
+  return g_build_filename(g_get_user_cache_dir(), THUMBNAILERS_SNAPSHOT, NULL);
+}
+
+static void invalidate_thumbnailers_snapshot(void) {
+  char *path = thumbnailers_snapshot_path();
+
+  g_unlink(path);
+  g_free(path);
+}
+
+/* Returns the a(sx) of the thumbnailer directories as they are now */
+static GVariant *get_thumbnailers_dirs_state(void) {
+  const gchar *const *dirs;
+  GVariantBuilder builder;
+  guint i;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sx)"));
+
+  dirs = get_thumbnailers_dirs();
+  for (i = 0; dirs[i]; i++) {
+    GFileInfo *info;
+    GFile *file;
+    gint64 mtime = 0;
+
+    file = g_file_new_for_path(dirs[i]);
+    info = g_file_query_info(file,
+                             G_FILE_ATTRIBUTE_TIME_MODIFIED
+                             "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                             G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    if (info) {
+      mtime = (gint64)g_file_info_get_attribute_uint64(
+                  info, G_FILE_ATTRIBUTE_TIME_MODIFIED) *
+                  G_USEC_PER_SEC +
+              g_file_info_get_attribute_uint32(
+                  info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+      g_object_unref(info);
+    }
+    g_object_unref(file);
+
+    g_variant_builder_add(&builder, "(sx)", dirs[i], mtime);
+  }
+
+  return g_variant_ref_sink(g_variant_builder_end(&builder));
+}
+
+/* Registers the thumbnailers of the snapshot, if it was taken of the
+ * directories in @dirs_state. Called with the lock held. */
+static gboolean mate_desktop_thumbnail_factory_load_snapshot(
+    MateDesktopThumbnailFactory *factory, GVariant *dirs_state) {
+  GMappedFile *mapped;
+  GVariant *snapshot, *dirs, *thumbnailers;
+  GVariantIter iter;
+  GBytes *bytes;
+  gboolean loaded = FALSE;
+  guint32 version;
+  char *path;
+  const gchar *thumb_path, *command, *try_exec;
+  gchar **mime_types;
+
+  path = thumbnailers_snapshot_path();
+  mapped = g_mapped_file_new(path, FALSE, NULL);
+  g_free(path);
+
+  if (!mapped) return FALSE;
+
+  /* untrusted, so GVariant checks every access against the file size */
+  bytes = g_mapped_file_get_bytes(mapped);
+  g_mapped_file_unref(mapped);
+  snapshot = g_variant_ref_sink(g_variant_new_from_bytes(
+      G_VARIANT_TYPE(THUMBNAILERS_SNAPSHOT_TYPE), bytes, FALSE));
+  g_bytes_unref(bytes);
+
+  g_variant_get_child(snapshot, 0, "u", &version);
+  dirs = g_variant_get_child_value(snapshot, 1);
+
+  if (version == THUMBNAILERS_SNAPSHOT_VERSION &&
+      g_variant_equal(dirs, dirs_state)) {
+    thumbnailers = g_variant_get_child_value(snapshot, 2);
+
+    g_variant_iter_init(&iter, thumbnailers);
+    while (g_variant_iter_next(&iter, "(&s&s&s^as)", &thumb_path, &command,
+                               &try_exec, &mime_types)) {
+      Thumbnailer *thumb;
+
+      thumb = g_slice_new0(Thumbnailer);
+      thumb->ref_count = 1;
+      thumb->path = g_strdup(thumb_path);
+      thumb->command = g_strdup(command);
+      thumb->try_exec = *try_exec ? g_strdup(try_exec) : NULL;
+      thumb->mime_types = mime_types;
+
+      mate_desktop_thumbnail_factory_add_thumbnailer(factory, thumb);
+    }
+
+    g_variant_unref(thumbnailers);
+    loaded = TRUE;
+  }
+
+  g_variant_unref(dirs);
+  g_variant_unref(snapshot);
+
+  return loaded;
+}
+
+/* Called with the lock held, right after the directories were read */
+static void mate_desktop_thumbnail_factory_save_snapshot(
+    MateDesktopThumbnailFactory *factory, GVariant *dirs_state) {
+  MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
+  GVariantBuilder builder;
+  GVariant *snapshot;
+  char *path, *dir;
+  GList *l;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sssas)"));
+
+  /* thumbnailers are prepended as they are registered */
+  for (l = g_list_last(priv->thumbnailers); l; l = l->prev) {
+    Thumbnailer *thumb = l->data;
+
+    g_variant_builder_add(&builder, "(sss^as)", thumb->path, thumb->command,
+                          thumb->try_exec ? thumb->try_exec : "",
+                          thumb->mime_types);
+  }
+
+  snapshot = g_variant_ref_sink(
+      g_variant_new("(u@a(sx)a(sssas))", THUMBNAILERS_SNAPSHOT_VERSION,
+                    dirs_state, &builder));
+
+  path = thumbnailers_snapshot_path();
+  dir = g_path_get_dirname(path);
+
+  if (g_mkdir_with_parents(dir, 0700) == 0)
+    g_file_set_contents(path, g_variant_get_data(snapshot),
+                        g_variant_get_size(snapshot), NULL);
+
+  g_free(dir);
+  g_free(path);
+  g_variant_unref(snapshot);
+}
+
 static void thumbnailers_directory_changed(
     GFileMonitor *monitor, GFile *file, GFile *other_file,
     GFileMonitorEvent event_type, MateDesktopThumbnailFactory *factory) {
@@ -397,6 +587,9 @@ static void thumbnailers_directory_changed(
         return;
       }
 
+      /* files edited in place don't change the directory mtime */
+      invalidate_thumbnailers_snapshot();
+
       if (event_type == G_FILE_MONITOR_EVENT_DELETED)
         remove_thumbnailer(factory, path);
       else
@@ -406,6 +599,8 @@ static void thumbnailers_directory_changed(
       break;
     case G_FILE_MONITOR_EVENT_UNMOUNTED:
     case G_FILE_MONITOR_EVENT_MOVED:
+      invalidate_thumbnailers_snapshot();
+
       path = g_file_get_path(file);
       remove_thumbnailers_for_dir(factory, path, monitor);
 
@@ -427,14 +622,33 @@ static void mate_desktop_thumbnail_factory_load_thumbnailers(
   MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
   const gchar *const *dirs;
   guint i;
+  GVariant *dirs_state;
+  GVariantIter iter;
+  const gchar *path;
+  gint64 mtime;
 
   if (priv->loaded) return;
 
-  dirs = get_thumbnailers_dirs();
-  for (i = 0; dirs[i]; i++) {
-    mate_desktop_thumbnail_factory_load_thumbnailers_for_dir(factory, dirs[i]);
+  /* taken before reading, so changes made meanwhile aren't missed */
+  dirs_state = get_thumbnailers_dirs_state();
+
+  if (mate_desktop_thumbnail_factory_load_snapshot(factory, dirs_state)) {
+    g_variant_iter_init(&iter, dirs_state);
+    while (g_variant_iter_next(&iter, "(&sx)", &path, &mtime))
+      if (mtime != 0)
+        mate_desktop_thumbnail_factory_monitor_thumbnailers_dir(factory, path);
+  } else {
+    dirs = get_thumbnailers_dirs();
+    for (i = 0; dirs[i]; i++) {
+      mate_desktop_thumbnail_factory_load_thumbnailers_for_dir(factory,
+                                                               dirs[i]);
+    }
+
+    mate_desktop_thumbnail_factory_save_snapshot(factory, dirs_state);
   }
 
+  g_variant_unref(dirs_state);
+
   priv->loaded = TRUE;
 }
 
@@ -472,6 +686,16 @@ static void external_thumbnailers_disabled_changed_cb(
   g_mutex_unlock(&priv->lock);
 }
 
+static void in_memory_output_changed_cb(GSettings *settings, const gchar *key,
+                                       MateDesktopThumbnailFactory *factory) {
+  MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
+
+  g_mutex_lock(&priv->lock);
+  priv->in_memory_output =
+      g_settings_get_boolean(priv->settings, "in-memory-output");
+  g_mutex_unlock(&priv->lock);
+}
+
 static void mate_desktop_thumbnail_factory_init(
     MateDesktopThumbnailFactory *factory) {
   MateDesktopThumbnailFactoryPrivate *priv;
@@ -481,6 +705,7 @@ static void mate_desktop_thumbnail_factory_init(
   priv = factory->priv;
 
   priv->size = MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL;
+  priv->compression = -1;
 
   priv->mime_types_map =
       g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free,
@@ -488,6 +713,12 @@ static void mate_desktop_thumbnail_factory_init(
 
   g_mutex_init(&priv->lock);
 
+  g_mutex_init(&priv->queue_lock);
+  g_queue_init(&priv->queue);
+  priv->requests = g_hash_table_new(g_str_hash, g_str_equal);
+
+  g_mutex_init(&priv->failed_lock);
+
   priv->settings = g_settings_new("org.mate.thumbnailers");
 
   g_signal_connect(priv->settings, "changed::disable-all",
@@ -496,8 +727,12 @@ static void mate_desktop_thumbnail_factory_init(
   g_signal_connect(priv->settings, "changed::disable",
                    G_CALLBACK(external_thumbnailers_disabled_changed_cb),
                    factory);
+  g_signal_connect(priv->settings, "changed::in-memory-output",
+                   G_CALLBACK(in_memory_output_changed_cb), factory);
 
   priv->disabled = g_settings_get_boolean(priv->settings, "disable-all");
+  priv->in_memory_output =
+      g_settings_get_boolean(priv->settings, "in-memory-output");
 
   if (!priv->disabled)
     priv->disabled_types = g_settings_get_strv(priv->settings, "disable");
@@ -528,6 +763,18 @@ static void mate_desktop_thumbnail_factory_finalize(GObject *object) {
 
   g_mutex_clear(&priv->lock);
 
+  /* Every token pushed to the pool holds a reference until its worker is
+   * done with it, so no worker can still be using priv here. This may run
+   * on a worker dropping the last reference, so it must not wait. */
+  if (priv->pool) g_thread_pool_free(priv->pool, TRUE, FALSE);
+  /* lookups hold a reference while they run, so this one is idle */
+  if (priv->lookup_pool) g_thread_pool_free(priv->lookup_pool, TRUE, FALSE);
+  g_clear_pointer(&priv->requests, g_hash_table_destroy);
+  g_mutex_clear(&priv->queue_lock);
+
+  g_clear_pointer(&priv->failed, g_hash_table_destroy);
+  g_mutex_clear(&priv->failed_lock);
+
   g_clear_pointer(&priv->disabled_types, g_strfreev);
 
   if (priv->settings) {
@@ -535,6 +782,8 @@ static void mate_desktop_thumbnail_factory_finalize(GObject *object) {
         priv->settings, external_thumbnailers_disabled_all_changed_cb, factory);
     g_signal_handlers_disconnect_by_func(
         priv->settings, external_thumbnailers_disabled_changed_cb, factory);
+    g_signal_handlers_disconnect_by_func(priv->settings,
+                                         in_memory_output_changed_cb, factory);
     g_clear_object(&priv->settings);
   }
 
@@ -595,14 +844,33 @@ static char *thumbnail_filename(const char *uri) {
   return file;
 }
 
+/* The directory and largest dimension of each size in the thumbnail spec */
+static const struct {
+  const char *dir;
+  int pixels;
+} thumbnail_sizes[] = {
+    [MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL] = {"normal", 128},
+    [MATE_DESKTOP_THUMBNAIL_SIZE_LARGE] = {"large", 256},
+    [MATE_DESKTOP_THUMBNAIL_SIZE_XLARGE] = {"x-large", 512},
+    [MATE_DESKTOP_THUMBNAIL_SIZE_XXLARGE] = {"xx-large", 1024},
+};
+
+static int thumbnail_size_pixels(MateDesktopThumbnailSize size) {
+  if ((guint)size >= G_N_ELEMENTS(thumbnail_sizes))
+    size = MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL;
+
+  return thumbnail_sizes[size].pixels;
+}
+
 static char *thumbnail_path(const char *uri, MateDesktopThumbnailSize size) {
   char *path, *file;
 
+  if ((guint)size >= G_N_ELEMENTS(thumbnail_sizes))
+    size = MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL;
+
   file = thumbnail_filename(uri);
-  path = g_build_filename(
-      g_get_user_cache_dir(), "thumbnails",
-      size == MATE_DESKTOP_THUMBNAIL_SIZE_LARGE ? "large" : "normal", file,
-      NULL);
+  path = g_build_filename(g_get_user_cache_dir(), "thumbnails",
+                          thumbnail_sizes[size].dir, file, NULL);
   g_free(file);
   return path;
 }
@@ -618,18 +886,180 @@ static char *thumbnail_failed_path(const char *uri) {
   return path;
 }
 
+static gboolean thumbnail_info_is_valid(const char *thumb_uri,
+                                        const char *thumb_mtime_str,
+                                        const char *uri, time_t mtime) {
+  time_t thumb_mtime;
+
+  if (g_strcmp0(uri, thumb_uri) != 0) return FALSE;
+
+  if (!thumb_mtime_str) return FALSE;
+  thumb_mtime = (time_t)g_ascii_strtoll(thumb_mtime_str, (gchar **)NULL, 10);
+  if (mtime != thumb_mtime) return FALSE;
+
+  return TRUE;
+}
+
+/* Thumbnails are validated by their Thumb::URI and Thumb::MTime text chunks
+ * alone. Those come before the image data, so rather than having
+ * gdk-pixbuf decode the whole image, the chunks are read up to the first
+ * IDAT. */
+#define PNG_SIGNATURE "\211PNG\r\n\032\n"
+#define PNG_TEXT_CHUNK_MAX (64 * 1024)
+
+typedef enum {
+  PNG_TEXT_READ,   /* every chunk before the image data was looked at */
+  PNG_TEXT_NONE,   /* not a PNG file, or not one gdk-pixbuf could load */
+  PNG_TEXT_UNSURE, /* compressed text, only a full load can tell */
+} PngTextResult;
+
+static guint32 png_crc(const guint8 *data, gsize len) {
+  guint32 crc = 0xffffffff;
+  gsize i;
+  int k;
+
+  for (i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+  }
+
+  return crc ^ 0xffffffff;
+}
+
+static guint32 png_uint32(const guint8 *p) {
+  return ((guint32)p[0] << 24) | ((guint32)p[1] << 16) | ((guint32)p[2] << 8) |
+         (guint32)p[3];
+}
+
+/* Stores the text of a tEXt or uncompressed iTXt chunk if it is one of the
+ * keys asked for and the first of its kind, like gdk-pixbuf's options */
+static void png_text_chunk(const guint8 *type, const guint8 *data, gsize len,
+                           char **uri, char **mtime,
+                           gboolean *compressed) {
+  const char *key = (const char *)data;
+  const guint8 *end = data + len;
+  const guint8 *text;
+  char **value;
+
+  text = memchr(data, '\0', len);
+  if (!text) return;
+  text++;
+
+  if (strcmp(key, "Thumb::URI") == 0)
+    value = uri;
+  else if (strcmp(key, "Thumb::MTime") == 0)
+    value = mtime;
+  else
+    return;
+
+  if (*value) return;
+
+  if (memcmp(type, "iTXt", 4) == 0) {
+    /* compression flag and method, language tag, translated keyword */
+    if (end - text < 2) return;
+    if (text[0] != 0) {
+      *compressed = TRUE;
+      return;
+    }
+    text += 2;
+    if (!(text = memchr(text, '\0', end - text))) return;
+    text++;
+    if (!(text = memchr(text, '\0', end - text))) return;
+    text++;
+
+    *value = g_strndup((const char *)text, end - text);
+  } else {
+    /* tEXt is Latin-1 */
+    *value = g_convert((const char *)text, end - text, "UTF-8", "ISO-8859-1",
+                       NULL, NULL, NULL);
+  }
+}
+
+static PngTextResult read_png_text(const char *path, char **uri,
+                                   char **mtime) {
+  PngTextResult result = PNG_TEXT_NONE;
+  gboolean compressed = FALSE;
+  guint8 head[8];
+  guint8 *chunk = NULL;
+  FILE *file;
+
+  *uri = NULL;
+  *mtime = NULL;
+
+  if (!(file = g_fopen(path, "rb"))) return PNG_TEXT_NONE;
+
+  if (fread(head, 1, 8, file) != 8 || memcmp(head, PNG_SIGNATURE, 8) != 0)
+    goto out;
+
+  while (fread(head, 1, 8, file) == 8) {
+    const guint8 *type = head + 4;
+    guint32 length = png_uint32(head);
+
+    if (length > G_MAXINT32) break;
+
+    if (memcmp(type, "IDAT", 4) == 0 || memcmp(type, "IEND", 4) == 0) {
+      result = compressed && (!*uri || !*mtime) ? PNG_TEXT_UNSURE
+                                                : PNG_TEXT_READ;
+      break;
+    }
+
+    if (memcmp(type, "zTXt", 4) == 0) compressed = TRUE;
+
+    if ((memcmp(type, "tEXt", 4) == 0 || memcmp(type, "iTXt", 4) == 0) &&
+        length <= PNG_TEXT_CHUNK_MAX) {
+      /* the CRC covers the type too; a bad one drops the chunk, as libpng
+       * does for ancillary chunks */
+      chunk = g_realloc(chunk, 4 + length + 4);
+      memcpy(chunk, type, 4);
+      if (fread(chunk + 4, 1, length + 4, file) != length + 4) break;
+
+      if (png_crc(chunk, 4 + length) == png_uint32(chunk + 4 + length))
+        png_text_chunk(type, chunk + 4, length, uri, mtime, &compressed);
+    } else if (fseek(file, (long)length + 4, SEEK_CUR) != 0) {
+      break;
+    }
+  }
+
+out:
+  g_free(chunk);
+  fclose(file);
+
+  if (result != PNG_TEXT_READ) {
+    g_clear_pointer(uri, g_free);
+    g_clear_pointer(mtime, g_free);
+  }
+
+  return result;
+}
+
 static char *validate_thumbnail_path(char *path, const char *uri, time_t mtime,
                                      MateDesktopThumbnailSize size) {
   GdkPixbuf *pixbuf;
+  char *thumb_uri, *thumb_mtime;
+  gboolean valid = FALSE;
+
+  switch (read_png_text(path, &thumb_uri, &thumb_mtime)) {
+    case PNG_TEXT_READ:
+      valid = thumbnail_info_is_valid(thumb_uri, thumb_mtime, uri, mtime);
+      g_free(thumb_uri);
+      g_free(thumb_mtime);
+      break;
+    case PNG_TEXT_NONE:
+      break;
+    case PNG_TEXT_UNSURE:
+      pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+      if (pixbuf) {
+        valid = mate_desktop_thumbnail_is_valid(pixbuf, uri, mtime);
+        g_object_unref(pixbuf);
+      }
+      break;
+  }
 
-  pixbuf = gdk_pixbuf_new_from_file(path, NULL);
-  if (pixbuf == NULL || !mate_desktop_thumbnail_is_valid(pixbuf, uri, mtime)) {
+  if (!valid) {
     g_free(path);
     return NULL;
   }
 
-  g_clear_object(&pixbuf);
-
   return path;
 }
 
@@ -669,90 +1099,673 @@ char *mate_desktop_thumbnail_factory_lookup(
   return lookup_thumbnail_path(uri, mtime, priv->size);
 }
 
+/* Batches of this many lookups are handed to one thread at a time */
+#define LOOKUP_BATCH_SIZE 64
+
+typedef struct {
+  const char *const *uris;
+  const time_t *mtimes;
+  MateDesktopThumbnailSize size;
+  GCancellable *cancellable;
+  char **paths;
+
+  GMutex lock;
+  GCond done;
+  guint pending; /* batches still on the pool */
+} LookupContext;
+
+typedef struct {
+  LookupContext *ctx;
+  guint first;
+  guint end;
+} LookupBatch;
+
+static void lookup_range(LookupContext *ctx, guint first, guint end) {
+  guint i;
+
+  for (i = first; i < end; i++) {
+    if (g_cancellable_is_cancelled(ctx->cancellable)) return;
+
+    if (ctx->uris[i] != NULL)
+      ctx->paths[i] = lookup_thumbnail_path(ctx->uris[i], ctx->mtimes[i],
+                                            ctx->size);
+  }
+}
+
+static void lookup_batch(gpointer data, gpointer user_data) {
+  LookupBatch *batch = data;
+  LookupContext *ctx = batch->ctx;
+
+  lookup_range(ctx, batch->first, batch->end);
+
+  g_mutex_lock(&ctx->lock);
+  if (--ctx->pending == 0) g_cond_signal(&ctx->done);
+  g_mutex_unlock(&ctx->lock);
+}
+
+static GThreadPool *get_lookup_pool(MateDesktopThumbnailFactory *factory) {
+  MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
+  GThreadPool *pool;
+
+  g_mutex_lock(&priv->queue_lock);
+  if (!priv->lookup_pool)
+    priv->lookup_pool = g_thread_pool_new(
+        lookup_batch, NULL, (gint)g_get_num_processors(), FALSE, NULL);
+  pool = priv->lookup_pool;
+  g_mutex_unlock(&priv->queue_lock);
+
+  return pool;
+}
+
+/* The result has one path, or NULL, per uri */
+static GPtrArray *lookup_many(MateDesktopThumbnailFactory *factory,
+                              const char *const *uris, const time_t *mtimes,
+                              guint n_uris, GCancellable *cancellable) {
+  LookupContext ctx;
+  LookupBatch *batches;
+  GPtrArray *result;
+  guint n_batches, i;
+
+  ctx.uris = uris;
+  ctx.mtimes = mtimes;
+  ctx.size = factory->priv->size;
+  ctx.cancellable = cancellable;
+  ctx.paths = g_new0(char *, n_uris);
+  g_mutex_init(&ctx.lock);
+  g_cond_init(&ctx.done);
+
+  n_batches = (n_uris + LOOKUP_BATCH_SIZE - 1) / LOOKUP_BATCH_SIZE;
+  batches = g_new(LookupBatch, n_batches);
+  ctx.pending = n_batches > 0 ? n_batches - 1 : 0;
+
+  for (i = 0; i < n_batches; i++) {
+    batches[i].ctx = &ctx;
+    batches[i].first = i * LOOKUP_BATCH_SIZE;
+    batches[i].end = MIN(n_uris, (i + 1) * LOOKUP_BATCH_SIZE);
+  }
+
+  /* the first batch is looked up on this thread while the pool does the
+   * rest */
+  if (n_batches > 1) {
+    GThreadPool *pool = get_lookup_pool(factory);
+
+    for (i = 1; i < n_batches; i++) g_thread_pool_push(pool, &batches[i], NULL);
+  }
+  if (n_batches > 0) lookup_range(&ctx, batches[0].first, batches[0].end);
+
+  g_mutex_lock(&ctx.lock);
+  while (ctx.pending > 0) g_cond_wait(&ctx.done, &ctx.lock);
+  g_mutex_unlock(&ctx.lock);
+
+  result = g_ptr_array_new_full(n_uris, g_free);
+  for (i = 0; i < n_uris; i++) g_ptr_array_add(result, ctx.paths[i]);
+
+  g_cond_clear(&ctx.done);
+  g_mutex_clear(&ctx.lock);
+  g_free(ctx.paths);
+  g_free(batches);
+
+  return result;
+}
+
 /**
- * mate_desktop_thumbnail_factory_has_valid_failed_thumbnail:
+ * mate_desktop_thumbnail_factory_lookup_many:
  * @factory: a #MateDesktopThumbnailFactory
- * @uri: the uri of a file
- * @mtime: the mtime of the file
+ * @uris: (array length=n_uris): the uris of the files
+ * @mtimes: (array length=n_uris): the mtimes of the files
+ * @n_uris: the number of files
  *
- * Tries to locate an failed thumbnail for the file specified. Writing
- * and looking for failed thumbnails is important to avoid to try to
- * thumbnail e.g. broken images several times.
+ * Like mate_desktop_thumbnail_factory_lookup(), for many files at once. The
+ * thumbnails are looked up on as many threads as there are processors.
  *
  * Usage of this function is threadsafe.
  *
- * Return value: TRUE if there is a failed thumbnail for the file.
- *
- * Since: 2.2
+ * Return value: (transfer full) (element-type filename): an array with the
+ * absolute path of the thumbnail of each file in @uris, or %NULL where
+ * there is none
  **/
-gboolean mate_desktop_thumbnail_factory_has_valid_failed_thumbnail(
-    MateDesktopThumbnailFactory *factory, const char *uri, time_t mtime) {
-  char *path;
+GPtrArray *mate_desktop_thumbnail_factory_lookup_many(
+    MateDesktopThumbnailFactory *factory, const char *const *uris,
+    const time_t *mtimes, guint n_uris) {
+  g_return_val_if_fail(MATE_DESKTOP_IS_THUMBNAIL_FACTORY(factory), NULL);
+  g_return_val_if_fail(uris != NULL || n_uris == 0, NULL);
+  g_return_val_if_fail(mtimes != NULL || n_uris == 0, NULL);
+
+  return lookup_many(factory, uris, mtimes, n_uris, NULL);
+}
 
-  g_return_val_if_fail(uri != NULL, FALSE);
+typedef struct {
+  char **uris;
+  time_t *mtimes;
+  guint n_uris;
+} LookupManyData;
+
+static void lookup_many_data_free(LookupManyData *data) {
+  guint i;
 
-  path = lookup_failed_thumbnail_path(uri, mtime, factory->priv->size);
-  if (path == NULL) return FALSE;
+  /* not g_strfreev(), @uris may have NULLs in the middle */
+  for (i = 0; i < data->n_uris; i++) g_free(data->uris[i]);
+  g_free(data->uris);
+  g_free(data->mtimes);
+  g_free(data);
+}
 
-  g_free(path);
+static void lookup_many_thread(GTask *task, gpointer source_object,
+                               gpointer task_data, GCancellable *cancellable) {
+  LookupManyData *data = task_data;
+  GPtrArray *paths;
 
-  return TRUE;
+  paths = lookup_many(MATE_DESKTOP_THUMBNAIL_FACTORY(source_object),
+                      (const char *const *)data->uris, data->mtimes,
+                      data->n_uris, cancellable);
+
+  if (g_task_return_error_if_cancelled(task)) {
+    g_ptr_array_unref(paths);
+    return;
+  }
+
+  g_task_return_pointer(task, paths, (GDestroyNotify)g_ptr_array_unref);
 }
 
 /**
- * mate_desktop_thumbnail_factory_can_thumbnail:
+ * mate_desktop_thumbnail_factory_lookup_many_async:
  * @factory: a #MateDesktopThumbnailFactory
- * @uri: the uri of a file
- * @mime_type: the mime type of the file
- * @mtime: the mtime of the file
- *
- * Returns TRUE if this MateDesktopThumbnailFactory can (at least try) to
- *thumbnail this file. Thumbnails or files with failed thumbnails won't be
- *thumbnailed.
+ * @uris: (array length=n_uris): the uris of the files
+ * @mtimes: (array length=n_uris): the mtimes of the files
+ * @n_uris: the number of files
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: called when the thumbnails have been looked up
+ * @user_data: data for @callback
  *
- * Usage of this function is threadsafe.
+ * Starts mate_desktop_thumbnail_factory_lookup_many() on another thread.
+ * @uris and @mtimes are copied, so they can be freed right away. Call
+ * mate_desktop_thumbnail_factory_lookup_many_finish() from @callback to
+ * get the result.
+ **/
+void mate_desktop_thumbnail_factory_lookup_many_async(
+    MateDesktopThumbnailFactory *factory, const char *const *uris,
+    const time_t *mtimes, guint n_uris, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data) {
+  LookupManyData *data;
+  GTask *task;
+  guint i;
+
+  g_return_if_fail(MATE_DESKTOP_IS_THUMBNAIL_FACTORY(factory));
+  g_return_if_fail(uris != NULL || n_uris == 0);
+  g_return_if_fail(mtimes != NULL || n_uris == 0);
+
+  data = g_new0(LookupManyData, 1);
+  data->uris = g_new0(char *, n_uris);
+  for (i = 0; i < n_uris; i++) data->uris[i] = g_strdup(uris[i]);
+  data->mtimes = g_new(time_t, n_uris);
+  memcpy(data->mtimes, mtimes, n_uris * sizeof(time_t));
+  data->n_uris = n_uris;
+
+  task = g_task_new(factory, cancellable, callback, user_data);
+  g_task_set_source_tag(task, mate_desktop_thumbnail_factory_lookup_many_async);
+  g_task_set_task_data(task, data, (GDestroyNotify)lookup_many_data_free);
+  g_task_run_in_thread(task, lookup_many_thread);
+  g_object_unref(task);
+}
+
+/**
+ * mate_desktop_thumbnail_factory_lookup_many_finish:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError, or %NULL
  *
- * Return value: TRUE if the file can be thumbnailed.
+ * Finishes an operation started with
+ * mate_desktop_thumbnail_factory_lookup_many_async().
  *
- * Since: 2.2
+ * Return value: (transfer full) (element-type filename): the same array
+ * mate_desktop_thumbnail_factory_lookup_many() returns, or %NULL if the
+ * lookup was cancelled
  **/
-gboolean mate_desktop_thumbnail_factory_can_thumbnail(
-    MateDesktopThumbnailFactory *factory, const char *uri,
-    const char *mime_type, time_t mtime) {
-  gboolean have_script = FALSE;
+GPtrArray *mate_desktop_thumbnail_factory_lookup_many_finish(
+    MateDesktopThumbnailFactory *factory, GAsyncResult *result,
+    GError **error) {
+  g_return_val_if_fail(g_task_is_valid(result, factory), NULL);
 
-  /* Don't thumbnail thumbnails */
-  if (uri && strncmp(uri, "file:/", 6) == 0 &&
-      (strstr(uri, "/.thumbnails/") != NULL ||
-       strstr(uri, "/.cache/thumbnails/") != NULL))
-    return FALSE;
+  return g_task_propagate_pointer(G_TASK(result), error);
+}
 
-  if (!mime_type) return FALSE;
+/* How often the fail directory is checked for thumbnails other processes
+ * wrote */
+#define FAILED_INDEX_RECHECK_USEC (2 * G_USEC_PER_SEC)
 
-  g_mutex_lock(&factory->priv->lock);
-  if (!mate_desktop_thumbnail_factory_is_disabled(factory, mime_type)) {
-    Thumbnailer *thumb;
+/* A failed thumbnail that hasn't been read yet, or can't be used */
+#define FAILED_MTIME_UNKNOWN G_MININT64
+#define FAILED_MTIME_INVALID (G_MININT64 + 1)
 
-    thumb = g_hash_table_lookup(factory->priv->mime_types_map, mime_type);
-    have_script = thumbnailer_try_exec(thumb);
-  }
-  g_mutex_unlock(&factory->priv->lock);
+typedef struct {
+  guint8 digest[16];
+  gint64 mtime;
+} FailedThumbnail;
 
-  if (uri && (have_script)) {
-    return !mate_desktop_thumbnail_factory_has_valid_failed_thumbnail(
-        factory, uri, mtime);
-  }
+static guint failed_thumbnail_hash(gconstpointer key) {
+  const FailedThumbnail *failed = key;
+  guint hash;
 
-  return FALSE;
+  /* the digest is already as well spread as it gets */
+  memcpy(&hash, failed->digest, sizeof(hash));
+  return hash;
 }
 
-static char *expand_thumbnailing_elem(const char *elem, const int size,
-                                      const char *inuri, const char *outfile,
-                                      gboolean *got_input,
-                                      gboolean *got_output) {
-  GString *str;
-  const char *p, *last;
-  char *localfile;
+static gboolean failed_thumbnail_equal(gconstpointer a, gconstpointer b) {
+  return memcmp(((const FailedThumbnail *)a)->digest,
+                ((const FailedThumbnail *)b)->digest, 16) == 0;
+}
+
+static void uri_digest(const char *uri, guint8 digest[16]) {
+  GChecksum *checksum;
+  gsize digest_len = 16;
+
+  checksum = g_checksum_new(G_CHECKSUM_MD5);
+  g_checksum_update(checksum, (const guchar *)uri, -1);
+  g_checksum_get_digest(checksum, digest, &digest_len);
+  g_checksum_free(checksum);
+}
+
+/* Parses the digest back out of a thumbnail file name */
+static gboolean filename_digest(const char *name, guint8 digest[16]) {
+  guint i;
+
+  if (strlen(name) != 32 + strlen(".png") ||
+      !g_str_has_suffix(name, ".png"))
+    return FALSE;
+
+  for (i = 0; i < 16; i++) {
+    int hi = g_ascii_xdigit_value(name[2 * i]);
+    int lo = g_ascii_xdigit_value(name[2 * i + 1]);
+
+    if (hi < 0 || lo < 0) return FALSE;
+    digest[i] = (guint8)(hi << 4 | lo);
+  }
+
+  return TRUE;
+}
+
+/* What tells whether the fail directory changed. Several thumbnails can
+ * fail within a second, so the mtime is taken to the nanosecond where
+ * struct stat has it, and the size of the directory listing catches most
+ * changes where it hasn't. */
+static void failed_dir_stat(const char *path, gint64 *mtime, goffset *size) {
+  GStatBuf st;
+
+  if (g_stat(path, &st) != 0) {
+    *mtime = 0;
+    *size = 0;
+    return;
+  }
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  *mtime = (gint64)st.st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+           st.st_mtim.tv_nsec;
+#else
+  *mtime = (gint64)st.st_mtime * G_GINT64_CONSTANT(1000000000);
+#endif
+  *size = st.st_size;
+}
+
+/* This only reads file names: what they were written for is read when
+ * they are first asked about */
+static GHashTable *read_failed_dir(const char *path) {
+  GHashTable *failed;
+  GDir *dir;
+
+  failed = g_hash_table_new_full(failed_thumbnail_hash, failed_thumbnail_equal,
+                                 g_free, NULL);
+
+  if ((dir = g_dir_open(path, 0, NULL))) {
+    const char *name;
+
+    while ((name = g_dir_read_name(dir))) {
+      FailedThumbnail *entry;
+
+      entry = g_new(FailedThumbnail, 1);
+      if (!filename_digest(name, entry->digest)) {
+        g_free(entry);
+        continue;
+      }
+
+      /* any of them may have been rewritten since they were read */
+      entry->mtime = FAILED_MTIME_UNKNOWN;
+      g_hash_table_add(failed, entry);
+    }
+    g_dir_close(dir);
+  }
+
+  return failed;
+}
+
+/* Lists the fail directory again if it changed since the last time. The
+ * disk is only touched with failed_lock released; the new index is
+ * swapped in under it. */
+static void failed_index_update(MateDesktopThumbnailFactory *factory) {
+  MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
+  GHashTable *failed;
+  gboolean unchanged;
+  goffset size;
+  gint64 now, mtime;
+  char *path;
+
+  g_mutex_lock(&priv->failed_lock);
+  now = g_get_monotonic_time();
+  if (priv->failed && now - priv->failed_checked < FAILED_INDEX_RECHECK_USEC) {
+    g_mutex_unlock(&priv->failed_lock);
+    return;
+  }
+  priv->failed_checked = now;
+  g_mutex_unlock(&priv->failed_lock);
+
+  path = g_build_filename(g_get_user_cache_dir(), "thumbnails", "fail",
+                          appname, NULL);
+  failed_dir_stat(path, &mtime, &size);
+
+  g_mutex_lock(&priv->failed_lock);
+  unchanged = priv->failed && mtime == priv->failed_dir_mtime &&
+              size == priv->failed_dir_size;
+  g_mutex_unlock(&priv->failed_lock);
+
+  if (unchanged) {
+    g_free(path);
+    return;
+  }
+
+  failed = read_failed_dir(path);
+  g_free(path);
+
+  g_mutex_lock(&priv->failed_lock);
+  if (priv->failed) g_hash_table_destroy(priv->failed);
+  priv->failed = failed;
+  priv->failed_dir_mtime = mtime;
+  priv->failed_dir_size = size;
+  g_mutex_unlock(&priv->failed_lock);
+}
+
+/* Tells whether there is a failed thumbnail for @uri at @mtime. Files
+ * without one, which is what is asked about most, are answered from
+ * memory, and the others are only read the first time. */
+static gboolean failed_index_lookup(MateDesktopThumbnailFactory *factory,
+                                    const char *uri, time_t mtime) {
+  MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
+  FailedThumbnail key, *entry;
+  gint64 entry_mtime = FAILED_MTIME_UNKNOWN;
+  char *path, *thumb_uri, *thumb_mtime;
+
+  uri_digest(uri, key.digest);
+
+  failed_index_update(factory);
+
+  g_mutex_lock(&priv->failed_lock);
+  entry = priv->failed ? g_hash_table_lookup(priv->failed, &key) : NULL;
+  if (entry) entry_mtime = entry->mtime;
+  g_mutex_unlock(&priv->failed_lock);
+
+  if (!entry) return FALSE;
+
+  if (entry_mtime != FAILED_MTIME_UNKNOWN)
+    return entry_mtime == (gint64)mtime;
+
+  path = thumbnail_failed_path(uri);
+  if (read_png_text(path, &thumb_uri, &thumb_mtime) != PNG_TEXT_READ) {
+    /* can't tell without decoding it, so don't remember anything */
+    char *valid_path;
+    gboolean valid;
+
+    valid_path = lookup_failed_thumbnail_path(uri, mtime, priv->size);
+    valid = valid_path != NULL;
+    g_free(valid_path);
+    g_free(path);
+
+    return valid;
+  }
+  g_free(path);
+
+  if (thumbnail_info_is_valid(thumb_uri, thumb_mtime, uri, mtime))
+    entry_mtime = mtime;
+  else if (g_strcmp0(thumb_uri, uri) == 0 && thumb_mtime)
+    entry_mtime = g_ascii_strtoll(thumb_mtime, NULL, 10);
+  else
+    entry_mtime = FAILED_MTIME_INVALID;
+
+  g_free(thumb_uri);
+  g_free(thumb_mtime);
+
+  /* the index may have been swapped meanwhile, and the file read again */
+  g_mutex_lock(&priv->failed_lock);
+  entry = priv->failed ? g_hash_table_lookup(priv->failed, &key) : NULL;
+  if (entry && entry->mtime == FAILED_MTIME_UNKNOWN) entry->mtime = entry_mtime;
+  g_mutex_unlock(&priv->failed_lock);
+
+  return entry_mtime == (gint64)mtime;
+}
+
+/* Records a failed thumbnail this factory just wrote. The stamp of the
+ * directory is left as it was: someone else may have written to it just
+ * as well, so it is listed again on the next check. */
+static void failed_index_add(MateDesktopThumbnailFactory *factory,
+                             const char *uri, time_t mtime) {
+  MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
+  FailedThumbnail *entry;
+
+  g_mutex_lock(&priv->failed_lock);
+
+  if (priv->failed) {
+    entry = g_new(FailedThumbnail, 1);
+    uri_digest(uri, entry->digest);
+    entry->mtime = mtime;
+    g_hash_table_replace(priv->failed, entry, entry);
+  }
+
+  g_mutex_unlock(&priv->failed_lock);
+}
+
+/**
+ * mate_desktop_thumbnail_factory_has_valid_failed_thumbnail:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @uri: the uri of a file
+ * @mtime: the mtime of the file
+ *
+ * Tries to locate an failed thumbnail for the file specified. Writing
+ * and looking for failed thumbnails is important to avoid to try to
+ * thumbnail e.g. broken images several times.
+ *
+ * The factory keeps an index of the failed thumbnails, so files without
+ * one are answered without touching the disk.
+ *
+ * Usage of this function is threadsafe.
+ *
+ * Return value: TRUE if there is a failed thumbnail for the file.
+ *
+ * Since: 2.2
+ **/
+gboolean mate_desktop_thumbnail_factory_has_valid_failed_thumbnail(
+    MateDesktopThumbnailFactory *factory, const char *uri, time_t mtime) {
+  g_return_val_if_fail(uri != NULL, FALSE);
+
+  return failed_index_lookup(factory, uri, mtime);
+}
+
+/* Formats that are common and cheap enough to decode without a
+ * thumbnailer process, if gdk-pixbuf has a loader for them */
+static const char *const in_process_mime_types[] = {
+    "image/png", "image/jpeg", "image/gif", "image/bmp", "image/webp",
+};
+
+static gpointer init_in_process_mime_types(gpointer data) {
+  GHashTable *mime_types;
+  GSList *formats, *l;
+
+  mime_types = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  formats = gdk_pixbuf_get_formats();
+  for (l = formats; l; l = l->next) {
+    GdkPixbufFormat *format = l->data;
+    char **format_types;
+    guint i, j;
+
+    if (gdk_pixbuf_format_is_disabled(format)) continue;
+
+    format_types = gdk_pixbuf_format_get_mime_types(format);
+    for (i = 0; format_types[i]; i++)
+      for (j = 0; j < G_N_ELEMENTS(in_process_mime_types); j++)
+        if (strcmp(format_types[i], in_process_mime_types[j]) == 0)
+          g_hash_table_add(mime_types, g_strdup(format_types[i]));
+    g_strfreev(format_types);
+  }
+  g_slist_free(formats);
+
+  return mime_types;
+}
+
+static gboolean can_load_in_process(const char *mime_type) {
+  static GOnce once_init = G_ONCE_INIT;
+  GHashTable *mime_types;
+
+  mime_types = g_once(&once_init, init_in_process_mime_types, NULL);
+
+  return g_hash_table_contains(mime_types, mime_type);
+}
+
+/* Most loaders decode the whole image before scaling it, so a small file
+ * that claims huge dimensions could take gigabytes in this process. Images
+ * over this many pixels are left to the thumbnailer, which runs in a
+ * process of its own. */
+#define IN_PROCESS_MAX_PIXELS (64 * 1000 * 1000)
+
+typedef struct {
+  int size;
+  gboolean too_large;
+} InProcessLoad;
+
+/* Only ever scales down, like the thumbnailers do */
+static void in_process_size_prepared(GdkPixbufLoader *loader, int width,
+                                     int height, gpointer data) {
+  InProcessLoad *load = data;
+  int size = load->size;
+  double scale;
+
+  if (width <= 0 || height <= 0 ||
+      (guint64)width * (guint64)height > IN_PROCESS_MAX_PIXELS) {
+    /* the loaders give up on a zero size before allocating anything */
+    gdk_pixbuf_loader_set_size(loader, 0, 0);
+    load->too_large = TRUE;
+    return;
+  }
+
+  if (width <= size && height <= size) return;
+
+  scale = MIN((double)size / width, (double)size / height);
+  gdk_pixbuf_loader_set_size(loader, MAX((int)(width * scale + 0.5), 1),
+                             MAX((int)(height * scale + 0.5), 1));
+}
+
+/* Decodes the image straight at thumbnail size. The loaders decode to the
+ * requested size where they can, the JPEG one with DCT scaling, so this
+ * skips the thumbnailer process, its temporary file and decoding that
+ * again. Returns NULL for images over IN_PROCESS_MAX_PIXELS, as soon as
+ * the header says so. */
+static GdkPixbuf *get_in_process_thumbnail(const char *uri,
+                                           const char *mime_type, int size) {
+  GdkPixbufLoader *loader;
+  GFileInputStream *stream;
+  GdkPixbuf *pixbuf = NULL;
+  GFile *file;
+  guchar buffer[65536];
+  InProcessLoad load = {size, FALSE};
+  gboolean ok = TRUE;
+  gssize n_read;
+
+  file = g_file_new_for_uri(uri);
+  stream = g_file_read(file, NULL, NULL);
+  g_object_unref(file);
+
+  if (!stream) return NULL;
+
+  loader = gdk_pixbuf_loader_new_with_mime_type(mime_type, NULL);
+  if (!loader) {
+    g_object_unref(stream);
+    return NULL;
+  }
+
+  g_signal_connect(loader, "size-prepared",
+                   G_CALLBACK(in_process_size_prepared), &load);
+
+  while (ok && !load.too_large &&
+         (n_read = g_input_stream_read(G_INPUT_STREAM(stream), buffer,
+                                       sizeof(buffer), NULL, NULL)) > 0)
+    ok = gdk_pixbuf_loader_write(loader, buffer, n_read, NULL);
+
+  if (n_read < 0 || load.too_large) ok = FALSE;
+
+  if (gdk_pixbuf_loader_close(loader, NULL) && ok) {
+    GdkPixbuf *loaded = gdk_pixbuf_loader_get_pixbuf(loader);
+
+    if (loaded) pixbuf = gdk_pixbuf_apply_embedded_orientation(loaded);
+  }
+
+  g_object_unref(loader);
+  g_object_unref(stream);
+
+  return pixbuf;
+}
+
+/**
+ * mate_desktop_thumbnail_factory_can_thumbnail:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @uri: the uri of a file
+ * @mime_type: the mime type of the file
+ * @mtime: the mtime of the file
+ *
+ * Returns TRUE if this MateDesktopThumbnailFactory can (at least try) to
+ *thumbnail this file. Thumbnails or files with failed thumbnails won't be
+ *thumbnailed.
+ *
+ * Usage of this function is threadsafe.
+ *
+ * Return value: TRUE if the file can be thumbnailed.
+ *
+ * Since: 2.2
+ **/
+gboolean mate_desktop_thumbnail_factory_can_thumbnail(
+    MateDesktopThumbnailFactory *factory, const char *uri,
+    const char *mime_type, time_t mtime) {
+  gboolean have_script = FALSE;
+
+  /* Don't thumbnail thumbnails */
+  if (uri && strncmp(uri, "file:/", 6) == 0 &&
+      (strstr(uri, "/.thumbnails/") != NULL ||
+       strstr(uri, "/.cache/thumbnails/") != NULL))
+    return FALSE;
+
+  if (!mime_type) return FALSE;
+
+  g_mutex_lock(&factory->priv->lock);
+  if (!mate_desktop_thumbnail_factory_is_disabled(factory, mime_type)) {
+    Thumbnailer *thumb;
+
+    thumb = g_hash_table_lookup(factory->priv->mime_types_map, mime_type);
+    have_script =
+        thumbnailer_try_exec(thumb) || can_load_in_process(mime_type);
+  }
+  g_mutex_unlock(&factory->priv->lock);
+
+  if (uri && (have_script)) {
+    return !mate_desktop_thumbnail_factory_has_valid_failed_thumbnail(
+        factory, uri, mtime);
+  }
+
+  return FALSE;
+}
+
+static char *expand_thumbnailing_elem(const char *elem, const int size,
+                                      const char *inuri, const char *outfile,
+                                      gboolean *got_input,
+                                      gboolean *got_output) {
+  GString *str;
+  const char *p, *last;
+  char *localfile;
 
   str = g_string_new(NULL);
 
@@ -889,6 +1902,173 @@ static GdkPixbuf *get_preview_thumbnail(const char *uri, int size) {
   return pixbuf;
 }
 
+static GdkPixbuf *run_thumbnailer(const char *script, int size,
+                                  const char *uri) {
+  GdkPixbuf *pixbuf = NULL;
+  char *tmpname;
+  int exit_status;
+  int fd;
+
+  fd = g_file_open_tmp(".mate_desktop_thumbnail.XXXXXX", &tmpname, NULL);
+
+  if (fd != -1) {
+    char **expanded_script;
+    GError *error = NULL;
+
+    close(fd);
+
+    expanded_script =
+        expand_thumbnailing_script(script, size, uri, tmpname, &error);
+    if (expanded_script == NULL) {
+      g_warning("Failed to expand script '%s': %s", script, error->message);
+      g_error_free(error);
+    } else {
+      gboolean ret;
+
+      ret = g_spawn_sync(NULL, expanded_script, NULL, G_SPAWN_SEARCH_PATH,
+                         NULL, NULL, NULL, NULL, &exit_status, NULL);
+      if (ret && exit_status == 0)
+        pixbuf = gdk_pixbuf_new_from_file(tmpname, NULL);
+
+      g_strfreev(expanded_script);
+    }
+
+    g_unlink(tmpname);
+    g_free(tmpname);
+  }
+
+  return pixbuf;
+}
+
+/* The fd the thumbnailer finds its output file on */
+#define THUMBNAILER_OUTPUT_FD 3
+
+/* Like run_thumbnailer(), but the thumbnailer writes to an anonymous memory
+ * file it reaches as /proc/self/fd/3, so nothing touches the disk. Returns
+ * FALSE if that isn't possible here, and run_thumbnailer() should be used
+ * instead. */
+static gboolean run_thumbnailer_in_memory(const char *script, int size,
+                                          const char *uri,
+                                          GdkPixbuf **pixbuf) {
+#ifdef HAVE_MEMFD_CREATE
+  GSubprocessLauncher *launcher;
+  GSubprocess *subprocess;
+  char **expanded_script;
+  GError *error = NULL;
+  char *outfile;
+  struct stat st;
+  int fd, child_fd;
+
+  *pixbuf = NULL;
+
+  fd = memfd_create("mate-desktop-thumbnail", MFD_CLOEXEC);
+  if (fd == -1) return FALSE;
+
+  child_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (child_fd == -1) {
+    close(fd);
+    return FALSE;
+  }
+
+  outfile = g_strdup_printf("/proc/self/fd/%d", THUMBNAILER_OUTPUT_FD);
+  expanded_script =
+      expand_thumbnailing_script(script, size, uri, outfile, &error);
+  g_free(outfile);
+
+  if (expanded_script == NULL) {
+    g_warning("Failed to expand script '%s': %s", script, error->message);
+    g_error_free(error);
+    close(child_fd);
+    close(fd);
+    return TRUE;
+  }
+
+  /* the launcher owns child_fd from here on */
+  launcher = g_subprocess_launcher_new(G_SUBPROCESS_FLAGS_NONE);
+  g_subprocess_launcher_take_fd(launcher, child_fd, THUMBNAILER_OUTPUT_FD);
+  subprocess = g_subprocess_launcher_spawnv(
+      launcher, (const char *const *)expanded_script, NULL);
+  g_object_unref(launcher);
+  g_strfreev(expanded_script);
+
+  if (subprocess && g_subprocess_wait_check(subprocess, NULL, NULL) &&
+      fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *data;
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
+
+      if (gdk_pixbuf_loader_write(loader, data, st.st_size, NULL) &&
+          gdk_pixbuf_loader_close(loader, NULL)) {
+        *pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+        if (*pixbuf) g_object_ref(*pixbuf);
+      } else {
+        gdk_pixbuf_loader_close(loader, NULL);
+      }
+
+      g_object_unref(loader);
+      munmap(data, st.st_size);
+    }
+  }
+
+  g_clear_object(&subprocess);
+  close(fd);
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+/* Thumbnails @uri at @size pixels: there's no telling which sizes any
+ * factory is used for, so this doesn't depend on the factory's own size */
+static GdkPixbuf *generate_thumbnail(MateDesktopThumbnailFactory *factory,
+                                     const char *uri, const char *mime_type,
+                                     int size) {
+  GdkPixbuf *pixbuf;
+  char *script;
+  gboolean in_process, in_memory_output;
+
+  pixbuf = NULL;
+
+  pixbuf = get_preview_thumbnail(uri, size);
+  if (pixbuf != NULL) return pixbuf;
+
+  script = NULL;
+  in_process = in_memory_output = FALSE;
+  g_mutex_lock(&factory->priv->lock);
+  if (!mate_desktop_thumbnail_factory_is_disabled(factory, mime_type)) {
+    Thumbnailer *thumb;
+
+    in_process = can_load_in_process(mime_type);
+    in_memory_output = factory->priv->in_memory_output;
+
+    thumb = g_hash_table_lookup(factory->priv->mime_types_map, mime_type);
+    if (thumb) script = g_strdup(thumb->command);
+  }
+  g_mutex_unlock(&factory->priv->lock);
+
+  /* the thumbnailer, if any, is still tried for files this can't decode */
+  if (in_process) {
+    pixbuf = get_in_process_thumbnail(uri, mime_type, size);
+    if (pixbuf != NULL) {
+      g_free(script);
+      return pixbuf;
+    }
+  }
+
+  if (script) {
+    if (!in_memory_output ||
+        !run_thumbnailer_in_memory(script, size, uri, &pixbuf))
+      pixbuf = run_thumbnailer(script, size, uri);
+
+    g_free(script);
+  }
+
+  return pixbuf;
+}
+
 /**
  * mate_desktop_thumbnail_factory_generate_thumbnail:
  * @factory: a #MateDesktopThumbnailFactory
@@ -898,6 +2078,10 @@ static GdkPixbuf *get_preview_thumbnail(const char *uri, int size) {
  * Tries to generate a thumbnail for the specified file. If it succeeds
  * it returns a pixbuf that can be used as a thumbnail.
  *
+ * Common image formats are decoded in process when gdk-pixbuf can load
+ * them; other files, and images it fails on, go to the thumbnailer
+ * registered for @mime_type.
+ *
  * Usage of this function is threadsafe.
  *
  * Return value: (transfer full): thumbnail pixbuf if thumbnailing succeeded,
@@ -908,81 +2092,447 @@ static GdkPixbuf *get_preview_thumbnail(const char *uri, int size) {
 GdkPixbuf *mate_desktop_thumbnail_factory_generate_thumbnail(
     MateDesktopThumbnailFactory *factory, const char *uri,
     const char *mime_type) {
-  GdkPixbuf *pixbuf;
-  char *script;
-  int size;
-  int exit_status;
-  char *tmpname;
-
   g_return_val_if_fail(uri != NULL, NULL);
   g_return_val_if_fail(mime_type != NULL, NULL);
 
   /* Doesn't access any volatile fields in factory, so it's threadsafe */
 
-  size = 128;
-  if (factory->priv->size == MATE_DESKTOP_THUMBNAIL_SIZE_LARGE) size = 256;
+  return generate_thumbnail(factory, uri, mime_type,
+                            thumbnail_size_pixels(factory->priv->size));
+}
 
-  pixbuf = NULL;
+/* Scales @pixbuf down to fit @size, keeping what the thumbnailer said about
+ * the original image */
+static GdkPixbuf *downscale_thumbnail(GdkPixbuf *pixbuf, int size) {
+  GdkPixbuf *scaled;
+  int width, height;
+  double scale;
 
-  pixbuf = get_preview_thumbnail(uri, size);
-  if (pixbuf != NULL) return pixbuf;
+  width = gdk_pixbuf_get_width(pixbuf);
+  height = gdk_pixbuf_get_height(pixbuf);
 
-  script = NULL;
-  g_mutex_lock(&factory->priv->lock);
-  if (!mate_desktop_thumbnail_factory_is_disabled(factory, mime_type)) {
-    Thumbnailer *thumb;
+  if (width <= size && height <= size) return g_object_ref(pixbuf);
 
-    thumb = g_hash_table_lookup(factory->priv->mime_types_map, mime_type);
-    if (thumb) script = g_strdup(thumb->command);
+  scale = MIN((double)size / width, (double)size / height);
+  scaled = gdk_pixbuf_scale_simple(pixbuf, MAX((int)(width * scale + 0.5), 1),
+                                   MAX((int)(height * scale + 0.5), 1),
+                                   GDK_INTERP_BILINEAR);
+  if (scaled) gdk_pixbuf_copy_options(pixbuf, scaled);
+
+  return scaled;
+}
+
+/**
+ * mate_desktop_thumbnail_factory_generate_thumbnails:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @uri: the uri of a file
+ * @mime_type: the mime type of the file
+ * @sizes: (array length=n_sizes): the sizes to generate
+ * @n_sizes: the number of sizes
+ *
+ * Like mate_desktop_thumbnail_factory_generate_thumbnail(), for several
+ * sizes at once, whatever size @factory was created for. The file is only
+ * thumbnailed once, at the largest of @sizes, and the smaller thumbnails
+ * are scaled down from that one. Pass the result to
+ * mate_desktop_thumbnail_factory_save_thumbnails() to save all of them.
+ *
+ * Usage of this function is threadsafe.
+ *
+ * Return value: (transfer full) (element-type GdkPixbuf) (nullable): the
+ * thumbnails, in the order of @sizes, or %NULL if thumbnailing failed
+ **/
+GPtrArray *mate_desktop_thumbnail_factory_generate_thumbnails(
+    MateDesktopThumbnailFactory *factory, const char *uri,
+    const char *mime_type, const MateDesktopThumbnailSize *sizes,
+    guint n_sizes) {
+  GPtrArray *thumbnails;
+  GdkPixbuf *pixbuf;
+  int largest = 0;
+  guint i;
+
+  g_return_val_if_fail(uri != NULL, NULL);
+  g_return_val_if_fail(mime_type != NULL, NULL);
+  g_return_val_if_fail(sizes != NULL && n_sizes > 0, NULL);
+
+  for (i = 0; i < n_sizes; i++)
+    largest = MAX(largest, thumbnail_size_pixels(sizes[i]));
+
+  pixbuf = generate_thumbnail(factory, uri, mime_type, largest);
+  if (!pixbuf) return NULL;
+
+  thumbnails = g_ptr_array_new_full(n_sizes, g_object_unref);
+  for (i = 0; i < n_sizes; i++) {
+    GdkPixbuf *scaled;
+
+    scaled = downscale_thumbnail(pixbuf, thumbnail_size_pixels(sizes[i]));
+    if (!scaled) {
+      g_ptr_array_unref(thumbnails);
+      thumbnails = NULL;
+      break;
+    }
+    g_ptr_array_add(thumbnails, scaled);
   }
-  g_mutex_unlock(&factory->priv->lock);
 
-  if (script) {
-    int fd;
+  g_object_unref(pixbuf);
 
-    fd = g_file_open_tmp(".mate_desktop_thumbnail.XXXXXX", &tmpname, NULL);
+  return thumbnails;
+}
 
-    if (fd != -1) {
-      char **expanded_script;
-      GError *error = NULL;
+/* One thumbnail to generate, shared by every caller that queued its uri */
+typedef struct {
+  char *uri;
+  char *mime_type;
+  int priority;
+  GList *tasks;
+  gboolean running;
+} ThumbnailRequest;
 
-      close(fd);
+typedef struct {
+  char *uri;
+  gulong cancelled_id;
+  gboolean done;
+} QueuedThumbnail;
+
+static void queued_thumbnail_free(QueuedThumbnail *queued) {
+  g_free(queued->uri);
+  g_free(queued);
+}
 
-      expanded_script =
-          expand_thumbnailing_script(script, size, uri, tmpname, &error);
-      if (expanded_script == NULL) {
-        g_warning("Failed to expand script '%s': %s", script, error->message);
-        g_error_free(error);
-      } else {
-        gboolean ret;
+static void thumbnail_request_free(ThumbnailRequest *request) {
+  g_free(request->uri);
+  g_free(request->mime_type);
+  g_free(request);
+}
 
-        ret = g_spawn_sync(NULL, expanded_script, NULL, G_SPAWN_SEARCH_PATH,
-                           NULL, NULL, NULL, NULL, &exit_status, NULL);
-        if (ret && exit_status == 0)
-          pixbuf = gdk_pixbuf_new_from_file(tmpname, NULL);
+/* Equal priorities compare as smaller, so they run first come first served */
+static gint thumbnail_request_compare(gconstpointer a, gconstpointer b,
+                                      gpointer user_data) {
+  const ThumbnailRequest *request_a = a;
+  const ThumbnailRequest *request_b = b;
 
-        g_strfreev(expanded_script);
-      }
+  return request_a->priority <= request_b->priority ? -1 : 1;
+}
+
+typedef struct {
+  GCancellable *cancellable;
+  gulong id;
+} CancelledHandler;
 
-      g_unlink(tmpname);
-      g_free(tmpname);
+static gboolean disconnect_cancelled_handler(gpointer data) {
+  CancelledHandler *handler = data;
+
+  g_cancellable_disconnect(handler->cancellable, handler->id);
+  g_object_unref(handler->cancellable);
+  g_free(handler);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* The handler holds a reference to the task, and with it the factory, for
+ * as long as it is connected, but disconnecting it from within would
+ * deadlock */
+static void disconnect_cancelled_handler_in_idle(GCancellable *cancellable,
+                                                 gulong id,
+                                                 GMainContext *context) {
+  CancelledHandler *handler = g_new(CancelledHandler, 1);
+  GSource *source;
+
+  handler->cancellable = g_object_ref(cancellable);
+  handler->id = id;
+
+  source = g_idle_source_new();
+  g_source_set_callback(source, disconnect_cancelled_handler, handler, NULL);
+  g_source_attach(source, context);
+  g_source_unref(source);
+}
+
+static void queued_thumbnail_cancelled(GCancellable *cancellable,
+                                       GTask *task) {
+  MateDesktopThumbnailFactory *factory = g_task_get_source_object(task);
+  MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
+  QueuedThumbnail *queued = g_task_get_task_data(task);
+  ThumbnailRequest *request;
+  gboolean found = FALSE;
+  gulong id = 0;
+
+  g_mutex_lock(&priv->queue_lock);
+
+  request = g_hash_table_lookup(priv->requests, queued->uri);
+  if (request && g_list_find(request->tasks, task)) {
+    request->tasks = g_list_remove(request->tasks, task);
+    queued->done = TRUE;
+    found = TRUE;
+
+    /* not set yet if this runs from g_cancellable_connect(), which then
+     * disconnects it itself */
+    id = queued->cancelled_id;
+    queued->cancelled_id = 0;
+
+    /* nobody wants it any more, so don't spawn a thumbnailer for it */
+    if (!request->tasks && !request->running) {
+      g_queue_remove(&priv->queue, request);
+      g_hash_table_remove(priv->requests, request->uri);
+      thumbnail_request_free(request);
     }
+  }
 
-    g_free(script);
+  g_mutex_unlock(&priv->queue_lock);
+
+  if (found) {
+    if (id != 0)
+      disconnect_cancelled_handler_in_idle(cancellable, id,
+                                           g_task_get_context(task));
+    g_task_return_error_if_cancelled(task);
+    g_object_unref(task);
   }
+}
 
-  return pixbuf;
+/* Every queued request pushes one token to the pool, a reference to the
+ * factory, and whichever worker gets it runs the most urgent request at
+ * that moment. Requests that were cancelled leave tokens behind that find
+ * nothing to do. */
+static void run_thumbnail_request(gpointer data, gpointer user_data) {
+  MateDesktopThumbnailFactory *factory = data;
+  MateDesktopThumbnailFactoryPrivate *priv = factory->priv;
+  ThumbnailRequest *request;
+  GdkPixbuf *pixbuf;
+  GList *tasks, *l;
+  gulong *cancelled_ids;
+  guint i;
+
+  g_mutex_lock(&priv->queue_lock);
+  request = g_queue_pop_head(&priv->queue);
+  if (request) request->running = TRUE;
+  g_mutex_unlock(&priv->queue_lock);
+
+  if (!request) {
+    g_object_unref(factory);
+    return;
+  }
+
+  pixbuf = mate_desktop_thumbnail_factory_generate_thumbnail(
+      factory, request->uri, request->mime_type);
+
+  g_mutex_lock(&priv->queue_lock);
+  g_hash_table_remove(priv->requests, request->uri);
+  tasks = request->tasks;
+  request->tasks = NULL;
+  /* whoever sees the id under the lock disconnects it, see
+   * mate_desktop_thumbnail_factory_queue_thumbnail() */
+  cancelled_ids = g_new0(gulong, g_list_length(tasks));
+  for (l = tasks, i = 0; l; l = l->next, i++) {
+    QueuedThumbnail *queued = g_task_get_task_data(l->data);
+
+    queued->done = TRUE;
+    cancelled_ids[i] = queued->cancelled_id;
+    queued->cancelled_id = 0;
+  }
+  g_mutex_unlock(&priv->queue_lock);
+
+  for (l = tasks, i = 0; l; l = l->next, i++) {
+    GTask *task = l->data;
+
+    if (cancelled_ids[i] != 0)
+      g_cancellable_disconnect(g_task_get_cancellable(task),
+                               cancelled_ids[i]);
+
+    if (pixbuf)
+      g_task_return_pointer(task, g_object_ref(pixbuf), g_object_unref);
+    else
+      g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                              "Could not generate a thumbnail for %s",
+                              request->uri);
+  }
+
+  g_list_free_full(tasks, g_object_unref);
+  g_free(cancelled_ids);
+  g_clear_object(&pixbuf);
+  thumbnail_request_free(request);
+
+  /* last, as it may finalize the factory */
+  g_object_unref(factory);
+}
+
+/**
+ * mate_desktop_thumbnail_factory_queue_thumbnail:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @uri: the uri of a file
+ * @mime_type: the mime type of the file
+ * @priority: the priority of the request, lower runs first
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: called with the thumbnail
+ * @user_data: data for @callback
+ *
+ * Queues mate_desktop_thumbnail_factory_generate_thumbnail() for the
+ * specified file. Queued thumbnails are generated in the order of
+ * @priority, as many at a time as
+ * mate_desktop_thumbnail_factory_set_max_jobs() allows, and @callback is
+ * called in the thread-default main context of the caller.
+ *
+ * Queuing a uri that is already queued doesn't generate it twice: both
+ * callers get the same thumbnail, and the request moves up if @priority
+ * is more urgent, so visible items can be bumped ahead of the rest.
+ * Cancelling @cancellable completes the request with
+ * %G_IO_ERROR_CANCELLED, and the thumbnailer is not run at all if nobody
+ * else is waiting for it.
+ **/
+void mate_desktop_thumbnail_factory_queue_thumbnail(
+    MateDesktopThumbnailFactory *factory, const char *uri,
+    const char *mime_type, int priority, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data) {
+  MateDesktopThumbnailFactoryPrivate *priv;
+  ThumbnailRequest *request;
+  QueuedThumbnail *queued;
+  gboolean is_new = FALSE, done;
+  GTask *task;
+  gulong id;
+
+  g_return_if_fail(MATE_DESKTOP_IS_THUMBNAIL_FACTORY(factory));
+  g_return_if_fail(uri != NULL);
+  g_return_if_fail(mime_type != NULL);
+
+  priv = factory->priv;
+
+  task = g_task_new(factory, cancellable, callback, user_data);
+  g_task_set_source_tag(task, mate_desktop_thumbnail_factory_queue_thumbnail);
+  g_task_set_priority(task, priority);
+
+  if (g_task_return_error_if_cancelled(task)) {
+    g_object_unref(task);
+    return;
+  }
+
+  queued = g_new0(QueuedThumbnail, 1);
+  queued->uri = g_strdup(uri);
+  g_task_set_task_data(task, queued, (GDestroyNotify)queued_thumbnail_free);
+
+  g_mutex_lock(&priv->queue_lock);
+
+  if (!priv->pool)
+    priv->pool = g_thread_pool_new(
+        run_thumbnail_request, NULL,
+        priv->max_jobs ? (gint)priv->max_jobs : (gint)g_get_num_processors(),
+        FALSE, NULL);
+
+  request = g_hash_table_lookup(priv->requests, uri);
+  if (!request) {
+    request = g_new0(ThumbnailRequest, 1);
+    request->uri = g_strdup(uri);
+    request->mime_type = g_strdup(mime_type);
+    request->priority = priority;
+    g_hash_table_insert(priv->requests, request->uri, request);
+    g_queue_insert_sorted(&priv->queue, request, thumbnail_request_compare,
+                          NULL);
+    is_new = TRUE;
+  } else if (!request->running && priority < request->priority) {
+    g_queue_remove(&priv->queue, request);
+    request->priority = priority;
+    g_queue_insert_sorted(&priv->queue, request, thumbnail_request_compare,
+                          NULL);
+  }
+
+  /* the reference is dropped when the task is completed */
+  request->tasks = g_list_append(request->tasks, g_object_ref(task));
+
+  g_mutex_unlock(&priv->queue_lock);
+
+  if (is_new) g_thread_pool_push(priv->pool, g_object_ref(factory), NULL);
+
+  if (cancellable) {
+    /* calls the handler right away if it was cancelled in the meantime */
+    id = g_cancellable_connect(cancellable,
+                               G_CALLBACK(queued_thumbnail_cancelled),
+                               g_object_ref(task), g_object_unref);
+
+    /* once done, the worker that completed it has already looked for the
+     * id, so it is left to disconnect here */
+    g_mutex_lock(&priv->queue_lock);
+    done = queued->done;
+    if (!done) queued->cancelled_id = id;
+    g_mutex_unlock(&priv->queue_lock);
+
+    if (done) g_cancellable_disconnect(cancellable, id);
+  }
+
+  g_object_unref(task);
+}
+
+/**
+ * mate_desktop_thumbnail_factory_queue_thumbnail_finish:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finishes a request started with
+ * mate_desktop_thumbnail_factory_queue_thumbnail().
+ *
+ * Return value: (transfer full): the thumbnail, or %NULL if it could not be
+ * generated or the request was cancelled
+ **/
+GdkPixbuf *mate_desktop_thumbnail_factory_queue_thumbnail_finish(
+    MateDesktopThumbnailFactory *factory, GAsyncResult *result,
+    GError **error) {
+  g_return_val_if_fail(g_task_is_valid(result, factory), NULL);
+
+  return g_task_propagate_pointer(G_TASK(result), error);
 }
 
-static gboolean save_thumbnail(GdkPixbuf *pixbuf, char *path, const char *uri,
+/**
+ * mate_desktop_thumbnail_factory_set_max_jobs:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @max_jobs: the most thumbnails to generate at once, or 0 for one per
+ * processor
+ *
+ * Sets how many thumbnails queued with
+ * mate_desktop_thumbnail_factory_queue_thumbnail() are generated at the
+ * same time.
+ **/
+void mate_desktop_thumbnail_factory_set_max_jobs(
+    MateDesktopThumbnailFactory *factory, guint max_jobs) {
+  MateDesktopThumbnailFactoryPrivate *priv;
+
+  g_return_if_fail(MATE_DESKTOP_IS_THUMBNAIL_FACTORY(factory));
+
+  priv = factory->priv;
+
+  g_mutex_lock(&priv->queue_lock);
+  priv->max_jobs = max_jobs;
+  if (priv->pool)
+    g_thread_pool_set_max_threads(
+        priv->pool, max_jobs ? (gint)max_jobs : (gint)g_get_num_processors(),
+        NULL);
+  g_mutex_unlock(&priv->queue_lock);
+}
+
+static gboolean write_all(int fd, const gchar *buffer, gsize size) {
+  while (size > 0) {
+    gssize n = write(fd, buffer, size);
+
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return FALSE;
+    }
+    buffer += n;
+    size -= n;
+  }
+
+  return TRUE;
+}
+
+static gboolean save_thumbnail(MateDesktopThumbnailFactory *factory,
+                               GdkPixbuf *pixbuf, char *path, const char *uri,
                                time_t mtime) {
   char *dirname;
   char *tmp_path = NULL;
-  int tmp_fd;
-  gchar *mtime_str;
+  int tmp_fd = -1;
+  gchar *mtime_str, *compression_str = NULL;
+  gchar *buffer = NULL;
+  gsize buffer_size;
   gboolean ret = FALSE;
   GError *error = NULL;
   const char *width, *height;
+  char *keys[7], *values[7];
+  int n_options = 0, compression;
 
   if (pixbuf == NULL) return FALSE;
 
@@ -994,24 +2544,44 @@ static gboolean save_thumbnail(GdkPixbuf *pixbuf, char *path, const char *uri,
   tmp_fd = g_mkstemp(tmp_path);
 
   if (tmp_fd == -1) goto out;
-  close(tmp_fd);
 
   mtime_str = g_strdup_printf("%" G_GINT64_FORMAT, (gint64)mtime);
   width = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::Image::Width");
   height = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::Image::Height");
 
+  if (width != NULL && height != NULL) {
+    keys[n_options] = "tEXt::Thumb::Image::Width";
+    values[n_options++] = (char *)width;
+    keys[n_options] = "tEXt::Thumb::Image::Height";
+    values[n_options++] = (char *)height;
+  }
+  keys[n_options] = "tEXt::Thumb::URI";
+  values[n_options++] = (char *)uri;
+  keys[n_options] = "tEXt::Thumb::MTime";
+  values[n_options++] = mtime_str;
+  keys[n_options] = "tEXt::Software";
+  values[n_options++] = "MATE::ThumbnailFactory";
+
+  compression = g_atomic_int_get(&factory->priv->compression);
+  if (compression >= 0) {
+    compression_str = g_strdup_printf("%d", compression);
+    keys[n_options] = "compression";
+    values[n_options++] = compression_str;
+  }
+  keys[n_options] = values[n_options] = NULL;
+
+  /* encoded in memory, so the file gets it all in one write */
   error = NULL;
-  if (width != NULL && height != NULL)
-    ret = gdk_pixbuf_save(
-        pixbuf, tmp_path, "png", &error, "tEXt::Thumb::Image::Width", width,
-        "tEXt::Thumb::Image::Height", height, "tEXt::Thumb::URI", uri,
-        "tEXt::Thumb::MTime", mtime_str, "tEXt::Software",
-        "MATE::ThumbnailFactory", NULL);
-  else
-    ret = gdk_pixbuf_save(pixbuf, tmp_path, "png", &error, "tEXt::Thumb::URI",
-                          uri, "tEXt::Thumb::MTime", mtime_str,
-                          "tEXt::Software", "MATE::ThumbnailFactory", NULL);
+  ret = gdk_pixbuf_save_to_bufferv(pixbuf, &buffer, &buffer_size, "png", keys,
+                                   values, &error);
   g_free(mtime_str);
+  g_free(compression_str);
+
+  if (!ret) goto out;
+
+  ret = write_all(tmp_fd, buffer, buffer_size);
+  ret = close(tmp_fd) == 0 && ret;
+  tmp_fd = -1;
 
   if (!ret) goto out;
 
@@ -1023,8 +2593,10 @@ out:
     g_warning("Failed to create thumbnail %s: %s", tmp_path, error->message);
     g_error_free(error);
   }
+  if (tmp_fd != -1) close(tmp_fd);
   g_unlink(tmp_path);
   g_free(tmp_path);
+  g_free(buffer);
   g_free(dirname);
   return ret;
 }
@@ -1057,16 +2629,73 @@ void mate_desktop_thumbnail_factory_save_thumbnail(
   char *path;
 
   path = thumbnail_path(uri, factory->priv->size);
-  if (!save_thumbnail(thumbnail, path, uri, original_mtime)) {
+  if (!save_thumbnail(factory, thumbnail, path, uri, original_mtime)) {
     thumbnail = make_failed_thumbnail();
     g_free(path);
     path = thumbnail_failed_path(uri);
-    save_thumbnail(thumbnail, path, uri, original_mtime);
+    save_thumbnail(factory, thumbnail, path, uri, original_mtime);
     g_object_unref(thumbnail);
   }
   g_free(path);
 }
 
+/**
+ * mate_desktop_thumbnail_factory_set_compression:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @compression: the zlib compression level, from 0 to 9, or -1 for the
+ * default of gdk-pixbuf
+ *
+ * Sets how hard thumbnails saved by @factory are compressed. When many
+ * files are thumbnailed at once, encoding takes a large share of the time,
+ * and a low level like 1 saves most of it for slightly larger files.
+ *
+ * Usage of this function is threadsafe.
+ **/
+void mate_desktop_thumbnail_factory_set_compression(
+    MateDesktopThumbnailFactory *factory, int compression) {
+  g_return_if_fail(MATE_DESKTOP_IS_THUMBNAIL_FACTORY(factory));
+  g_return_if_fail(compression >= -1 && compression <= 9);
+
+  g_atomic_int_set(&factory->priv->compression, compression);
+}
+
+/**
+ * mate_desktop_thumbnail_factory_save_thumbnails:
+ * @factory: a #MateDesktopThumbnailFactory
+ * @thumbnails: (element-type GdkPixbuf): the thumbnails, as returned by
+ * mate_desktop_thumbnail_factory_generate_thumbnails()
+ * @sizes: (array length=n_sizes): the sizes of @thumbnails
+ * @n_sizes: the number of sizes, which must be the length of @thumbnails
+ * @uri: the uri of a file
+ * @original_mtime: the modification time of the original file
+ *
+ * Saves the thumbnail of each size in @sizes in the thumbnail cache, as
+ * mate_desktop_thumbnail_factory_save_thumbnail() does for the size of
+ * @factory.
+ *
+ * Usage of this function is threadsafe.
+ **/
+void mate_desktop_thumbnail_factory_save_thumbnails(
+    MateDesktopThumbnailFactory *factory, GPtrArray *thumbnails,
+    const MateDesktopThumbnailSize *sizes, guint n_sizes, const char *uri,
+    time_t original_mtime) {
+  guint i;
+
+  g_return_if_fail(MATE_DESKTOP_IS_THUMBNAIL_FACTORY(factory));
+  g_return_if_fail(thumbnails != NULL);
+  g_return_if_fail(sizes != NULL || n_sizes == 0);
+  g_return_if_fail(n_sizes == thumbnails->len);
+  g_return_if_fail(uri != NULL);
+
+  for (i = 0; i < n_sizes; i++) {
+    char *path = thumbnail_path(uri, sizes[i]);
+
+    save_thumbnail(factory, g_ptr_array_index(thumbnails, i), path, uri,
+                   original_mtime);
+    g_free(path);
+  }
+}
+
 /**
  * mate_desktop_thumbnail_factory_create_failed_thumbnail:
  * @factory: a #MateDesktopThumbnailFactory
@@ -1087,12 +2716,226 @@ void mate_desktop_thumbnail_factory_create_failed_thumbnail(
 
   path = thumbnail_failed_path(uri);
   pixbuf = make_failed_thumbnail();
-  save_thumbnail(pixbuf, path, uri, mtime);
+  if (save_thumbnail(factory, pixbuf, path, uri, mtime))
+    failed_index_add(factory, uri, mtime);
 
   g_free(path);
   g_object_unref(pixbuf);
 }
 
+/* Cleaning sleeps this long every CLEAN_THROTTLE_FILES files, so it stays
+ * out of the way of the session it runs in */
+#define CLEAN_THROTTLE_FILES 256
+#define CLEAN_THROTTLE_USEC (10 * 1000)
+
+typedef struct {
+  guint dir;
+  char *name;
+  time_t time;
+  guint64 size;
+} CachedThumbnail;
+
+typedef struct {
+  GPtrArray *dirs;
+  GArray *files;
+  time_t oldest;
+  guint64 total;
+  guint n_io;
+  guint n_removed;
+  guint64 n_bytes_removed;
+  GCancellable *cancellable;
+} CacheCleaner;
+
+static void close_dir(gpointer d) { closedir(d); }
+
+static void cached_thumbnail_clear(CachedThumbnail *file) {
+  g_free(file->name);
+}
+
+static gint cached_thumbnail_compare(gconstpointer a, gconstpointer b) {
+  const CachedThumbnail *file_a = a;
+  const CachedThumbnail *file_b = b;
+
+  return (file_a->time > file_b->time) - (file_a->time < file_b->time);
+}
+
+static gboolean cache_cleaner_throttle(CacheCleaner *cleaner,
+                                       GError **error) {
+  if (++cleaner->n_io % CLEAN_THROTTLE_FILES == 0)
+    g_usleep(CLEAN_THROTTLE_USEC);
+
+  return !g_cancellable_set_error_if_cancelled(cleaner->cancellable, error);
+}
+
+static void cache_cleaner_remove(CacheCleaner *cleaner, guint dir,
+                                 const char *name, guint64 size) {
+  DIR *d = g_ptr_array_index(cleaner->dirs, dir);
+
+  if (unlinkat(dirfd(d), name, 0) == 0) {
+    cleaner->n_removed++;
+    cleaner->n_bytes_removed += size;
+  }
+}
+
+/* Reads the directory in one pass, with a single fstatat() per file.
+ * Thumbnails older than the maximum age go right away, and the rest are
+ * kept for cache_cleaner_shrink(). */
+static gboolean cache_cleaner_scan(CacheCleaner *cleaner, const char *path,
+                                   GError **error) {
+  struct dirent *entry;
+  guint index;
+  DIR *d;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) return TRUE;
+
+  if (!(d = fdopendir(fd))) {
+    close(fd);
+    return TRUE;
+  }
+
+  /* kept open, so the files can be removed relative to it later */
+  index = cleaner->dirs->len;
+  g_ptr_array_add(cleaner->dirs, d);
+
+  while ((entry = readdir(d))) {
+    CachedThumbnail file;
+    struct stat st;
+
+    if (!g_str_has_suffix(entry->d_name, ".png")) continue;
+
+    if (!cache_cleaner_throttle(cleaner, error)) return FALSE;
+
+    if (fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+        !S_ISREG(st.st_mode))
+      continue;
+
+    /* atime is often not updated, so use whichever is newer */
+    file.time = MAX(st.st_atime, st.st_mtime);
+    file.size = st.st_size;
+
+    if (file.time < cleaner->oldest) {
+      cache_cleaner_remove(cleaner, index, entry->d_name, file.size);
+      continue;
+    }
+
+    file.dir = index;
+    file.name = g_strdup(entry->d_name);
+    g_array_append_val(cleaner->files, file);
+    cleaner->total += file.size;
+  }
+
+  return TRUE;
+}
+
+/* Removes the least recently used thumbnails until the rest fit */
+static gboolean cache_cleaner_shrink(CacheCleaner *cleaner, guint64 budget,
+                                     GError **error) {
+  guint i;
+
+  if (cleaner->total <= budget) return TRUE;
+
+  g_array_sort(cleaner->files, cached_thumbnail_compare);
+
+  for (i = 0; i < cleaner->files->len && cleaner->total > budget; i++) {
+    CachedThumbnail *file = &g_array_index(cleaner->files, CachedThumbnail, i);
+
+    if (!cache_cleaner_throttle(cleaner, error)) return FALSE;
+
+    cache_cleaner_remove(cleaner, file->dir, file->name, file->size);
+    cleaner->total -= file->size;
+  }
+
+  return TRUE;
+}
+
+/**
+ * mate_desktop_thumbnail_cache_clean:
+ * @max_age: the number of days after which a thumbnail that wasn't used
+ * is removed, or -1 to keep thumbnails regardless of their age
+ * @max_size: the number of megabytes the cache may take, or -1 for no
+ * limit
+ * @n_removed: (out) (optional): return location for the number of removed
+ * thumbnails, or %NULL
+ * @n_bytes_removed: (out) (optional): return location for their size, or
+ * %NULL
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @error: return location for a #GError, or %NULL
+ *
+ * Cleans the thumbnail cache of the user, the normal, large and failed
+ * thumbnails of every application alike. Thumbnails that weren't used for
+ * @max_age days are removed first, then the least recently used ones until
+ * the cache takes at most @max_size megabytes. The arguments mean the same
+ * as the maximum-age and maximum-size keys of org.mate.thumbnail-cache.
+ *
+ * The cache is read in one pass, with a single fstatat() per file, and
+ * thumbnails over @max_age are removed as they are found. Removing by size
+ * needs every thumbnail's last use, as a partial scan would drop recently
+ * used thumbnails while older ones elsewhere are kept, so this always goes
+ * through the whole cache rather than resuming where the last call
+ * stopped. It blocks for as long as that takes, and is throttled to keep
+ * the disk usable meanwhile, so it is best called from a thread or a
+ * helper process, and not more often than the maximum-age granularity of a
+ * day calls for.
+ *
+ * Return value: %TRUE, or %FALSE if @cancellable was cancelled
+ **/
+gboolean mate_desktop_thumbnail_cache_clean(int max_age, int max_size,
+                                            guint *n_removed,
+                                            guint64 *n_bytes_removed,
+                                            GCancellable *cancellable,
+                                            GError **error) {
+  CacheCleaner cleaner = {0};
+  char *cache_dir, *path;
+  gboolean ok = TRUE;
+  GDir *fail_dir;
+  guint i;
+
+  cleaner.dirs = g_ptr_array_new_with_free_func(close_dir);
+  cleaner.files = g_array_new(FALSE, FALSE, sizeof(CachedThumbnail));
+  g_array_set_clear_func(cleaner.files, (GDestroyNotify)cached_thumbnail_clear);
+  cleaner.oldest = max_age >= 0 ? time(NULL) - (time_t)max_age * 24 * 3600 : 0;
+  cleaner.cancellable = cancellable;
+
+  cache_dir = g_build_filename(g_get_user_cache_dir(), "thumbnails", NULL);
+
+  /* every size of the thumbnail spec, whatever size factories write */
+  for (i = 0; ok && i < G_N_ELEMENTS(thumbnail_sizes); i++) {
+    path = g_build_filename(cache_dir, thumbnail_sizes[i].dir, NULL);
+    ok = cache_cleaner_scan(&cleaner, path, error);
+    g_free(path);
+  }
+
+  /* failed thumbnails are kept per application */
+  path = g_build_filename(cache_dir, "fail", NULL);
+  if (ok && (fail_dir = g_dir_open(path, 0, NULL))) {
+    const char *name;
+
+    while (ok && (name = g_dir_read_name(fail_dir))) {
+      char *app_path = g_build_filename(path, name, NULL);
+
+      ok = cache_cleaner_scan(&cleaner, app_path, error);
+      g_free(app_path);
+    }
+    g_dir_close(fail_dir);
+  }
+  g_free(path);
+
+  if (ok && max_size >= 0)
+    ok = cache_cleaner_shrink(&cleaner, (guint64)max_size * 1024 * 1024,
+                              error);
+
+  if (n_removed) *n_removed = cleaner.n_removed;
+  if (n_bytes_removed) *n_bytes_removed = cleaner.n_bytes_removed;
+
+  g_array_unref(cleaner.files);
+  g_ptr_array_unref(cleaner.dirs);
+  g_free(cache_dir);
+
+  return ok;
+}
+
 /**
  * mate_desktop_thumbnail_path_for_uri:
  * @uri: an uri
@@ -1143,16 +2986,7 @@ gboolean mate_desktop_thumbnail_has_uri(GdkPixbuf *pixbuf, const char *uri) {
  **/
 gboolean mate_desktop_thumbnail_is_valid(GdkPixbuf *pixbuf, const char *uri,
                                          time_t mtime) {
-  const char *thumb_uri, *thumb_mtime_str;
-  time_t thumb_mtime;
-
-  thumb_uri = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::URI");
-  if (g_strcmp0(uri, thumb_uri) != 0) return FALSE;
-
-  thumb_mtime_str = gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::MTime");
-  if (!thumb_mtime_str) return FALSE;
-  thumb_mtime = (time_t)g_ascii_strtoll(thumb_mtime_str, (gchar **)NULL, 10);
-  if (mtime != thumb_mtime) return FALSE;
-
-  return TRUE;
+  return thumbnail_info_is_valid(
+      gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::URI"),
+      gdk_pixbuf_get_option(pixbuf, "tEXt::Thumb::MTime"), uri, mtime);
 }
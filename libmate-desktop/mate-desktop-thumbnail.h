@@ -31,6 +31,7 @@
 #endif
 
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gio/gio.h>
 #include <glib-object.h>
 #include <glib.h>
 #include <time.h>
@@ -39,7 +40,9 @@ G_BEGIN_DECLS
 
 typedef enum {
   MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL,
-  MATE_DESKTOP_THUMBNAIL_SIZE_LARGE
+  MATE_DESKTOP_THUMBNAIL_SIZE_LARGE,
+  MATE_DESKTOP_THUMBNAIL_SIZE_XLARGE,
+  MATE_DESKTOP_THUMBNAIL_SIZE_XXLARGE
 } MateDesktopThumbnailSize;
 
 #define MATE_DESKTOP_TYPE_THUMBNAIL_FACTORY \
@@ -77,6 +80,16 @@ MateDesktopThumbnailFactory *mate_desktop_thumbnail_factory_new(
 
 char *mate_desktop_thumbnail_factory_lookup(
     MateDesktopThumbnailFactory *factory, const char *uri, time_t mtime);
+GPtrArray *mate_desktop_thumbnail_factory_lookup_many(
+    MateDesktopThumbnailFactory *factory, const char *const *uris,
+    const time_t *mtimes, guint n_uris);
+void mate_desktop_thumbnail_factory_lookup_many_async(
+    MateDesktopThumbnailFactory *factory, const char *const *uris,
+    const time_t *mtimes, guint n_uris, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data);
+GPtrArray *mate_desktop_thumbnail_factory_lookup_many_finish(
+    MateDesktopThumbnailFactory *factory, GAsyncResult *result,
+    GError **error);
 
 gboolean mate_desktop_thumbnail_factory_has_valid_failed_thumbnail(
     MateDesktopThumbnailFactory *factory, const char *uri, time_t mtime);
@@ -86,9 +99,28 @@ gboolean mate_desktop_thumbnail_factory_can_thumbnail(
 GdkPixbuf *mate_desktop_thumbnail_factory_generate_thumbnail(
     MateDesktopThumbnailFactory *factory, const char *uri,
     const char *mime_type);
+GPtrArray *mate_desktop_thumbnail_factory_generate_thumbnails(
+    MateDesktopThumbnailFactory *factory, const char *uri,
+    const char *mime_type, const MateDesktopThumbnailSize *sizes,
+    guint n_sizes);
+void mate_desktop_thumbnail_factory_queue_thumbnail(
+    MateDesktopThumbnailFactory *factory, const char *uri,
+    const char *mime_type, int priority, GCancellable *cancellable,
+    GAsyncReadyCallback callback, gpointer user_data);
+GdkPixbuf *mate_desktop_thumbnail_factory_queue_thumbnail_finish(
+    MateDesktopThumbnailFactory *factory, GAsyncResult *result,
+    GError **error);
+void mate_desktop_thumbnail_factory_set_max_jobs(
+    MateDesktopThumbnailFactory *factory, guint max_jobs);
 void mate_desktop_thumbnail_factory_save_thumbnail(
     MateDesktopThumbnailFactory *factory, GdkPixbuf *thumbnail, const char *uri,
     time_t original_mtime);
+void mate_desktop_thumbnail_factory_set_compression(
+    MateDesktopThumbnailFactory *factory, int compression);
+void mate_desktop_thumbnail_factory_save_thumbnails(
+    MateDesktopThumbnailFactory *factory, GPtrArray *thumbnails,
+    const MateDesktopThumbnailSize *sizes, guint n_sizes, const char *uri,
+    time_t original_mtime);
 void mate_desktop_thumbnail_factory_create_failed_thumbnail(
     MateDesktopThumbnailFactory *factory, const char *uri, time_t mtime);
 
@@ -99,6 +131,12 @@ gboolean mate_desktop_thumbnail_is_valid(GdkPixbuf *pixbuf, const char *uri,
 char *mate_desktop_thumbnail_path_for_uri(const char *uri,
                                           MateDesktopThumbnailSize size);
 
+gboolean mate_desktop_thumbnail_cache_clean(int max_age, int max_size,
+                                            guint *n_removed,
+                                            guint64 *n_bytes_removed,
+                                            GCancellable *cancellable,
+                                            GError **error);
+
 G_END_DECLS
 
 #endif /* MATE_DESKTOP_THUMBNAIL_H */
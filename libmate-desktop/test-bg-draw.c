@@ -0,0 +1,160 @@
+/*
+ * test-bg-draw.c: compare the MateBG drawing paths
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gtk/gtk.h>
+#include <string.h>
+
+#define MATE_DESKTOP_USE_UNSTABLE_API
+#include "mate-bg.h"
+
+static MateBG *load_bg(const char *filename, guint n_threads) {
+  MateBG *bg;
+
+  bg = mate_bg_new();
+  mate_bg_load_from_preferences(bg);
+  if (filename) mate_bg_set_filename(bg, filename);
+  mate_bg_set_draw_threads(bg, n_threads);
+
+  return bg;
+}
+
+static GdkPixbuf *draw(GdkScreen *screen, const char *filename,
+                       guint n_threads, int width, int height) {
+  MateBG *bg;
+  GdkPixbuf *pixbuf;
+  gint64 start;
+
+  bg = load_bg(filename, n_threads);
+
+  pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+
+  start = g_get_monotonic_time();
+  mate_bg_draw(bg, pixbuf, screen, TRUE);
+  g_print("%u thread(s): %.1f ms\n", n_threads,
+          (double)(g_get_monotonic_time() - start) / 1000.0);
+
+  g_object_unref(bg);
+
+  return pixbuf;
+}
+
+/* Draws directly into a root window surface, and reads it back */
+static GdkPixbuf *paint(GdkWindow *root, const char *filename, int width,
+                        int height) {
+  MateBG *bg;
+  cairo_surface_t *surface;
+  GdkPixbuf *pixbuf;
+  gint64 start;
+
+  bg = load_bg(filename, 0);
+
+  start = g_get_monotonic_time();
+  surface = mate_bg_create_surface(bg, root, width, height, TRUE);
+  g_print("surface: %.1f ms\n",
+          (double)(g_get_monotonic_time() - start) / 1000.0);
+
+  pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, width, height);
+
+  cairo_surface_destroy(surface);
+  g_object_unref(bg);
+
+  return pixbuf;
+}
+
+/* Largest difference of any channel, or -1 if the layouts differ */
+static int pixbuf_max_diff(GdkPixbuf *a, GdkPixbuf *b) {
+  int rowstride = gdk_pixbuf_get_rowstride(a);
+  int row_bytes = gdk_pixbuf_get_width(a) * gdk_pixbuf_get_n_channels(a);
+  const guchar *pa = gdk_pixbuf_get_pixels(a);
+  const guchar *pb = gdk_pixbuf_get_pixels(b);
+  int max_diff = 0;
+  int x, y;
+
+  if (gdk_pixbuf_get_n_channels(a) != gdk_pixbuf_get_n_channels(b) ||
+      gdk_pixbuf_get_rowstride(b) != rowstride)
+    return -1;
+
+  /* the padding at the end of each row is never written to */
+  for (y = 0; y < gdk_pixbuf_get_height(a); y++) {
+    const guchar *ra = pa + y * rowstride;
+    const guchar *rb = pb + y * rowstride;
+
+    if (memcmp(ra, rb, (size_t)row_bytes) == 0) continue;
+
+    for (x = 0; x < row_bytes; x++)
+      max_diff = MAX(max_diff, ABS(ra[x] - rb[x]));
+  }
+
+  return max_diff;
+}
+
+static gboolean report(const char *what, GdkPixbuf *a, GdkPixbuf *b,
+                       int tolerance) {
+  int diff = pixbuf_max_diff(a, b);
+
+  if (diff == 0)
+    g_print("%s: identical\n", what);
+  else
+    g_print("%s: DIFFERENT (max difference %d)\n", what, diff);
+
+  return diff >= 0 && diff <= tolerance;
+}
+
+int main(int argc, char **argv) {
+  GdkScreen *screen;
+  GdkWindow *root;
+  GdkPixbuf *serial, *threaded, *painted;
+  const char *filename;
+  int width, height;
+  gboolean ok;
+
+  gtk_init(&argc, &argv);
+
+  filename = argc > 1 ? argv[1] : NULL;
+
+  screen = gdk_screen_get_default();
+  root = gdk_screen_get_root_window(screen);
+  width = gdk_window_get_width(root);
+  height = gdk_window_get_height(root);
+
+  /* Make sure both runs start from the same on-disk wallpaper cache */
+  g_object_unref(draw(screen, filename, 1, width, height));
+
+  serial = draw(screen, filename, 1, width, height);
+  threaded = draw(screen, filename, 0, width, height);
+  painted = paint(root, filename, width, height);
+
+  g_print("%dx%d\n", width, height);
+  ok = report("threaded", serial, threaded, 0);
+  /* translucent wallpapers are premultiplied by cairo, which can round
+   * differently from gdk_pixbuf_composite() */
+  ok = report("surface", serial, painted, 1) && ok;
+
+  g_object_unref(serial);
+  g_object_unref(threaded);
+  g_object_unref(painted);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,354 @@
+/*
+ * test-bg-pixels.c: check and time the MateBG pixel kernels against the
+ * scalar loops and gdk-pixbuf calls they replace
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <string.h>
+
+#include "mate-bg-pixels.h"
+
+#define N_RUNS 5
+#define TILE_SIZE 256
+
+static const char *implementations[] = {"c", "sse2", "avx2"};
+
+static gboolean failed = FALSE;
+
+static GdkPixbuf *random_pixbuf(guint32 seed, gboolean has_alpha, int width,
+                                int height) {
+  GdkPixbuf *pixbuf;
+  GRand *rand;
+  guchar *pixels;
+  gsize i, length;
+
+  pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, has_alpha, 8, width, height);
+  pixels = gdk_pixbuf_get_pixels(pixbuf);
+  length = gdk_pixbuf_get_byte_length(pixbuf);
+
+  rand = g_rand_new_with_seed(seed);
+  for (i = 0; i < length; i++) pixels[i] = (guchar)g_rand_int(rand);
+
+  /* plenty of fully opaque and transparent pixels, like real images */
+  if (has_alpha) {
+    for (i = 3; i < length; i += 4) {
+      guint32 r = g_rand_int_range(rand, 0, 4);
+
+      if (r == 0) pixels[i] = 0;
+      if (r == 1 || r == 2) pixels[i] = 255;
+    }
+  }
+
+  g_rand_free(rand);
+
+  return pixbuf;
+}
+
+static gboolean pixbuf_equal(GdkPixbuf *a, GdkPixbuf *b) {
+  int rowstride = gdk_pixbuf_get_rowstride(a);
+  int row_bytes = gdk_pixbuf_get_width(a) * gdk_pixbuf_get_n_channels(a);
+  const guchar *pa = gdk_pixbuf_read_pixels(a);
+  const guchar *pb = gdk_pixbuf_read_pixels(b);
+  int y;
+
+  for (y = 0; y < gdk_pixbuf_get_height(a); y++) {
+    if (memcmp(pa + y * rowstride, pb + y * rowstride, (size_t)row_bytes) != 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* The scalar versions, as mate-bg.c had them */
+
+static void sum_scalar(GdkPixbuf *pixbuf, guint64 totals[4]) {
+  int width = gdk_pixbuf_get_width(pixbuf);
+  int height = gdk_pixbuf_get_height(pixbuf);
+  int row_stride = gdk_pixbuf_get_rowstride(pixbuf);
+  const guchar *pixels = gdk_pixbuf_read_pixels(pixbuf);
+  const guchar *p;
+  guchar r, g, b, a;
+  int row, column;
+
+  memset(totals, 0, 4 * sizeof(guint64));
+
+  if (gdk_pixbuf_get_has_alpha(pixbuf)) {
+    for (row = 0; row < height; row++) {
+      p = pixels + (row * row_stride);
+      for (column = 0; column < width; column++) {
+        r = *p++;
+        g = *p++;
+        b = *p++;
+        a = *p++;
+
+        totals[3] += a;
+        totals[0] += r * a;
+        totals[1] += g * a;
+        totals[2] += b * a;
+      }
+    }
+  } else {
+    for (row = 0; row < height; row++) {
+      p = pixels + (row * row_stride);
+      for (column = 0; column < width; column++) {
+        totals[0] += *p++;
+        totals[1] += *p++;
+        totals[2] += *p++;
+      }
+    }
+  }
+}
+
+static void gradient_scalar(GdkPixbuf *pixbuf, const guchar *gradient) {
+  int rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  int width = gdk_pixbuf_get_width(pixbuf);
+  int height = gdk_pixbuf_get_height(pixbuf);
+  guchar *dst = gdk_pixbuf_get_pixels(pixbuf);
+  int i, j, k;
+
+  for (i = 0; i < height; i++) {
+    guchar *d = dst + rowstride * i;
+    const guchar *gb = gradient + 3 * i;
+
+    for (j = width; j > 0; j--) {
+      for (k = 0; k < 3; k++) *(d++) = gb[k];
+    }
+  }
+}
+
+static void tile_scalar(GdkPixbuf *tile, GdkPixbuf *dest) {
+  int dest_width = gdk_pixbuf_get_width(dest);
+  int dest_height = gdk_pixbuf_get_height(dest);
+  int x, y;
+
+  for (y = 0; y < dest_height; y += TILE_SIZE) {
+    for (x = 0; x < dest_width; x += TILE_SIZE) {
+      gdk_pixbuf_composite(tile, dest, x, y, MIN(TILE_SIZE, dest_width - x),
+                           MIN(TILE_SIZE, dest_height - y), x, y, 1.0, 1.0,
+                           GDK_INTERP_NEAREST, 255);
+    }
+  }
+}
+
+/* The same operations on top of the kernels */
+
+static void gradient_kernel(GdkPixbuf *pixbuf, const guchar *gradient) {
+  int rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+  int width = gdk_pixbuf_get_width(pixbuf);
+  int height = gdk_pixbuf_get_height(pixbuf);
+  guchar *dst = gdk_pixbuf_get_pixels(pixbuf);
+  int i;
+
+  for (i = 0; i < height; i++)
+    _mate_bg_pixels_fill_rgb(dst + rowstride * i, width, gradient + 3 * i);
+}
+
+static void composite_kernel(GdkPixbuf *src, GdkPixbuf *dest, int src_y,
+                             int dest_x, int dest_y, int width, int height,
+                             guint alpha) {
+  int src_stride = gdk_pixbuf_get_rowstride(src);
+  int dest_stride = gdk_pixbuf_get_rowstride(dest);
+  const guchar *s = gdk_pixbuf_read_pixels(src) + src_y * src_stride;
+  guchar *d =
+      gdk_pixbuf_get_pixels(dest) + dest_y * dest_stride + dest_x * 3;
+  int y;
+
+  for (y = 0; y < height; y++)
+    _mate_bg_pixels_composite_row(d + y * dest_stride, s + y * src_stride,
+                                  gdk_pixbuf_get_n_channels(src), width,
+                                  alpha);
+}
+
+static void tile_kernel(GdkPixbuf *tile, GdkPixbuf *dest) {
+  int dest_width = gdk_pixbuf_get_width(dest);
+  int dest_height = gdk_pixbuf_get_height(dest);
+  int x, y;
+
+  for (y = 0; y < dest_height; y++) {
+    for (x = 0; x < dest_width; x += TILE_SIZE)
+      composite_kernel(tile, dest, y % TILE_SIZE, x, y,
+                       MIN(TILE_SIZE, dest_width - x), 1, 255);
+  }
+}
+
+/* Timing */
+
+typedef enum {
+  OP_AVERAGE_RGB,
+  OP_AVERAGE_RGBA,
+  OP_GRADIENT,
+  OP_BLEND_RGBA,
+  OP_BLEND_HALF,
+  OP_TILE,
+  N_OPS
+} Op;
+
+static const char *op_names[N_OPS] = {
+    "average rgb", "average rgba", "v-gradient",
+    "blend rgba",  "blend 50%",    "tile",
+};
+
+typedef struct {
+  GdkPixbuf *rgb;
+  GdkPixbuf *rgba;
+  GdkPixbuf *tile;
+  GdkPixbuf *background; /* what the blends start from */
+  GdkPixbuf *dest;
+  guchar *gradient;
+  guint64 totals[4];
+} Images;
+
+/* Runs @op once, with the kernels if @scalar is FALSE */
+static void run_op(Images *im, Op op, gboolean scalar) {
+  int width = gdk_pixbuf_get_width(im->dest);
+  int height = gdk_pixbuf_get_height(im->dest);
+
+  switch (op) {
+    case OP_AVERAGE_RGB:
+    case OP_AVERAGE_RGBA: {
+      GdkPixbuf *p = op == OP_AVERAGE_RGB ? im->rgb : im->rgba;
+
+      if (scalar)
+        sum_scalar(p, im->totals);
+      else
+        _mate_bg_pixels_sum(gdk_pixbuf_read_pixels(p), width, height,
+                            gdk_pixbuf_get_rowstride(p),
+                            gdk_pixbuf_get_has_alpha(p), im->totals);
+      break;
+    }
+    case OP_GRADIENT:
+      if (scalar)
+        gradient_scalar(im->dest, im->gradient);
+      else
+        gradient_kernel(im->dest, im->gradient);
+      break;
+    case OP_BLEND_RGBA:
+    case OP_BLEND_HALF: {
+      GdkPixbuf *src = op == OP_BLEND_RGBA ? im->rgba : im->rgb;
+      guint alpha = op == OP_BLEND_RGBA ? 255 : 127;
+
+      gdk_pixbuf_copy_area(im->background, 0, 0, width, height, im->dest, 0,
+                           0);
+      if (scalar)
+        gdk_pixbuf_composite(src, im->dest, 0, 0, width, height, 0, 0, 1.0,
+                             1.0, GDK_INTERP_NEAREST, (int)alpha);
+      else
+        composite_kernel(src, im->dest, 0, 0, 0, width, height, alpha);
+      break;
+    }
+    case OP_TILE:
+      gdk_pixbuf_copy_area(im->background, 0, 0, width, height, im->dest, 0,
+                           0);
+      if (scalar)
+        tile_scalar(im->tile, im->dest);
+      else
+        tile_kernel(im->tile, im->dest);
+      break;
+    default:
+      g_assert_not_reached();
+  }
+}
+
+static double time_op(Images *im, Op op, gboolean scalar) {
+  double best = G_MAXDOUBLE;
+  int i;
+
+  for (i = 0; i < N_RUNS; i++) {
+    gint64 start = g_get_monotonic_time();
+
+    run_op(im, op, scalar);
+    best = MIN(best, (double)(g_get_monotonic_time() - start) / 1000.0);
+  }
+
+  return best;
+}
+
+static void bench_size(int width, int height) {
+  Images im;
+  GdkPixbuf *expected;
+  guint64 expected_totals[4];
+  Op op;
+  guint i;
+
+  im.rgb = random_pixbuf(1, FALSE, width, height);
+  im.rgba = random_pixbuf(2, TRUE, width, height);
+  im.tile = gdk_pixbuf_new_subpixbuf(im.rgba, 0, 0, TILE_SIZE, TILE_SIZE);
+  im.background = random_pixbuf(3, FALSE, width, height);
+  im.dest = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  im.gradient = g_malloc(3 * (gsize)height);
+  for (i = 0; i < 3 * (guint)height; i++) im.gradient[i] = (guchar)(i / 7);
+
+  g_print("\n%dx%d\n%-14s %10s", width, height, "", "scalar");
+  for (i = 0; i < G_N_ELEMENTS(implementations); i++)
+    g_print(" %10s", implementations[i]);
+  g_print("\n");
+
+  for (op = 0; op < N_OPS; op++) {
+    g_print("%-14s %7.2f ms", op_names[op], time_op(&im, op, TRUE));
+
+    expected = gdk_pixbuf_copy(im.dest);
+    memcpy(expected_totals, im.totals, sizeof(expected_totals));
+
+    for (i = 0; i < G_N_ELEMENTS(implementations); i++) {
+      gboolean same;
+
+      if (!_mate_bg_pixels_set_implementation(implementations[i])) {
+        g_print(" %10s", "-");
+        continue;
+      }
+
+      g_print(" %7.2f ms", time_op(&im, op, FALSE));
+
+      if (op == OP_AVERAGE_RGB || op == OP_AVERAGE_RGBA)
+        same = memcmp(expected_totals, im.totals, sizeof(im.totals)) == 0;
+      else
+        same = pixbuf_equal(expected, im.dest);
+
+      if (!same) {
+        g_print(" (DIFFERENT)");
+        failed = TRUE;
+      }
+    }
+    g_print("\n");
+
+    g_object_unref(expected);
+  }
+
+  g_object_unref(im.rgb);
+  g_object_unref(im.rgba);
+  g_object_unref(im.tile);
+  g_object_unref(im.background);
+  g_object_unref(im.dest);
+  g_free(im.gradient);
+}
+
+int main(void) {
+  g_print("detected: %s\n", _mate_bg_pixels_get_implementation());
+
+  bench_size(1920, 1080);
+  bench_size(3840, 2160);
+  bench_size(7680, 4320);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * test-ditem-cache.c: check that desktop items come from the item cache
+ * while it is current, and are parsed again when it isn't
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib/gstdio.h>
+#include <string.h>
+#include <utime.h>
+
+#include "mate-desktop-item.h"
+#include "test-utils.h"
+
+/* whole seconds, so the times read back are exactly the ones set */
+#define BASE_TIME 1600000000
+
+static char *apps_dir;
+static int failed = 0;
+
+static void set_time(const char *path, time_t mtime) {
+  struct utimbuf times = {mtime, mtime};
+
+  if (g_utime(path, &times) != 0) {
+    g_printerr("could not set the time of %s\n", path);
+    failed++;
+  }
+}
+
+/* Writes the file with the given time, and puts the directory's time back,
+ * as writing changes it */
+static void write_desktop_file(const char *name, const char *title,
+                               time_t mtime, time_t dir_mtime) {
+  char *path, *contents;
+
+  path = g_build_filename(apps_dir, name, NULL);
+  contents = g_strdup_printf("[Desktop Entry]\n"
+                             "Type=Application\n"
+                             "Name=%s\n"
+                             "Exec=true\n",
+                             title);
+
+  if (!g_file_set_contents(path, contents, -1, NULL)) {
+    g_printerr("could not write %s\n", path);
+    failed++;
+  }
+  set_time(path, mtime);
+  set_time(apps_dir, dir_mtime);
+
+  g_free(contents);
+  g_free(path);
+}
+
+static void check_name(const char *name, const char *expected,
+                       const char *what) {
+  MateDesktopItem *item;
+  const char *title = NULL;
+  char *path;
+
+  path = g_build_filename(apps_dir, name, NULL);
+  item = mate_desktop_item_new_from_file(path, 0, NULL);
+  if (item) title = mate_desktop_item_get_string(item, MATE_DESKTOP_ITEM_NAME);
+
+  if (g_strcmp0(title, expected) != 0) {
+    g_printerr("%s: %s is named %s, expected %s\n", what, name,
+               title ? title : "(null)", expected);
+    failed++;
+  }
+
+  if (item) mate_desktop_item_unref(item);
+  g_free(path);
+}
+
+/* Returns the path of the only cache file, or NULL if there isn't one */
+static char *find_cache_file(const char *cache_dir) {
+  const char *name;
+  char *path = NULL;
+  GDir *dir;
+  int n = 0;
+
+  dir = g_dir_open(cache_dir, 0, NULL);
+  if (!dir) return NULL;
+
+  while ((name = g_dir_read_name(dir))) {
+    if (!g_str_has_suffix(name, ".cache")) continue;
+    g_free(path);
+    path = g_build_filename(cache_dir, name, NULL);
+    n++;
+  }
+  g_dir_close(dir);
+
+  if (n != 1) g_clear_pointer(&path, g_free);
+
+  return path;
+}
+
+static void corrupt_cache_file(const char *path, gboolean truncate) {
+  char *contents;
+  gsize length;
+
+  if (!g_file_get_contents(path, &contents, &length, NULL)) {
+    g_printerr("could not read %s\n", path);
+    failed++;
+    return;
+  }
+
+  if (truncate)
+    length /= 2;
+  else
+    memset(contents, 0xa5, length);
+
+  if (!g_file_set_contents(path, contents, length, NULL)) {
+    g_printerr("could not write %s\n", path);
+    failed++;
+  }
+
+  g_free(contents);
+}
+
+int main(int argc, char **argv) {
+  char *tmp_dir, *data_dir, *cache_home, *cache_dir, *cache_file;
+
+  tmp_dir = g_dir_make_tmp("test-ditem-cache-XXXXXX", NULL);
+  if (!tmp_dir) return 1;
+
+  /* before anything asks glib for them */
+  data_dir = g_build_filename(tmp_dir, "data", NULL);
+  cache_home = g_build_filename(tmp_dir, "cache", NULL);
+  g_setenv("XDG_DATA_HOME", data_dir, TRUE);
+  g_setenv("XDG_CACHE_HOME", cache_home, TRUE);
+
+  apps_dir = g_build_filename(data_dir, "applications", NULL);
+  cache_dir = g_build_filename(cache_home, "mate", "desktop-entries", NULL);
+  g_mkdir_with_parents(apps_dir, 0700);
+
+  /* the first load builds and saves the cache */
+  write_desktop_file("foo.desktop", "Alpha", BASE_TIME, BASE_TIME);
+  check_name("foo.desktop", "Alpha", "first load");
+
+  cache_file = find_cache_file(cache_dir);
+  if (!cache_file) {
+    g_printerr("no cache file in %s\n", cache_dir);
+    failed++;
+  }
+
+  /* same size and time: the cache can't tell, so still the old name */
+  write_desktop_file("foo.desktop", "Bravo", BASE_TIME, BASE_TIME);
+  check_name("foo.desktop", "Alpha", "cache hit");
+
+  /* a new time makes the entry stale */
+  write_desktop_file("foo.desktop", "Bravo", BASE_TIME + 1, BASE_TIME);
+  check_name("foo.desktop", "Bravo", "file changed");
+
+  /* a file that came later is found once the directory's time changes */
+  write_desktop_file("bar.desktop", "Delta", BASE_TIME, BASE_TIME + 2);
+  check_name("bar.desktop", "Delta", "directory changed");
+  write_desktop_file("bar.desktop", "Gamma", BASE_TIME, BASE_TIME + 2);
+  check_name("bar.desktop", "Delta", "cache hit after directory changed");
+
+  /* a broken cache file is ignored, and changed files parsed again */
+  if (cache_file) {
+    corrupt_cache_file(cache_file, TRUE);
+    write_desktop_file("foo.desktop", "Hotel", BASE_TIME + 3, BASE_TIME + 3);
+    check_name("foo.desktop", "Hotel", "truncated cache");
+    /* bar looks unchanged, so its entry is copied over, not parsed */
+    check_name("bar.desktop", "Delta", "truncated cache");
+
+    corrupt_cache_file(cache_file, FALSE);
+    write_desktop_file("foo.desktop", "India", BASE_TIME + 4, BASE_TIME + 4);
+    check_name("foo.desktop", "India", "garbled cache");
+    write_desktop_file("bar.desktop", "Juliet", BASE_TIME, BASE_TIME + 4);
+    check_name("bar.desktop", "Juliet", "garbled cache");
+  }
+
+  test_remove_tree(tmp_dir);
+
+  g_free(cache_file);
+  g_free(cache_dir);
+  g_free(apps_dir);
+  g_free(cache_home);
+  g_free(data_dir);
+  g_free(tmp_dir);
+
+  if (failed) g_printerr("%d checks failed\n", failed);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * test-ditem-load.c: time loading every .desktop file in a directory, one
+ * by one and on a pool of threads, and measure the memory the items take.
+ * With --no-cache, the files are parsed every time instead of coming from
+ * the item cache.
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "mate-desktop-item.h"
+#include "test-utils.h"
+
+#define APPLICATIONS_DIR "/usr/share/applications"
+#define N_ROUNDS 20
+
+/* Values used to be cut off at 1 KB */
+static gboolean long_value_survives(void) {
+  MateDesktopItem *item;
+  GString *contents;
+  char *comment;
+  const char *value;
+  gboolean survives;
+
+  comment = g_strnfill(4096, 'x');
+  contents = g_string_new("[Desktop Entry]\r\n");
+  g_string_append_printf(contents, "Comment=%s\r\n", comment);
+  g_string_append(contents, "Type=Application\r\nExec=true\r\n");
+
+  item = mate_desktop_item_new_from_string(NULL, contents->str, contents->len,
+                                           0, NULL);
+  value = item ? mate_desktop_item_get_string(item, "Comment") : NULL;
+  survives = value != NULL && strcmp(value, comment) == 0;
+
+  if (item) mate_desktop_item_unref(item);
+  g_string_free(contents, TRUE);
+  g_free(comment);
+
+  return survives;
+}
+
+typedef struct {
+  GMainLoop *loop;
+  char *last_file;
+  int n_loaded;
+  int out_of_order;
+  GPtrArray *items;
+} AsyncLoad;
+
+static void item_loaded(const char *file, MateDesktopItem *item,
+                        const GError *error, gpointer user_data) {
+  AsyncLoad *load = user_data;
+
+  /* files must come in the order of their names */
+  if (load->last_file && strcmp(load->last_file, file) >= 0)
+    load->out_of_order++;
+  g_free(load->last_file);
+  load->last_file = g_strdup(file);
+
+  if (item) load->n_loaded++;
+}
+
+static void directory_loaded(GObject *source, GAsyncResult *result,
+                             gpointer user_data) {
+  AsyncLoad *load = user_data;
+
+  load->items = mate_desktop_item_load_directory_finish(result, NULL);
+  g_main_loop_quit(load->loop);
+}
+
+/* Returns the number of problems */
+static int load_directory(const char *dir_name, guint n_loaded) {
+  AsyncLoad load = {NULL};
+  int failed;
+
+  load.loop = g_main_loop_new(NULL, FALSE);
+  mate_desktop_item_load_directory_async(dir_name, 0, NULL, item_loaded,
+                                         &load, directory_loaded, &load);
+  g_main_loop_run(load.loop);
+
+  failed = load.out_of_order;
+  if (!load.items || load.items->len != n_loaded ||
+      (guint)load.n_loaded != n_loaded)
+    failed++;
+
+  if (load.items) g_ptr_array_unref(load.items);
+  g_free(load.last_file);
+  g_main_loop_unref(load.loop);
+
+  return failed;
+}
+
+/* The item cache only covers the data dirs, so the parser alone is timed
+ * on a copy of the files outside of them. Returns the copy's directory. */
+static char *copy_out_of_data_dirs(const char *tmp_dir, const char *dir_name) {
+  char *copy_dir;
+  const char *name;
+  GDir *dir;
+
+  copy_dir = g_build_filename(tmp_dir, "applications", NULL);
+  if (g_mkdir_with_parents(copy_dir, 0700) != 0 ||
+      !(dir = g_dir_open(dir_name, 0, NULL))) {
+    g_free(copy_dir);
+    return NULL;
+  }
+
+  while ((name = g_dir_read_name(dir))) {
+    char *from, *to, *contents;
+    gsize length;
+
+    if (!g_str_has_suffix(name, ".desktop")) continue;
+
+    from = g_build_filename(dir_name, name, NULL);
+    to = g_build_filename(copy_dir, name, NULL);
+    if (g_file_get_contents(from, &contents, &length, NULL)) {
+      g_file_set_contents(to, contents, length, NULL);
+      g_free(contents);
+    }
+    g_free(to);
+    g_free(from);
+  }
+  g_dir_close(dir);
+
+  return copy_dir;
+}
+
+/* Prints how much of the heap the items of all the files take */
+static void measure_memory(GPtrArray *files) {
+#ifdef HAVE_MALLINFO2
+  GPtrArray *items;
+  gsize before, after;
+  guint i;
+
+  items = g_ptr_array_new_full(files->len,
+                               (GDestroyNotify)mate_desktop_item_unref);
+
+  before = mallinfo2().uordblks;
+  for (i = 0; i < files->len; i++) {
+    MateDesktopItem *item;
+
+    item = mate_desktop_item_new_from_file(g_ptr_array_index(files, i), 0,
+                                           NULL);
+    if (item) g_ptr_array_add(items, item);
+  }
+  after = mallinfo2().uordblks;
+
+  if (items->len > 0 && after > before)
+    g_print("%u items: %" G_GSIZE_FORMAT " KB, %" G_GSIZE_FORMAT
+            " bytes per item\n",
+            items->len, (after - before) / 1024,
+            (after - before) / items->len);
+
+  g_ptr_array_unref(items);
+#else
+  g_print("The memory the items take can't be measured here\n");
+#endif
+}
+
+int main(int argc, char **argv) {
+  const char *dir_name;
+  char *tmp_dir, *cache_dir, *copy_dir = NULL;
+  GPtrArray *files;
+  GTimer *timer;
+  GDir *dir;
+  const char *name;
+  gboolean no_cache = FALSE;
+  double elapsed;
+  int rounds, round, failed = 0;
+  guint i, n_loaded = 0;
+
+  if (argc > 1 && strcmp(argv[1], "--no-cache") == 0) {
+    no_cache = TRUE;
+    argc--;
+    argv++;
+  }
+
+  dir_name = argc > 1 ? argv[1] : APPLICATIONS_DIR;
+  rounds = argc > 2 ? atoi(argv[2]) : N_ROUNDS;
+  if (rounds <= 0) {
+    g_print("Usage: %s [--no-cache] [DIRECTORY [N_ROUNDS]]\n", argv[0]);
+    return 1;
+  }
+
+  tmp_dir = g_dir_make_tmp("test-ditem-load-XXXXXX", NULL);
+  if (!tmp_dir) return 1;
+
+  /* start from an empty item cache, and keep the user's out of this */
+  cache_dir = g_build_filename(tmp_dir, "cache", NULL);
+  g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+
+  if (no_cache) {
+    copy_dir = copy_out_of_data_dirs(tmp_dir, dir_name);
+    if (!copy_dir) {
+      g_printerr("Cannot copy %s\n", dir_name);
+      return 1;
+    }
+    dir_name = copy_dir;
+  }
+  g_print("%s\n", no_cache ? "Parsing every time" : "With the item cache");
+
+  if (!long_value_survives()) {
+    g_printerr("A long value was cut off\n");
+    failed++;
+  }
+
+  dir = g_dir_open(dir_name, 0, NULL);
+  if (!dir) {
+    g_printerr("Cannot open %s\n", dir_name);
+    return 1;
+  }
+
+  files = g_ptr_array_new_with_free_func(g_free);
+  while ((name = g_dir_read_name(dir)))
+    if (g_str_has_suffix(name, ".desktop"))
+      g_ptr_array_add(files, g_build_filename(dir_name, name, NULL));
+  g_dir_close(dir);
+
+  timer = g_timer_new();
+  for (round = 0; round < rounds; round++) {
+    for (i = 0; i < files->len; i++) {
+      MateDesktopItem *item;
+
+      item = mate_desktop_item_new_from_file(g_ptr_array_index(files, i), 0,
+                                             NULL);
+      if (item) {
+        mate_desktop_item_unref(item);
+        if (round == 0) n_loaded++;
+      } else if (round == 0) {
+        failed++;
+      }
+    }
+  }
+  elapsed = g_timer_elapsed(timer, NULL);
+
+  g_print("%u files, %d rounds one by one: %.1f ms, %.0f files/s\n",
+          files->len, rounds, elapsed * 1000,
+          elapsed > 0 ? files->len * rounds / elapsed : 0.0);
+
+  g_timer_start(timer);
+  for (round = 0; round < rounds; round++)
+    failed += load_directory(dir_name, n_loaded);
+  elapsed = g_timer_elapsed(timer, NULL);
+
+  g_print("%u files, %d rounds on %u threads: %.1f ms, %.0f files/s\n",
+          files->len, rounds, g_get_num_processors(), elapsed * 1000,
+          elapsed > 0 ? files->len * rounds / elapsed : 0.0);
+
+  /* after the loads above, so that the keys are interned already */
+  measure_memory(files);
+
+  g_timer_destroy(timer);
+  g_ptr_array_unref(files);
+
+  test_remove_tree(tmp_dir);
+  g_free(copy_dir);
+  g_free(cache_dir);
+  g_free(tmp_dir);
+
+  if (failed) g_printerr("%d files could not be loaded\n", failed);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * test-thumbnail-bulk.c: time thumbnailing a batch of images at each
+ * compression level
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib/gstdio.h>
+#include <stdlib.h>
+
+#define MATE_DESKTOP_USE_UNSTABLE_API
+#include "mate-desktop-thumbnail.h"
+#include "test-utils.h"
+
+#define N_IMAGES 100
+#define MTIME 1234567890
+
+static const int levels[] = {-1, 9, 6, 1, 0};
+
+/* Smooth gradients with some grain, which compress about like photos */
+static GdkPixbuf *photo_pixbuf(GRand *rand) {
+  GdkPixbuf *pixbuf;
+  guchar *pixels;
+  int x, y, rowstride;
+  int r, g, b;
+
+  pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, 1600, 1200);
+  pixels = gdk_pixbuf_get_pixels(pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+
+  r = g_rand_int_range(rand, 0, 128);
+  g = g_rand_int_range(rand, 0, 128);
+  b = g_rand_int_range(rand, 0, 128);
+
+  for (y = 0; y < 1200; y++) {
+    guchar *p = pixels + y * rowstride;
+
+    for (x = 0; x < 1600; x++) {
+      int grain = g_rand_int_range(rand, 0, 16);
+
+      *p++ = (guchar)(r + x * 64 / 1600 + grain);
+      *p++ = (guchar)(g + y * 64 / 1200 + grain);
+      *p++ = (guchar)(b + (x + y) * 64 / 2800 + grain);
+    }
+  }
+
+  return pixbuf;
+}
+
+int main(int argc, char **argv) {
+  MateDesktopThumbnailFactory *factory;
+  char **uris;
+  char *tmp_dir, *cache_dir;
+  GTimer *timer;
+  GRand *rand;
+  guint l;
+  int n, i, failed = 0;
+
+  n = argc > 1 ? atoi(argv[1]) : N_IMAGES;
+  if (n <= 0) {
+    g_print("Usage: %s [N_IMAGES]\n", argv[0]);
+    return 1;
+  }
+
+  tmp_dir = g_dir_make_tmp("test-thumbnail-bulk-XXXXXX", NULL);
+  if (!tmp_dir) return 1;
+
+  /* keep the user's thumbnails out of this */
+  cache_dir = g_build_filename(tmp_dir, "cache", NULL);
+  g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+
+  rand = g_rand_new_with_seed(1);
+  uris = g_new0(char *, n + 1);
+  for (i = 0; i < n; i++) {
+    GdkPixbuf *pixbuf = photo_pixbuf(rand);
+    char *name, *path;
+
+    name = g_strdup_printf("%d.png", i);
+    path = g_build_filename(tmp_dir, name, NULL);
+    if (!gdk_pixbuf_save(pixbuf, path, "png", NULL, "compression", "1",
+                         NULL))
+      failed++;
+    uris[i] = g_filename_to_uri(path, NULL, NULL);
+
+    g_free(path);
+    g_free(name);
+    g_object_unref(pixbuf);
+  }
+  g_rand_free(rand);
+
+  factory =
+      mate_desktop_thumbnail_factory_new(MATE_DESKTOP_THUMBNAIL_SIZE_LARGE);
+  timer = g_timer_new();
+
+  for (l = 0; l < G_N_ELEMENTS(levels); l++) {
+    guint64 n_bytes = 0;
+    double elapsed;
+    char *size;
+
+    test_remove_tree(cache_dir);
+    mate_desktop_thumbnail_factory_set_compression(factory, levels[l]);
+
+    g_timer_start(timer);
+    for (i = 0; i < n; i++) {
+      GdkPixbuf *thumbnail;
+
+      thumbnail = mate_desktop_thumbnail_factory_generate_thumbnail(
+          factory, uris[i], "image/png");
+      if (!thumbnail) {
+        failed++;
+        continue;
+      }
+
+      mate_desktop_thumbnail_factory_save_thumbnail(factory, thumbnail,
+                                                    uris[i], MTIME);
+      g_object_unref(thumbnail);
+    }
+    elapsed = g_timer_elapsed(timer, NULL);
+
+    for (i = 0; i < n; i++) {
+      char *path;
+      GStatBuf st;
+
+      path = mate_desktop_thumbnail_path_for_uri(
+          uris[i], MATE_DESKTOP_THUMBNAIL_SIZE_LARGE);
+      if (g_stat(path, &st) == 0)
+        n_bytes += st.st_size;
+      else
+        failed++;
+      g_free(path);
+    }
+
+    size = g_format_size(n_bytes);
+    if (levels[l] < 0)
+      g_print("default compression: ");
+    else
+      g_print("compression %d: ", levels[l]);
+    g_print("%.1f thumbnails/s, %s\n", elapsed > 0 ? n / elapsed : 0.0, size);
+    g_free(size);
+  }
+
+  g_timer_destroy(timer);
+  g_object_unref(factory);
+  g_strfreev(uris);
+
+  test_remove_tree(tmp_dir);
+  g_free(cache_dir);
+  g_free(tmp_dir);
+
+  if (failed) g_printerr("%d thumbnails could not be made\n", failed);
+
+  return failed ? 1 : 0;
+}
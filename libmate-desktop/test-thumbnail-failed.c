@@ -0,0 +1,91 @@
+/*
+ * test-thumbnail-failed.c: check the index of failed thumbnails against
+ * what other factories write to the fail directory
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define MATE_DESKTOP_USE_UNSTABLE_API
+#include "mate-desktop-thumbnail.h"
+#include "test-utils.h"
+
+#define MTIME 1234567890
+/* longer than the factory waits before looking at the directory again */
+#define RECHECK_USEC (3 * G_USEC_PER_SEC)
+
+static int failed;
+
+static void check(MateDesktopThumbnailFactory *factory, const char *uri,
+                  time_t mtime, gboolean expected, const char *what) {
+  if (mate_desktop_thumbnail_factory_has_valid_failed_thumbnail(
+          factory, uri, mtime) != expected) {
+    g_printerr("%s: expected %s\n", what, expected ? "TRUE" : "FALSE");
+    failed++;
+  }
+}
+
+int main(int argc, char **argv) {
+  MateDesktopThumbnailFactory *factory, *other;
+  const char *uri = "file:///test-thumbnail-failed/a.jpg";
+  const char *other_uri = "file:///test-thumbnail-failed/b.jpg";
+  char *cache_dir;
+
+  /* keep the user's thumbnails out of this */
+  cache_dir = g_dir_make_tmp("test-thumbnail-failed-XXXXXX", NULL);
+  if (!cache_dir) return 1;
+  g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+
+  factory =
+      mate_desktop_thumbnail_factory_new(MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+  other =
+      mate_desktop_thumbnail_factory_new(MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+
+  check(factory, uri, MTIME, FALSE, "nothing failed yet");
+
+  /* what the factory writes itself is known right away */
+  mate_desktop_thumbnail_factory_create_failed_thumbnail(factory, uri, MTIME);
+  check(factory, uri, MTIME, TRUE, "own failed thumbnail");
+  check(factory, uri, MTIME + 1, FALSE, "own failed thumbnail, file changed");
+  check(factory, other_uri, MTIME, FALSE, "other file");
+
+  /* another factory, standing in for another process, writes within the
+   * same second as the first one did */
+  mate_desktop_thumbnail_factory_create_failed_thumbnail(other, other_uri,
+                                                         MTIME);
+  mate_desktop_thumbnail_factory_create_failed_thumbnail(other, uri,
+                                                         MTIME + 1);
+  g_usleep(RECHECK_USEC);
+
+  check(factory, other_uri, MTIME, TRUE, "written behind its back");
+  check(factory, uri, MTIME + 1, TRUE, "rewritten behind its back");
+  check(factory, uri, MTIME, FALSE, "rewritten, old mtime");
+
+  g_object_unref(other);
+  g_object_unref(factory);
+
+  test_remove_tree(cache_dir);
+  g_free(cache_dir);
+
+  if (failed) g_printerr("%d checks failed\n", failed);
+
+  return failed ? 1 : 0;
+}
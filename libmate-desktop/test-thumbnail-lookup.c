@@ -0,0 +1,206 @@
+/*
+ * test-thumbnail-lookup.c: time thumbnail lookups against decoding every
+ * thumbnail to validate it
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#define MATE_DESKTOP_USE_UNSTABLE_API
+#include "mate-desktop-thumbnail.h"
+#include "test-utils.h"
+
+#define N_THUMBNAILS 2000
+#define MTIME 1234567890
+
+static GdkPixbuf *noise_pixbuf(GRand *rand) {
+  GdkPixbuf *pixbuf;
+  guchar *pixels;
+  gsize i, length;
+
+  pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, 256, 256);
+  pixels = gdk_pixbuf_get_pixels(pixbuf);
+  length = gdk_pixbuf_get_byte_length(pixbuf);
+
+  /* photos don't compress much better than this */
+  for (i = 0; i < length; i++) pixels[i] = (guchar)g_rand_int(rand);
+
+  return pixbuf;
+}
+
+/* What mate_desktop_thumbnail_factory_lookup() used to do */
+static gboolean lookup_by_decoding(const char *uri, time_t mtime) {
+  GdkPixbuf *pixbuf;
+  gboolean valid;
+  char *path;
+
+  path = mate_desktop_thumbnail_path_for_uri(
+      uri, MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+  pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+  valid = pixbuf && mate_desktop_thumbnail_is_valid(pixbuf, uri, mtime);
+
+  g_clear_object(&pixbuf);
+  g_free(path);
+
+  return valid;
+}
+
+static gboolean lookup(MateDesktopThumbnailFactory *factory, const char *uri,
+                       time_t mtime) {
+  gboolean found;
+  char *path;
+
+  path = mate_desktop_thumbnail_factory_lookup(factory, uri, mtime);
+  found = (path != NULL);
+  g_free(path);
+
+  return found;
+}
+
+/* Looks up a mix of present, stale and missing thumbnails in one call, and
+ * counts the answers that differ from looking each one up on its own */
+static int check_lookup_many(MateDesktopThumbnailFactory *factory,
+                             char **uris, int n, double *elapsed) {
+  const char **mixed;
+  time_t *mtimes;
+  GPtrArray *paths;
+  GTimer *timer;
+  int i, wrong = 0;
+
+  mixed = g_new(const char *, n);
+  mtimes = g_new(time_t, n);
+  for (i = 0; i < n; i++) {
+    mixed[i] = uris[i];
+    mtimes[i] = MTIME;
+
+    if (i % 3 == 1)
+      mtimes[i] = MTIME + 1; /* stale */
+    else if (i % 6 == 2)
+      mixed[i] = "file:///test-thumbnail-lookup/none.jpg"; /* missing */
+    else if (i % 6 == 5)
+      mixed[i] = NULL; /* the rest of its batch is still looked up */
+  }
+
+  timer = g_timer_new();
+  paths = mate_desktop_thumbnail_factory_lookup_many(factory, mixed, mtimes,
+                                                     (guint)n);
+  *elapsed = g_timer_elapsed(timer, NULL);
+  g_timer_destroy(timer);
+
+  if (!paths || paths->len != (guint)n) {
+    g_free(mixed);
+    g_free(mtimes);
+    if (paths) g_ptr_array_unref(paths);
+    return n;
+  }
+
+  for (i = 0; i < n; i++) {
+    char *path = NULL;
+
+    if (mixed[i])
+      path =
+          mate_desktop_thumbnail_factory_lookup(factory, mixed[i], mtimes[i]);
+    if (g_strcmp0(path, g_ptr_array_index(paths, i)) != 0 ||
+        (path != NULL) != (i % 3 == 0))
+      wrong++;
+    g_free(path);
+  }
+
+  g_ptr_array_unref(paths);
+  g_free(mtimes);
+  g_free(mixed);
+
+  return wrong;
+}
+
+int main(int argc, char **argv) {
+  MateDesktopThumbnailFactory *factory;
+  char **uris;
+  char *cache_dir;
+  GTimer *timer;
+  GRand *rand;
+  double decoding, reading, many;
+  int n, i, failed = 0;
+
+  n = argc > 1 ? atoi(argv[1]) : N_THUMBNAILS;
+  if (n <= 0) {
+    g_print("Usage: %s [N_THUMBNAILS]\n", argv[0]);
+    return 1;
+  }
+
+  /* keep the user's thumbnails out of this */
+  cache_dir = g_dir_make_tmp("test-thumbnail-lookup-XXXXXX", NULL);
+  if (!cache_dir) return 1;
+  g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+
+  factory =
+      mate_desktop_thumbnail_factory_new(MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+
+  rand = g_rand_new_with_seed(1);
+  uris = g_new0(char *, n + 1);
+  for (i = 0; i < n; i++) {
+    GdkPixbuf *pixbuf = noise_pixbuf(rand);
+
+    uris[i] = g_strdup_printf("file:///test-thumbnail-lookup/%d.jpg", i);
+    mate_desktop_thumbnail_factory_save_thumbnail(factory, pixbuf, uris[i],
+                                                  MTIME);
+    g_object_unref(pixbuf);
+  }
+  g_rand_free(rand);
+
+  timer = g_timer_new();
+
+  g_timer_start(timer);
+  for (i = 0; i < n; i++)
+    if (!lookup_by_decoding(uris[i], MTIME)) failed++;
+  decoding = g_timer_elapsed(timer, NULL);
+
+  g_timer_start(timer);
+  for (i = 0; i < n; i++)
+    if (!lookup(factory, uris[i], MTIME)) failed++;
+  reading = g_timer_elapsed(timer, NULL);
+
+  /* a stale thumbnail, or one for another file, must not be found */
+  if (lookup(factory, uris[0], MTIME + 1)) failed++;
+  if (lookup(factory, "file:///test-thumbnail-lookup/none.jpg", MTIME))
+    failed++;
+
+  failed += check_lookup_many(factory, uris, n, &many);
+
+  g_print("%d thumbnails: decoding %.1f ms, reading text chunks %.1f ms "
+          "(%.1fx)\n",
+          n, decoding * 1000, reading * 1000,
+          reading > 0 ? decoding / reading : 0.0);
+  g_print("lookup_many, a third of them present: %.1f ms\n", many * 1000);
+
+  g_timer_destroy(timer);
+  g_strfreev(uris);
+  g_object_unref(factory);
+
+  test_remove_tree(cache_dir);
+  g_free(cache_dir);
+
+  if (failed) g_printerr("%d lookups gave the wrong answer\n", failed);
+
+  return failed ? 1 : 0;
+}
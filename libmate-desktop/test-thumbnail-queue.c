@@ -0,0 +1,285 @@
+/*
+ * test-thumbnail-queue.c: check the order, sharing and cancellation of
+ * queued thumbnails
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MATE_DESKTOP_USE_UNSTABLE_API
+#include "mate-desktop-thumbnail.h"
+#include "test-utils.h"
+
+typedef struct {
+  const char *name;
+  GdkPixbuf *pixbuf;
+  GError *error;
+} Result;
+
+static GPtrArray *finished; /* names of the thumbnails made, in order */
+static GMainLoop *loop;
+static int n_pending;
+
+static GdkPixbuf *small_pixbuf(void) {
+  GdkPixbuf *pixbuf;
+
+  pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, 64, 48);
+  gdk_pixbuf_fill(pixbuf, 0x336699ff);
+
+  return pixbuf;
+}
+
+static char *write_image(const char *dir, const char *name) {
+  GdkPixbuf *pixbuf = small_pixbuf();
+  char *path, *uri;
+
+  path = g_build_filename(dir, name, NULL);
+  gdk_pixbuf_save(pixbuf, path, "png", NULL, NULL);
+  uri = g_filename_to_uri(path, NULL, NULL);
+
+  g_object_unref(pixbuf);
+  g_free(path);
+
+  return uri;
+}
+
+/* Reading a fifo blocks until something writes to it, which holds the
+ * only worker back until everything else is queued */
+static gboolean feed_fifo(const char *path) {
+  GdkPixbuf *pixbuf = small_pixbuf();
+  gchar *buffer;
+  gsize size, done = 0;
+  int fd;
+
+  if (!gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &size, "png", NULL, NULL)) {
+    g_object_unref(pixbuf);
+    return FALSE;
+  }
+  g_object_unref(pixbuf);
+
+  fd = g_open(path, O_WRONLY, 0);
+  if (fd < 0) {
+    g_free(buffer);
+    return FALSE;
+  }
+
+  while (done < size) {
+    gssize n = write(fd, buffer + done, size - done);
+
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    done += n;
+  }
+
+  close(fd);
+  g_free(buffer);
+
+  return done == size;
+}
+
+static void thumbnail_ready(GObject *source_object, GAsyncResult *res,
+                            gpointer user_data) {
+  Result *result = user_data;
+
+  result->pixbuf = mate_desktop_thumbnail_factory_queue_thumbnail_finish(
+      MATE_DESKTOP_THUMBNAIL_FACTORY(source_object), res, &result->error);
+  if (result->pixbuf) g_ptr_array_add(finished, (gpointer)result->name);
+
+  if (--n_pending == 0) g_main_loop_quit(loop);
+}
+
+static void queue(MateDesktopThumbnailFactory *factory, const char *uri,
+                  int priority, GCancellable *cancellable, Result *result,
+                  const char *name) {
+  result->name = name;
+  n_pending++;
+  mate_desktop_thumbnail_factory_queue_thumbnail(
+      factory, uri, "image/png", priority, cancellable, thumbnail_ready,
+      result);
+}
+
+static gboolean is_cancelled(Result *result) {
+  return !result->pixbuf &&
+         g_error_matches(result->error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+}
+
+/* Workers drop their reference after the callbacks are queued, and
+ * cancelled handlers are disconnected from an idle */
+static gboolean wait_finalized(gpointer *object) {
+  gint64 deadline = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+
+  while (*object && g_get_monotonic_time() < deadline) {
+    if (!g_main_context_iteration(NULL, FALSE)) g_usleep(10000);
+  }
+
+  return *object == NULL;
+}
+
+int main(int argc, char **argv) {
+  static const char *const expected[] = {
+      "blocker", "bumped", "bumped", "shared", "high", "mid", "low",
+  };
+  MateDesktopThumbnailFactory *factory;
+  Result blocker = {0}, low = {0}, mid = {0}, high = {0};
+  Result bumped[2] = {{0}}, cancelled = {0}, shared[2] = {{0}};
+  GCancellable *cancel_one, *cancel_shared;
+  char *tmp_dir, *fifo, *fifo_uri;
+  char *low_uri, *mid_uri, *high_uri, *bumped_uri, *cancelled_uri;
+  char *shared_uri;
+  int failed = 0;
+  guint i;
+
+  tmp_dir = g_dir_make_tmp("test-thumbnail-queue-XXXXXX", NULL);
+  if (!tmp_dir) return 1;
+
+  fifo = g_build_filename(tmp_dir, "blocker.png", NULL);
+  if (mkfifo(fifo, 0600) != 0) {
+    g_printerr("could not make a fifo\n");
+    return 1;
+  }
+  fifo_uri = g_filename_to_uri(fifo, NULL, NULL);
+
+  low_uri = write_image(tmp_dir, "low.png");
+  mid_uri = write_image(tmp_dir, "mid.png");
+  high_uri = write_image(tmp_dir, "high.png");
+  bumped_uri = write_image(tmp_dir, "bumped.png");
+  cancelled_uri = write_image(tmp_dir, "cancelled.png");
+  shared_uri = write_image(tmp_dir, "shared.png");
+
+  factory =
+      mate_desktop_thumbnail_factory_new(MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+  mate_desktop_thumbnail_factory_set_max_jobs(factory, 1);
+
+  finished = g_ptr_array_new();
+  loop = g_main_loop_new(NULL, FALSE);
+  cancel_one = g_cancellable_new();
+  cancel_shared = g_cancellable_new();
+
+  /* the worker blocks on this one while the rest is queued; it is the
+   * most urgent, in case the worker only starts after everything else */
+  queue(factory, fifo_uri, -100, NULL, &blocker, "blocker");
+
+  queue(factory, low_uri, 10, NULL, &low, "low");
+  queue(factory, mid_uri, 5, NULL, &mid, "mid");
+  queue(factory, high_uri, 1, NULL, &high, "high");
+
+  /* queued again, more urgently: made once, ahead of the rest */
+  queue(factory, bumped_uri, 20, NULL, &bumped[0], "bumped");
+  queue(factory, bumped_uri, -1, NULL, &bumped[1], "bumped");
+
+  /* nobody else wants it, so it is never made */
+  queue(factory, cancelled_uri, 2, cancel_one, &cancelled, "cancelled");
+  g_cancellable_cancel(cancel_one);
+
+  /* one of two callers gives up, the other still gets it */
+  queue(factory, shared_uri, 0, cancel_shared, &shared[0], "shared");
+  queue(factory, shared_uri, 0, NULL, &shared[1], "shared");
+  g_cancellable_cancel(cancel_shared);
+
+  if (!feed_fifo(fifo)) {
+    g_printerr("could not write to the fifo\n");
+    failed++;
+  }
+
+  g_main_loop_run(loop);
+
+  if (finished->len != G_N_ELEMENTS(expected)) {
+    g_printerr("%u thumbnails made, expected %u\n", finished->len,
+               (guint)G_N_ELEMENTS(expected));
+    failed++;
+  } else {
+    for (i = 0; i < finished->len; i++) {
+      if (g_strcmp0(g_ptr_array_index(finished, i), expected[i]) != 0) {
+        g_printerr("thumbnail %u is %s, expected %s\n", i,
+                   (char *)g_ptr_array_index(finished, i), expected[i]);
+        failed++;
+      }
+    }
+  }
+
+  if (!bumped[0].pixbuf || bumped[0].pixbuf != bumped[1].pixbuf) {
+    g_printerr("the same uri queued twice was not made once\n");
+    failed++;
+  }
+
+  if (!is_cancelled(&cancelled)) {
+    g_printerr("the cancelled thumbnail was not cancelled\n");
+    failed++;
+  }
+
+  if (!is_cancelled(&shared[0]) || !shared[1].pixbuf) {
+    g_printerr("cancelling one caller affected the other\n");
+    failed++;
+  }
+
+  g_clear_object(&blocker.pixbuf);
+  g_clear_object(&low.pixbuf);
+  g_clear_object(&mid.pixbuf);
+  g_clear_object(&high.pixbuf);
+  for (i = 0; i < 2; i++) {
+    g_clear_object(&bumped[i].pixbuf);
+    g_clear_object(&shared[i].pixbuf);
+    g_clear_error(&bumped[i].error);
+    g_clear_error(&shared[i].error);
+  }
+  g_clear_error(&blocker.error);
+  g_clear_error(&low.error);
+  g_clear_error(&mid.error);
+  g_clear_error(&high.error);
+  g_clear_error(&cancelled.error);
+
+  /* the cancellables outlive it, and must not keep it alive */
+  g_object_add_weak_pointer(G_OBJECT(factory), (gpointer *)&factory);
+  g_object_unref(factory);
+  if (!wait_finalized((gpointer *)&factory)) {
+    g_printerr("the factory was not finalized\n");
+    failed++;
+  }
+
+  g_object_unref(cancel_one);
+  g_object_unref(cancel_shared);
+  g_main_loop_unref(loop);
+  g_ptr_array_unref(finished);
+
+  g_free(low_uri);
+  g_free(mid_uri);
+  g_free(high_uri);
+  g_free(bumped_uri);
+  g_free(cancelled_uri);
+  g_free(shared_uri);
+  g_free(fifo_uri);
+  g_free(fifo);
+
+  test_remove_tree(tmp_dir);
+  g_free(tmp_dir);
+
+  if (failed) g_printerr("%d checks failed\n", failed);
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * test-thumbnail-sizes.c: check that thumbnails generated for several
+ * sizes at once are saved where they belong, at the size they should be
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#define MATE_DESKTOP_USE_UNSTABLE_API
+#include "mate-desktop-thumbnail.h"
+#include "test-utils.h"
+
+#define WIDTH 1600
+#define HEIGHT 1200
+#define MTIME 1234567890
+
+/* not in order, so that the result has to follow @sizes */
+static const struct {
+  MateDesktopThumbnailSize size;
+  const char *dir;
+  int pixels;
+} sizes[] = {
+    {MATE_DESKTOP_THUMBNAIL_SIZE_LARGE, "large", 256},
+    {MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL, "normal", 128},
+    {MATE_DESKTOP_THUMBNAIL_SIZE_XXLARGE, "xx-large", 1024},
+    {MATE_DESKTOP_THUMBNAIL_SIZE_XLARGE, "x-large", 512},
+};
+
+/* The long side at @pixels, the short one in proportion */
+static gboolean has_size(GdkPixbuf *pixbuf, int pixels) {
+  int height = pixels * HEIGHT / WIDTH;
+
+  return gdk_pixbuf_get_width(pixbuf) == pixels &&
+         abs(gdk_pixbuf_get_height(pixbuf) - height) <= 1;
+}
+
+int main(int argc, char **argv) {
+  MateDesktopThumbnailSize wanted[G_N_ELEMENTS(sizes)];
+  MateDesktopThumbnailFactory *factory;
+  GPtrArray *thumbnails;
+  GdkPixbuf *pixbuf;
+  char *tmp_dir, *cache_dir, *path, *uri;
+  int failed = 0;
+  guint i;
+
+  tmp_dir = g_dir_make_tmp("test-thumbnail-sizes-XXXXXX", NULL);
+  if (!tmp_dir) return 1;
+
+  /* keep the user's thumbnails out of this */
+  cache_dir = g_build_filename(tmp_dir, "cache", NULL);
+  g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+
+  pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, WIDTH, HEIGHT);
+  gdk_pixbuf_fill(pixbuf, 0x336699ff);
+  path = g_build_filename(tmp_dir, "image.png", NULL);
+  if (!gdk_pixbuf_save(pixbuf, path, "png", NULL, NULL)) failed++;
+  uri = g_filename_to_uri(path, NULL, NULL);
+  g_object_unref(pixbuf);
+  g_free(path);
+
+  for (i = 0; i < G_N_ELEMENTS(sizes); i++) wanted[i] = sizes[i].size;
+
+  /* the factory's own size has nothing to do with it */
+  factory =
+      mate_desktop_thumbnail_factory_new(MATE_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+
+  thumbnails = mate_desktop_thumbnail_factory_generate_thumbnails(
+      factory, uri, "image/png", wanted, G_N_ELEMENTS(wanted));
+  if (!thumbnails || thumbnails->len != G_N_ELEMENTS(sizes)) {
+    g_printerr("no thumbnail for each size\n");
+    return 1;
+  }
+
+  for (i = 0; i < thumbnails->len; i++) {
+    if (!has_size(g_ptr_array_index(thumbnails, i), sizes[i].pixels)) {
+      g_printerr("generated %s thumbnail is %dx%d\n", sizes[i].dir,
+                 gdk_pixbuf_get_width(g_ptr_array_index(thumbnails, i)),
+                 gdk_pixbuf_get_height(g_ptr_array_index(thumbnails, i)));
+      failed++;
+    }
+  }
+
+  mate_desktop_thumbnail_factory_save_thumbnails(
+      factory, thumbnails, wanted, G_N_ELEMENTS(wanted), uri, MTIME);
+  g_ptr_array_unref(thumbnails);
+
+  for (i = 0; i < G_N_ELEMENTS(sizes); i++) {
+    char *dir, *expected_dir;
+
+    path = mate_desktop_thumbnail_path_for_uri(uri, sizes[i].size);
+    dir = g_path_get_dirname(path);
+    expected_dir =
+        g_build_filename(cache_dir, "thumbnails", sizes[i].dir, NULL);
+
+    if (g_strcmp0(dir, expected_dir) != 0) {
+      g_printerr("%s thumbnail goes to %s\n", sizes[i].dir, dir);
+      failed++;
+    }
+
+    pixbuf = gdk_pixbuf_new_from_file(path, NULL);
+    if (!pixbuf) {
+      g_printerr("%s thumbnail was not saved\n", sizes[i].dir);
+      failed++;
+    } else {
+      if (!has_size(pixbuf, sizes[i].pixels)) {
+        g_printerr("saved %s thumbnail is %dx%d\n", sizes[i].dir,
+                   gdk_pixbuf_get_width(pixbuf),
+                   gdk_pixbuf_get_height(pixbuf));
+        failed++;
+      }
+      if (!mate_desktop_thumbnail_is_valid(pixbuf, uri, MTIME)) {
+        g_printerr("saved %s thumbnail is not valid\n", sizes[i].dir);
+        failed++;
+      }
+      g_object_unref(pixbuf);
+    }
+
+    g_free(expected_dir);
+    g_free(dir);
+    g_free(path);
+  }
+
+  g_object_unref(factory);
+  g_free(uri);
+
+  test_remove_tree(tmp_dir);
+  g_free(cache_dir);
+  g_free(tmp_dir);
+
+  if (failed) g_printerr("%d checks failed\n", failed);
+
+  return failed ? 1 : 0;
+}
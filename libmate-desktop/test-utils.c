@@ -0,0 +1,46 @@
+/*
+ * test-utils.c: helpers shared by the test programs
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#include "test-utils.h"
+
+void test_remove_tree(const char *path) {
+  GDir *dir;
+
+  if ((dir = g_dir_open(path, 0, NULL))) {
+    const char *name;
+
+    while ((name = g_dir_read_name(dir))) {
+      char *child = g_build_filename(path, name, NULL);
+
+      test_remove_tree(child);
+      g_free(child);
+    }
+    g_dir_close(dir);
+  }
+
+  g_remove(path);
+}
@@ -0,0 +1,144 @@
+/*
+ * mate-thumbnail-cache-clean.c: keep the thumbnail cache within the limits
+ * of org.mate.thumbnail-cache
+ *
+ * Copyright (C) 2022 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib/gi18n.h>
+#ifdef ENABLE_NLS
+#include <locale.h>
+#endif /* ENABLE_NLS */
+#include <gio/gio.h>
+#include <glib.h>
+#include <stdlib.h>
+
+#define MATE_DESKTOP_USE_UNSTABLE_API
+#include <libmate-desktop/mate-desktop-thumbnail.h>
+
+#define THUMBNAIL_CACHE_SCHEMA "org.mate.thumbnail-cache"
+
+/* How often --daemon cleans the cache */
+#define CLEAN_INTERVAL_SECS (24 * 3600)
+
+/* -1 disables a limit, so -2 means the option wasn't given */
+#define UNSET -2
+
+static int max_age = UNSET;
+static int max_size = UNSET;
+static gboolean daemon_mode = FALSE;
+static gboolean verbose = FALSE;
+
+static GOptionEntry entries[] = {
+    {"max-age", 'a', 0, G_OPTION_ARG_INT, &max_age,
+     N_("Remove thumbnails not used for DAYS days, instead of the configured "
+        "age"),
+     N_("DAYS")},
+    {"max-size", 's', 0, G_OPTION_ARG_INT, &max_size,
+     N_("Shrink the cache to MB megabytes, instead of the configured size"),
+     N_("MB")},
+    {"daemon", 'd', 0, G_OPTION_ARG_NONE, &daemon_mode,
+     N_("Keep running and clean the cache once a day"), NULL},
+    {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+     N_("Tell how much was removed"), NULL},
+    {NULL}};
+
+static void clean(GSettings *settings) {
+  GError *error = NULL;
+  guint64 n_bytes;
+  guint n_files;
+  int age, size;
+
+  /* options override the settings, which can change between runs */
+  age = max_age != UNSET ? max_age
+                         : g_settings_get_int(settings, "maximum-age");
+  size = max_size != UNSET ? max_size
+                           : g_settings_get_int(settings, "maximum-size");
+
+  if (age < 0 && size < 0) return;
+
+  if (!mate_desktop_thumbnail_cache_clean(age, size, &n_files, &n_bytes, NULL,
+                                          &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return;
+  }
+
+  if (verbose) {
+    char *freed = g_format_size(n_bytes);
+
+    g_print(_("Removed %u thumbnails, %s\n"), n_files, freed);
+    g_free(freed);
+  }
+}
+
+static gboolean clean_timeout(gpointer data) {
+  clean(data);
+
+  return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char **argv) {
+  GOptionContext *context;
+  GSettings *settings;
+  GError *error = NULL;
+  char *summary;
+
+#ifdef ENABLE_NLS
+  setlocale(LC_ALL, "");
+  bindtextdomain(GETTEXT_PACKAGE, LOCALE_DIR);
+  bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+  textdomain(GETTEXT_PACKAGE);
+#endif /* ENABLE_NLS */
+
+  context = g_option_context_new(NULL);
+  summary = g_strdup_printf(_("Removes old thumbnails until the thumbnail "
+                              "cache fits the limits set in %s."),
+                            THUMBNAIL_CACHE_SCHEMA);
+  g_option_context_set_summary(context, summary);
+  g_free(summary);
+  g_option_context_add_main_entries(context, entries, GETTEXT_PACKAGE);
+
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    g_option_context_free(context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  settings = g_settings_new(THUMBNAIL_CACHE_SCHEMA);
+
+  clean(settings);
+
+  if (daemon_mode) {
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+    g_timeout_add_seconds(CLEAN_INTERVAL_SECS, clean_timeout, settings);
+    g_main_loop_run(loop);
+    g_main_loop_unref(loop);
+  }
+
+  g_object_unref(settings);
+
+  return EXIT_SUCCESS;
+}